@@ -0,0 +1,192 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "AnimationSource.h"
+
+#define MAX_CACHED_ANIMATION_BYTES (64 * 1024 * 1024)
+#define MAX_RING_BYTES (32 * 1024 * 1024)
+#define MIN_RING_FRAMES 2
+#define MAX_RING_FRAMES 16
+#define DEFAULT_FRAME_DELAY 100
+
+class AnimationSource::Worker : public QRunnable {
+public:
+    explicit Worker(AnimationSource *source) : source(source) {}
+
+    void run() override {
+        source->decodeFrames();
+    }
+
+private:
+    AnimationSource *source;
+};
+
+std::shared_ptr<AnimationSource> AnimationSource::forFile(const QString &fileName) {
+    static QHash<QString, std::weak_ptr<AnimationSource>> sources;
+
+    // An edited file gets a source of its own
+    const QString key = fileName + QLatin1Char('@')
+                        + QString::number(QFileInfo(fileName).lastModified().toMSecsSinceEpoch());
+    std::shared_ptr<AnimationSource> source = sources.value(key).lock();
+    if (source) {
+        return source;
+    }
+
+    for (QHash<QString, std::weak_ptr<AnimationSource>>::iterator it = sources.begin(); it != sources.end();) {
+        if (it->expired()) {
+            it = sources.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    source = std::make_shared<AnimationSource>(fileName);
+    sources.insert(key, source);
+    return source;
+}
+
+AnimationSource::AnimationSource(const QString &fileName) : fileName(fileName) {
+    QImageReader reader(fileName);
+    imageSize = reader.size();
+    imageCount = reader.imageCount();
+    loopCount = reader.loopCount();
+
+    const qint64 frameBytes = qint64(imageSize.width()) * imageSize.height() * 4;
+    cachesAllFrames = imageCount > 0 && frameBytes > 0 && frameBytes * imageCount <= MAX_CACHED_ANIMATION_BYTES;
+    ringCapacity = qBound(MIN_RING_FRAMES, frameBytes > 0 ? int(MAX_RING_BYTES / frameBytes) : MIN_RING_FRAMES,
+                          MAX_RING_FRAMES);
+
+    frameTimer.setSingleShot(true);
+    connect(&frameTimer, &QTimer::timeout, this, &AnimationSource::showNextFrame);
+    connect(this, &AnimationSource::frameDecoded, this, &AnimationSource::onFrameDecoded, Qt::QueuedConnection);
+
+    threadPool.setMaxThreadCount(1);
+    threadPool.start(new Worker(this));
+}
+
+AnimationSource::~AnimationSource() {
+    {
+        QMutexLocker locker(&mutex);
+        isStopped = true;
+        pendingFrames.clear();
+        spaceAvailable.wakeAll();
+    }
+    threadPool.waitForDone();
+}
+
+QSize AnimationSource::size() const {
+    return imageSize;
+}
+
+QImage AnimationSource::currentFrame() const {
+    return current;
+}
+
+int AnimationSource::currentFrameNumber() const {
+    return frameNumber;
+}
+
+bool AnimationSource::isCachingAllFrames() const {
+    return cachesAllFrames;
+}
+
+int AnimationSource::frameCount() const {
+    return imageCount;
+}
+
+void AnimationSource::decodeFrames() {
+    int loopsDecoded = 0;
+    forever {
+        QImageReader reader(fileName);
+        int decodedCount = 0;
+        QImage image;
+        while (reader.read(&image)) {
+            Frame frame;
+            // Converted here so painting it is a plain copy
+            frame.image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+            frame.delay = reader.nextImageDelay();
+            ++decodedCount;
+            {
+                QMutexLocker locker(&mutex);
+                if (cachesAllFrames) {
+                    frames.append(frame);
+                } else {
+                    while (pendingFrames.size() >= ringCapacity && !isStopped) {
+                        spaceAvailable.wait(&mutex);
+                    }
+                    pendingFrames.enqueue(frame);
+                }
+                if (isStopped) {
+                    return;
+                }
+            }
+            emit frameDecoded();
+        }
+
+        // Cached frames are played again from memory, a still image has nothing to play again
+        QMutexLocker locker(&mutex);
+        if (cachesAllFrames || decodedCount <= 1 || isStopped || (loopCount >= 0 && loopsDecoded++ >= loopCount)) {
+            isDecodeFinished = true;
+            break;
+        }
+    }
+    emit frameDecoded();
+}
+
+void AnimationSource::onFrameDecoded() {
+    if (isWaitingForFrame) {
+        isWaitingForFrame = false;
+        showNextFrame();
+    }
+}
+
+void AnimationSource::showNextFrame() {
+    Frame frame;
+    {
+        QMutexLocker locker(&mutex);
+        if (cachesAllFrames) {
+            int nextFrameNumber = frameNumber + 1;
+            if (nextFrameNumber >= frames.size()) {
+                if (!isDecodeFinished) {
+                    isWaitingForFrame = true;
+                    return;
+                }
+                if (frames.size() <= 1 || (loopCount >= 0 && loopsPlayed >= loopCount)) {
+                    return;
+                }
+                ++loopsPlayed;
+                nextFrameNumber = 0;
+            }
+            frameNumber = nextFrameNumber;
+            frame = frames.at(frameNumber);
+        } else {
+            if (pendingFrames.isEmpty()) {
+                isWaitingForFrame = !isDecodeFinished;
+                return;
+            }
+            frame = pendingFrames.dequeue();
+            spaceAvailable.wakeOne();
+            ++frameNumber;
+        }
+    }
+
+    current = frame.image;
+    // Like browsers, delays that short mean the file did not set one
+    frameTimer.start(frame.delay > 10 ? frame.delay : DEFAULT_FRAME_DELAY);
+    emit frameChanged(frameNumber);
+}
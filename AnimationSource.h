@@ -0,0 +1,97 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef ANIMATION_SOURCE_H
+#define ANIMATION_SOURCE_H
+
+#include <QtGui>
+#include <memory>
+
+// Plays an animated image for every widget showing it. Frames are decoded
+// ahead on a background thread: short animations are kept whole after the
+// first loop, longer ones go through a small ring of upcoming frames, so
+// memory stays bounded either way.
+class AnimationSource : public QObject {
+Q_OBJECT
+
+public:
+    // The viewer and the preview showing the same file share one source. GUI thread only.
+    static std::shared_ptr<AnimationSource> forFile(const QString &fileName);
+
+    explicit AnimationSource(const QString &fileName);
+
+    ~AnimationSource() override;
+
+    QSize size() const;
+
+    QImage currentFrame() const;
+
+    int currentFrameNumber() const;
+
+    // Frame numbers repeat with every loop, so they can be used to cache anything made from a frame
+    bool isCachingAllFrames() const;
+
+    int frameCount() const;
+
+signals:
+
+    void frameChanged(int frameNumber);
+
+    // From the decode thread to the GUI thread
+    void frameDecoded();
+
+private slots:
+
+    void onFrameDecoded();
+
+    void showNextFrame();
+
+private:
+    struct Frame {
+        QImage image;
+        int delay = 0;
+    };
+
+    class Worker;
+
+    void decodeFrames();
+
+    QString fileName;
+    QSize imageSize;
+    int imageCount = 0;
+    int loopCount = 0;
+    int loopsPlayed = 0;
+    bool cachesAllFrames = false;
+    int ringCapacity = 0;
+
+    QTimer frameTimer;
+    QImage current;
+    int frameNumber = -1;
+    bool isWaitingForFrame = true;
+
+    QThreadPool threadPool;
+    mutable QMutex mutex;
+    QWaitCondition spaceAvailable;
+    QVector<Frame> frames;
+    QQueue<Frame> pendingFrames;
+    bool isDecodeFinished = false;
+    bool isStopped = false;
+};
+
+#endif // ANIMATION_SOURCE_H
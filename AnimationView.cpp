@@ -0,0 +1,77 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "AnimationView.h"
+
+#define MAX_SCALED_FRAME_BYTES (32 * 1024 * 1024)
+
+AnimationView::AnimationView(QWidget *parent) : QWidget(parent) {
+}
+
+void AnimationView::setSource(const std::shared_ptr<AnimationSource> &source, const QPixmap &placeholder) {
+    disconnect(frameConnection);
+    this->source = source;
+    this->placeholder = placeholder;
+    scaledFrames.clear();
+    frameConnection = connect(source.get(), &AnimationSource::frameChanged, this, [this]() {
+        update();
+    });
+    update();
+}
+
+QSize AnimationView::frameSize() const {
+    return source ? source->size() : QSize();
+}
+
+void AnimationView::paintEvent(QPaintEvent *) {
+    QPainter painter(this);
+    const QImage frame = source ? source->currentFrame() : QImage();
+    if (frame.isNull()) {
+        if (!placeholder.isNull()) {
+            painter.setRenderHint(QPainter::SmoothPixmapTransform);
+            painter.drawPixmap(rect(), placeholder);
+        }
+        return;
+    }
+
+    const QSize targetSize = size() * devicePixelRatioF();
+    if (frame.size() == targetSize) {
+        painter.drawImage(rect(), frame);
+        return;
+    }
+
+    const int frameNumber = source->currentFrameNumber();
+    QPixmap scaledFrame = scaledFrames.value(frameNumber);
+    if (scaledFrame.isNull()) {
+        scaledFrame = QPixmap::fromImage(frame.scaled(targetSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+        scaledFrame.setDevicePixelRatio(devicePixelRatioF());
+
+        const qint64 scaledBytes = qint64(targetSize.width()) * targetSize.height() * 4;
+        if (!source->isCachingAllFrames() || scaledBytes * source->frameCount() > MAX_SCALED_FRAME_BYTES) {
+            scaledFrames.clear();
+        }
+        scaledFrames.insert(frameNumber, scaledFrame);
+    }
+    painter.drawPixmap(0, 0, scaledFrame);
+}
+
+void AnimationView::resizeEvent(QResizeEvent *event) {
+    QWidget::resizeEvent(event);
+    scaledFrames.clear();
+}
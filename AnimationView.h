@@ -0,0 +1,53 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef ANIMATION_VIEW_H
+#define ANIMATION_VIEW_H
+
+#include <QtWidgets>
+#include <memory>
+#include "AnimationSource.h"
+
+// Paints the frames of an AnimationSource at the widget's own size. Each
+// frame is scaled once; when the source keeps every frame, the scaled ones
+// are kept too, within a budget.
+class AnimationView : public QWidget {
+Q_OBJECT
+
+public:
+    explicit AnimationView(QWidget *parent = nullptr);
+
+    // The placeholder is shown until the first frame is decoded
+    void setSource(const std::shared_ptr<AnimationSource> &source, const QPixmap &placeholder = QPixmap());
+
+    QSize frameSize() const;
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+
+    void resizeEvent(QResizeEvent *event) override;
+
+private:
+    std::shared_ptr<AnimationSource> source;
+    QPixmap placeholder;
+    QHash<int, QPixmap> scaledFrames;
+    QMetaObject::Connection frameConnection;
+};
+
+#endif // ANIMATION_VIEW_H
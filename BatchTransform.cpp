@@ -0,0 +1,332 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <exiv2/exiv2.hpp>
+#include "BatchTransform.h"
+#include "Exiv2Init.h"
+#include "Settings.h"
+#include "ImageViewer.h"
+#include "LosslessTransform.h"
+#include "MetadataCache.h"
+#include "Resampler.h"
+
+#define BATCH_MEMORY_BUDGET (1024LL * 1024 * 1024)
+// A decoded image, its transformed copy and the encoder's buffers
+#define BATCH_COPIES_PER_IMAGE 3
+
+class BatchTransformer::Worker : public QRunnable {
+public:
+    explicit Worker(BatchTransformer *transformer) : transformer(transformer) {}
+
+    void run() override {
+        transformer->processQueue();
+    }
+
+private:
+    BatchTransformer *transformer;
+};
+
+TransformRecipe TransformRecipe::fromSettings() {
+    TransformRecipe recipe;
+    recipe.rotation = Settings::rotation;
+    recipe.flipH = Settings::flipH;
+    recipe.flipV = Settings::flipV;
+    recipe.cropLeft = Settings::cropLeft;
+    recipe.cropTop = Settings::cropTop;
+    recipe.cropWidth = Settings::cropWidth;
+    recipe.cropHeight = Settings::cropHeight;
+    recipe.cropLeftPercent = Settings::cropLeftPercent;
+    recipe.cropTopPercent = Settings::cropTopPercent;
+    recipe.cropWidthPercent = Settings::cropWidthPercent;
+    recipe.cropHeightPercent = Settings::cropHeightPercent;
+    if (Settings::scaledWidth) {
+        recipe.scaledSize = QSize(Settings::scaledWidth, Settings::scaledHeight);
+    }
+    if (Settings::colorsActive || Settings::keepTransform) {
+        recipe.colorAdjustment = colorsFromSettings();
+    }
+    recipe.exifRotation = Settings::exifRotationEnabled;
+    recipe.saveDirectory = Settings::saveDirectory;
+    recipe.quality = Settings::defaultSaveQuality;
+    return recipe;
+}
+
+ColorAdjustment TransformRecipe::colorsFromSettings() {
+    ColorAdjustment colorAdjustment;
+    colorAdjustment.isEnabled = true;
+    colorAdjustment.negateRed = Settings::rNegateEnabled;
+    colorAdjustment.negateGreen = Settings::gNegateEnabled;
+    colorAdjustment.negateBlue = Settings::bNegateEnabled;
+    colorAdjustment.red = Settings::redVal;
+    colorAdjustment.green = Settings::greenVal;
+    colorAdjustment.blue = Settings::blueVal;
+    colorAdjustment.brightness = Settings::brightVal;
+    colorAdjustment.contrast = Settings::contrastVal;
+    colorAdjustment.colorize = Settings::colorizeEnabled;
+    colorAdjustment.hue = Settings::hueVal;
+    colorAdjustment.saturation = Settings::saturationVal;
+    colorAdjustment.lightness = Settings::lightnessVal;
+    colorAdjustment.hueRedChannel = Settings::hueRedChannel;
+    colorAdjustment.hueGreenChannel = Settings::hueGreenChannel;
+    colorAdjustment.hueBlueChannel = Settings::hueBlueChannel;
+    return colorAdjustment;
+}
+
+bool TransformRecipe::hasCrop() const {
+    return cropLeft || cropTop || cropWidth || cropHeight
+           || cropLeftPercent || cropTopPercent || cropWidthPercent || cropHeightPercent;
+}
+
+bool TransformRecipe::isOrientationOnly() const {
+    return exifRotation && !scaledSize.isValid() && !hasCrop() && !colorAdjustment.changesColors()
+           && LosslessTransform::combinedOrientation(1, rotation, false, false);
+}
+
+// A zero side follows the aspect ratio of the other one
+void TransformRecipe::scale(QImage &image, qreal pixelScale) const {
+    if (!scaledSize.isValid() || scaledSize.isNull() || image.isNull()) {
+        return;
+    }
+    QSize size = scaledSize;
+    if (!size.width()) {
+        size.setWidth(qRound(qreal(image.width()) * size.height() / image.height()));
+    } else if (!size.height()) {
+        size.setHeight(qRound(qreal(image.height()) * size.width() / image.width()));
+    }
+    size = QSize(qMax(1, qRound(size.width() * pixelScale)), qMax(1, qRound(size.height() * pixelScale)));
+    const bool isEnlarging = size.width() > image.width() || size.height() > image.height();
+    image = Resampler::scaled(image, size, Qt::IgnoreAspectRatio,
+                              isEnlarging ? Resampler::Mitchell : Resampler::Lanczos3);
+}
+
+// Absolute crops are in full resolution pixels, the percentages in those of the rotated image
+void TransformRecipe::transform(QImage &image, qreal pixelScale) const {
+    if (!qFuzzyCompare(rotation, 0)) {
+        QTransform trans;
+        trans.rotate(rotation);
+        const bool isRightAngle = qFuzzyIsNull(std::fmod(rotation, 90));
+        image = image.transformed(trans, isRightAngle ? Qt::FastTransformation : Qt::SmoothTransformation);
+    }
+
+    if (flipH || flipV) {
+        image = image.mirrored(flipH, flipV);
+    }
+
+    if (!hasCrop()) {
+        return;
+    }
+    const int left = qRound(cropLeft * pixelScale) + (image.width() * cropLeftPercent) / 100;
+    const int top = qRound(cropTop * pixelScale) + (image.height() * cropTopPercent) / 100;
+    const int right = qRound(cropWidth * pixelScale) + (image.width() * cropWidthPercent) / 100;
+    const int bottom = qRound(cropHeight * pixelScale) + (image.height() * cropHeightPercent) / 100;
+    image = image.copy(left, top, image.width() - left - right, image.height() - top - bottom);
+}
+
+BatchTransformer::BatchTransformer(const std::shared_ptr<MetadataCache> &metadataCache, QObject *parent)
+    : QObject(parent), metadataCache(metadataCache) {
+    Exiv2Init::ensure();
+    threadPool.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+BatchTransformer::~BatchTransformer() {
+    cancel();
+    threadPool.waitForDone();
+}
+
+void BatchTransformer::start(const QStringList &imageFileNames, const TransformRecipe &recipe) {
+    QMutexLocker locker(&mutex);
+    if (activeWorkers) {
+        qWarning() << "Batch transform already running";
+        return;
+    }
+
+    this->recipe = recipe;
+    queue = imageFileNames;
+    total = imageFileNames.size();
+    done = failed = 0;
+    isCancelled = false;
+
+    if (queue.isEmpty()) {
+        locker.unlock();
+        emit finished(0);
+        return;
+    }
+    while (activeWorkers < threadPool.maxThreadCount() && activeWorkers < queue.size()) {
+        ++activeWorkers;
+        threadPool.start(new Worker(this));
+    }
+}
+
+void BatchTransformer::cancel() {
+    QMutexLocker locker(&mutex);
+    isCancelled = true;
+    queue.clear();
+    // Workers waiting for memory see the cancel without waiting for another image to finish
+    memoryReleased.wakeAll();
+}
+
+bool BatchTransformer::isRunning() {
+    QMutexLocker locker(&mutex);
+    return activeWorkers;
+}
+
+void BatchTransformer::processQueue() {
+    forever {
+        QString imageFileName;
+        {
+            QMutexLocker locker(&mutex);
+            if (queue.isEmpty()) {
+                if (--activeWorkers == 0) {
+                    emit finished(failed);
+                }
+                return;
+            }
+            imageFileName = queue.takeFirst();
+        }
+
+        QString error;
+        const bool isTransformed = transformImage(imageFileName, error);
+        if (!isTransformed) {
+            qWarning() << "Batch transform failed for" << imageFileName << error;
+            emit imageFailed(imageFileName, error);
+        }
+
+        QMutexLocker locker(&mutex);
+        ++done;
+        if (!isTransformed) {
+            ++failed;
+        }
+        emit progress(done, total);
+    }
+}
+
+// The largest image always gets through on its own, however big it is
+qint64 BatchTransformer::reserveMemory(const QSize &imageSize) {
+    const qint64 bytes = qint64(imageSize.width()) * imageSize.height() * 4 * BATCH_COPIES_PER_IMAGE;
+    QMutexLocker locker(&mutex);
+    while (memoryInFlight && memoryInFlight + bytes > BATCH_MEMORY_BUDGET && !isCancelled) {
+        memoryReleased.wait(&mutex);
+    }
+    memoryInFlight += bytes;
+    return bytes;
+}
+
+void BatchTransformer::releaseMemory(qint64 bytes) {
+    QMutexLocker locker(&mutex);
+    memoryInFlight -= bytes;
+    memoryReleased.wakeAll();
+}
+
+bool BatchTransformer::transformImage(const QString &imageFileName, QString &error) {
+    QImageReader imageReader(imageFileName);
+    const QByteArray format = imageReader.format();
+    const QSize imageSize = imageReader.size();
+    QString savePath = imageFileName;
+    if (!recipe.saveDirectory.isEmpty()) {
+        savePath = QDir(recipe.saveDirectory).filePath(QFileInfo(imageFileName).fileName());
+    }
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#if EXIV2_TEST_VERSION(0,28,0)
+    Exiv2::Image::UniquePtr exifImage;
+#else
+    Exiv2::Image::AutoPtr exifImage;
+#endif
+#pragma clang diagnostic pop
+
+    ImageMetadata imageMetadata;
+    try {
+        exifImage = Exiv2::ImageFactory::open(imageFileName.toStdString());
+        exifImage->readMetadata();
+        MetadataCache::readImageMetadata(*exifImage, imageMetadata);
+    }
+    catch (const Exiv2::Error &) {
+        exifImage.reset();
+    }
+
+    if (recipe.isOrientationOnly() && LosslessTransform::supportsFormat(format)) {
+        const int orientation = LosslessTransform::combinedOrientation(imageMetadata.orientation, recipe.rotation,
+                                                                       recipe.flipH, recipe.flipV);
+        if (LosslessTransform::saveOrientation(imageFileName, savePath, orientation)) {
+            if (metadataCache) {
+                metadataCache->removeImage(savePath);
+            }
+            return true;
+        }
+    }
+
+    if (!imageSize.isValid()) {
+        error = imageReader.errorString();
+        return false;
+    }
+
+    const qint64 reservedBytes = reserveMemory(imageSize);
+    QImage image;
+    bool isSaved = false;
+    if (!isCancelled && imageReader.read(&image)) {
+        if (recipe.exifRotation) {
+            ImageViewer::rotateByExifOrientation(image, imageMetadata.orientation);
+        }
+        recipe.scale(image);
+        recipe.transform(image);
+        if (recipe.colorAdjustment.changesColors()) {
+            ColorEngine::apply(image, recipe.colorAdjustment);
+        }
+        isSaved = image.save(savePath, format.constData(), recipe.quality);
+        if (!isSaved) {
+            error = QObject::tr("Failed to save image.");
+        }
+    } else {
+        error = isCancelled ? QObject::tr("Cancelled") : imageReader.errorString();
+    }
+    image = QImage();
+    releaseMemory(reservedBytes);
+    if (!isSaved) {
+        return false;
+    }
+
+    // The pixels are upright now, other viewers must not turn them again
+    if (exifImage) {
+        try {
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#if EXIV2_TEST_VERSION(0,28,0)
+            Exiv2::Image::UniquePtr savedImage = Exiv2::ImageFactory::open(savePath.toStdString());
+#else
+            Exiv2::Image::AutoPtr savedImage = Exiv2::ImageFactory::open(savePath.toStdString());
+#endif
+#pragma clang diagnostic pop
+            savedImage->setMetadata(*exifImage);
+            if (recipe.exifRotation && imageMetadata.orientation > 1) {
+                savedImage->exifData()["Exif.Image.Orientation"] = uint16_t(1);
+            }
+            Exiv2::ExifThumb thumb(savedImage->exifData());
+            thumb.erase();
+            savedImage->writeMetadata();
+        }
+        catch (const Exiv2::Error &exiv2Error) {
+            qWarning() << "EXIV2:" << exiv2Error.what();
+        }
+    }
+    if (metadataCache) {
+        metadataCache->removeImage(savePath);
+    }
+    return true;
+}
@@ -0,0 +1,118 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BATCH_TRANSFORM_H
+#define BATCH_TRANSFORM_H
+
+#include <QtCore>
+#include <QImage>
+#include <atomic>
+#include <memory>
+#include "ColorEngine.h"
+
+class MetadataCache;
+
+// Everything a transform does to an image, copied out of the Settings so workers never read them
+struct TransformRecipe
+{
+    qreal rotation = 0;
+    bool flipH = false;
+    bool flipV = false;
+    int cropLeft = 0;
+    int cropTop = 0;
+    int cropWidth = 0;
+    int cropHeight = 0;
+    int cropLeftPercent = 0;
+    int cropTopPercent = 0;
+    int cropWidthPercent = 0;
+    int cropHeightPercent = 0;
+    QSize scaledSize;
+    ColorAdjustment colorAdjustment;
+    bool exifRotation = true;
+    QString saveDirectory;
+    int quality = -1;
+
+    static TransformRecipe fromSettings();
+
+    // The colours dialog values, whether or not they are in use
+    static ColorAdjustment colorsFromSettings();
+
+    bool hasCrop() const;
+
+    // Right angle turns and flips only, which a new orientation tag can do
+    bool isOrientationOnly() const;
+
+    // pixelScale maps the absolute sizes onto a scaled down copy of the image
+    void scale(QImage &image, qreal pixelScale = 1) const;
+
+    void transform(QImage &image, qreal pixelScale = 1) const;
+};
+
+// Decodes, transforms, encodes and copies the metadata of many images at once,
+// one image per worker. Workers wait before decoding while the images in flight
+// would take more than the memory budget, progress comes through queued signals.
+class BatchTransformer : public QObject {
+Q_OBJECT
+
+public:
+    explicit BatchTransformer(const std::shared_ptr<MetadataCache> &metadataCache = nullptr,
+                              QObject *parent = nullptr);
+
+    ~BatchTransformer() override;
+
+    void start(const QStringList &imageFileNames, const TransformRecipe &recipe);
+
+    // Images already being worked on are finished, the rest are skipped
+    void cancel();
+
+    bool isRunning();
+
+signals:
+
+    void progress(int done, int total);
+
+    void imageFailed(const QString &imageFileName, const QString &error);
+
+    void finished(int failed);
+
+private:
+    class Worker;
+
+    void processQueue();
+
+    bool transformImage(const QString &imageFileName, QString &error);
+
+    qint64 reserveMemory(const QSize &imageSize);
+
+    void releaseMemory(qint64 bytes);
+
+    std::shared_ptr<MetadataCache> metadataCache;
+    TransformRecipe recipe;
+    QThreadPool threadPool;
+    QMutex mutex;
+    QWaitCondition memoryReleased;
+    QStringList queue;
+    qint64 memoryInFlight = 0;
+    int activeWorkers = 0;
+    int total = 0;
+    int done = 0;
+    int failed = 0;
+    std::atomic<bool> isCancelled{false};
+};
+
+#endif // BATCH_TRANSFORM_H
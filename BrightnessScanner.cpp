@@ -0,0 +1,174 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QImageReader>
+#include <exiv2/exiv2.hpp>
+#include "BrightnessScanner.h"
+#include "Exiv2Init.h"
+#include "ExifPreview.h"
+#include "ThumbnailLoader.h"
+#include "ThumbnailPack.h"
+#include "PackedThumbnail.h"
+
+#define BRIGHTNESS_BATCH_SIZE 32
+#define BRIGHTNESS_DECODE_SIZE 32
+
+class BrightnessScanner::Worker : public QRunnable {
+public:
+    explicit Worker(BrightnessScanner *scanner) : scanner(scanner) {}
+
+    void run() override {
+        scanner->processQueue();
+    }
+
+private:
+    BrightnessScanner *scanner;
+};
+
+static bool readScaled(QImageReader &reader, QImage &image) {
+    QSize scaledSize = reader.size();
+    if (scaledSize.isValid()) {
+        scaledSize.scale(BRIGHTNESS_DECODE_SIZE, BRIGHTNESS_DECODE_SIZE, Qt::KeepAspectRatio);
+        reader.setScaledSize(scaledSize);
+    }
+    return reader.read(&image);
+}
+
+static bool readScaled(QByteArray data, QImage &image) {
+    if (data.isEmpty()) {
+        return false;
+    }
+    QBuffer buffer(&data);
+    QImageReader reader(&buffer);
+    return readScaled(reader, image);
+}
+
+BrightnessScanner::BrightnessScanner(QObject *parent) : QObject(parent) {
+    qRegisterMetaType<ImageBrightness>();
+    qRegisterMetaType<QVector<ImageBrightness>>();
+
+    Exiv2Init::ensure();
+    threadPool.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+BrightnessScanner::~BrightnessScanner() {
+    cancel();
+    threadPool.waitForDone();
+}
+
+void BrightnessScanner::scan(const QList<ImageBrightness> &images) {
+    if (images.isEmpty()) {
+        return;
+    }
+
+    QMutexLocker locker(&mutex);
+    queue.append(images);
+
+    const int wantedWorkers = (queue.size() + BRIGHTNESS_BATCH_SIZE - 1) / BRIGHTNESS_BATCH_SIZE;
+    while (activeWorkers < threadPool.maxThreadCount() && activeWorkers < wantedWorkers) {
+        ++activeWorkers;
+        threadPool.start(new Worker(this));
+    }
+}
+
+void BrightnessScanner::cancel() {
+    QMutexLocker locker(&mutex);
+    queue.clear();
+    ++generation;
+}
+
+int BrightnessScanner::currentGeneration() const {
+    return generation;
+}
+
+float BrightnessScanner::imageBrightness(const QImage &image) {
+    // Smooth scaling averages all pixels, a fast one would pick a single one
+    return qGray(image.scaled(1, 1, Qt::IgnoreAspectRatio, Qt::SmoothTransformation).pixel(0, 0)) / 255.0f;
+}
+
+bool BrightnessScanner::computeBrightness(const ImageBrightness &image, float &brightness) {
+    QImage scaledImage;
+
+    // Cheapest first: thumbnails cached by earlier sessions, then previews the camera embedded
+    if (image.usePack) {
+        const QFileInfo fileInfo(image.imageFileName);
+        std::shared_ptr<ThumbnailPack> pack = ThumbnailPack::forDirectory(fileInfo.absolutePath());
+        const QByteArray data = pack->find(fileInfo.fileName(), image.lastModified, image.fileSize, nullptr);
+        QSize scaledSize = PackedThumbnail::size(data);
+        if (scaledSize.isValid()) {
+            scaledSize.scale(BRIGHTNESS_DECODE_SIZE, BRIGHTNESS_DECODE_SIZE, Qt::KeepAspectRatio);
+            scaledImage = PackedThumbnail::decode(data, scaledSize);
+        }
+    }
+
+    if (scaledImage.isNull()) {
+        const QString thumbnailPath = ThumbnailLoader::locateThumbnail(image.imageFileName, 0);
+        if (!thumbnailPath.isEmpty()) {
+            QImageReader reader(thumbnailPath);
+            readScaled(reader, scaledImage);
+        }
+    }
+
+    if (scaledImage.isNull()) {
+        QSize imageSize;
+        readScaled(ExifPreview::extract(image.imageFileName, QSize(BRIGHTNESS_DECODE_SIZE, BRIGHTNESS_DECODE_SIZE),
+                                        Qt::KeepAspectRatio, imageSize), scaledImage);
+    }
+
+    if (scaledImage.isNull()) {
+        QImageReader reader(image.imageFileName);
+        readScaled(reader, scaledImage);
+    }
+
+    if (scaledImage.isNull()) {
+        return false;
+    }
+    brightness = imageBrightness(scaledImage);
+    return true;
+}
+
+void BrightnessScanner::processQueue() {
+    forever {
+        QList<ImageBrightness> images;
+        int batchGeneration;
+        {
+            QMutexLocker locker(&mutex);
+            if (queue.isEmpty()) {
+                --activeWorkers;
+                return;
+            }
+            images = queue.mid(0, BRIGHTNESS_BATCH_SIZE);
+            queue.erase(queue.begin(), queue.begin() + images.size());
+            batchGeneration = generation;
+        }
+
+        QVector<ImageBrightness> results;
+        results.reserve(images.size());
+        for (ImageBrightness image : images) {
+            if (batchGeneration != generation) {
+                break;
+            }
+            image.isValid = computeBrightness(image, image.brightness);
+            results.append(image);
+        }
+
+        if (batchGeneration == generation) {
+            emit brightnessComputed(batchGeneration, results);
+        }
+    }
+}
@@ -0,0 +1,81 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BRIGHTNESS_SCANNER_H
+#define BRIGHTNESS_SCANNER_H
+
+#include <QtCore>
+#include <QImage>
+#include <atomic>
+#include <cmath>
+
+struct ImageBrightness
+{
+    QString imageFileName;
+    qint64 lastModified = 0;
+    qint64 fileSize = 0;
+    bool usePack = false;
+    float brightness = NAN;
+    bool isValid = false;
+};
+
+Q_DECLARE_METATYPE(ImageBrightness)
+
+// Finds the average brightness of images on a pool of worker threads without
+// making thumbnails for them. It is taken from a cached thumbnail or an
+// embedded preview when there is one, and from a decode a few pixels wide
+// otherwise. Results are delivered in batches through queued signals, tagged
+// with the generation they were queued in.
+class BrightnessScanner : public QObject {
+Q_OBJECT
+
+public:
+    explicit BrightnessScanner(QObject *parent = nullptr);
+
+    ~BrightnessScanner() override;
+
+    void scan(const QList<ImageBrightness> &images);
+
+    // Starts a new generation; everything queued or in flight is discarded
+    void cancel();
+
+    int currentGeneration() const;
+
+    // The same measure thumbnails are given when they are loaded
+    static float imageBrightness(const QImage &image);
+
+    // Safe to call from worker threads
+    static bool computeBrightness(const ImageBrightness &image, float &brightness);
+
+signals:
+
+    void brightnessComputed(int generation, const QVector<ImageBrightness> &results);
+
+private:
+    class Worker;
+
+    void processQueue();
+
+    QThreadPool threadPool;
+    QMutex mutex;
+    QList<ImageBrightness> queue;
+    int activeWorkers = 0;
+    std::atomic<int> generation{0};
+};
+
+#endif // BRIGHTNESS_SCANNER_H
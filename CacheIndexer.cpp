@@ -0,0 +1,373 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QImageReader>
+#include <exiv2/exiv2.hpp>
+#include "CacheIndexer.h"
+#include "Exiv2Init.h"
+#include "Settings.h"
+#include "ExifPreview.h"
+#include "ThumbnailLoader.h"
+#include "ThumbnailWriter.h"
+#include "ThumbnailPack.h"
+#include "MetadataCache.h"
+#include "MetadataDatabase.h"
+#include "FeatureDatabase.h"
+#include "DuplicateHasher.h"
+#include "BrightnessScanner.h"
+#include "Resampler.h"
+
+#if defined(Q_OS_LINUX)
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+#endif
+
+// The largest cache size, smaller ones are scaled from it
+#define INDEXER_THUMBNAIL_SIZE 1024
+#define INDEXER_HISTOGRAM_SIZE 256
+#define INDEXER_IDLE_DELAY 2000
+#define INDEXER_POLL_INTERVAL 200
+#define INDEXER_MAX_PENDING_WRITES 8
+
+class CacheIndexer::Worker : public QRunnable {
+public:
+    explicit Worker(CacheIndexer *indexer) : indexer(indexer) {}
+
+    void run() override {
+        QThread::currentThread()->setPriority(QThread::IdlePriority);
+#if defined(Q_OS_LINUX)
+        // Thread ids are process ids to ioprio_set(), 0 is the calling thread
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#endif
+        indexer->processQueue();
+    }
+
+private:
+    CacheIndexer *indexer;
+};
+
+// Whatever the indexer read is of no use to anyone else, keep it from pushing out what is
+static void dropFromPageCache(const QString &filePath) {
+#if defined(Q_OS_LINUX)
+    const int fd = ::open(QFile::encodeName(filePath).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(fd);
+    }
+#else
+    Q_UNUSED(filePath)
+#endif
+}
+
+static bool readScaled(QImageReader &reader, QImage &image) {
+    QSize scaledSize = reader.size();
+    if (scaledSize.isValid() && qMax(scaledSize.width(), scaledSize.height()) > INDEXER_THUMBNAIL_SIZE) {
+        scaledSize.scale(INDEXER_THUMBNAIL_SIZE, INDEXER_THUMBNAIL_SIZE, Qt::KeepAspectRatio);
+        reader.setScaledSize(scaledSize);
+    }
+    return reader.read(&image);
+}
+
+CacheIndexer::CacheIndexer(QObject *parent) : QObject(parent) {
+    Exiv2Init::ensure();
+    threadPool.setMaxThreadCount(1);
+
+    QMimeDatabase db;
+    for (const QByteArray &type : QImageReader::supportedMimeTypes()) {
+        nameFilters.append(db.mimeTypeForName(type).globPatterns());
+    }
+
+    statePath = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) +
+        QLatin1String("/phototonic/indexer");
+    loadState();
+    QCoreApplication::instance()->installEventFilter(this);
+}
+
+CacheIndexer::~CacheIndexer() {
+    stop();
+}
+
+void CacheIndexer::index(const QString &rootPath, int thumbSize) {
+    QMutexLocker locker(&mutex);
+    const QString directoryPath = QDir(rootPath).absolutePath();
+    if (!pendingDirectories.contains(directoryPath)) {
+        pendingDirectories.append(directoryPath);
+    }
+    updateOptions(thumbSize);
+    saveState();
+    startWorker();
+}
+
+void CacheIndexer::resume() {
+    QMutexLocker locker(&mutex);
+    if (pendingDirectories.isEmpty()) {
+        return;
+    }
+    updateOptions(options.thumbSize);
+    startWorker();
+}
+
+void CacheIndexer::stop() {
+    isStopped = true;
+    threadPool.waitForDone();
+}
+
+bool CacheIndexer::eventFilter(QObject *watched, QEvent *event) {
+    switch (event->type()) {
+        case QEvent::KeyPress:
+        case QEvent::MouseButtonPress:
+        case QEvent::MouseMove:
+        case QEvent::Wheel:
+        case QEvent::TouchBegin:
+            lastInteraction = QDateTime::currentMSecsSinceEpoch();
+            break;
+        default:
+            break;
+    }
+    return QObject::eventFilter(watched, event);
+}
+
+// Settings are only read on the GUI thread, the worker gets a copy
+void CacheIndexer::updateOptions(int thumbSize) {
+    options.thumbSize = thumbSize;
+    options.usePack = Settings::packedThumbnails;
+    options.packEncoding = PackedThumbnail::Encoding(Settings::packedThumbnailEncoding);
+    options.useMetadataDatabase = Settings::metadataDatabase;
+    options.preciseSimilarity = Settings::preciseSimilarity;
+    options.showHiddenFiles = Settings::showHiddenFiles;
+    options.nameFilters = nameFilters;
+}
+
+void CacheIndexer::startWorker() {
+    isStopped = false;
+    if (!isWorkerRunning) {
+        isWorkerRunning = true;
+        threadPool.start(new Worker(this));
+    }
+}
+
+void CacheIndexer::processQueue() {
+    forever {
+        QString directoryPath;
+        Options directoryOptions;
+        {
+            QMutexLocker locker(&mutex);
+            if (pendingDirectories.isEmpty() || isStopped) {
+                isWorkerRunning = false;
+                break;
+            }
+            directoryPath = pendingDirectories.first();
+            directoryOptions = options;
+        }
+
+        QStringList subDirectories;
+        const bool isIndexed = indexDirectory(directoryPath, directoryOptions, subDirectories);
+        // Records are buffered, one write per directory
+        MetadataDatabase::instance()->flush();
+        FeatureDatabase::instance()->flush();
+        if (!isIndexed) {
+            // Stopped half way, the directory is done again next time
+            QMutexLocker locker(&mutex);
+            isWorkerRunning = false;
+            return;
+        }
+
+        // Depth first, so the queue only ever holds the siblings on the way down
+        QMutexLocker locker(&mutex);
+        pendingDirectories.removeOne(directoryPath);
+        pendingDirectories = subDirectories + pendingDirectories;
+        saveState();
+    }
+
+    if (!isStopped) {
+        emit finished();
+    }
+}
+
+bool CacheIndexer::indexDirectory(const QString &directoryPath, const Options &options,
+                                  QStringList &subDirectories) {
+    const QDir directory(directoryPath);
+    const QDir::Filters hiddenFilter = options.showHiddenFiles ? QDir::Hidden : QDir::Filters();
+
+    // Links are left out, they could lead back up the tree
+    const QFileInfoList directories = directory.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks
+                                                              | hiddenFilter, QDir::Name);
+    for (const QFileInfo &directoryInfo : directories) {
+        subDirectories.append(directoryInfo.absoluteFilePath());
+    }
+
+    const QFileInfoList files = directory.entryInfoList(options.nameFilters, QDir::Files | hiddenFilter, QDir::Name);
+    for (const QFileInfo &fileInfo : files) {
+        if (!waitForIdle()) {
+            return false;
+        }
+        indexImage(fileInfo, options);
+    }
+    return true;
+}
+
+void CacheIndexer::indexImage(const QFileInfo &fileInfo, const Options &options) {
+    const QString imageFileName = fileInfo.absoluteFilePath();
+    const qint64 lastModified = fileInfo.lastModified().toMSecsSinceEpoch();
+    const qint64 fileSize = fileInfo.size();
+    bool isFileRead = false;
+
+    if (options.useMetadataDatabase) {
+        ImageMetadata imageMetadata;
+        if (!MetadataDatabase::instance()->find(imageFileName, lastModified, fileSize, imageMetadata)) {
+            imageMetadata.lastModified = lastModified;
+            imageMetadata.readable = MetadataCache::readImageMetadata(imageFileName, imageMetadata);
+            imageMetadata.loaded = true;
+            MetadataDatabase::instance()->insert(imageFileName, lastModified, fileSize, imageMetadata);
+            isFileRead = true;
+        }
+    }
+
+    // Everything below is skipped for images indexed before, which makes resuming cheap
+    std::shared_ptr<ThumbnailPack> pack;
+    bool needsThumbnail = false;
+    if (options.usePack) {
+        pack = ThumbnailPack::forDirectory(fileInfo.absolutePath());
+        needsThumbnail = pack->find(fileInfo.fileName(), lastModified, fileSize, nullptr).isEmpty();
+    }
+#if !defined(Q_OS_MAC) && !defined(Q_OS_WIN)
+    needsThumbnail = needsThumbnail
+                     || ThumbnailLoader::locateThumbnail(imageFileName, INDEXER_THUMBNAIL_SIZE).isEmpty();
+#endif
+
+    ImageFeatures features;
+    FeatureDatabase::instance()->find(imageFileName, lastModified, fileSize, features);
+    const bool needsHistogram = !features.hasDescriptor || (options.preciseSimilarity && !features.histogram);
+    const bool needsFeatures = !features.hasDHash || needsHistogram || std::isnan(features.brightness);
+
+    if (needsThumbnail || needsFeatures) {
+        // One decode at the largest cache size serves every thumbnail size and the descriptors
+        QImage image;
+        QImageReader reader(imageFileName);
+        const QSize originalSize = reader.size();
+        if (!readScaled(reader, image)) {
+            QSize previewImageSize;
+            QByteArray preview = ExifPreview::extract(imageFileName,
+                                                      QSize(INDEXER_THUMBNAIL_SIZE, INDEXER_THUMBNAIL_SIZE),
+                                                      Qt::KeepAspectRatio, previewImageSize);
+            QBuffer buffer(&preview);
+            QImageReader previewReader(&buffer);
+            readScaled(previewReader, image);
+        }
+        isFileRead = true;
+
+        if (!image.isNull()) {
+            // Like the thumbnail loader, files Qt cannot read are never matched to a freedesktop thumbnail
+            if (needsThumbnail && originalSize.isValid()) {
+                ThumbnailWriter::instance()->storeThumbnailSizes(imageFileName, image, originalSize,
+                                                                 ThumbnailWriter::LowPriority);
+            }
+            if (needsThumbnail && pack) {
+                const QImage packedThumbnail = options.thumbSize > 0
+                                               && qMin(image.width(), image.height()) > options.thumbSize
+                                               ? Resampler::scaled(image, options.thumbSize, options.thumbSize,
+                                                                   Qt::KeepAspectRatioByExpanding)
+                                               : image;
+                ThumbnailWriter::instance()->storePackedThumbnail(pack, imageFileName, lastModified, fileSize,
+                                                                  packedThumbnail, originalSize, options.packEncoding,
+                                                                  ThumbnailWriter::LowPriority);
+            }
+
+            if (needsFeatures) {
+                if (!features.hasDHash) {
+                    features.hasDHash = DuplicateHasher::computeDHash(image, features.dHash);
+                }
+                if (needsHistogram) {
+                    const Histogram histogram = Histogram::fromImage(
+                            image.scaled(INDEXER_HISTOGRAM_SIZE, INDEXER_HISTOGRAM_SIZE, Qt::IgnoreAspectRatio,
+                                         Qt::SmoothTransformation));
+                    features.descriptor = ColorDescriptor::fromHistogram(histogram);
+                    features.hasDescriptor = true;
+                    if (options.preciseSimilarity) {
+                        features.histogram = std::make_shared<Histogram>(histogram);
+                    }
+                }
+                if (std::isnan(features.brightness)) {
+                    features.brightness = BrightnessScanner::imageBrightness(image);
+                }
+                FeatureDatabase::instance()->insert(imageFileName, lastModified, fileSize, features);
+            }
+        }
+    }
+
+    if (isFileRead) {
+        dropFromPageCache(imageFileName);
+    }
+}
+
+bool CacheIndexer::waitForIdle() {
+    // Also waits for the thumbnail writer, so no more than a few decoded images are held at once
+    forever {
+        if (isStopped) {
+            return false;
+        }
+        if (QDateTime::currentMSecsSinceEpoch() - lastInteraction >= INDEXER_IDLE_DELAY
+            && ThumbnailWriter::instance()->pendingCount() < INDEXER_MAX_PENDING_WRITES) {
+            return true;
+        }
+        QThread::msleep(INDEXER_POLL_INTERVAL);
+    }
+}
+
+// The thumbnail size on the first line, then one pending directory per line
+void CacheIndexer::loadState() {
+    QFile stateFile(statePath);
+    if (!stateFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return;
+    }
+
+    options.thumbSize = stateFile.readLine().trimmed().toInt();
+    while (!stateFile.atEnd()) {
+        QString directoryPath = QString::fromUtf8(stateFile.readLine());
+        directoryPath.remove(QLatin1Char('\n'));
+        if (!directoryPath.isEmpty()) {
+            pendingDirectories.append(directoryPath);
+        }
+    }
+}
+
+void CacheIndexer::saveState() {
+    if (pendingDirectories.isEmpty()) {
+        QFile::remove(statePath);
+        return;
+    }
+
+    QDir().mkpath(QFileInfo(statePath).absolutePath());
+    QSaveFile stateFile(statePath);
+    if (!stateFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qWarning() << "Unable to save indexer state" << statePath << stateFile.errorString();
+        return;
+    }
+    stateFile.write(QByteArray::number(options.thumbSize) + '\n');
+    for (const QString &directoryPath : pendingDirectories) {
+        stateFile.write(directoryPath.toUtf8() + '\n');
+    }
+    if (!stateFile.commit()) {
+        qWarning() << "Unable to save indexer state" << statePath << stateFile.errorString();
+    }
+}
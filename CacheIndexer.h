@@ -0,0 +1,98 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CACHE_INDEXER_H
+#define CACHE_INDEXER_H
+
+#include <QtCore>
+#include <atomic>
+#include "PackedThumbnail.h"
+
+// Fills the thumbnail cache, the metadata database and the feature database
+// for whole directory trees ahead of the first visit. Each image is decoded
+// once for all of them. It runs on one thread at idle CPU and I/O priority,
+// pauses while the user is interacting, and keeps the directories it has not
+// finished on disk, so it picks up where it left off after a restart.
+class CacheIndexer : public QObject {
+Q_OBJECT
+
+public:
+    explicit CacheIndexer(QObject *parent = nullptr);
+
+    ~CacheIndexer() override;
+
+    // Queues the tree below rootPath, thumbSize is the one the packed store is filled for
+    void index(const QString &rootPath, int thumbSize);
+
+    // Goes on with directories left over from the last session
+    void resume();
+
+    // Waits for the image in progress, the rest stays queued for the next session
+    void stop();
+
+signals:
+
+    // Sent once every queued directory is done
+    void finished();
+
+protected:
+    bool eventFilter(QObject *watched, QEvent *event) override;
+
+private:
+    struct Options {
+        int thumbSize = 0;
+        bool usePack = false;
+        PackedThumbnail::Encoding packEncoding = PackedThumbnail::Png;
+        bool useMetadataDatabase = false;
+        bool preciseSimilarity = false;
+        bool showHiddenFiles = false;
+        QStringList nameFilters;
+    };
+
+    class Worker;
+
+    void updateOptions(int thumbSize);
+
+    void startWorker();
+
+    void processQueue();
+
+    bool indexDirectory(const QString &directoryPath, const Options &options, QStringList &subDirectories);
+
+    void indexImage(const QFileInfo &fileInfo, const Options &options);
+
+    // Returns false if the indexer was stopped while waiting
+    bool waitForIdle();
+
+    void loadState();
+
+    void saveState();
+
+    QString statePath;
+    QStringList nameFilters;
+    QThreadPool threadPool;
+    QMutex mutex;
+    QStringList pendingDirectories;
+    Options options;
+    bool isWorkerRunning = false;
+    std::atomic<bool> isStopped{false};
+    std::atomic<qint64> lastInteraction{0};
+};
+
+#endif // CACHE_INDEXER_H
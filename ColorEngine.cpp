@@ -0,0 +1,269 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QtCore>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include "ColorEngine.h"
+
+#define COLOR_ENGINE_ROWS_PER_BLOCK 32
+#define COLOR_ENGINE_CACHE_BITS 12
+
+namespace {
+
+struct Tables {
+    uchar channel[3][256];
+    uchar hue[256];
+    uchar saturation[256];
+    uchar lightness[256];
+    // 2^32 / d rounded up, exact for the small numerators divided here
+    quint32 reciprocal[1024];
+    bool hueChannel[3];
+    bool isHslIdentity;
+};
+
+void buildTables(const ColorAdjustment &adjustment, Tables &tables) {
+    uchar contrastTransform[256];
+    uchar brightTransform[256];
+    const float contrast = adjustment.contrast / 100.0f;
+    const float brightness = adjustment.brightness / 100.0f;
+    for (int i = 0; i < 256; ++i) {
+        if (i < (int) (128.0f + 128.0f * tan(contrast)) && i > (int) (128.0f - 128.0f * tan(contrast))) {
+            contrastTransform[i] = (i - 128) / tan(contrast) + 128;
+        } else if (i >= (int) (128.0f + 128.0f * tan(contrast))) {
+            contrastTransform[i] = 255;
+        } else {
+            contrastTransform[i] = 0;
+        }
+        brightTransform[i] = qMin(255, (int) ((255.0 * pow(i / 255.0, 1.0 / brightness)) + 0.5));
+    }
+
+    const bool negate[3] = {adjustment.negateRed, adjustment.negateGreen, adjustment.negateBlue};
+    const int gain[3] = {adjustment.red + 100, adjustment.green + 100, adjustment.blue + 100};
+    for (int c = 0; c < 3; ++c) {
+        for (int i = 0; i < 256; ++i) {
+            const int value = qBound(0, ((negate[c] ? 255 - i : i) * gain[c]) / 100, 255);
+            tables.channel[c][i] = contrastTransform[brightTransform[value]];
+        }
+    }
+
+    for (int i = 0; i < 256; ++i) {
+        tables.hue[i] = uchar(adjustment.colorize ? adjustment.hue : i + adjustment.hue);
+        tables.saturation[i] = uchar(qBound(0, (i * adjustment.saturation) / 100, 255));
+        tables.lightness[i] = uchar(qBound(0, (i * adjustment.lightness) / 100, 255));
+    }
+    tables.reciprocal[0] = 0;
+    for (int d = 1; d < 1024; ++d) {
+        tables.reciprocal[d] = quint32((Q_UINT64_C(1) << 32) / d + 1);
+    }
+
+    tables.hueChannel[0] = adjustment.hueRedChannel;
+    tables.hueChannel[1] = adjustment.hueGreenChannel;
+    tables.hueChannel[2] = adjustment.hueBlueChannel;
+    tables.isHslIdentity = !adjustment.colorize && (adjustment.hue & 255) == 0
+                           && adjustment.saturation == 100 && adjustment.lightness == 100;
+}
+
+// m1 and m2 carry 8 fractional bits. Written as selects rather than
+// branches, which colours in a photo would mispredict all the time.
+inline int hslValue(int m1, int m2, int hue) {
+    hue += hue > 255 ? -255 : (hue < 0 ? 255 : 0);
+
+    const int rising = m1 + ((m2 - m1) * hue * 2) / 85;
+    const int falling = m1 + ((m2 - m1) * (170 - hue) * 2) / 85;
+    const int value = hue * 2 < 85 ? rising : (hue * 2 < 255 ? m2 : (hue < 170 ? falling : m1));
+    return qMin(255, (value + 128) >> 8);
+}
+
+inline int divide(const Tables &tables, int numerator, int denominator) {
+    return int((quint64(numerator) * tables.reciprocal[denominator]) >> 32);
+}
+
+inline void adjustHsl(const Tables &tables, int &r, int &g, int &b) {
+    const int max = qMax(r, qMax(g, b));
+    const int min = qMin(r, qMin(g, b));
+    const int delta = max - min;
+
+    // Lightness and saturation are rounded like the floating point original did
+    int l = (max + min + 1) / 2;
+    int s = 0;
+    int h = 0;
+    if (delta) {
+        const int denominator = max + min < 256 ? max + min : 511 - max - min;
+        s = divide(tables, 510 * delta + denominator, 2 * denominator);
+
+        // The hue is 42.5 * sixths on a 0-255 circle, kept as a fraction over 2 * delta
+        int numerator = r == max ? 85 * (g - b)
+                                 : (g == max ? 85 * (2 * delta + b - r) : 85 * (4 * delta + r - g));
+        numerator += numerator < 0 ? 255 * 2 * delta : 0;
+        h = divide(tables, 2 * numerator + 2 * delta, 4 * delta);
+    }
+
+    h = tables.hue[h];
+    s = tables.saturation[s];
+    l = tables.lightness[l];
+
+    if (s == 0) {
+        r = g = b = l;
+        return;
+    }
+
+    const int m2 = l < 128 ? (l * (255 + s) * 256) / 255 : (l + s) * 256 - (l * s * 256) / 255;
+    const int m1 = l * 512 - m2;
+    r = hslValue(m1, m2, h + 85);
+    g = hslValue(m1, m2, h);
+    b = hslValue(m1, m2, h - 85);
+}
+
+struct Pixels {
+    uchar *bits;
+    qint64 bytesPerLine;
+    int width;
+    int height;
+    bool hasAlpha;
+};
+
+// Recent results of the HSL path by input colour, the same few colours tend to repeat in a region
+struct ResultCache {
+    ResultCache() {
+        std::fill(colors, colors + (1 << COLOR_ENGINE_CACHE_BITS), 0xffffffff);
+    }
+
+    quint32 colors[1 << COLOR_ENGINE_CACHE_BITS];
+    quint32 results[1 << COLOR_ENGINE_CACHE_BITS];
+};
+
+void adjustRows(const Tables &tables, const Pixels &pixels, int firstRow, int lastRow, ResultCache &cache) {
+    const int width = pixels.width;
+    const bool hasAlpha = pixels.hasAlpha;
+    for (int y = firstRow; y < lastRow; ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(pixels.bits + qint64(y) * pixels.bytesPerLine);
+        if (tables.isHslIdentity) {
+            // Tables only, simple enough for the compiler to unroll
+            for (int x = 0; x < width; ++x) {
+                const QRgb pixel = line[x];
+                const QRgb alpha = hasAlpha ? pixel & 0xff000000 : 0xff000000;
+                const QRgb r = tables.hueChannel[0] ? tables.channel[0][qRed(pixel)] : qRed(pixel);
+                const QRgb g = tables.hueChannel[1] ? tables.channel[1][qGreen(pixel)] : qGreen(pixel);
+                const QRgb b = tables.hueChannel[2] ? tables.channel[2][qBlue(pixel)] : qBlue(pixel);
+                line[x] = alpha | (r << 16) | (g << 8) | b;
+            }
+            continue;
+        }
+
+        for (int x = 0; x < width; ++x) {
+            const QRgb pixel = line[x];
+            const QRgb alpha = hasAlpha ? pixel & 0xff000000 : 0xff000000;
+            const quint32 color = pixel & 0xffffff;
+            const quint32 slot = (color * 2654435761u) >> (32 - COLOR_ENGINE_CACHE_BITS);
+            if (cache.colors[slot] == color) {
+                line[x] = alpha | cache.results[slot];
+                continue;
+            }
+
+            int r = tables.channel[0][qRed(pixel)];
+            int g = tables.channel[1][qGreen(pixel)];
+            int b = tables.channel[2][qBlue(pixel)];
+            adjustHsl(tables, r, g, b);
+            r = tables.hueChannel[0] ? r : qRed(pixel);
+            g = tables.hueChannel[1] ? g : qGreen(pixel);
+            b = tables.hueChannel[2] ? b : qBlue(pixel);
+            cache.colors[slot] = color;
+            cache.results[slot] = (r << 16) | (g << 8) | b;
+            line[x] = alpha | cache.results[slot];
+        }
+    }
+}
+
+class Worker : public QRunnable {
+public:
+    Worker(const Tables &tables, const Pixels &pixels, std::atomic<int> &nextRow, QSemaphore &done)
+        : tables(tables), pixels(pixels), nextRow(nextRow), done(done) {}
+
+    void run() override {
+        processBlocks(tables, pixels, nextRow);
+        done.release();
+    }
+
+    // Rows are handed out in blocks, so a slow core does not hold up the others
+    static void processBlocks(const Tables &tables, const Pixels &pixels, std::atomic<int> &nextRow) {
+        ResultCache cache;
+        forever {
+            const int firstRow = nextRow.fetch_add(COLOR_ENGINE_ROWS_PER_BLOCK);
+            if (firstRow >= pixels.height) {
+                return;
+            }
+            adjustRows(tables, pixels, firstRow, qMin(firstRow + COLOR_ENGINE_ROWS_PER_BLOCK, pixels.height), cache);
+        }
+    }
+
+private:
+    const Tables &tables;
+    const Pixels &pixels;
+    std::atomic<int> &nextRow;
+    QSemaphore &done;
+};
+
+} // anonymous namespace
+
+bool ColorAdjustment::changesColors() const {
+    const ColorAdjustment identity;
+    return isEnabled && (negateRed || negateGreen || negateBlue
+                         || red != identity.red || green != identity.green || blue != identity.blue
+                         || brightness != identity.brightness || contrast != identity.contrast
+                         || colorize || (hue & 255) != 0 || saturation != identity.saturation
+                         || lightness != identity.lightness);
+}
+
+namespace ColorEngine {
+
+void apply(QImage &image, const ColorAdjustment &adjustment) {
+    switch (image.format()) {
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+        break;
+    default:
+        image = image.convertToFormat(QImage::Format_RGB32);
+    }
+    if (image.isNull()) {
+        return;
+    }
+
+    Tables tables;
+    buildTables(adjustment, tables);
+
+    // Detaches once here, the workers only get the raw rows
+    const Pixels pixels = {image.bits(), image.bytesPerLine(), image.width(), image.height(),
+                           image.hasAlphaChannel()};
+
+    // A pool of its own, the calling thread must not wait behind unrelated work
+    static QThreadPool threadPool;
+    std::atomic<int> nextRow{0};
+    QSemaphore done;
+    const int blocks = (pixels.height + COLOR_ENGINE_ROWS_PER_BLOCK - 1) / COLOR_ENGINE_ROWS_PER_BLOCK;
+    const int workers = qMax(0, qMin(QThread::idealThreadCount(), blocks) - 1);
+    for (int i = 0; i < workers; ++i) {
+        threadPool.start(new Worker(tables, pixels, nextRow, done));
+    }
+    Worker::processBlocks(tables, pixels, nextRow);
+    done.acquire(workers);
+}
+
+}
@@ -0,0 +1,57 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COLOR_ENGINE_H
+#define COLOR_ENGINE_H
+
+#include <QImage>
+
+// The colours dialog values, in the ranges of the Settings they come from
+struct ColorAdjustment
+{
+    bool isEnabled = false;
+    bool negateRed = false;
+    bool negateGreen = false;
+    bool negateBlue = false;
+    int red = 0;
+    int green = 0;
+    int blue = 0;
+    int brightness = 100;
+    int contrast = 78;
+    bool colorize = false;
+    int hue = 0;
+    int saturation = 100;
+    int lightness = 100;
+    bool hueRedChannel = true;
+    bool hueGreenChannel = true;
+    bool hueBlueChannel = true;
+
+    // False when it is disabled or would leave every pixel as it is
+    bool changesColors() const;
+};
+
+namespace ColorEngine {
+
+// Adjusts the image in place on all cores, converting it to a 32 bit format first if needed.
+// Negation, gain, brightness and contrast are folded into one table per channel,
+// the HSL step runs in fixed point and is skipped when it would not change anything.
+void apply(QImage &image, const ColorAdjustment &adjustment);
+
+}
+
+#endif // COLOR_ENGINE_H
@@ -0,0 +1,272 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QtCore>
+#include <QColorTransform>
+#include <atomic>
+#include <memory>
+#include "ColorTransforms.h"
+#include "PerfCounters.h"
+
+#define LUT_GRID_SIZE 33
+#define MAX_CACHED_LUTS 16
+#define LUT_ROWS_PER_BLOCK 32
+#define LUT_PARALLEL_PIXELS (512 * 512)
+
+namespace {
+
+// Output colours at every grid point, 8 bit values with 8 bits of fraction
+struct Lut {
+    QVector<quint16> values;
+};
+
+struct GridPosition {
+    int base;
+    int fraction;
+};
+
+struct Pixels {
+    uchar *bits;
+    int bytesPerLine;
+    int width;
+    int height;
+};
+
+struct GridPositions {
+    GridPositions() {
+        for (int value = 0; value < 256; ++value) {
+            const int position = value * (LUT_GRID_SIZE - 1) * 256 / 255;
+            positions[value] = {position >> 8, position & 255};
+            // The last grid cell is interpolated from below, so base + 1 stays in the grid
+            if (positions[value].base == LUT_GRID_SIZE - 1) {
+                positions[value] = {LUT_GRID_SIZE - 2, 256};
+            }
+        }
+    }
+
+    GridPosition positions[256];
+};
+
+const GridPosition *gridPositions() {
+    static const GridPositions gridPositions;
+    return gridPositions.positions;
+}
+
+QByteArray profileKey(const QColorSpace &colorSpace) {
+    QByteArray key = colorSpace.iccProfile();
+    if (key.isEmpty()) {
+        key = QByteArray::number(int(colorSpace.primaries())) + ':'
+              + QByteArray::number(int(colorSpace.transferFunction())) + ':'
+              + QByteArray::number(colorSpace.gamma());
+    }
+    return key;
+}
+
+std::shared_ptr<const Lut> buildLut(const QColorSpace &source, const QColorSpace &target) {
+    const QColorTransform transform = source.transformationToColorSpace(target);
+    auto lut = std::make_shared<Lut>();
+    lut->values.resize(LUT_GRID_SIZE * LUT_GRID_SIZE * LUT_GRID_SIZE * 3);
+    quint16 *value = lut->values.data();
+    for (int r = 0; r < LUT_GRID_SIZE; ++r) {
+        for (int g = 0; g < LUT_GRID_SIZE; ++g) {
+            for (int b = 0; b < LUT_GRID_SIZE; ++b) {
+                const QRgba64 color = transform.map(QRgba64::fromRgba64(
+                        quint16(r * 65535 / (LUT_GRID_SIZE - 1)), quint16(g * 65535 / (LUT_GRID_SIZE - 1)),
+                        quint16(b * 65535 / (LUT_GRID_SIZE - 1)), 65535));
+                *value++ = quint16((quint32(color.red()) * 65280 + 32767) / 65535);
+                *value++ = quint16((quint32(color.green()) * 65280 + 32767) / 65535);
+                *value++ = quint16((quint32(color.blue()) * 65280 + 32767) / 65535);
+            }
+        }
+    }
+    return lut;
+}
+
+// Most recently used last
+std::shared_ptr<const Lut> findLut(const QColorSpace &source, const QColorSpace &target) {
+    static QMutex mutex;
+    static QList<QPair<QByteArray, std::shared_ptr<const Lut>>> luts;
+
+    const QByteArray key = profileKey(source) + '\0' + profileKey(target);
+    // Held while building, so workers converting from the same profile wait for one table
+    QMutexLocker locker(&mutex);
+    for (int i = luts.size() - 1; i >= 0; --i) {
+        if (luts.at(i).first == key) {
+            luts.move(i, luts.size() - 1);
+            Perf::count(Perf::ColorTransformHits);
+            return luts.last().second;
+        }
+    }
+
+    Perf::count(Perf::ColorTransformBuilds);
+    std::shared_ptr<const Lut> lut = buildLut(source, target);
+    if (luts.size() >= MAX_CACHED_LUTS) {
+        luts.removeFirst();
+    }
+    luts.append(qMakePair(key, lut));
+    return lut;
+}
+
+// Tetrahedral interpolation, four of the eight corners of the grid cell
+void mapRows(const Lut &lut, const Pixels &pixels, int firstRow, int lastRow) {
+    const GridPosition *positions = gridPositions();
+    const int strideR = LUT_GRID_SIZE * LUT_GRID_SIZE * 3;
+    const int strideG = LUT_GRID_SIZE * 3;
+    const int strideB = 3;
+    const quint16 *values = lut.values.constData();
+
+    for (int y = firstRow; y < lastRow; ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(pixels.bits + y * pixels.bytesPerLine);
+        for (int x = 0; x < pixels.width; ++x) {
+            const QRgb pixel = line[x];
+            const GridPosition &r = positions[qRed(pixel)];
+            const GridPosition &g = positions[qGreen(pixel)];
+            const GridPosition &b = positions[qBlue(pixel)];
+            const quint16 *corner0 = values + r.base * strideR + g.base * strideG + b.base * strideB;
+            const quint16 *corner3 = corner0 + strideR + strideG + strideB;
+            const quint16 *corner1;
+            const quint16 *corner2;
+            int weight0, weight1, weight2, weight3;
+            if (r.fraction >= g.fraction) {
+                if (g.fraction >= b.fraction) {
+                    corner1 = corner0 + strideR;
+                    corner2 = corner1 + strideG;
+                    weight0 = 256 - r.fraction, weight1 = r.fraction - g.fraction;
+                    weight2 = g.fraction - b.fraction, weight3 = b.fraction;
+                } else if (r.fraction >= b.fraction) {
+                    corner1 = corner0 + strideR;
+                    corner2 = corner1 + strideB;
+                    weight0 = 256 - r.fraction, weight1 = r.fraction - b.fraction;
+                    weight2 = b.fraction - g.fraction, weight3 = g.fraction;
+                } else {
+                    corner1 = corner0 + strideB;
+                    corner2 = corner1 + strideR;
+                    weight0 = 256 - b.fraction, weight1 = b.fraction - r.fraction;
+                    weight2 = r.fraction - g.fraction, weight3 = g.fraction;
+                }
+            } else {
+                if (r.fraction >= b.fraction) {
+                    corner1 = corner0 + strideG;
+                    corner2 = corner1 + strideR;
+                    weight0 = 256 - g.fraction, weight1 = g.fraction - r.fraction;
+                    weight2 = r.fraction - b.fraction, weight3 = b.fraction;
+                } else if (g.fraction >= b.fraction) {
+                    corner1 = corner0 + strideG;
+                    corner2 = corner1 + strideB;
+                    weight0 = 256 - g.fraction, weight1 = g.fraction - b.fraction;
+                    weight2 = b.fraction - r.fraction, weight3 = r.fraction;
+                } else {
+                    corner1 = corner0 + strideB;
+                    corner2 = corner1 + strideG;
+                    weight0 = 256 - b.fraction, weight1 = b.fraction - g.fraction;
+                    weight2 = g.fraction - r.fraction, weight3 = r.fraction;
+                }
+            }
+
+            int channels[3];
+            for (int c = 0; c < 3; ++c) {
+                channels[c] = (corner0[c] * weight0 + corner1[c] * weight1 + corner2[c] * weight2
+                               + corner3[c] * weight3 + 32768) >> 16;
+            }
+            line[x] = (pixel & 0xff000000) | (channels[0] << 16) | (channels[1] << 8) | channels[2];
+        }
+    }
+}
+
+class Worker : public QRunnable {
+public:
+    Worker(const Lut &lut, const Pixels &pixels, std::atomic<int> &nextRow, QSemaphore &done)
+        : lut(lut), pixels(pixels), nextRow(nextRow), done(done) {}
+
+    void run() override {
+        processBlocks(lut, pixels, nextRow);
+        done.release();
+    }
+
+    static void processBlocks(const Lut &lut, const Pixels &pixels, std::atomic<int> &nextRow) {
+        forever {
+            const int firstRow = nextRow.fetch_add(LUT_ROWS_PER_BLOCK);
+            if (firstRow >= pixels.height) {
+                return;
+            }
+            mapRows(lut, pixels, firstRow, qMin(firstRow + LUT_ROWS_PER_BLOCK, pixels.height));
+        }
+    }
+
+private:
+    const Lut &lut;
+    const Pixels &pixels;
+    std::atomic<int> &nextRow;
+    QSemaphore &done;
+};
+
+} // anonymous namespace
+
+namespace ColorTransforms {
+
+void convert(QImage &image, const QColorSpace &target) {
+    const QColorSpace source = image.colorSpace();
+    if (image.isNull() || !source.isValid() || !target.isValid() || source == target) {
+        return;
+    }
+
+    Perf::ScopedTimer timer(Perf::ColorTransform);
+    switch (image.format()) {
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+        break;
+    default:
+        image = image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+    }
+    if (image.isNull()) {
+        return;
+    }
+
+    const std::shared_ptr<const Lut> lut = findLut(source, target);
+    const Pixels pixels = {image.bits(), image.bytesPerLine(), image.width(), image.height()};
+    std::atomic<int> nextRow{0};
+
+    // Thumbnails are converted on the loader's workers already
+    if (qint64(pixels.width) * pixels.height < LUT_PARALLEL_PIXELS) {
+        Worker::processBlocks(*lut, pixels, nextRow);
+    } else {
+        static QThreadPool threadPool;
+        QSemaphore done;
+        const int blocks = (pixels.height + LUT_ROWS_PER_BLOCK - 1) / LUT_ROWS_PER_BLOCK;
+        const int workers = qMax(0, qMin(QThread::idealThreadCount(), blocks) - 1);
+        for (int i = 0; i < workers; ++i) {
+            threadPool.start(new Worker(*lut, pixels, nextRow, done));
+        }
+        Worker::processBlocks(*lut, pixels, nextRow);
+        done.acquire(workers);
+    }
+    image.setColorSpace(target);
+}
+
+QColorSpace displayColorSpace() {
+    return QColorSpace(QColorSpace::SRgb);
+}
+
+QImage toDisplay(const QImage &image) {
+    QImage displayImage = image;
+    convert(displayImage, displayColorSpace());
+    return displayImage;
+}
+
+}
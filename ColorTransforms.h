@@ -0,0 +1,41 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef COLOR_TRANSFORMS_H
+#define COLOR_TRANSFORMS_H
+
+#include <QImage>
+#include <QColorSpace>
+
+namespace ColorTransforms {
+
+// Converts the image from its own colour space to target through a 3D table, on all cores
+// for large images. One table is kept for each pair of profiles, so the images of a folder
+// that share a camera profile only pay for it once. Images without a colour space are left alone.
+void convert(QImage &image, const QColorSpace &target);
+
+// What images are shown in. Qt does not tell us the monitor profile, so this is sRGB.
+QColorSpace displayColorSpace();
+
+// image itself when it is already in the display colour space
+QImage toDisplay(const QImage &image);
+
+}
+
+#endif // COLOR_TRANSFORMS_H
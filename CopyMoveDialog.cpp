@@ -18,56 +18,27 @@
 
 #include "CopyMoveDialog.h"
 
-static QString autoRename(QString &destDir, QString &currFile) {
-    int extSep = currFile.lastIndexOf(".");
-    QString nameOnly = currFile.left(extSep);
-    QString extOnly = currFile.right(currFile.size() - extSep - 1);
-    QString newFile;
-
-    int idx = 1;
-    do {
-        newFile = QString(nameOnly + "_copy_%1." + extOnly).arg(idx);
-        ++idx;
-    } while (idx && (QFile::exists(destDir + QDir::separator() + newFile)));
-
-    return newFile;
-}
+#define PROGRESS_INTERVAL 250
 
 int CopyMoveDialog::copyOrMoveFile(bool isCopy, QString &srcFile, QString &srcPath, QString &dstPath, QString &dstDir) {
-    int res;
-
-    if (isCopy) {
-        res = QFile::copy(srcPath, dstPath);
-    } else {
-        res = QFile::rename(srcPath, dstPath);
-    }
-
-    if (!res && QFile::exists(dstPath)) {
-        QString newName = autoRename(dstDir, srcFile);
-        QString newDestPath = dstDir + QDir::separator() + newName;
-
-        if (isCopy) {
-            res = QFile::copy(srcPath, newDestPath);
-        } else {
-            res = QFile::rename(srcPath, newDestPath);
-        }
-        dstPath = newDestPath;
-    }
-
-    return res;
+    Q_UNUSED(srcFile)
+    return CopyMoveEngine::transferFile(isCopy, srcPath, dstPath, dstDir);
 }
 
 CopyMoveDialog::CopyMoveDialog(QWidget *parent) : QDialog(parent) {
     abortOp = false;
 
     opLabel = new QLabel("");
+    progressLabel = new QLabel("");
+    copyMoveEngine = new CopyMoveEngine(this);
 
     cancelButton = new QPushButton(tr("Cancel"));
     cancelButton->setSizePolicy(QSizePolicy::Fixed, QSizePolicy::Fixed);
     connect(cancelButton, SIGNAL(clicked()), this, SLOT(abort()));
 
-    QHBoxLayout *topLayout = new QHBoxLayout;
+    QVBoxLayout *topLayout = new QVBoxLayout;
     topLayout->addWidget(opLabel);
+    topLayout->addWidget(progressLabel);
 
     QHBoxLayout *buttonsLayout = new QHBoxLayout;
     buttonsLayout->addWidget(cancelButton);
@@ -79,68 +50,97 @@ CopyMoveDialog::CopyMoveDialog(QWidget *parent) : QDialog(parent) {
 }
 
 void CopyMoveDialog::execute(ThumbsViewer *thumbView, QString &destDir, bool pasteInCurrDir) {
-    int res = 0;
-    QString sourceFile;
-    QFileInfo fileInfo;
-    QString currFile;
-    QString destFile;
-    int tn;
+    QStringList sourcePaths;
+    QList<int> rows;
+
+    if (pasteInCurrDir) {
+        sourcePaths = Settings::copyCutFileList;
+    } else {
+        for (int tn = Settings::copyCutIndexList.size() - 1; tn >= 0; --tn) {
+            rows.append(Settings::copyCutIndexList[tn].row());
+            sourcePaths.append(thumbView->thumbsViewerModel->filePath(rows.last()));
+        }
+    }
+
+    // An empty destination marks a file that was not copied or moved
+    QVector<QString> destPaths(sourcePaths.size());
+    QEventLoop eventLoop;
+    connect(copyMoveEngine, &CopyMoveEngine::fileStarted, this,
+            [this](int, const QString &sourcePath, const QString &destPath) {
+        currentSource = sourcePath;
+        currentDest = destPath;
+    });
+    connect(copyMoveEngine, &CopyMoveEngine::fileFinished, this, [&](int index, const QString &destPath, bool ok) {
+        if (ok) {
+            destPaths[index] = destPath;
+        } else {
+            copyMoveEngine->cancel();
+        }
+    });
+    connect(copyMoveEngine, &CopyMoveEngine::finished, &eventLoop, &QEventLoop::quit);
+
+    QTimer progressTimer;
+    connect(&progressTimer, &QTimer::timeout, this, &CopyMoveDialog::updateProgress);
+    progressTimer.start(PROGRESS_INTERVAL);
 
     show();
+    elapsedTimer.start();
+    copyMoveEngine->start(sourcePaths, destDir, Settings::isCopyOperation);
+    eventLoop.exec();
+    progressTimer.stop();
+    disconnect(copyMoveEngine, nullptr, this, nullptr);
 
     if (pasteInCurrDir) {
-        for (tn = 0; tn < Settings::copyCutFileList.size(); ++tn) {
-            sourceFile = Settings::copyCutFileList[tn];
-            fileInfo = QFileInfo(sourceFile);
-            currFile = fileInfo.fileName();
-            destFile = destDir + QDir::separator() + currFile;
-
-            opLabel->setText((Settings::isCopyOperation ? tr("Copying \"%1\" to \"%2\".") : tr("Moving \"%1\" to \"%2\"."))
-                                     .arg(sourceFile).arg(destFile));
-            QApplication::processEvents();
-
-            res = CopyMoveDialog::copyOrMoveFile(Settings::isCopyOperation, currFile, sourceFile, destFile, destDir);
-
-            if (!res || abortOp) {
-                break;
-            } else {
-                Settings::copyCutFileList[tn] = destFile;
+        QStringList destFiles;
+        for (const QString &destPath : destPaths) {
+            if (!destPath.isEmpty()) {
+                destFiles.append(destPath);
             }
         }
+        Settings::copyCutFileList = destFiles;
     } else {
         QList<int> rowList;
-        for (tn = Settings::copyCutIndexList.size() - 1; tn >= 0; --tn) {
-            sourceFile = thumbView->thumbsViewerModel->item(Settings::copyCutIndexList[tn].row())->
-                    data(thumbView->FileNameRole).toString();
-            fileInfo = QFileInfo(sourceFile);
-            currFile = fileInfo.fileName();
-            destFile = destDir + QDir::separator() + currFile;
-
-            opLabel->setText((Settings::isCopyOperation ?
-                              tr("Copying %1 to %2.") : tr("Moving %1 to %2.")).arg(sourceFile).arg(destFile));
-            QApplication::processEvents();
-
-            res = copyOrMoveFile(Settings::isCopyOperation, currFile, sourceFile, destFile, destDir);
-
-            if (!res || abortOp) {
-                break;
+        for (int i = 0; i < rows.size(); ++i) {
+            if (!destPaths.at(i).isEmpty()) {
+                rowList.append(rows.at(i));
             }
-
-            rowList.append(Settings::copyCutIndexList[tn].row());
         }
 
         if (!Settings::isCopyOperation) {
             std::sort(rowList.begin(), rowList.end());
-            for (int t = rowList.size() - 1; t >= 0; --t)
-                thumbView->thumbsViewerModel->removeRow(rowList.at(t));
+            thumbView->thumbsViewerModel->removeRowList(rowList);
         }
-        latestRow = rowList.at(0);
+        latestRow = rowList.isEmpty() ? 0 : rowList.at(0);
     }
 
     nFiles = Settings::copyCutIndexList.size();
     close();
 }
 
+void CopyMoveDialog::updateProgress() {
+    if (!currentSource.isEmpty()) {
+        opLabel->setText((Settings::isCopyOperation ?
+                          tr("Copying %1 to %2.") : tr("Moving %1 to %2.")).arg(currentSource).arg(currentDest));
+    }
+
+    const qint64 bytesDone = copyMoveEngine->bytesDone();
+    const qint64 bytesTotal = copyMoveEngine->bytesTotal();
+    const qint64 elapsed = qMax(qint64(1), elapsedTimer.elapsed());
+    const double bytesPerSecond = bytesDone * 1000.0 / elapsed;
+    QString remaining = "-";
+    if (bytesPerSecond > 0) {
+        const int secondsLeft = int((bytesTotal - bytesDone) / bytesPerSecond);
+        remaining = QTime(0, 0).addSecs(secondsLeft).toString(secondsLeft >= 3600 ? "h:mm:ss" : "m:ss");
+    }
+
+    progressLabel->setText(tr("%1 of %2 files, %3 MB/s, %4 remaining")
+                                   .arg(copyMoveEngine->filesDone())
+                                   .arg(copyMoveEngine->filesTotal())
+                                   .arg(bytesPerSecond / (1024 * 1024), 0, 'f', 1)
+                                   .arg(remaining));
+}
+
 void CopyMoveDialog::abort() {
     abortOp = true;
+    copyMoveEngine->cancel();
 }
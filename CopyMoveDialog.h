@@ -21,6 +21,7 @@
 
 #include <QtWidgets/qdialog.h>
 #include "ThumbsViewer.h"
+#include "CopyMoveEngine.h"
 
 class CopyMoveDialog : public QDialog {
 Q_OBJECT
@@ -29,6 +30,10 @@ public slots:
 
     void abort();
 
+private slots:
+
+    void updateProgress();
+
 public:
     CopyMoveDialog(QWidget *parent);
 
@@ -41,7 +46,12 @@ public:
 
 private:
     QLabel *opLabel;
+    QLabel *progressLabel;
     QPushButton *cancelButton;
+    CopyMoveEngine *copyMoveEngine;
+    QElapsedTimer elapsedTimer;
+    QString currentSource;
+    QString currentDest;
     bool abortOp;
 };
 
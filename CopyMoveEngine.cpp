@@ -0,0 +1,322 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CopyMoveEngine.h"
+#include "PerfCounters.h"
+
+#if defined(Q_OS_LINUX)
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <unistd.h>
+#include <cerrno>
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define HAVE_COPY_FILE_RANGE
+#endif
+#endif
+
+#define COPY_MOVE_THREADS 4
+#define LARGE_FILE_SIZE (qint64(64) << 20)
+#define COPY_CHUNK_SIZE (qint64(8) << 20)
+#define COPY_BUFFER_SIZE (1 << 20)
+
+class CopyMoveEngine::Worker : public QRunnable {
+public:
+    explicit Worker(CopyMoveEngine *engine) : engine(engine) {}
+
+    void run() override {
+        engine->processQueue();
+    }
+
+private:
+    CopyMoveEngine *engine;
+};
+
+CopyMoveEngine::CopyMoveEngine(QObject *parent) : QObject(parent) {
+    threadPool.setMaxThreadCount(COPY_MOVE_THREADS);
+}
+
+CopyMoveEngine::~CopyMoveEngine() {
+    cancel();
+    threadPool.waitForDone();
+}
+
+void CopyMoveEngine::start(const QStringList &sourcePaths, const QString &destDir, bool isCopy) {
+    QMutexLocker locker(&mutex);
+    this->destDir = destDir;
+    this->isCopy = isCopy;
+    cancelled = false;
+    reservedPaths.clear();
+    queue.clear();
+
+    qint64 total = 0;
+    for (int i = 0; i < sourcePaths.size(); ++i) {
+        Job job;
+        job.index = i;
+        job.sourcePath = sourcePaths.at(i);
+        job.size = QFileInfo(job.sourcePath).size();
+        total += job.size;
+        queue.append(job);
+    }
+    totalBytes = total;
+    doneBytes = 0;
+    doneFiles = 0;
+    totalFiles = queue.size();
+
+    if (queue.isEmpty()) {
+        QMetaObject::invokeMethod(this, "finished", Qt::QueuedConnection);
+        return;
+    }
+
+    const int workers = qMin(queue.size(), COPY_MOVE_THREADS);
+    for (int i = activeWorkers; i < workers; ++i) {
+        ++activeWorkers;
+        threadPool.start(new Worker(this));
+    }
+}
+
+void CopyMoveEngine::cancel() {
+    QMutexLocker locker(&mutex);
+    cancelled = true;
+    queue.clear();
+}
+
+bool CopyMoveEngine::isRunning() const {
+    QMutexLocker locker(&mutex);
+    return activeWorkers > 0;
+}
+
+qint64 CopyMoveEngine::bytesDone() const {
+    return doneBytes;
+}
+
+qint64 CopyMoveEngine::bytesTotal() const {
+    return totalBytes;
+}
+
+int CopyMoveEngine::filesDone() const {
+    return doneFiles;
+}
+
+int CopyMoveEngine::filesTotal() const {
+    return totalFiles;
+}
+
+bool CopyMoveEngine::takeJob(Job &job, QString &destPath) {
+    for (int i = 0; i < queue.size(); ++i) {
+        const bool isLarge = queue.at(i).size >= LARGE_FILE_SIZE;
+        if (isLarge && isLargeFileActive) {
+            // Only one large file streams at a time, the worker doing it picks up the next
+            continue;
+        }
+        job = queue.takeAt(i);
+        if (isLarge) {
+            isLargeFileActive = true;
+        }
+        destPath = reserveDestination(job.sourcePath);
+        return true;
+    }
+    return false;
+}
+
+void CopyMoveEngine::processQueue() {
+    forever {
+        Job job;
+        QString destPath;
+        bool isFinished = false;
+        {
+            QMutexLocker locker(&mutex);
+            if (!takeJob(job, destPath)) {
+                --activeWorkers;
+                isFinished = activeWorkers == 0;
+            }
+        }
+        if (destPath.isEmpty()) {
+            if (isFinished) {
+                emit finished();
+            }
+            return;
+        }
+
+        emit fileStarted(job.index, job.sourcePath, destPath);
+
+        bool ok = false;
+        if (!cancelled) {
+            Perf::ScopedTimer timer(Perf::CopyMoveFile);
+            if (!isCopy && QDir().rename(job.sourcePath, destPath)) {
+                // Same device, nothing to copy
+                doneBytes += job.size;
+                ok = true;
+            } else {
+                ok = copyFile(job.sourcePath, destPath, &doneBytes, &cancelled);
+                if (ok && !isCopy && !QFile::remove(job.sourcePath)) {
+                    QFile::remove(destPath);
+                    ok = false;
+                }
+            }
+        }
+
+        {
+            QMutexLocker locker(&mutex);
+            if (job.size >= LARGE_FILE_SIZE) {
+                isLargeFileActive = false;
+            }
+        }
+        ++doneFiles;
+        emit fileFinished(job.index, destPath, ok);
+    }
+}
+
+QString CopyMoveEngine::autoRename(const QString &destDir, const QString &fileName,
+                                   const QSet<QString> &reservedPaths) {
+    int extSep = fileName.lastIndexOf(".");
+    if (extSep <= 0) {
+        extSep = fileName.size();
+    }
+    const QString nameOnly = fileName.left(extSep);
+    const QString extOnly = fileName.mid(extSep);
+    QString newPath;
+
+    int idx = 1;
+    do {
+        newPath = destDir + QDir::separator() + QString(nameOnly + "_copy_%1" + extOnly).arg(idx);
+        ++idx;
+    } while (idx && (reservedPaths.contains(newPath) || QFile::exists(newPath)));
+
+    return newPath;
+}
+
+QString CopyMoveEngine::reserveDestination(const QString &sourcePath) {
+    // Parallel workers must not pick the same name for two files
+    const QString fileName = QFileInfo(sourcePath).fileName();
+    QString destPath = destDir + QDir::separator() + fileName;
+    if (reservedPaths.contains(destPath) || QFile::exists(destPath)) {
+        destPath = autoRename(destDir, fileName, reservedPaths);
+    }
+    reservedPaths.insert(destPath);
+    return destPath;
+}
+
+bool CopyMoveEngine::copyFile(const QString &srcPath, const QString &dstPath, std::atomic<qint64> *progress,
+                              const std::atomic<bool> *cancelled) {
+    QFile srcFile(srcPath);
+    if (!srcFile.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        return false;
+    }
+    QFile dstFile(dstPath);
+    if (!dstFile.open(QIODevice::WriteOnly | QIODevice::NewOnly | QIODevice::Unbuffered)) {
+        return false;
+    }
+
+    bool ok = false;
+    bool isCopied = false;
+
+#if defined(Q_OS_LINUX)
+    const int srcFd = srcFile.handle();
+    const int dstFd = dstFile.handle();
+#ifdef FICLONE
+    // Reflink: the new file shares the source extents until either is written
+    if (ioctl(dstFd, FICLONE, srcFd) == 0) {
+        if (progress) {
+            *progress += srcFile.size();
+        }
+        ok = isCopied = true;
+    }
+#endif
+#ifdef HAVE_COPY_FILE_RANGE
+    if (!isCopied) {
+        qint64 copied = 0;
+        forever {
+            if (cancelled && *cancelled) {
+                isCopied = true;
+                break;
+            }
+            const ssize_t written = copy_file_range(srcFd, nullptr, dstFd, nullptr, size_t(COPY_CHUNK_SIZE), 0);
+            if (written < 0) {
+                // Not supported between these file systems, fall back unless we are half way through
+                isCopied = copied > 0 || (errno != EXDEV && errno != ENOSYS && errno != EINVAL
+                                          && errno != EOPNOTSUPP && errno != EPERM);
+                break;
+            }
+            if (written == 0) {
+                ok = isCopied = true;
+                break;
+            }
+            copied += written;
+            if (progress) {
+                *progress += written;
+            }
+        }
+    }
+#endif
+#endif
+
+    if (!isCopied) {
+        QByteArray buffer(COPY_BUFFER_SIZE, Qt::Uninitialized);
+        forever {
+            if (cancelled && *cancelled) {
+                break;
+            }
+            const qint64 bytesRead = srcFile.read(buffer.data(), buffer.size());
+            if (bytesRead < 0) {
+                break;
+            }
+            if (bytesRead == 0) {
+                ok = true;
+                break;
+            }
+            if (dstFile.write(buffer.constData(), bytesRead) != bytesRead) {
+                break;
+            }
+            if (progress) {
+                *progress += bytesRead;
+            }
+        }
+    }
+
+    if (ok) {
+        dstFile.setPermissions(srcFile.permissions());
+    }
+    dstFile.close();
+    if (!ok) {
+        dstFile.remove();
+        return false;
+    }
+    return true;
+}
+
+bool CopyMoveEngine::transferFile(bool isCopy, const QString &srcPath, QString &dstPath, const QString &dstDir) {
+    if (QFile::exists(dstPath)) {
+        dstPath = autoRename(dstDir, QFileInfo(srcPath).fileName(), QSet<QString>());
+    }
+
+    if (!isCopy) {
+        if (QDir().rename(srcPath, dstPath)) {
+            return true;
+        }
+        if (!copyFile(srcPath, dstPath, nullptr, nullptr)) {
+            return false;
+        }
+        if (!QFile::remove(srcPath)) {
+            QFile::remove(dstPath);
+            return false;
+        }
+        return true;
+    }
+
+    return copyFile(srcPath, dstPath, nullptr, nullptr);
+}
@@ -0,0 +1,98 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COPY_MOVE_ENGINE_H
+#define COPY_MOVE_ENGINE_H
+
+#include <QtCore>
+#include <atomic>
+
+// Copies or moves files on a small pool of background threads. Small files
+// are spread over several workers, large ones are streamed one at a time so
+// they do not compete for the disk. Where the kernel supports it the data
+// never passes through user space.
+class CopyMoveEngine : public QObject {
+Q_OBJECT
+
+public:
+    explicit CopyMoveEngine(QObject *parent = nullptr);
+
+    ~CopyMoveEngine() override;
+
+    void start(const QStringList &sourcePaths, const QString &destDir, bool isCopy);
+
+    // Drops pending files and aborts the ones in flight, removing partial copies
+    void cancel();
+
+    bool isRunning() const;
+
+    qint64 bytesDone() const;
+
+    qint64 bytesTotal() const;
+
+    int filesDone() const;
+
+    int filesTotal() const;
+
+    // Synchronous single file transfer; dstPath is updated if the file had to be renamed
+    static bool transferFile(bool isCopy, const QString &srcPath, QString &dstPath, const QString &dstDir);
+
+signals:
+
+    void fileStarted(int index, const QString &sourcePath, const QString &destPath);
+
+    void fileFinished(int index, const QString &destPath, bool ok);
+
+    void finished();
+
+private:
+    struct Job {
+        int index = 0;
+        QString sourcePath;
+        qint64 size = 0;
+    };
+
+    class Worker;
+
+    void processQueue();
+
+    bool takeJob(Job &job, QString &destPath);
+
+    QString reserveDestination(const QString &sourcePath);
+
+    static QString autoRename(const QString &destDir, const QString &fileName, const QSet<QString> &reservedPaths);
+
+    static bool copyFile(const QString &srcPath, const QString &dstPath, std::atomic<qint64> *progress,
+                         const std::atomic<bool> *cancelled);
+
+    QThreadPool threadPool;
+    mutable QMutex mutex;
+    QList<Job> queue;
+    QSet<QString> reservedPaths;
+    QString destDir;
+    bool isCopy = true;
+    bool isLargeFileActive = false;
+    int activeWorkers = 0;
+    std::atomic<bool> cancelled{false};
+    std::atomic<qint64> doneBytes{0};
+    std::atomic<qint64> totalBytes{0};
+    std::atomic<int> doneFiles{0};
+    std::atomic<int> totalFiles{0};
+};
+
+#endif // COPY_MOVE_ENGINE_H
@@ -16,12 +16,13 @@
  *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <QFileSystemModel>
 #include "DirCompleter.h"
+#include "FileSystemModel.h"
 
 DirCompleter::DirCompleter(QObject *parent) : QCompleter(parent)
 {
-    QFileSystemModel *model = new QFileSystemModel;
+    // Shares the subdirectory probe with the tree, so neither lists directories on the GUI thread
+    FileSystemModel *model = new FileSystemModel(this);
     model->setFilter(QDir::AllDirs | QDir::Dirs | QDir::NoDotAndDotDot);
     setModel(model);
 }
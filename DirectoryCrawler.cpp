@@ -0,0 +1,218 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+#include "DirectoryCrawler.h"
+
+#define CRAWLER_THREADS 4
+#define CRAWL_BATCH_SIZE 256
+#define PARALLEL_SORT_THRESHOLD 20000
+
+template <typename Less>
+class SortRunnable : public QRunnable {
+public:
+    SortRunnable(int *first, int *last, const Less &less) : first(first), last(last), less(less) {}
+
+    void run() override {
+        std::stable_sort(first, last, less);
+    }
+
+private:
+    int *first;
+    int *last;
+    const Less &less;
+};
+
+// Large lists are sorted in slices on all cores and merged afterwards
+template <typename Less>
+static void sortOrder(QVector<int> &order, const Less &less, bool isParallel) {
+    const int count = order.size();
+    const int threads = QThread::idealThreadCount();
+    int *begin = order.data();
+    if (!isParallel || count < PARALLEL_SORT_THRESHOLD || threads < 2) {
+        std::stable_sort(begin, begin + count, less);
+        return;
+    }
+
+    const int sliceSize = (count + threads - 1) / threads;
+    QThreadPool threadPool;
+    threadPool.setMaxThreadCount(threads);
+    for (int first = 0; first < count; first += sliceSize) {
+        threadPool.start(new SortRunnable<Less>(begin + first, begin + qMin(first + sliceSize, count), less));
+    }
+    threadPool.waitForDone();
+
+    for (int width = sliceSize; width < count; width *= 2) {
+        for (int first = 0; first + width < count; first += 2 * width) {
+            std::inplace_merge(begin + first, begin + first + width, begin + qMin(first + 2 * width, count), less);
+        }
+    }
+}
+
+class DirectoryCrawler::Worker : public QRunnable {
+public:
+    explicit Worker(DirectoryCrawler *crawler) : crawler(crawler) {}
+
+    void run() override {
+        crawler->processQueue();
+    }
+
+private:
+    DirectoryCrawler *crawler;
+};
+
+DirectoryCrawler::DirectoryCrawler(QObject *parent) : QObject(parent) {
+    qRegisterMetaType<QFileInfoList>();
+    threadPool.setMaxThreadCount(CRAWLER_THREADS);
+}
+
+DirectoryCrawler::~DirectoryCrawler() {
+    cancel();
+    threadPool.waitForDone();
+}
+
+void DirectoryCrawler::crawl(const QString &rootPath, const QDir &filesTemplate, QDir::SortFlags sortFlags) {
+    QMutexLocker locker(&mutex);
+    pendingDirectories.clear();
+    ++generation;
+    this->rootPath = rootPath;
+    this->filesTemplate = filesTemplate;
+    this->sortFlags = sortFlags;
+    pendingDirectories.append(rootPath);
+    startWorkers();
+}
+
+void DirectoryCrawler::cancel() {
+    QMutexLocker locker(&mutex);
+    pendingDirectories.clear();
+    ++generation;
+}
+
+int DirectoryCrawler::currentGeneration() const {
+    return generation;
+}
+
+void DirectoryCrawler::sortByName(QFileInfoList &files, QDir::SortFlags sortFlags) {
+    QCollator collator;
+    if (sortFlags & QDir::IgnoreCase) {
+        collator.setCaseSensitivity(Qt::CaseInsensitive);
+    }
+
+    collator.setNumericMode(true);
+
+    const bool isReversed = sortFlags & QDir::Reversed;
+    QVector<int> order(files.size());
+    std::iota(order.begin(), order.end(), 0);
+
+    // Some collation backends ignore numeric mode in sort keys, those compare names instead
+    if (collator.sortKey(QStringLiteral("2")).compare(collator.sortKey(QStringLiteral("10"))) < 0) {
+        std::vector<QCollatorSortKey> keys;
+        keys.reserve(files.size());
+        for (const QFileInfo &fileInfo : files) {
+            keys.push_back(collator.sortKey(fileInfo.fileName()));
+        }
+        sortOrder(order, [&](int a, int b) {
+            return isReversed ? keys[b].compare(keys[a]) < 0 : keys[a].compare(keys[b]) < 0;
+        }, true);
+    } else {
+        QVector<QString> fileNames;
+        fileNames.reserve(files.size());
+        for (const QFileInfo &fileInfo : files) {
+            fileNames.append(fileInfo.fileName());
+        }
+        sortOrder(order, [&](int a, int b) {
+            return isReversed ? collator.compare(fileNames[b], fileNames[a]) < 0
+                              : collator.compare(fileNames[a], fileNames[b]) < 0;
+        }, false);
+    }
+
+    QFileInfoList sortedFiles;
+    sortedFiles.reserve(files.size());
+    for (int i : order) {
+        sortedFiles.append(files.at(i));
+    }
+    files.swap(sortedFiles);
+}
+
+// Called with the mutex held
+void DirectoryCrawler::startWorkers() {
+    while (activeWorkers < threadPool.maxThreadCount() && activeWorkers < pendingDirectories.size()) {
+        ++activeWorkers;
+        threadPool.start(new Worker(this));
+    }
+}
+
+void DirectoryCrawler::processQueue() {
+    forever {
+        QString directoryPath;
+        QDir directory;
+        QDir::SortFlags nameSortFlags;
+        bool isRoot;
+        int crawlGeneration;
+        {
+            QMutexLocker locker(&mutex);
+            if (pendingDirectories.isEmpty()) {
+                // The last worker out is the one that knows nothing else will be listed
+                if (--activeWorkers == 0) {
+                    emit finished(generation);
+                }
+                return;
+            }
+            // Depth first keeps the number of pending directories down
+            directoryPath = pendingDirectories.takeLast();
+            directory = filesTemplate;
+            nameSortFlags = sortFlags;
+            isRoot = directoryPath == rootPath;
+            crawlGeneration = generation;
+        }
+
+        // Symbolic links are not followed, they could lead back up the tree
+        QDir::Filters directoryFilters = QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks;
+        if (directory.filter() & QDir::Hidden) {
+            directoryFilters |= QDir::Hidden;
+        }
+        const QStringList subdirectories = QDir(directoryPath).entryList(directoryFilters, QDir::NoSort);
+        {
+            QMutexLocker locker(&mutex);
+            if (crawlGeneration != generation) {
+                continue;
+            }
+            for (const QString &subdirectory : subdirectories) {
+                pendingDirectories.append(directoryPath + QLatin1Char('/') + subdirectory);
+            }
+            startWorkers();
+        }
+
+        if (isRoot) {
+            continue;
+        }
+
+        directory.setPath(directoryPath);
+        QFileInfoList files = directory.entryInfoList();
+        if (directory.sorting() == QDir::NoSort) {
+            sortByName(files, nameSortFlags);
+        }
+
+        for (int first = 0; first < files.size() && crawlGeneration == generation; first += CRAWL_BATCH_SIZE) {
+            emit filesListed(crawlGeneration, files.mid(first, CRAWL_BATCH_SIZE));
+        }
+    }
+}
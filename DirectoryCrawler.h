@@ -0,0 +1,78 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef DIRECTORY_CRAWLER_H
+#define DIRECTORY_CRAWLER_H
+
+#include <QtCore>
+#include <atomic>
+
+Q_DECLARE_METATYPE(QFileInfoList)
+
+// Lists every directory below a root on a few worker threads at once. A
+// small fixed number of threads keeps network file systems responsive while
+// still hiding the latency of each listing. Files are delivered in batches
+// through queued signals as soon as a directory has been read, tagged with
+// the generation they were listed in.
+class DirectoryCrawler : public QObject {
+Q_OBJECT
+
+public:
+    explicit DirectoryCrawler(QObject *parent = nullptr);
+
+    ~DirectoryCrawler() override;
+
+    // Files are listed and sorted like filesTemplate would list them, name sorting
+    // with sortFlags is applied on top where filesTemplate does not sort.
+    // The files directly in rootPath are left out.
+    void crawl(const QString &rootPath, const QDir &filesTemplate, QDir::SortFlags sortFlags);
+
+    // Starts a new generation; everything queued or in flight is discarded
+    void cancel();
+
+    int currentGeneration() const;
+
+    // Natural order, as the file manager shows it
+    static void sortByName(QFileInfoList &files, QDir::SortFlags sortFlags);
+
+signals:
+
+    void filesListed(int generation, const QFileInfoList &files);
+
+    // Sent after the last batch of the generation
+    void finished(int generation);
+
+private:
+    class Worker;
+
+    void startWorkers();
+
+    void processQueue();
+
+    QThreadPool threadPool;
+    QMutex mutex;
+    QStringList pendingDirectories;
+    QString rootPath;
+    QDir filesTemplate;
+    QDir::SortFlags sortFlags;
+    int activeWorkers = 0;
+    std::atomic<int> generation{0};
+};
+
+#endif // DIRECTORY_CRAWLER_H
@@ -0,0 +1,183 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "DirectoryEntries.h"
+#include <atomic>
+#if defined(Q_OS_UNIX)
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+// Enough requests in flight to hide network latency, on any number of cores
+#define ATTRIBUTE_THREADS 16
+#define ATTRIBUTE_BATCH_SIZE 256
+
+namespace DirectoryEntries {
+
+NameMatcher::NameMatcher(const QStringList &nameFilters) {
+    static const QRegularExpression plainSuffix(QStringLiteral("^\\*\\.[^*?\\[\\].]+$"));
+    for (QString nameFilter : nameFilters) {
+        // "**.jpg" is what an empty text filter in front of "*.jpg" gives, and means the same
+        while (nameFilter.startsWith(QLatin1String("**"))) {
+            nameFilter.remove(0, 1);
+        }
+        if (plainSuffix.match(nameFilter).hasMatch()) {
+            suffixes.insert(nameFilter.mid(2).toLower());
+        } else {
+            patterns.append(QRegularExpression(QRegularExpression::wildcardToRegularExpression(nameFilter),
+                                               QRegularExpression::CaseInsensitiveOption));
+        }
+    }
+}
+
+bool NameMatcher::matches(const QString &fileName) const {
+    if (suffixes.isEmpty() && patterns.isEmpty()) {
+        return true;
+    }
+    const int dot = fileName.lastIndexOf(QLatin1Char('.'));
+    if (dot > 0 && suffixes.contains(fileName.mid(dot + 1).toLower())) {
+        return true;
+    }
+    for (const QRegularExpression &pattern : patterns) {
+        if (pattern.match(fileName).hasMatch()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+QFileInfoList files(const QDir &directory) {
+#if defined(Q_OS_UNIX) && defined(DT_UNKNOWN)
+    const QDir::Filters filters = directory.filter() & ~QDir::Hidden;
+    if (filters != QDir::Files || directory.sorting() != QDir::NoSort) {
+        return directory.entryInfoList();
+    }
+
+    DIR *dir = opendir(QFile::encodeName(directory.path()).constData());
+    if (!dir) {
+        return QFileInfoList();
+    }
+
+    const bool includeHidden = directory.filter() & QDir::Hidden;
+    const NameMatcher nameMatcher(directory.nameFilters());
+    const QString directoryPath = directory.path() == QLatin1String("/")
+                                  ? directory.path() : directory.path() + QLatin1Char('/');
+    QFileInfoList files;
+    while (const dirent *entry = readdir(dir)) {
+        if (entry->d_name[0] == '.' && (!includeHidden || entry->d_name[1] == '\0'
+                                        || (entry->d_name[1] == '.' && entry->d_name[2] == '\0'))) {
+            continue;
+        }
+
+        bool isFile = entry->d_type == DT_REG;
+        if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+            // Links count by what they point to, like in QDir
+            struct stat status;
+            isFile = fstatat(dirfd(dir), entry->d_name, &status, 0) == 0 && S_ISREG(status.st_mode);
+        }
+        if (!isFile) {
+            continue;
+        }
+
+        const QString fileName = QFile::decodeName(entry->d_name);
+        if (nameMatcher.matches(fileName)) {
+            files.append(QFileInfo(directoryPath + fileName));
+        }
+    }
+    closedir(dir);
+    return files;
+#else
+    return directory.entryInfoList();
+#endif
+}
+
+static void readAttributes(const QString &filePath, qint64 &size, qint64 &lastModified) {
+#if defined(Q_OS_LINUX) && defined(STATX_SIZE)
+    // Only what is asked for, some network file systems can answer that without a full revalidation
+    struct statx status;
+    if (statx(AT_FDCWD, QFile::encodeName(filePath).constData(), 0, STATX_SIZE | STATX_MTIME, &status) == 0) {
+        size = qint64(status.stx_size);
+        lastModified = qint64(status.stx_mtime.tv_sec) * 1000 + status.stx_mtime.tv_nsec / 1000000;
+        return;
+    }
+    size = lastModified = 0;
+#else
+    const QFileInfo fileInfo(filePath);
+    size = fileInfo.size();
+    lastModified = fileInfo.exists() ? fileInfo.lastModified().toMSecsSinceEpoch() : 0;
+#endif
+}
+
+class AttributeWorker : public QRunnable {
+public:
+    AttributeWorker(const QStringList &filePaths, qint64 *sizes, qint64 *lastModified,
+                    std::atomic<int> &nextBatch, QSemaphore &finished)
+        : filePaths(filePaths), sizes(sizes), lastModified(lastModified), nextBatch(nextBatch), finished(finished) {}
+
+    void run() override {
+        forever {
+            const int first = nextBatch++ * ATTRIBUTE_BATCH_SIZE;
+            if (first >= filePaths.size()) {
+                break;
+            }
+            const int last = qMin(first + ATTRIBUTE_BATCH_SIZE, filePaths.size());
+            for (int i = first; i < last; ++i) {
+                readAttributes(filePaths.at(i), sizes[i], lastModified[i]);
+            }
+        }
+        finished.release();
+    }
+
+private:
+    const QStringList &filePaths;
+    qint64 *sizes;
+    qint64 *lastModified;
+    std::atomic<int> &nextBatch;
+    QSemaphore &finished;
+};
+
+void readAttributes(const QStringList &filePaths, QVector<qint64> &sizes, QVector<qint64> &lastModified) {
+    static QThreadPool *threadPool = []() {
+        QThreadPool *pool = new QThreadPool(QCoreApplication::instance());
+        pool->setMaxThreadCount(ATTRIBUTE_THREADS);
+        return pool;
+    }();
+
+    sizes.resize(filePaths.size());
+    lastModified.resize(filePaths.size());
+    if (filePaths.size() <= ATTRIBUTE_BATCH_SIZE) {
+        for (int i = 0; i < filePaths.size(); ++i) {
+            readAttributes(filePaths.at(i), sizes[i], lastModified[i]);
+        }
+        return;
+    }
+
+    // Each worker takes the next batch until none are left, every file's attributes are written by one of them
+    std::atomic<int> nextBatch{0};
+    QSemaphore finished;
+    const int batchCount = (filePaths.size() + ATTRIBUTE_BATCH_SIZE - 1) / ATTRIBUTE_BATCH_SIZE;
+    const int workerCount = qMin(ATTRIBUTE_THREADS, batchCount);
+    for (int i = 0; i < workerCount; ++i) {
+        threadPool->start(new AttributeWorker(filePaths, sizes.data(), lastModified.data(), nextBatch, finished));
+    }
+    finished.acquire(workerCount);
+}
+
+}
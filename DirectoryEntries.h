@@ -0,0 +1,53 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef DIRECTORY_ENTRIES_H
+#define DIRECTORY_ENTRIES_H
+
+#include <QtCore>
+
+// Directory listings that leave file attributes for later. Listing a large
+// folder on a network file system is mostly waiting for one stat() per file,
+// and sorting by name needs none of them.
+namespace DirectoryEntries {
+
+// Name filters as QDir takes them, case insensitive. Most are plain suffixes such as "*.jpg",
+// those are looked up in a set rather than matched one by one.
+struct NameMatcher {
+    QSet<QString> suffixes;
+    QVector<QRegularExpression> patterns;
+
+    explicit NameMatcher(const QStringList &nameFilters);
+
+    bool matches(const QString &fileName) const;
+};
+
+// The files of directory that match its name filters, in no particular order, as QFileInfos
+// that have not touched the file yet. On Unix the names and types come straight from readdir(),
+// only entries the file system gives no type for are stat'ed. Listings that need attributes,
+// such as sorting by time, and other platforms go through QDir::entryInfoList().
+QFileInfoList files(const QDir &directory);
+
+// Sizes and modification times, in milliseconds since the epoch, read on several threads at once
+// to hide file system latency. Files that cannot be read get 0 for both.
+void readAttributes(const QStringList &filePaths, QVector<qint64> &sizes, QVector<qint64> &lastModified);
+
+}
+
+#endif // DIRECTORY_ENTRIES_H
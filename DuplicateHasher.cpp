@@ -0,0 +1,161 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QImageReader>
+#include <exiv2/exiv2.hpp>
+#include "DuplicateHasher.h"
+#include "Exiv2Init.h"
+#include "ExifPreview.h"
+
+#define HASH_BATCH_SIZE 16
+
+class DuplicateHasher::Worker : public QRunnable {
+public:
+    explicit Worker(DuplicateHasher *hasher) : hasher(hasher) {}
+
+    void run() override {
+        hasher->processQueue();
+    }
+
+private:
+    DuplicateHasher *hasher;
+};
+
+DuplicateHasher::DuplicateHasher(QObject *parent) : QObject(parent) {
+    qRegisterMetaType<ImageHash>();
+    qRegisterMetaType<QVector<ImageHash>>();
+
+    Exiv2Init::ensure();
+    threadPool.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+DuplicateHasher::~DuplicateHasher() {
+    cancel();
+    threadPool.waitForDone();
+}
+
+void DuplicateHasher::hash(const QList<ImageHash> &images) {
+    if (images.isEmpty()) {
+        return;
+    }
+
+    QMutexLocker locker(&mutex);
+    queue.append(images);
+
+    const int wantedWorkers = (queue.size() + HASH_BATCH_SIZE - 1) / HASH_BATCH_SIZE;
+    while (activeWorkers < threadPool.maxThreadCount() && activeWorkers < wantedWorkers) {
+        ++activeWorkers;
+        threadPool.start(new Worker(this));
+    }
+}
+
+void DuplicateHasher::cancel() {
+    QMutexLocker locker(&mutex);
+    queue.clear();
+    ++generation;
+}
+
+int DuplicateHasher::currentGeneration() const {
+    return generation;
+}
+
+bool DuplicateHasher::computeDHash(const QString &imageFileName, quint64 &dHash) {
+    QImage image;
+    QImageReader reader(imageFileName);
+    QSize scaledSize = reader.size();
+    if (scaledSize.isValid()) {
+        scaledSize.scale(9, 9, Qt::KeepAspectRatioByExpanding);
+        reader.setScaledSize(scaledSize);
+    }
+    reader.read(&image);
+
+    if (image.isNull()) {
+        // Files Qt cannot decode, such as RAW files, are hashed from their embedded preview
+        QSize imageSize;
+        QByteArray preview = ExifPreview::extract(imageFileName, QSize(9, 9), Qt::KeepAspectRatioByExpanding,
+                                                  imageSize);
+        QBuffer buffer(&preview);
+        QImageReader previewReader(&buffer);
+        QSize previewSize = previewReader.size();
+        if (!previewSize.isValid()) {
+            return false;
+        }
+        previewSize.scale(9, 9, Qt::KeepAspectRatioByExpanding);
+        previewReader.setScaledSize(previewSize);
+        if (!previewReader.read(&image)) {
+            return false;
+        }
+    }
+
+    return computeDHash(image, dHash);
+}
+
+bool DuplicateHasher::computeDHash(const QImage &image, quint64 &dHash) {
+    if (image.isNull()) {
+        return false;
+    }
+
+    // Decoded at full size the image needs a smooth scale, the decoder already did that for small reads
+    const QImage scaledImage = image.width() > 9 * 2 || image.height() > 9 * 2
+                               ? image.scaled(9, 9, Qt::KeepAspectRatioByExpanding, Qt::SmoothTransformation)
+                               : image;
+    const QImage grayImage = scaledImage.convertToFormat(QImage::Format_Grayscale8)
+            .scaled(9, 9, Qt::KeepAspectRatioByExpanding);
+    dHash = 0;
+    for (int y = 0; y < 8; y++) {
+        const uchar *line = grayImage.constScanLine(y);
+        for (int x = 0; x < 8; x++) {
+            if (line[x] > line[x + 1]) {
+                dHash |= quint64(1) << (y * 8 + x);
+            }
+        }
+    }
+    return true;
+}
+
+void DuplicateHasher::processQueue() {
+    forever {
+        QList<ImageHash> images;
+        int batchGeneration;
+        {
+            QMutexLocker locker(&mutex);
+            if (queue.isEmpty()) {
+                --activeWorkers;
+                return;
+            }
+            images = queue.mid(0, HASH_BATCH_SIZE);
+            queue.erase(queue.begin(), queue.begin() + images.size());
+            batchGeneration = generation;
+        }
+
+        QVector<ImageHash> results;
+        results.reserve(images.size());
+        for (ImageHash image : images) {
+            if (batchGeneration != generation) {
+                break;
+            }
+            image.isValid = computeDHash(image.imageFileName, image.dHash);
+            results.append(image);
+        }
+
+        if (batchGeneration == generation) {
+            emit hashesComputed(batchGeneration, results);
+        }
+    }
+}
@@ -0,0 +1,80 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef DUPLICATE_HASHER_H
+#define DUPLICATE_HASHER_H
+
+#include <QtCore>
+#include <atomic>
+
+struct ImageHash
+{
+    QString imageFileName;
+    qint64 lastModified = 0;
+    qint64 fileSize = 0;
+    quint64 dHash = 0;
+    // Shared by byte-identical files, from IdenticalFileFinder
+    quint64 contentHash = 0;
+    bool isValid = false;
+};
+
+Q_DECLARE_METATYPE(ImageHash)
+
+// Computes difference hashes for the duplicate finder on a pool of worker
+// threads. Images are decoded at a few pixels wide, which most readers do far
+// faster than a full decode. Results are delivered in batches through queued
+// signals, tagged with the generation they were queued in.
+class DuplicateHasher : public QObject {
+Q_OBJECT
+
+public:
+    explicit DuplicateHasher(QObject *parent = nullptr);
+
+    ~DuplicateHasher() override;
+
+    void hash(const QList<ImageHash> &images);
+
+    // Starts a new generation; everything queued or in flight is discarded
+    void cancel();
+
+    int currentGeneration() const;
+
+    // Safe to call from worker threads
+    static bool computeDHash(const QString &imageFileName, quint64 &dHash);
+
+    // For callers that decoded the image anyway
+    static bool computeDHash(const QImage &image, quint64 &dHash);
+
+signals:
+
+    void hashesComputed(int generation, const QVector<ImageHash> &results);
+
+private:
+    class Worker;
+
+    void processQueue();
+
+    QThreadPool threadPool;
+    QMutex mutex;
+    QList<ImageHash> queue;
+    int activeWorkers = 0;
+    std::atomic<int> generation{0};
+};
+
+#endif // DUPLICATE_HASHER_H
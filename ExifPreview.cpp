@@ -0,0 +1,140 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <exiv2/exiv2.hpp>
+#include "ExifPreview.h"
+
+// Letterboxed or cropped previews are not worth using
+#define MAX_ASPECT_RATIO_DIFFERENCE 0.01
+
+namespace ExifPreview {
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#if EXIV2_TEST_VERSION(0,28,0)
+typedef Exiv2::Image::UniquePtr ExifImagePointer;
+#else
+typedef Exiv2::Image::AutoPtr ExifImagePointer;
+#endif
+#pragma clang diagnostic pop
+
+// Exiv2 reads straight out of the caller's data, without copying it
+static ExifImagePointer openImage(const QString &imageFullPath, const QByteArray &fileData) {
+    if (fileData.isEmpty()) {
+        return Exiv2::ImageFactory::open(imageFullPath.toStdString());
+    }
+    return Exiv2::ImageFactory::open(reinterpret_cast<const Exiv2::byte *>(fileData.constData()),
+                                     fileData.size());
+}
+
+static bool aspectRatioMatches(const QSize &a, const QSize &b) {
+    const qreal aspectA = qreal(a.width()) / a.height();
+    const qreal aspectB = qreal(b.width()) / b.height();
+    return qAbs(aspectA - aspectB) <= aspectB * MAX_ASPECT_RATIO_DIFFERENCE;
+}
+
+QByteArray extract(const QString &imageFullPath, const QSize &targetSize, Qt::AspectRatioMode mode,
+                   QSize &imageSize, const QByteArray &fileData) {
+    ExifImagePointer exifImage;
+    try {
+        exifImage = openImage(imageFullPath, fileData);
+        exifImage->readMetadata();
+
+        if (!imageSize.isValid()) {
+            imageSize = QSize(int(exifImage->pixelWidth()), int(exifImage->pixelHeight()));
+        }
+
+        Exiv2::PreviewManager previewManager(*exifImage);
+        const Exiv2::PreviewPropertiesList previews = previewManager.getPreviewProperties();
+
+        // Sorted by size, smallest first
+        for (const Exiv2::PreviewProperties &properties : previews) {
+            const QSize previewSize(int(properties.width_), int(properties.height_));
+            if (previewSize.isEmpty()) {
+                continue;
+            }
+            if (imageSize.isValid() && !aspectRatioMatches(previewSize, imageSize)) {
+                continue;
+            }
+            const QSize scaledSize = previewSize.scaled(targetSize, mode);
+            if (scaledSize.width() > previewSize.width() || scaledSize.height() > previewSize.height()) {
+                continue;
+            }
+
+            const Exiv2::PreviewImage preview = previewManager.getPreviewImage(properties);
+            return QByteArray(reinterpret_cast<const char *>(preview.pData()), int(preview.size()));
+        }
+    } catch (const Exiv2::Error &error) {
+        qWarning() << "EXIV2:" << error.what();
+    }
+
+    return QByteArray();
+}
+
+QByteArray extractLargest(const QString &imageFullPath, QSize &imageSize, const QByteArray &fileData) {
+    ExifImagePointer exifImage;
+    try {
+        exifImage = openImage(imageFullPath, fileData);
+        exifImage->readMetadata();
+
+        if (!imageSize.isValid()) {
+            imageSize = QSize(int(exifImage->pixelWidth()), int(exifImage->pixelHeight()));
+        }
+
+        Exiv2::PreviewManager previewManager(*exifImage);
+        const Exiv2::PreviewPropertiesList previews = previewManager.getPreviewProperties();
+
+        // Sorted by size, largest last
+        for (Exiv2::PreviewPropertiesList::const_reverse_iterator properties = previews.rbegin();
+             properties != previews.rend(); ++properties) {
+            const QSize previewSize(int(properties->width_), int(properties->height_));
+            if (previewSize.isEmpty() || (imageSize.isValid() && !aspectRatioMatches(previewSize, imageSize))) {
+                continue;
+            }
+
+            const Exiv2::PreviewImage preview = previewManager.getPreviewImage(*properties);
+            return QByteArray(reinterpret_cast<const char *>(preview.pData()), int(preview.size()));
+        }
+    } catch (const Exiv2::Error &error) {
+        qWarning() << "EXIV2:" << error.what();
+    }
+
+    return QByteArray();
+}
+
+static const QSet<QString> &rawSuffixes() {
+    static const QSet<QString> suffixes = {
+        "3fr", "arw", "cr2", "cr3", "crw", "dcr", "dng", "erf", "iiq", "kdc", "mef", "mos", "mrw", "nef", "nrw",
+        "orf", "pef", "raf", "raw", "rw2", "rwl", "sr2", "srf", "srw", "x3f"
+    };
+    return suffixes;
+}
+
+bool isRawFile(const QString &imageFullPath) {
+    return rawSuffixes().contains(QFileInfo(imageFullPath).suffix().toLower());
+}
+
+QStringList rawNameFilters() {
+    QStringList nameFilters;
+    for (const QString &suffix : rawSuffixes()) {
+        nameFilters.append(QStringLiteral("*.") + suffix);
+    }
+    return nameFilters;
+}
+
+}
@@ -0,0 +1,48 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EXIF_PREVIEW_H
+#define EXIF_PREVIEW_H
+
+#include <QtCore>
+
+// Access to the thumbnails and previews cameras embed in JPEG and RAW files
+namespace ExifPreview {
+
+// Returns the encoded data of the smallest embedded preview that can be scaled to
+// targetSize without upscaling, or an empty array if there is none.
+// A valid imageSize rejects previews whose aspect ratio does not match it, an invalid
+// one is filled in from the file's metadata when possible.
+// With fileData the file is parsed from there instead of being opened again.
+QByteArray extract(const QString &imageFullPath, const QSize &targetSize, Qt::AspectRatioMode mode,
+                   QSize &imageSize, const QByteArray &fileData = QByteArray());
+
+// The largest embedded preview, under the same rules for imageSize. For RAW files
+// this is usually a full resolution JPEG.
+QByteArray extractLargest(const QString &imageFullPath, QSize &imageSize,
+                          const QByteArray &fileData = QByteArray());
+
+// Camera RAW formats, by suffix
+bool isRawFile(const QString &imageFullPath);
+
+// Globs for the RAW formats, listed whether or not Qt has a decoder for them
+QStringList rawNameFilters();
+
+}
+
+#endif // EXIF_PREVIEW_H
@@ -0,0 +1,147 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "FeatureDatabase.h"
+
+#define DATABASE_VERSION 1
+#define DATABASE_RECORD_MAGIC 0x54414546
+#define HISTOGRAM_SIZE qint64(sizeof(float) * 3 * 256)
+#define DESCRIPTOR_SIZE qint64(sizeof(ColorDescriptor::bins))
+
+FeatureDatabase *FeatureDatabase::instance() {
+    static FeatureDatabase database;
+    return &database;
+}
+
+FeatureDatabase::FeatureDatabase()
+    : records(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) +
+              QLatin1String("/phototonic/features.db"), QByteArray("PHTFEAT1"), DATABASE_VERSION, parseRecord) {
+}
+
+qint64 FeatureDatabase::recordSize(quint32 flags) {
+    return qint64(sizeof(RecordHeader)) + ((flags & HasHistogram) ? HISTOGRAM_SIZE : 0)
+           + ((flags & HasDescriptor) ? DESCRIPTOR_SIZE : 0);
+}
+
+qint64 FeatureDatabase::parseRecord(const uchar *data, qint64 available, RecordFile::FileId &id) {
+    RecordHeader header;
+    if (available < qint64(sizeof(header))) {
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != DATABASE_RECORD_MAGIC) {
+        return 0;
+    }
+    id = {header.device, header.inode};
+    return recordSize(header.flags);
+}
+
+bool FeatureDatabase::find(const QString &filePath, qint64 lastModified, qint64 fileSize, ImageFeatures &features) {
+    RecordFile::FileId id;
+    if (!RecordFile::fileId(filePath, id)) {
+        return false;
+    }
+
+    QMutexLocker locker(&mutex);
+    const qint64 offset = records.find(id);
+    RecordHeader header;
+    if (offset < 0 || !records.read(offset, &header, sizeof(header))
+        || header.lastModified != lastModified || header.fileSize != fileSize) {
+        return false;
+    }
+
+    features = ImageFeatures();
+    if (header.flags & HasDHash) {
+        features.dHash = header.dHash;
+        features.hasDHash = true;
+    }
+    if (header.flags & HasBrightness) {
+        features.brightness = header.brightness;
+    }
+    qint64 dataOffset = offset + qint64(sizeof(header));
+    if (header.flags & HasHistogram) {
+        std::shared_ptr<Histogram> histogram = std::make_shared<Histogram>();
+        if (!records.read(dataOffset, histogram->red, sizeof(histogram->red))
+            || !records.read(dataOffset + qint64(sizeof(histogram->red)), histogram->green,
+                             sizeof(histogram->green))
+            || !records.read(dataOffset + qint64(sizeof(histogram->red) + sizeof(histogram->green)),
+                             histogram->blue, sizeof(histogram->blue))) {
+            return false;
+        }
+        features.histogram = histogram;
+        dataOffset += HISTOGRAM_SIZE;
+    }
+    if (header.flags & HasDescriptor) {
+        if (!records.read(dataOffset, features.descriptor.bins, DESCRIPTOR_SIZE)) {
+            return false;
+        }
+        features.hasDescriptor = true;
+    } else if (features.histogram) {
+        // Written before descriptors were stored
+        features.descriptor = ColorDescriptor::fromHistogram(*features.histogram);
+        features.hasDescriptor = true;
+    }
+    return true;
+}
+
+void FeatureDatabase::insert(const QString &filePath, qint64 lastModified, qint64 fileSize,
+                             const ImageFeatures &features) {
+    RecordFile::FileId id;
+    if (!RecordFile::fileId(filePath, id)) {
+        return;
+    }
+
+    quint32 flags = 0;
+    if (features.hasDHash) {
+        flags |= HasDHash;
+    }
+    if (features.histogram) {
+        flags |= HasHistogram;
+    }
+    if (!std::isnan(features.brightness)) {
+        flags |= HasBrightness;
+    }
+    if (features.hasDescriptor) {
+        flags |= HasDescriptor;
+    }
+    if (!flags) {
+        return;
+    }
+
+    const RecordHeader header = {DATABASE_RECORD_MAGIC, flags, id.device, id.inode, lastModified, fileSize,
+                                 features.dHash, features.brightness, 0};
+    QByteArray record(reinterpret_cast<const char *>(&header), sizeof(header));
+    if (features.histogram) {
+        const Histogram &histogram = *features.histogram;
+        record.append(reinterpret_cast<const char *>(histogram.red), sizeof(histogram.red));
+        record.append(reinterpret_cast<const char *>(histogram.green), sizeof(histogram.green));
+        record.append(reinterpret_cast<const char *>(histogram.blue), sizeof(histogram.blue));
+    }
+    if (features.hasDescriptor) {
+        record.append(reinterpret_cast<const char *>(features.descriptor.bins), DESCRIPTOR_SIZE);
+    }
+
+    QMutexLocker locker(&mutex);
+    records.append(id, record);
+}
+
+void FeatureDatabase::flush() {
+    QMutexLocker locker(&mutex);
+    records.flush();
+}
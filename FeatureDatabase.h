@@ -0,0 +1,72 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef FEATURE_DATABASE_H
+#define FEATURE_DATABASE_H
+
+#include <QtCore>
+#include "FeatureStore.h"
+#include "RecordFile.h"
+
+// On-disk store of image features, so hashes and histograms survive the
+// session. Kept in a RecordFile of fixed size records, a record only
+// applies while the image's size and modification time match.
+class FeatureDatabase {
+
+public:
+    static FeatureDatabase *instance();
+
+    bool find(const QString &filePath, qint64 lastModified, qint64 fileSize, ImageFeatures &features);
+
+    // Buffered, flush() writes the records out
+    void insert(const QString &filePath, qint64 lastModified, qint64 fileSize, const ImageFeatures &features);
+
+    void flush();
+
+private:
+    enum RecordFlags {
+        HasDHash = 1,
+        HasHistogram = 2,
+        HasBrightness = 4,
+        HasDescriptor = 8
+    };
+
+    struct RecordHeader {
+        quint32 magic;
+        quint32 flags;
+        quint64 device;
+        quint64 inode;
+        qint64 lastModified;
+        qint64 fileSize;
+        quint64 dHash;
+        float brightness;
+        quint32 reserved;
+    };
+
+    FeatureDatabase();
+
+    static qint64 recordSize(quint32 flags);
+
+    static qint64 parseRecord(const uchar *data, qint64 available, RecordFile::FileId &id);
+
+    QMutex mutex;
+    RecordFile records;
+};
+
+#endif // FEATURE_DATABASE_H
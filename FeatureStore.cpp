@@ -0,0 +1,87 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FeatureStore.h"
+#include "FeatureDatabase.h"
+
+#define MAX_UNSAVED_ENTRIES 256
+
+FeatureStore::~FeatureStore() {
+    flush();
+}
+
+void FeatureStore::setHistogramsKept(bool isKept) {
+    isKeepingHistograms = isKept;
+}
+
+FeatureStore::Entry &FeatureStore::entry(const QString &filePath, qint64 lastModified, qint64 fileSize) {
+    Entry &entry = entries[filePath];
+    if (entry.lastModified != lastModified || entry.fileSize != fileSize) {
+        // Also remembers that the database has nothing, so it is only asked once
+        entry.lastModified = lastModified;
+        entry.fileSize = fileSize;
+        entry.features = ImageFeatures();
+        FeatureDatabase::instance()->find(filePath, lastModified, fileSize, entry.features);
+        if (!isKeepingHistograms) {
+            entry.features.histogram.reset();
+        }
+        changedPaths.remove(filePath);
+    }
+    return entry;
+}
+
+const ImageFeatures *FeatureStore::find(const QString &filePath, qint64 lastModified, qint64 fileSize) {
+    const ImageFeatures &features = entry(filePath, lastModified, fileSize).features;
+    if (!features.hasDHash && !features.hasDescriptor && std::isnan(features.brightness)) {
+        return nullptr;
+    }
+    return &features;
+}
+
+ImageFeatures &FeatureStore::features(const QString &filePath, qint64 lastModified, qint64 fileSize) {
+    // The caller changes the entry after this returns, so earlier ones are saved now
+    if (changedPaths.size() >= MAX_UNSAVED_ENTRIES) {
+        flush();
+    }
+    Entry &changedEntry = entry(filePath, lastModified, fileSize);
+    changedPaths.insert(filePath);
+    return changedEntry.features;
+}
+
+void FeatureStore::remove(const QString &filePath) {
+    entries.remove(filePath);
+    changedPaths.remove(filePath);
+}
+
+void FeatureStore::clear() {
+    flush();
+    entries.clear();
+}
+
+void FeatureStore::flush() {
+    for (const QString &filePath : changedPaths) {
+        QHash<QString, Entry>::const_iterator it = entries.constFind(filePath);
+        if (it != entries.constEnd()) {
+            FeatureDatabase::instance()->insert(filePath, it->lastModified, it->fileSize, it->features);
+        }
+    }
+    if (!changedPaths.isEmpty()) {
+        FeatureDatabase::instance()->flush();
+    }
+    changedPaths.clear();
+}
@@ -0,0 +1,80 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FEATURE_STORE_H
+#define FEATURE_STORE_H
+
+#include <QtCore>
+#include <cmath>
+#include <memory>
+#include "Histogram.h"
+
+// Per image values computed by the similarity sort, the duplicate finder
+// and the thumbnail loader
+struct ImageFeatures
+{
+    ColorDescriptor descriptor;
+    bool hasDescriptor = false;
+    // Only kept in precise similarity mode, the descriptor is made from it either way
+    std::shared_ptr<Histogram> histogram;
+    quint64 dHash = 0;
+    bool hasDHash = false;
+    float brightness = NAN;
+};
+
+// Features keyed by file path. An entry is only handed out while the file's
+// modification time and size still match the ones it was computed for.
+// Entries missing from memory are looked up in the FeatureDatabase, and
+// entries handed out for writing are saved back to it in batches.
+// Not thread safe, only used from the GUI thread.
+class FeatureStore {
+
+public:
+    ~FeatureStore();
+
+    // Without them, histograms read from the database are dropped once their descriptor is known
+    void setHistogramsKept(bool isKept);
+
+    // Returns nullptr if nothing is known about the file in this state
+    const ImageFeatures *find(const QString &filePath, qint64 lastModified, qint64 fileSize);
+
+    // Returns the entry for the file, starting over if it has changed since
+    ImageFeatures &features(const QString &filePath, qint64 lastModified, qint64 fileSize);
+
+    void remove(const QString &filePath);
+
+    void clear();
+
+    // Writes the entries changed since the last call to the database
+    void flush();
+
+private:
+    struct Entry {
+        qint64 lastModified = -1;
+        qint64 fileSize = -1;
+        ImageFeatures features;
+    };
+
+    Entry &entry(const QString &filePath, qint64 lastModified, qint64 fileSize);
+
+    QHash<QString, Entry> entries;
+    QSet<QString> changedPaths;
+    bool isKeepingHistograms = false;
+};
+
+#endif // FEATURE_STORE_H
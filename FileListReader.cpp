@@ -0,0 +1,171 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "FileListReader.h"
+#ifdef Q_OS_UNIX
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#define FIRST_CHUNK_SIZE 256
+#define MAX_CHUNK_SIZE 4096
+#define READ_BUFFER_SIZE 65536
+#define POLL_INTERVAL 100
+
+class FileListReader::Worker : public QRunnable {
+public:
+    Worker(FileListReader *reader, const QString &listPath, int readGeneration)
+        : reader(reader), listPath(listPath), readGeneration(readGeneration) {}
+
+    void run() override {
+        reader->readList(listPath, readGeneration);
+    }
+
+private:
+    FileListReader *reader;
+    QString listPath;
+    int readGeneration;
+};
+
+FileListReader::FileListReader(QObject *parent) : QObject(parent) {
+    threadPool.setMaxThreadCount(1);
+}
+
+FileListReader::~FileListReader() {
+    cancel();
+    threadPool.waitForDone();
+}
+
+void FileListReader::read(const QString &listPath) {
+    threadPool.start(new Worker(this, listPath, ++generation));
+}
+
+void FileListReader::cancel() {
+    ++generation;
+}
+
+int FileListReader::currentGeneration() const {
+    return generation;
+}
+
+void FileListReader::readList(const QString &listPath, int readGeneration) {
+    const bool isStandardInput = listPath == QLatin1String("-");
+    QFile file(listPath);
+    const bool isOpen = isStandardInput ? file.open(stdin, QIODevice::ReadOnly | QIODevice::Unbuffered)
+                                        : file.open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    if (!isOpen) {
+        qWarning() << "Unable to read file list" << listPath << file.errorString();
+        emit finished(readGeneration);
+        return;
+    }
+
+    const QDir workingDirectory = QDir::current();
+    QByteArray buffer(READ_BUFFER_SIZE, Qt::Uninitialized);
+    QByteArray partialLine;
+    QStringList paths;
+    int chunkSize = FIRST_CHUNK_SIZE;
+
+    // Small chunks first for the first screen, larger ones keep the receiver from being flooded
+    auto flush = [&]() {
+        if (!paths.isEmpty()) {
+            emit pathsRead(readGeneration, paths);
+            paths.clear();
+            chunkSize = qMin(chunkSize * 2, MAX_CHUNK_SIZE);
+        }
+    };
+
+    auto addLine = [&](const char *line, int length) {
+        if (length > 0 && line[length - 1] == '\r') {
+            --length;
+        }
+        if (length > 0) {
+            const QString path = QFile::decodeName(QByteArray::fromRawData(line, length));
+            paths.append(QDir::cleanPath(workingDirectory.absoluteFilePath(path)));
+        }
+    };
+
+    while (readGeneration == generation) {
+#ifdef Q_OS_UNIX
+        // A pipe can stay quiet for long, waiting in steps leaves room to notice a cancel
+        if (isStandardInput) {
+            pollfd descriptor = {file.handle(), POLLIN, 0};
+            const int ready = poll(&descriptor, 1, POLL_INTERVAL);
+            if (ready < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ready == 0) {
+                // Whatever arrived is shown before waiting for more
+                flush();
+                continue;
+            }
+        }
+        // QFile keeps reading until the buffer is full, a pipe is read as far as it has data
+        qint64 count;
+        if (isStandardInput) {
+            count = ::read(file.handle(), buffer.data(), size_t(buffer.size()));
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count < 0) {
+                qWarning() << "Unable to read file list" << listPath << qt_error_string(errno);
+                break;
+            }
+        } else {
+            count = file.read(buffer.data(), buffer.size());
+        }
+#else
+        const qint64 count = file.read(buffer.data(), buffer.size());
+#endif
+        if (count < 0) {
+            qWarning() << "Unable to read file list" << listPath << file.errorString();
+            break;
+        }
+        if (count == 0) {
+            break;
+        }
+
+        const char *data = buffer.constData();
+        int lineStart = 0;
+        for (int i = 0; i < count; ++i) {
+            if (data[i] != '\n') {
+                continue;
+            }
+            if (partialLine.isEmpty()) {
+                addLine(data + lineStart, i - lineStart);
+            } else {
+                partialLine.append(data + lineStart, i - lineStart);
+                addLine(partialLine.constData(), partialLine.size());
+                partialLine.clear();
+            }
+            lineStart = i + 1;
+            if (paths.size() >= chunkSize) {
+                flush();
+            }
+        }
+        partialLine.append(data + lineStart, int(count) - lineStart);
+    }
+
+    if (readGeneration != generation) {
+        return;
+    }
+    addLine(partialLine.constData(), partialLine.size());
+    flush();
+    emit finished(readGeneration);
+}
@@ -0,0 +1,62 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef FILE_LIST_READER_H
+#define FILE_LIST_READER_H
+
+#include <QtCore>
+#include <atomic>
+
+// Reads a list of paths, one per line, from a file or from standard input
+// on a worker thread. Paths are delivered in chunks through queued signals
+// while the list is still being read, so a long list from a slow producer
+// is shown as it arrives. Relative paths are taken from the working directory.
+class FileListReader : public QObject {
+Q_OBJECT
+
+public:
+    explicit FileListReader(QObject *parent = nullptr);
+
+    ~FileListReader() override;
+
+    // "-" reads standard input
+    void read(const QString &listPath);
+
+    // Starts a new generation; everything still to be read is discarded
+    void cancel();
+
+    int currentGeneration() const;
+
+signals:
+
+    void pathsRead(int generation, const QStringList &paths);
+
+    // Sent after the last chunk of the generation, also when the list could not be opened
+    void finished(int generation);
+
+private:
+    class Worker;
+
+    void readList(const QString &listPath, int readGeneration);
+
+    QThreadPool threadPool;
+    std::atomic<int> generation{0};
+};
+
+#endif // FILE_LIST_READER_H
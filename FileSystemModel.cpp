@@ -18,6 +18,7 @@
 
 #include "FileSystemModel.h"
 #include "IconProvider.h"
+#include "SubdirectoryProbe.h"
 
 FileSystemModel::FileSystemModel(QObject *parent) : QFileSystemModel(parent)
 {
@@ -43,5 +44,8 @@ bool FileSystemModel::hasChildren(const QModelIndex &parent) const {
         return false;
     }
 
-    return QDirIterator(filePath(parent), filter() | QDir::NoDotAndDotDot, QDirIterator::NoIteratorFlags).hasNext();
+    // Listing a directory can take seconds on a network mount, until it is known the arrow is shown
+    const SubdirectoryProbe::State state = SubdirectoryProbe::instance()->state(filePath(parent),
+                                                                                filter().testFlag(QDir::Hidden));
+    return state != SubdirectoryProbe::NoSubdirectories;
 }
@@ -37,6 +37,16 @@ FileSystemTree::FileSystemTree(QWidget *parent) : QTreeView(parent) {
             scrollTo(currentIndex());
         }, Qt::QueuedConnection);
 
+    // Expand arrows are only laid out again once a burst of probe results is in
+    relayoutTimer.setInterval(100);
+    relayoutTimer.setSingleShot(true);
+    connect(SubdirectoryProbe::instance(), &SubdirectoryProbe::probed, this, [this]() {
+        if (!relayoutTimer.isActive()) {
+            relayoutTimer.start();
+        }
+    });
+    connect(&relayoutTimer, &QTimer::timeout, this, &FileSystemTree::doItemsLayout);
+
     connect(this, SIGNAL(expanded(
                                  const QModelIndex &)),
             this, SLOT(resizeTreeColumn(
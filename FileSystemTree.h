@@ -20,6 +20,7 @@
 #include <QtWidgets/QtWidgets>
 #include "Settings.h"
 #include "FileSystemModel.h"
+#include "SubdirectoryProbe.h"
 
 #ifndef FILE_SYSTEM_TREE_H
 #define FILE_SYSTEM_TREE_H
@@ -50,6 +51,7 @@ signals:
 
 private:
     QModelIndex dndOrigSelection;
+    QTimer relayoutTimer;
 
 private slots:
 
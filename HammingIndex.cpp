@@ -0,0 +1,82 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "HammingIndex.h"
+
+void HammingIndex::insert(quint64 hash) {
+    if (nodes.isEmpty()) {
+        nodes.append({hash, 0, -1, -1});
+        return;
+    }
+
+    int node = 0;
+    forever {
+        const int d = distance(hash, nodes.at(node).hash);
+        if (d == 0) {
+            return;
+        }
+
+        int child = nodes.at(node).firstChild;
+        while (child >= 0 && nodes.at(child).distanceToParent != d) {
+            child = nodes.at(child).nextSibling;
+        }
+        if (child < 0) {
+            nodes.append({hash, d, -1, nodes.at(node).firstChild});
+            nodes[node].firstChild = nodes.size() - 1;
+            return;
+        }
+        node = child;
+    }
+}
+
+bool HammingIndex::findNearest(quint64 hash, int maxDistance, quint64 &nearest) const {
+    if (nodes.isEmpty()) {
+        return false;
+    }
+
+    int bestDistance = maxDistance + 1;
+    QVarLengthArray<int, 64> pending;
+    pending.append(0);
+    while (!pending.isEmpty()) {
+        const int node = pending.last();
+        pending.removeLast();
+
+        const int d = distance(hash, nodes.at(node).hash);
+        if (d < bestDistance) {
+            bestDistance = d;
+            nearest = nodes.at(node).hash;
+            if (d == 0) {
+                break;
+            }
+        }
+
+        // Only children at a distance in [d - best, d + best] can hold anything closer
+        for (int child = nodes.at(node).firstChild; child >= 0; child = nodes.at(child).nextSibling) {
+            if (qAbs(nodes.at(child).distanceToParent - d) < bestDistance) {
+                pending.append(child);
+            }
+        }
+    }
+
+    return bestDistance <= maxDistance;
+}
+
+void HammingIndex::clear() {
+    nodes.clear();
+}
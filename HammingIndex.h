@@ -0,0 +1,54 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HAMMING_INDEX_H
+#define HAMMING_INDEX_H
+
+#include <QtCore>
+
+// BK-tree over 64 bit perceptual hashes. Looking up the nearest hash within
+// a small Hamming distance only visits the subtrees the triangle inequality
+// cannot rule out, instead of every hash seen so far.
+class HammingIndex {
+
+public:
+    void insert(quint64 hash);
+
+    // Finds the closest hash no more than maxDistance bits away
+    bool findNearest(quint64 hash, int maxDistance, quint64 &nearest) const;
+
+    void clear();
+
+    static inline int distance(quint64 a, quint64 b) {
+        return qPopulationCount(a ^ b);
+    }
+
+private:
+    // Children are kept as a sibling list, most nodes only have a few
+    struct Node {
+        quint64 hash;
+        int distanceToParent;
+        int firstChild;
+        int nextSibling;
+    };
+
+    QVector<Node> nodes;
+};
+
+#endif // HAMMING_INDEX_H
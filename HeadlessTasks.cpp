@@ -0,0 +1,451 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include "HeadlessTasks.h"
+#include "BatchTransform.h"
+#include "DuplicateHasher.h"
+#include "FeatureStore.h"
+#include "HammingIndex.h"
+#include "IdenticalFileFinder.h"
+#include "MetadataCache.h"
+#include "Settings.h"
+#include "ThumbnailLoader.h"
+#include "ThumbnailWriter.h"
+#include "ThumbsViewer.h"
+
+#define OPTION_BATCH "batch"
+#define OPTION_ROTATE "rotate"
+#define OPTION_FLIP "flip"
+#define OPTION_CROP "crop"
+#define OPTION_RESIZE "resize"
+#define OPTION_COLORS "colors"
+#define OPTION_QUALITY "quality"
+#define OPTION_WARM_THUMBNAILS "warm-thumbnails"
+#define OPTION_FIND_DUPLICATES "find-duplicates"
+
+namespace HeadlessTasks {
+
+static void printError(const QString &message) {
+    fprintf(stderr, "%s\n", message.toLocal8Bit().constData());
+}
+
+// The stored settings the tasks depend on, with the defaults of a first run
+static void readSettings() {
+    QSettings settings("phototonic", "phototonic");
+    Settings::exifRotationEnabled = settings.value(Settings::optionExifRotationEnabled, true).toBool();
+    Settings::exifThumbRotationEnabled = settings.value(Settings::optionExifThumbRotationEnabled, false).toBool();
+    Settings::defaultSaveQuality = settings.value(Settings::optionDefaultSaveQuality, 90).toInt();
+    Settings::thumbsLayout = settings.value(Settings::optionThumbsLayout, int(ThumbsViewer::Classic)).toInt();
+    Settings::packedThumbnails = settings.value(Settings::optionPackedThumbnails, false).toBool();
+    Settings::packedThumbnailEncoding = settings.value(Settings::optionPackedThumbnailEncoding, 0).toInt();
+    Settings::dupesHammingDistance = settings.value(Settings::optionDupesHammingDistance, 0).toInt();
+    Settings::dupesMode = (Settings::DupesMode) qBound(0, settings.value(Settings::optionDupesMode, 0).toInt(),
+                                                       (int) Settings::IdenticalAndSimilar);
+}
+
+static QFileInfoList imageFiles(const QString &directoryPath) {
+    static QStringList imageTypeGlobs;
+    if (imageTypeGlobs.isEmpty()) {
+        QMimeDatabase db;
+        for (const QByteArray &type : QImageReader::supportedMimeTypes()) {
+            imageTypeGlobs.append(db.mimeTypeForName(type).globPatterns());
+        }
+    }
+    QDir directory(directoryPath);
+    directory.setNameFilters(imageTypeGlobs);
+    directory.setFilter(QDir::Files);
+    directory.setSorting(QDir::Name);
+    return directory.entryInfoList();
+}
+
+bool isHeadless(int argc, char *argv[]) {
+    static const char *const options[] = {"--" OPTION_BATCH, "--" OPTION_WARM_THUMBNAILS, "--" OPTION_FIND_DUPLICATES};
+    for (int i = 1; i < argc; ++i) {
+        for (const char *option : options) {
+            const size_t length = strlen(option);
+            if (!strncmp(argv[i], option, length) && (argv[i][length] == '\0' || argv[i][length] == '=')) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void addOptions(QCommandLineParser &parser) {
+    parser.addOption(QCommandLineOption(OPTION_BATCH,
+            QCoreApplication::translate("main", "Transform the given files without opening a window.")));
+    parser.addOption(QCommandLineOption(OPTION_ROTATE,
+            QCoreApplication::translate("main", "Batch: rotate clockwise by <degrees>."),
+            QCoreApplication::translate("main", "degrees")));
+    parser.addOption(QCommandLineOption(OPTION_FLIP,
+            QCoreApplication::translate("main", "Batch: flip horizontally, vertically or both."),
+            "h|v|hv"));
+    parser.addOption(QCommandLineOption(OPTION_CROP,
+            QCoreApplication::translate("main", "Batch: cut the given number of pixels off each side."),
+            "left,top,right,bottom"));
+    parser.addOption(QCommandLineOption(OPTION_RESIZE,
+            QCoreApplication::translate("main", "Batch: scale to a size, a missing side keeps the aspect ratio."),
+            "WxH"));
+    parser.addOption(QCommandLineOption(OPTION_COLORS,
+            QCoreApplication::translate("main", "Batch: adjust colours with the values in an ini file."),
+            QCoreApplication::translate("main", "file")));
+    parser.addOption(QCommandLineOption(OPTION_QUALITY,
+            QCoreApplication::translate("main", "Batch: encoder quality, from 0 to 100."),
+            QCoreApplication::translate("main", "quality")));
+    parser.addOption(QCommandLineOption(OPTION_WARM_THUMBNAILS,
+            QCoreApplication::translate("main", "Create the thumbnails of the images in <directory> and exit."),
+            QCoreApplication::translate("main", "directory")));
+    parser.addOption(QCommandLineOption(OPTION_FIND_DUPLICATES,
+            QCoreApplication::translate("main", "Print the duplicate images in <directory> as JSON and exit."),
+            QCoreApplication::translate("main", "directory")));
+}
+
+// Keys are named like the ColorAdjustment members, in the ranges of the colours dialog Settings
+static bool readColorPreset(const QString &fileName, ColorAdjustment &colorAdjustment) {
+    if (!QFileInfo(fileName).isReadable()) {
+        return false;
+    }
+    QSettings preset(fileName, QSettings::IniFormat);
+    preset.beginGroup("colors");
+    colorAdjustment.isEnabled = true;
+    colorAdjustment.negateRed = preset.value("negateRed", colorAdjustment.negateRed).toBool();
+    colorAdjustment.negateGreen = preset.value("negateGreen", colorAdjustment.negateGreen).toBool();
+    colorAdjustment.negateBlue = preset.value("negateBlue", colorAdjustment.negateBlue).toBool();
+    colorAdjustment.red = preset.value("red", colorAdjustment.red).toInt();
+    colorAdjustment.green = preset.value("green", colorAdjustment.green).toInt();
+    colorAdjustment.blue = preset.value("blue", colorAdjustment.blue).toInt();
+    colorAdjustment.brightness = preset.value("brightness", colorAdjustment.brightness).toInt();
+    colorAdjustment.contrast = preset.value("contrast", colorAdjustment.contrast).toInt();
+    colorAdjustment.colorize = preset.value("colorize", colorAdjustment.colorize).toBool();
+    colorAdjustment.hue = preset.value("hue", colorAdjustment.hue).toInt();
+    colorAdjustment.saturation = preset.value("saturation", colorAdjustment.saturation).toInt();
+    colorAdjustment.lightness = preset.value("lightness", colorAdjustment.lightness).toInt();
+    colorAdjustment.hueRedChannel = preset.value("hueRedChannel", colorAdjustment.hueRedChannel).toBool();
+    colorAdjustment.hueGreenChannel = preset.value("hueGreenChannel", colorAdjustment.hueGreenChannel).toBool();
+    colorAdjustment.hueBlueChannel = preset.value("hueBlueChannel", colorAdjustment.hueBlueChannel).toBool();
+    return preset.status() == QSettings::NoError;
+}
+
+static bool recipeFromArguments(const QCommandLineParser &parser, TransformRecipe &recipe, QString &error) {
+    recipe.exifRotation = Settings::exifRotationEnabled;
+    recipe.quality = Settings::defaultSaveQuality;
+    recipe.saveDirectory = parser.value("output-directory");
+
+    bool ok = true;
+    if (parser.isSet(OPTION_ROTATE)) {
+        recipe.rotation = parser.value(OPTION_ROTATE).toDouble(&ok);
+        if (!ok) {
+            error = QObject::tr("Invalid rotation: %1").arg(parser.value(OPTION_ROTATE));
+            return false;
+        }
+    }
+
+    if (parser.isSet(OPTION_FLIP)) {
+        const QString flip = parser.value(OPTION_FLIP).toLower();
+        if (flip != "h" && flip != "v" && flip != "hv" && flip != "vh") {
+            error = QObject::tr("Invalid flip: %1").arg(flip);
+            return false;
+        }
+        recipe.flipH = flip.contains('h');
+        recipe.flipV = flip.contains('v');
+    }
+
+    if (parser.isSet(OPTION_CROP)) {
+        const QStringList sides = parser.value(OPTION_CROP).split(',');
+        int values[4] = {0, 0, 0, 0};
+        for (int side = 0; side < 4 && ok; ++side) {
+            values[side] = sides.size() == 4 ? sides.at(side).toInt(&ok) : -1;
+            ok = ok && values[side] >= 0;
+        }
+        if (!ok) {
+            error = QObject::tr("Invalid crop: %1").arg(parser.value(OPTION_CROP));
+            return false;
+        }
+        recipe.cropLeft = values[0];
+        recipe.cropTop = values[1];
+        recipe.cropWidth = values[2];
+        recipe.cropHeight = values[3];
+    }
+
+    if (parser.isSet(OPTION_RESIZE)) {
+        const QStringList sides = parser.value(OPTION_RESIZE).toLower().split('x');
+        bool widthOk = true;
+        bool heightOk = true;
+        const int width = sides.value(0).isEmpty() ? 0 : sides.value(0).toInt(&widthOk);
+        const int height = sides.value(1).isEmpty() ? 0 : sides.value(1).toInt(&heightOk);
+        if (sides.size() != 2 || !widthOk || !heightOk || width < 0 || height < 0 || (!width && !height)) {
+            error = QObject::tr("Invalid size: %1").arg(parser.value(OPTION_RESIZE));
+            return false;
+        }
+        recipe.scaledSize = QSize(width, height);
+    }
+
+    if (parser.isSet(OPTION_COLORS) && !readColorPreset(parser.value(OPTION_COLORS), recipe.colorAdjustment)) {
+        error = QObject::tr("Unable to read colours from %1").arg(parser.value(OPTION_COLORS));
+        return false;
+    }
+
+    if (parser.isSet(OPTION_QUALITY)) {
+        recipe.quality = parser.value(OPTION_QUALITY).toInt(&ok);
+        if (!ok || recipe.quality < 0 || recipe.quality > 100) {
+            error = QObject::tr("Invalid quality: %1").arg(parser.value(OPTION_QUALITY));
+            return false;
+        }
+    }
+    return true;
+}
+
+static int batchTransform(const QCommandLineParser &parser) {
+    TransformRecipe recipe;
+    QString error;
+    if (!recipeFromArguments(parser, recipe, error)) {
+        printError(error);
+        return 2;
+    }
+
+    QStringList imageFileNames;
+    for (const QString &argument : parser.positionalArguments()) {
+        if (QFileInfo(argument).isDir()) {
+            for (const QFileInfo &fileInfo : imageFiles(argument)) {
+                imageFileNames << fileInfo.filePath();
+            }
+        } else {
+            imageFileNames << argument;
+        }
+    }
+    if (imageFileNames.isEmpty()) {
+        printError(QObject::tr("No images to transform"));
+        return 2;
+    }
+
+    BatchTransformer batchTransformer;
+    QEventLoop eventLoop;
+    int failedCount = 0;
+    QObject::connect(&batchTransformer, &BatchTransformer::imageFailed, [](const QString &imageFileName,
+                                                                           const QString &imageError) {
+        printError(imageFileName + ": " + imageError);
+    });
+    QObject::connect(&batchTransformer, &BatchTransformer::finished, &eventLoop, [&](int failed) {
+        failedCount = failed;
+        eventLoop.quit();
+    });
+    batchTransformer.start(imageFileNames, recipe);
+    eventLoop.exec();
+    return failedCount ? 1 : 0;
+}
+
+static int warmThumbnails(const QString &directoryPath) {
+    const QFileInfoList files = imageFiles(directoryPath);
+    const int thumbSize = QSettings("phototonic", "phototonic").value(Settings::optionThumbsZoomLevel, 200).toInt();
+
+    QList<ThumbnailRequest> requests;
+    for (const QFileInfo &fileInfo : files) {
+        ThumbnailRequest request;
+        request.ticket = quint64(requests.size());
+        request.imageFileName = fileInfo.filePath();
+        request.thumbSize = thumbSize;
+        request.smartCrop = Settings::thumbsLayout != ThumbsViewer::Classic;
+        request.readOrientation = Settings::exifThumbRotationEnabled;
+        request.lastModified = fileInfo.lastModified().toMSecsSinceEpoch();
+        request.fileSize = fileInfo.size();
+        request.usePack = Settings::packedThumbnails;
+        request.packEncoding = PackedThumbnail::Encoding(Settings::packedThumbnailEncoding);
+        requests.append(request);
+    }
+    if (requests.isEmpty()) {
+        return 0;
+    }
+
+    ThumbnailLoader thumbnailLoader(std::make_shared<MetadataCache>());
+    QEventLoop eventLoop;
+    int pending = requests.size();
+    int failedCount = 0;
+    QObject::connect(&thumbnailLoader, &ThumbnailLoader::thumbnailLoaded, &eventLoop, [&]() {
+        if (--pending == 0) {
+            eventLoop.quit();
+        }
+    });
+    QObject::connect(&thumbnailLoader, &ThumbnailLoader::thumbnailFailed, &eventLoop, [&](quint64 ticket) {
+        printError(requests.at(int(ticket)).imageFileName + ": " + QObject::tr("No thumbnail"));
+        ++failedCount;
+        if (--pending == 0) {
+            eventLoop.quit();
+        }
+    });
+    thumbnailLoader.enqueue(requests);
+    eventLoop.exec();
+
+    // Stores queued as low priority are only copies for other viewers
+    ThumbnailWriter::instance()->shutdown();
+    return failedCount ? 1 : 0;
+}
+
+static ImageHashGroups findIdenticalFiles(const QList<ImageHash> &images) {
+    IdenticalFileFinder identicalFileFinder;
+    QEventLoop eventLoop;
+    ImageHashGroups identicalGroups;
+    QObject::connect(&identicalFileFinder, &IdenticalFileFinder::filesGrouped, &eventLoop,
+                     [&](int, const ImageHashGroups &groups) {
+        identicalGroups = groups;
+        eventLoop.quit();
+    });
+    identicalFileFinder.find(images);
+    eventLoop.exec();
+    return identicalGroups;
+}
+
+static QStringList fileNames(const QVector<ImageHash> &images) {
+    QStringList names;
+    for (const ImageHash &image : images) {
+        names.append(image.imageFileName);
+    }
+    return names;
+}
+
+// Groups like the thumbnail view does, near duplicates join the closest hash seen so far
+static int findDuplicates(const QString &directoryPath) {
+    QList<ImageHash> images;
+    for (const QFileInfo &fileInfo : imageFiles(directoryPath)) {
+        ImageHash image;
+        image.imageFileName = fileInfo.filePath();
+        image.lastModified = fileInfo.lastModified().toMSecsSinceEpoch();
+        image.fileSize = fileInfo.size();
+        images.append(image);
+    }
+    // Invalid images are left out once it takes decoding to compare them
+    int imageCount = 0;
+
+    // Only one file of each byte-identical group is decoded, its copies join its group
+    QJsonArray duplicates;
+    QHash<QString, QVector<ImageHash>> identicalCopies;
+    if (Settings::dupesMode != Settings::SimilarImages) {
+        const ImageHashGroups identicalGroups = findIdenticalFiles(images);
+        if (Settings::dupesMode == Settings::IdenticalFiles) {
+            imageCount = images.size();
+        }
+        images.clear();
+        for (const QVector<ImageHash> &group : identicalGroups) {
+            if (Settings::dupesMode == Settings::IdenticalFiles) {
+                if (group.size() > 1) {
+                    duplicates.append(QJsonArray::fromStringList(fileNames(group)));
+                }
+                continue;
+            }
+            images.append(group.first());
+            if (group.size() > 1) {
+                identicalCopies.insert(group.first().imageFileName, group.mid(1));
+            }
+        }
+    }
+
+    FeatureStore featureStore;
+    QList<ImageHash> uncachedImages;
+    QVector<ImageHash> hashes;
+    for (const ImageHash &image : images) {
+        const ImageFeatures *features = featureStore.find(image.imageFileName, image.lastModified, image.fileSize);
+        if (features && features->hasDHash) {
+            hashes.append(image);
+            hashes.last().dHash = features->dHash;
+            hashes.last().isValid = true;
+        } else {
+            uncachedImages.append(image);
+        }
+    }
+
+    if (!uncachedImages.isEmpty()) {
+        DuplicateHasher duplicateHasher;
+        QEventLoop eventLoop;
+        int pending = uncachedImages.size();
+        QObject::connect(&duplicateHasher, &DuplicateHasher::hashesComputed, &eventLoop,
+                         [&](int, const QVector<ImageHash> &results) {
+            for (const ImageHash &result : results) {
+                if (result.isValid) {
+                    ImageFeatures &features = featureStore.features(result.imageFileName, result.lastModified,
+                                                                    result.fileSize);
+                    features.dHash = result.dHash;
+                    features.hasDHash = true;
+                    hashes.append(result);
+                } else {
+                    printError(result.imageFileName + ": " + QObject::tr("Invalid image"));
+                    if (identicalCopies.contains(result.imageFileName)) {
+                        duplicates.append(QJsonArray::fromStringList(
+                            QStringList(result.imageFileName) + fileNames(identicalCopies.value(result.imageFileName))));
+                    }
+                }
+            }
+            pending -= results.size();
+            if (pending <= 0) {
+                eventLoop.quit();
+            }
+        });
+        duplicateHasher.hash(uncachedImages);
+        eventLoop.exec();
+        featureStore.flush();
+    }
+
+    std::sort(hashes.begin(), hashes.end(), [](const ImageHash &a, const ImageHash &b) {
+        return a.imageFileName < b.imageFileName;
+    });
+
+    HammingIndex hashIndex;
+    QHash<quint64, QStringList> groups;
+    QList<quint64> groupOrder;
+    for (const ImageHash &image : hashes) {
+        quint64 groupHash = image.dHash;
+        if (!groups.contains(groupHash) && Settings::dupesHammingDistance > 0) {
+            hashIndex.findNearest(image.dHash, int(Settings::dupesHammingDistance), groupHash);
+        }
+        if (!groups.contains(groupHash)) {
+            groupHash = image.dHash;
+            hashIndex.insert(groupHash);
+            groupOrder.append(groupHash);
+        }
+        groups[groupHash].append(image.imageFileName);
+        const QStringList copies = fileNames(identicalCopies.value(image.imageFileName));
+        groups[groupHash] += copies;
+        imageCount += 1 + copies.size();
+    }
+
+    for (quint64 groupHash : groupOrder) {
+        const QStringList &group = groups.value(groupHash);
+        if (group.size() > 1) {
+            duplicates.append(QJsonArray::fromStringList(group));
+        }
+    }
+    QJsonObject result;
+    result.insert("directory", QFileInfo(directoryPath).absoluteFilePath());
+    result.insert("images", imageCount);
+    result.insert("duplicates", duplicates);
+    QTextStream(stdout) << QJsonDocument(result).toJson();
+    return 0;
+}
+
+int run(const QCommandLineParser &parser) {
+    readSettings();
+    if (parser.isSet(OPTION_WARM_THUMBNAILS)) {
+        return warmThumbnails(parser.value(OPTION_WARM_THUMBNAILS));
+    }
+    if (parser.isSet(OPTION_FIND_DUPLICATES)) {
+        return findDuplicates(parser.value(OPTION_FIND_DUPLICATES));
+    }
+    return batchTransform(parser);
+}
+
+}
@@ -0,0 +1,37 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HEADLESS_TASKS_H
+#define HEADLESS_TASKS_H
+
+#include <QtCore>
+
+// What the command line can do without a window, on the engines the desktop uses.
+// Each returns the exit code of the process, errors go to stderr.
+namespace HeadlessTasks {
+
+// True when the arguments ask for one of the tasks, before there is an application to parse them
+bool isHeadless(int argc, char *argv[]);
+
+void addOptions(QCommandLineParser &parser);
+
+int run(const QCommandLineParser &parser);
+
+}
+
+#endif // HEADLESS_TASKS_H
@@ -0,0 +1,204 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <QImage>
+#include <QMetaType>
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Each channel holds sqrt(count / total) per bin, so the Bhattacharyya
+// coefficient of two channels is a plain dot product
+struct Histogram
+{
+    alignas(32) float red[256]{};
+    alignas(32) float green[256]{};
+    alignas(32) float blue[256]{};
+
+    static inline float dotProduct(const float a[256], const float b[256])
+    {
+#if defined(__AVX2__) && defined(__FMA__)
+        __m256 sum0 = _mm256_setzero_ps(), sum1 = _mm256_setzero_ps();
+        for (int i = 0; i < 256; i += 16) {
+            sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+            sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), sum1);
+        }
+        const __m256 sum = _mm256_add_ps(sum0, sum1);
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+        half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+        return _mm_cvtss_f32(half);
+#elif defined(__ARM_NEON)
+        float32x4_t sum0 = vdupq_n_f32(0.f), sum1 = vdupq_n_f32(0.f);
+        for (int i = 0; i < 256; i += 8) {
+            sum0 = vmlaq_f32(sum0, vld1q_f32(a + i), vld1q_f32(b + i));
+            sum1 = vmlaq_f32(sum1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+        }
+        const float32x4_t sum = vaddq_f32(sum0, sum1);
+        return vgetq_lane_f32(sum, 0) + vgetq_lane_f32(sum, 1) + vgetq_lane_f32(sum, 2) + vgetq_lane_f32(sum, 3);
+#else
+        // Independent accumulators let the compiler vectorise without reassociating
+        float sum[8]{};
+        for (int i = 0; i < 256; i += 8) {
+            for (int lane = 0; lane < 8; ++lane) {
+                sum[lane] += a[i + lane] * b[i + lane];
+            }
+        }
+        return ((sum[0] + sum[1]) + (sum[2] + sum[3])) + ((sum[4] + sum[5]) + (sum[6] + sum[7]));
+#endif
+    }
+
+    inline float compareChannel(const float hist1[256], const float hist2[256]) const
+    {
+        // Rounding can push the coefficient of identical channels just above 1
+        return std::sqrt(std::max(0.f, 1.f - dotProduct(hist1, hist2)));
+    }
+
+    inline float compare(const Histogram &other) const
+    {
+        return compareChannel(red, other.red) +
+            compareChannel(green, other.green) +
+            compareChannel(blue, other.blue);
+    }
+
+    // Safe to call from worker threads
+    static Histogram fromImage(const QImage &img)
+    {
+        Histogram hist;
+        if (img.isNull()) {
+            qWarning() << "Invalid file";
+            return hist;
+        }
+        const QImage image = img.scaled(256, 256).convertToFormat(QImage::Format_RGB888);
+        for (int y=0; y<image.height(); y++) {
+            const uchar *line = image.scanLine(y);
+            for (int x=0; x<image.width(); x++) {
+                const int index = x * 3;
+                hist.red[line[index + 0]] += 1.f;
+                hist.green[line[index + 1]] += 1.f;
+                hist.blue[line[index + 2]] += 1.f;
+            }
+        }
+        hist.normalize();
+        return hist;
+    }
+
+private:
+    inline void normalize()
+    {
+        float *channels[3] = {red, green, blue};
+        for (float *channel : channels) {
+            float total = 0.f;
+            for (int i = 0; i < 256; i++) {
+                total += channel[i];
+            }
+            if (total <= 0.f) {
+                continue;
+            }
+            for (int i = 0; i < 256; i++) {
+                channel[i] = std::sqrt(channel[i] / total);
+            }
+        }
+    }
+};
+Q_DECLARE_METATYPE(Histogram);
+
+#define DESCRIPTOR_BINS 64
+
+// A histogram cut down to 64 bins per channel, each holding its square root
+// quantised to a byte: 192 bytes instead of 3 KB. Distances are the same
+// Hellinger sum Histogram::compare() gives, worked out from the difference of
+// the roots so identical images still come out at exactly 0.
+struct ColorDescriptor
+{
+    alignas(64) quint8 bins[3 * DESCRIPTOR_BINS]{};
+
+    // Sum of squared differences over the bins of one channel
+    static inline quint32 squaredDistance(const quint8 a[DESCRIPTOR_BINS], const quint8 b[DESCRIPTOR_BINS])
+    {
+#if defined(__AVX2__)
+        __m256i sum = _mm256_setzero_si256();
+        for (int i = 0; i < DESCRIPTOR_BINS; i += 16) {
+            const __m256i difference = _mm256_sub_epi16(
+                    _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i))),
+                    _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i))));
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(difference, difference));
+        }
+        __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+        return quint32(_mm_cvtsi128_si32(half));
+#elif defined(__ARM_NEON)
+        uint32x4_t sum = vdupq_n_u32(0);
+        for (int i = 0; i < DESCRIPTOR_BINS; i += 16) {
+            const uint8x16_t difference = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+            sum = vpadalq_u16(sum, vmull_u8(vget_low_u8(difference), vget_low_u8(difference)));
+            sum = vpadalq_u16(sum, vmull_u8(vget_high_u8(difference), vget_high_u8(difference)));
+        }
+        return vgetq_lane_u32(sum, 0) + vgetq_lane_u32(sum, 1) + vgetq_lane_u32(sum, 2) + vgetq_lane_u32(sum, 3);
+#else
+        quint32 sum[8]{};
+        for (int i = 0; i < DESCRIPTOR_BINS; i += 8) {
+            for (int lane = 0; lane < 8; ++lane) {
+                const int difference = int(a[i + lane]) - int(b[i + lane]);
+                sum[lane] += quint32(difference * difference);
+            }
+        }
+        return ((sum[0] + sum[1]) + (sum[2] + sum[3])) + ((sum[4] + sum[5]) + (sum[6] + sum[7]));
+#endif
+    }
+
+    // For normalised roots, 1 - dot product is half the squared distance
+    inline float compare(const ColorDescriptor &other) const
+    {
+        const float scale = 0.5f / (255.f * 255.f);
+        float distance = 0.f;
+        for (int channel = 0; channel < 3; ++channel) {
+            const int offset = channel * DESCRIPTOR_BINS;
+            distance += std::sqrt(float(squaredDistance(bins + offset, other.bins + offset)) * scale);
+        }
+        return distance;
+    }
+
+    static ColorDescriptor fromHistogram(const Histogram &histogram)
+    {
+        ColorDescriptor descriptor;
+        const float *channels[3] = {histogram.red, histogram.green, histogram.blue};
+        for (int channel = 0; channel < 3; ++channel) {
+            for (int bin = 0; bin < DESCRIPTOR_BINS; ++bin) {
+                float mass = 0.f;
+                for (int i = bin * (256 / DESCRIPTOR_BINS); i < (bin + 1) * (256 / DESCRIPTOR_BINS); ++i) {
+                    mass += channels[channel][i] * channels[channel][i];
+                }
+                descriptor.bins[channel * DESCRIPTOR_BINS + bin] =
+                        quint8(std::min(255.f, std::round(std::sqrt(mass) * 255.f)));
+            }
+        }
+        return descriptor;
+    }
+};
+
+#endif // HISTOGRAM_H
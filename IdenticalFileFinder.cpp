@@ -0,0 +1,265 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+#include <cstring>
+#include "IdenticalFileFinder.h"
+
+#define IDENTICAL_HASH_THREADS 4
+#define PARTIAL_HASH_SIZE 65536
+#define HASH_BLOCK_SIZE (1024 * 1024)
+
+namespace {
+
+enum HashExtent {
+    HeadAndTail,
+    WholeFile
+};
+
+// Empty when the file could not be read or the search was cancelled, so it matches nothing
+QByteArray hashFile(const ImageHash &file, HashExtent extent, const std::atomic<int> &generation,
+                    int findGeneration) {
+    QFile input(file.imageFileName);
+    if (!input.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        return QByteArray();
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    if (extent == HeadAndTail) {
+        // A short read means the file changed since it was listed
+        const qint64 headSize = qMin<qint64>(PARTIAL_HASH_SIZE, file.fileSize);
+        const QByteArray head = input.read(headSize);
+        if (head.size() != headSize) {
+            return QByteArray();
+        }
+        hash.addData(head);
+        if (file.fileSize > 2 * PARTIAL_HASH_SIZE && !input.seek(file.fileSize - PARTIAL_HASH_SIZE)) {
+            return QByteArray();
+        }
+        const qint64 tailSize = qMin<qint64>(PARTIAL_HASH_SIZE, file.fileSize - headSize);
+        const QByteArray tail = input.read(tailSize);
+        if (tail.size() != tailSize) {
+            return QByteArray();
+        }
+        hash.addData(tail);
+        return hash.result();
+    }
+
+    QByteArray block(HASH_BLOCK_SIZE, Qt::Uninitialized);
+    qint64 count;
+    while ((count = input.read(block.data(), block.size())) > 0) {
+        if (findGeneration != generation) {
+            return QByteArray();
+        }
+        hash.addData(block.constData(), int(count));
+    }
+    return count < 0 ? QByteArray() : hash.result();
+}
+
+class HashWorker : public QRunnable {
+public:
+    HashWorker(const QList<ImageHash> &files, const QVector<int> &indices, HashExtent extent, QByteArray *hashes,
+               std::atomic<int> &nextIndex, QSemaphore &done, const std::atomic<int> &generation, int findGeneration)
+        : files(files), indices(indices), extent(extent), hashes(hashes), nextIndex(nextIndex), done(done),
+          generation(generation), findGeneration(findGeneration) {}
+
+    void run() override {
+        processFiles();
+        done.release();
+    }
+
+    void processFiles() {
+        forever {
+            const int i = nextIndex++;
+            if (i >= indices.size() || findGeneration != generation) {
+                return;
+            }
+            hashes[i] = hashFile(files.at(indices.at(i)), extent, generation, findGeneration);
+        }
+    }
+
+private:
+    const QList<ImageHash> &files;
+    const QVector<int> &indices;
+    HashExtent extent;
+    QByteArray *hashes;
+    std::atomic<int> &nextIndex;
+    QSemaphore &done;
+    const std::atomic<int> &generation;
+    int findGeneration;
+};
+
+// The hashes of the files at indices, in the same order. Keys are the hash and the size, files
+// of different sizes never share one.
+QVector<QByteArray> hashFiles(const QList<ImageHash> &files, const QVector<int> &indices, HashExtent extent,
+                              const std::atomic<int> &generation, int findGeneration) {
+    static QThreadPool *threadPool = []() {
+        QThreadPool *pool = new QThreadPool(QCoreApplication::instance());
+        pool->setMaxThreadCount(IDENTICAL_HASH_THREADS - 1);
+        return pool;
+    }();
+
+    QVector<QByteArray> hashes(indices.size());
+    std::atomic<int> nextIndex{0};
+    QSemaphore done;
+    const int workers = qMin(IDENTICAL_HASH_THREADS, indices.size()) - 1;
+    for (int i = 0; i < workers; ++i) {
+        threadPool->start(new HashWorker(files, indices, extent, hashes.data(), nextIndex, done, generation,
+                                         findGeneration));
+    }
+    HashWorker(files, indices, extent, hashes.data(), nextIndex, done, generation, findGeneration).processFiles();
+    done.acquire(qMax(0, workers));
+
+    for (int i = 0; i < indices.size(); ++i) {
+        if (!hashes.at(i).isEmpty()) {
+            hashes[i] += QByteArray::number(files.at(indices.at(i)).fileSize);
+        }
+    }
+    return hashes;
+}
+
+// Keeps the groups of two or more, by key
+void collectGroups(const QVector<int> &indices, const QVector<QByteArray> &keys, QHash<QByteArray, QVector<int>> &groups) {
+    for (int i = 0; i < indices.size(); ++i) {
+        if (!keys.at(i).isEmpty()) {
+            groups[keys.at(i)].append(indices.at(i));
+        }
+    }
+    for (QHash<QByteArray, QVector<int>>::iterator it = groups.begin(); it != groups.end();) {
+        it = it->size() < 2 ? groups.erase(it) : it + 1;
+    }
+}
+
+} // anonymous namespace
+
+class IdenticalFileFinder::Worker : public QRunnable {
+public:
+    Worker(IdenticalFileFinder *finder, const QList<ImageHash> &files, int findGeneration)
+        : finder(finder), files(files), findGeneration(findGeneration) {}
+
+    void run() override {
+        finder->groupFiles(files, findGeneration);
+    }
+
+private:
+    IdenticalFileFinder *finder;
+    QList<ImageHash> files;
+    int findGeneration;
+};
+
+IdenticalFileFinder::IdenticalFileFinder(QObject *parent) : QObject(parent) {
+    qRegisterMetaType<ImageHashGroups>();
+    threadPool.setMaxThreadCount(1);
+}
+
+IdenticalFileFinder::~IdenticalFileFinder() {
+    cancel();
+    threadPool.waitForDone();
+}
+
+void IdenticalFileFinder::find(const QList<ImageHash> &files) {
+    threadPool.start(new Worker(this, files, ++generation));
+}
+
+void IdenticalFileFinder::cancel() {
+    ++generation;
+}
+
+int IdenticalFileFinder::currentGeneration() const {
+    return generation;
+}
+
+void IdenticalFileFinder::groupFiles(const QList<ImageHash> &files, int findGeneration) {
+    // Most files have a size no other file has, those are never read
+    QHash<qint64, QVector<int>> sizeGroups;
+    for (int i = 0; i < files.size(); ++i) {
+        if (files.at(i).fileSize > 0) {
+            sizeGroups[files.at(i).fileSize].append(i);
+        }
+    }
+    QVector<int> sameSizeFiles;
+    for (const QVector<int> &sizeGroup : sizeGroups) {
+        if (sizeGroup.size() > 1) {
+            sameSizeFiles += sizeGroup;
+        }
+    }
+
+    QHash<QByteArray, QVector<int>> partialGroups;
+    collectGroups(sameSizeFiles, hashFiles(files, sameSizeFiles, HeadAndTail, generation, findGeneration),
+                  partialGroups);
+    if (findGeneration != generation) {
+        return;
+    }
+
+    // Small files were read in full for the partial hash already
+    QHash<QByteArray, QVector<int>> identicalGroups;
+    QVector<int> partialMatches;
+    for (QHash<QByteArray, QVector<int>>::const_iterator it = partialGroups.constBegin();
+         it != partialGroups.constEnd(); ++it) {
+        if (files.at(it->first()).fileSize <= 2 * PARTIAL_HASH_SIZE) {
+            identicalGroups.insert(it.key(), *it);
+        } else {
+            partialMatches += *it;
+        }
+    }
+    collectGroups(partialMatches, hashFiles(files, partialMatches, WholeFile, generation, findGeneration),
+                  identicalGroups);
+    if (findGeneration != generation) {
+        return;
+    }
+
+    // Groups of one have no content hash, nothing shares it
+    QVector<QVector<int>> groupIndices;
+    QVector<quint64> contentHashes(files.size(), 0);
+    for (QHash<QByteArray, QVector<int>>::const_iterator it = identicalGroups.constBegin();
+         it != identicalGroups.constEnd(); ++it) {
+        quint64 contentHash;
+        memcpy(&contentHash, it.key().constData(), sizeof(contentHash));
+        QVector<int> indices = *it;
+        std::sort(indices.begin(), indices.end());
+        for (int index : indices) {
+            contentHashes[index] = contentHash;
+        }
+        groupIndices.append(indices);
+    }
+    for (int i = 0; i < files.size(); ++i) {
+        if (!contentHashes.at(i)) {
+            groupIndices.append(QVector<int>{i});
+        }
+    }
+    std::sort(groupIndices.begin(), groupIndices.end(), [](const QVector<int> &a, const QVector<int> &b) {
+        return a.first() < b.first();
+    });
+
+    ImageHashGroups groups;
+    groups.reserve(groupIndices.size());
+    for (const QVector<int> &indices : groupIndices) {
+        QVector<ImageHash> group;
+        group.reserve(indices.size());
+        for (int index : indices) {
+            group.append(files.at(index));
+            group.last().contentHash = contentHashes.at(index);
+        }
+        groups.append(group);
+    }
+
+    if (findGeneration == generation) {
+        emit filesGrouped(findGeneration, groups);
+    }
+}
@@ -0,0 +1,66 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef IDENTICAL_FILE_FINDER_H
+#define IDENTICAL_FILE_FINDER_H
+
+#include <QtCore>
+#include <atomic>
+#include "DuplicateHasher.h"
+
+typedef QVector<QVector<ImageHash>> ImageHashGroups;
+
+Q_DECLARE_METATYPE(ImageHashGroups)
+
+// Groups byte-identical files without decoding anything. Files are grouped by
+// size first, what is left by a hash of their first and last 64 KB, and only
+// files that still match have all of their content hashed. Hashing runs on a
+// few threads, enough to keep a disk busy without making it seek between them.
+class IdenticalFileFinder : public QObject {
+Q_OBJECT
+
+public:
+    explicit IdenticalFileFinder(QObject *parent = nullptr);
+
+    ~IdenticalFileFinder() override;
+
+    // The files need their sizes, empty files and the ones with an unknown size are never matched
+    void find(const QList<ImageHash> &files);
+
+    // Starts a new generation; a search in progress is discarded
+    void cancel();
+
+    int currentGeneration() const;
+
+signals:
+
+    // Every file is in exactly one group, in listing order. Files in a group share contentHash,
+    // groups of one file have no copies.
+    void filesGrouped(int generation, const ImageHashGroups &groups);
+
+private:
+    class Worker;
+
+    void groupFiles(const QList<ImageHash> &files, int findGeneration);
+
+    QThreadPool threadPool;
+    std::atomic<int> generation{0};
+};
+
+#endif // IDENTICAL_FILE_FINDER_H
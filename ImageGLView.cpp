@@ -0,0 +1,258 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include "ImageGLView.h"
+
+#define GL_VIEW_MAX_TILE_SIZE 4096
+
+static const char vertexShaderSource[] =
+    "attribute highp vec2 position;\n"
+    "attribute highp vec2 texCoord;\n"
+    "uniform highp mat4 matrix;\n"
+    "varying highp vec2 fragTexCoord;\n"
+    "void main() {\n"
+    "    fragTexCoord = texCoord;\n"
+    "    gl_Position = matrix * vec4(position, 0.0, 1.0);\n"
+    "}\n";
+
+// The same steps as ColorEngine, in its 0-255 ranges
+static const char fragmentShaderSource[] =
+    "uniform sampler2D image;\n"
+    "uniform bool adjust;\n"
+    "uniform highp vec3 negate;\n"
+    "uniform highp vec3 gain;\n"
+    "uniform highp float gamma;\n"
+    "uniform highp float contrast;\n"
+    "uniform bool colorize;\n"
+    "uniform highp float hue;\n"
+    "uniform highp float saturation;\n"
+    "uniform highp float lightness;\n"
+    "uniform highp vec3 hueChannels;\n"
+    "varying highp vec2 fragTexCoord;\n"
+    "highp float hslValue(highp float n1, highp float n2, highp float h) {\n"
+    "    if (h > 255.0) h -= 255.0; else if (h < 0.0) h += 255.0;\n"
+    "    if (h < 42.5) return n1 + (n2 - n1) * (h / 42.5);\n"
+    "    if (h < 127.5) return n2;\n"
+    "    if (h < 170.0) return n1 + (n2 - n1) * ((170.0 - h) / 42.5);\n"
+    "    return n1;\n"
+    "}\n"
+    "void main() {\n"
+    "    highp vec4 texel = texture2D(image, fragTexCoord);\n"
+    "    if (!adjust) {\n"
+    "        gl_FragColor = texel;\n"
+    "        return;\n"
+    "    }\n"
+    "    highp vec3 original = texel.rgb * 255.0;\n"
+    "    highp vec3 c = mix(original, 255.0 - original, negate);\n"
+    "    c = clamp(c * gain, 0.0, 255.0);\n"
+    "    c = 255.0 * pow(c / 255.0, vec3(gamma));\n"
+    "    c = clamp((c - 128.0) / contrast + 128.0, 0.0, 255.0);\n"
+    "    highp float maxC = max(c.r, max(c.g, c.b));\n"
+    "    highp float minC = min(c.r, min(c.g, c.b));\n"
+    "    highp float l = (maxC + minC) / 2.0;\n"
+    "    highp float s = 0.0;\n"
+    "    highp float h = 0.0;\n"
+    "    if (maxC != minC) {\n"
+    "        highp float delta = maxC - minC;\n"
+    "        s = l < 128.0 ? 255.0 * delta / (maxC + minC) : 255.0 * delta / (511.0 - maxC - minC);\n"
+    "        if (c.r == maxC) h = (c.g - c.b) / delta;\n"
+    "        else if (c.g == maxC) h = 2.0 + (c.b - c.r) / delta;\n"
+    "        else h = 4.0 + (c.r - c.g) / delta;\n"
+    "        h *= 42.5;\n"
+    "        if (h < 0.0) h += 255.0; else if (h > 255.0) h -= 255.0;\n"
+    "    }\n"
+    "    h = mod(colorize ? hue : h + hue, 256.0);\n"
+    "    s = clamp(s * saturation, 0.0, 255.0);\n"
+    "    l = clamp(l * lightness, 0.0, 255.0);\n"
+    "    highp vec3 hsl = vec3(l);\n"
+    "    if (s != 0.0) {\n"
+    "        highp float m2 = l < 128.0 ? (l * (255.0 + s)) / 65025.0 : (l + s - (l * s) / 255.0) / 255.0;\n"
+    "        highp float m1 = l / 127.5 - m2;\n"
+    "        hsl = 255.0 * vec3(hslValue(m1, m2, h + 85.0), hslValue(m1, m2, h), hslValue(m1, m2, h - 85.0));\n"
+    "    }\n"
+    "    gl_FragColor = vec4(clamp(mix(original, hsl, hueChannels), 0.0, 255.0) / 255.0, texel.a);\n"
+    "}\n";
+
+ImageGLView::ImageGLView(QWidget *parent) : QOpenGLWidget(parent) {
+    // Mouse handling stays with the ImageWidget and the viewer underneath
+    setAttribute(Qt::WA_TransparentForMouseEvents);
+}
+
+ImageGLView::~ImageGLView() {
+    makeCurrent();
+    deleteTiles();
+    doneCurrent();
+}
+
+void ImageGLView::setImage(const QImage &image) {
+    this->image = image;
+    isImageChanged = true;
+    update();
+}
+
+void ImageGLView::setRotation(qreal rotation) {
+    this->rotation = rotation;
+    update();
+}
+
+void ImageGLView::setMirrorCells(const QVector<MirrorCell> &cells) {
+    mirrorCells = cells;
+    update();
+}
+
+void ImageGLView::setColorAdjustment(const ColorAdjustment &colorAdjustment) {
+    this->colorAdjustment = colorAdjustment;
+    update();
+}
+
+void ImageGLView::initializeGL() {
+    initializeOpenGLFunctions();
+    if (!program.addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShaderSource)
+        || !program.addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentShaderSource)
+        || !program.link()) {
+        qWarning() << "Unable to build the image shaders" << program.log();
+        emit failed();
+    }
+}
+
+void ImageGLView::deleteTiles() {
+    for (const Tile &tile : tiles) {
+        delete tile.texture;
+    }
+    tiles.clear();
+}
+
+// Images larger than the GPU takes in one texture are uploaded in pieces
+void ImageGLView::uploadTiles() {
+    deleteTiles();
+    isImageChanged = false;
+    if (image.isNull()) {
+        return;
+    }
+
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    const int tileSize = qBound(256, int(maxTextureSize), GL_VIEW_MAX_TILE_SIZE);
+
+    for (int y = 0; y < image.height(); y += tileSize) {
+        for (int x = 0; x < image.width(); x += tileSize) {
+            const QRect rect = QRect(x, y, tileSize, tileSize) & image.rect();
+            QOpenGLTexture *texture = new QOpenGLTexture(image.copy(rect));
+            texture->setMinificationFilter(QOpenGLTexture::LinearMipMapLinear);
+            texture->setMagnificationFilter(QOpenGLTexture::Linear);
+            texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+            tiles.append({rect, texture});
+        }
+    }
+}
+
+void ImageGLView::paintGL() {
+    const QColor background = palette().color(QPalette::Window);
+    glClearColor(background.redF(), background.greenF(), background.blueF(), 1);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    if (!program.isLinked()) {
+        return;
+    }
+    if (isImageChanged) {
+        uploadTiles();
+    }
+    if (tiles.isEmpty()) {
+        return;
+    }
+
+    // This widget is the visible part of the ImageWidget, which the image fills
+    const QSizeF widgetSize = parentWidget()->size();
+    const QPointF center(widgetSize.width() / 2, widgetSize.height() / 2);
+    QMatrix4x4 matrix;
+    matrix.ortho(QRectF(pos(), size()));
+    matrix.translate(center.x(), center.y());
+    matrix.rotate(rotation, 0, 0, 1);
+    matrix.translate(-center.x(), -center.y());
+
+    const QSize grid = ImageWidget::mirrorGrid(mirrorCells);
+    const qreal scaleX = widgetSize.width() / (image.width() * grid.width());
+    const qreal scaleY = widgetSize.height() / (image.height() * grid.height());
+    const qreal cellWidth = image.width() * scaleX;
+    const qreal cellHeight = image.height() * scaleY;
+    const QVector<MirrorCell> cells = mirrorCells.isEmpty() ? QVector<MirrorCell>({{0, 0, false, false}})
+                                                            : mirrorCells;
+
+    program.bind();
+    program.setUniformValue("matrix", matrix);
+    program.setUniformValue("image", 0);
+    program.setUniformValue("adjust", colorAdjustment.isEnabled);
+    if (colorAdjustment.isEnabled) {
+        program.setUniformValue("negate", colorAdjustment.negateRed ? 1.0f : 0.0f,
+                                colorAdjustment.negateGreen ? 1.0f : 0.0f, colorAdjustment.negateBlue ? 1.0f : 0.0f);
+        program.setUniformValue("gain", (colorAdjustment.red + 100) / 100.0f,
+                                (colorAdjustment.green + 100) / 100.0f, (colorAdjustment.blue + 100) / 100.0f);
+        program.setUniformValue("gamma", 100.0f / qMax(1, colorAdjustment.brightness));
+        program.setUniformValue("contrast", qMax(1e-4f, float(std::tan(colorAdjustment.contrast / 100.0))));
+        program.setUniformValue("colorize", colorAdjustment.colorize);
+        program.setUniformValue("hue", float(colorAdjustment.hue));
+        program.setUniformValue("saturation", colorAdjustment.saturation / 100.0f);
+        program.setUniformValue("lightness", colorAdjustment.lightness / 100.0f);
+        program.setUniformValue("hueChannels", colorAdjustment.hueRedChannel ? 1.0f : 0.0f,
+                                colorAdjustment.hueGreenChannel ? 1.0f : 0.0f,
+                                colorAdjustment.hueBlueChannel ? 1.0f : 0.0f);
+    }
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    static const GLfloat texCoords[] = {0, 0, 1, 0, 0, 1, 1, 1};
+    const int positionLocation = program.attributeLocation("position");
+    const int texCoordLocation = program.attributeLocation("texCoord");
+    program.enableAttributeArray(positionLocation);
+    program.enableAttributeArray(texCoordLocation);
+    program.setAttributeArray(texCoordLocation, GL_FLOAT, texCoords, 2);
+
+    // Mirrored cells swap the edges of their quads, the texture coordinates stay put
+    for (const MirrorCell &cell : cells) {
+        const qreal cellLeft = cell.column * cellWidth;
+        const qreal cellTop = cell.row * cellHeight;
+        for (const Tile &tile : tiles) {
+            GLfloat left = tile.rect.left() * scaleX;
+            GLfloat top = tile.rect.top() * scaleY;
+            GLfloat right = (tile.rect.left() + tile.rect.width()) * scaleX;
+            GLfloat bottom = (tile.rect.top() + tile.rect.height()) * scaleY;
+            if (cell.flipH) {
+                left = cellWidth - left;
+                right = cellWidth - right;
+            }
+            if (cell.flipV) {
+                top = cellHeight - top;
+                bottom = cellHeight - bottom;
+            }
+            left += cellLeft;
+            right += cellLeft;
+            top += cellTop;
+            bottom += cellTop;
+            const GLfloat positions[] = {left, top, right, top, left, bottom, right, bottom};
+            program.setAttributeArray(positionLocation, GL_FLOAT, positions, 2);
+            tile.texture->bind(0);
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        }
+    }
+
+    program.disableAttributeArray(positionLocation);
+    program.disableAttributeArray(texCoordLocation);
+    program.release();
+}
@@ -0,0 +1,76 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMAGE_GL_VIEW_H
+#define IMAGE_GL_VIEW_H
+
+#include <QOpenGLWidget>
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLTexture>
+#include "ImageWidget.h"
+
+// Draws an ImageWidget's image as textures. It only covers the part of
+// the widget that is on screen, zoom and rotation are done by the vertex
+// stage and the colours dialog adjustments by the fragment shader.
+class ImageGLView : public QOpenGLWidget, protected QOpenGLFunctions {
+Q_OBJECT
+
+public:
+    explicit ImageGLView(QWidget *parent);
+
+    ~ImageGLView() override;
+
+    void setImage(const QImage &image);
+
+    void setRotation(qreal rotation);
+
+    void setMirrorCells(const QVector<MirrorCell> &cells);
+
+    void setColorAdjustment(const ColorAdjustment &colorAdjustment);
+
+signals:
+
+    // The shaders could not be built, the widget should draw on its own
+    void failed();
+
+protected:
+    void initializeGL() override;
+
+    void paintGL() override;
+
+private:
+    struct Tile {
+        QRect rect;
+        QOpenGLTexture *texture;
+    };
+
+    void uploadTiles();
+
+    void deleteTiles();
+
+    QOpenGLShaderProgram program;
+    QImage image;
+    bool isImageChanged = false;
+    QList<Tile> tiles;
+    qreal rotation = 0;
+    QVector<MirrorCell> mirrorCells;
+    ColorAdjustment colorAdjustment;
+};
+
+#endif // IMAGE_GL_VIEW_H
@@ -0,0 +1,184 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <exiv2/exiv2.hpp>
+#include "ImageInfoReader.h"
+#include "Exiv2Init.h"
+#include "ExifPreview.h"
+
+class ImageInfoReader::Worker : public QRunnable {
+public:
+    explicit Worker(ImageInfoReader *reader) : reader(reader) {}
+
+    void run() override {
+        reader->processRequests();
+    }
+
+private:
+    ImageInfoReader *reader;
+};
+
+ImageInfoReader::ImageInfoReader(const std::shared_ptr<MetadataCache> &metadataCache, QObject *parent)
+    : QObject(parent), metadataCache(metadataCache) {
+    qRegisterMetaType<ImageInfo>();
+
+    Exiv2Init::ensure();
+    threadPool.setMaxThreadCount(1);
+}
+
+ImageInfoReader::~ImageInfoReader() {
+    cancel();
+    threadPool.waitForDone();
+}
+
+void ImageInfoReader::read(const QString &imageFileName) {
+    QMutexLocker locker(&mutex);
+    pendingFileName = imageFileName;
+    ++generation;
+
+    if (!isWorkerRunning) {
+        isWorkerRunning = true;
+        threadPool.start(new Worker(this));
+    }
+}
+
+void ImageInfoReader::cancel() {
+    QMutexLocker locker(&mutex);
+    pendingFileName.clear();
+    ++generation;
+}
+
+void ImageInfoReader::processRequests() {
+    forever {
+        QString imageFileName;
+        int requestGeneration;
+        {
+            QMutexLocker locker(&mutex);
+            if (pendingFileName.isEmpty()) {
+                isWorkerRunning = false;
+                return;
+            }
+            imageFileName = pendingFileName;
+            pendingFileName.clear();
+            requestGeneration = generation;
+        }
+
+        const ImageInfo imageInfo = readInfo(imageFileName);
+        if (requestGeneration == generation) {
+            emit infoRead(requestGeneration, imageInfo);
+        }
+    }
+}
+
+static ImageInfoSection readSection(const QString &title, const Exiv2::ExifData &exifData) {
+    ImageInfoSection section;
+    section.title = title;
+    for (Exiv2::ExifData::const_iterator md = exifData.begin(); md != exifData.end(); ++md) {
+        section.entries.append(qMakePair(QString::fromUtf8(md->tagName().c_str()),
+                                         QString::fromUtf8(md->print().c_str())));
+    }
+    return section;
+}
+
+static ImageInfoSection readSection(const QString &title, const Exiv2::IptcData &iptcData) {
+    ImageInfoSection section;
+    section.title = title;
+    for (Exiv2::IptcData::const_iterator md = iptcData.begin(); md != iptcData.end(); ++md) {
+        section.entries.append(qMakePair(QString::fromUtf8(md->tagName().c_str()),
+                                         QString::fromUtf8(md->print().c_str())));
+    }
+    return section;
+}
+
+static ImageInfoSection readSection(const QString &title, const Exiv2::XmpData &xmpData) {
+    ImageInfoSection section;
+    section.title = title;
+    for (Exiv2::XmpData::const_iterator md = xmpData.begin(); md != xmpData.end(); ++md) {
+        section.entries.append(qMakePair(QString::fromUtf8(md->tagName().c_str()),
+                                         QString::fromUtf8(md->print().c_str())));
+    }
+    return section;
+}
+
+ImageInfo ImageInfoReader::readInfo(const QString &imageFileName) {
+    ImageInfo imageInfo;
+    imageInfo.imageFileName = imageFileName;
+    const QFileInfo fileInfo(imageFileName);
+    imageInfo.lastModified = fileInfo.lastModified().toMSecsSinceEpoch();
+    imageInfo.fileSize = fileInfo.size();
+
+    // Only the header is read for these
+    QImageReader imageInfoReader(imageFileName);
+    imageInfo.size = imageInfoReader.size();
+    if (imageInfo.size.isValid()) {
+        imageInfo.format = QString::fromLatin1(imageInfoReader.format().toUpper());
+    } else {
+        imageInfoReader.read();
+        imageInfo.error = imageInfoReader.errorString();
+    }
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#if EXIV2_TEST_VERSION(0,28,0)
+    Exiv2::Image::UniquePtr exifImage;
+#else
+    Exiv2::Image::AutoPtr exifImage;
+#endif
+#pragma clang diagnostic pop
+
+    try {
+        exifImage = Exiv2::ImageFactory::open(imageFileName.toStdString());
+        exifImage->readMetadata();
+
+        // RAW files Qt has no decoder for still have their resolution in the metadata
+        const QSize rawSize(int(exifImage->pixelWidth()), int(exifImage->pixelHeight()));
+        if (!imageInfo.size.isValid() && ExifPreview::isRawFile(imageFileName) && !rawSize.isEmpty()) {
+            imageInfo.size = rawSize;
+            imageInfo.format = fileInfo.suffix().toUpper();
+            imageInfo.error.clear();
+        }
+
+        if (!exifImage->exifData().empty()) {
+            imageInfo.sections.append(readSection(QStringLiteral("Exif"), exifImage->exifData()));
+        }
+        if (!exifImage->iptcData().empty()) {
+            imageInfo.sections.append(readSection(QStringLiteral("IPTC"), exifImage->iptcData()));
+        }
+        if (!exifImage->xmpData().empty()) {
+            imageInfo.sections.append(readSection(QStringLiteral("XMP"), exifImage->xmpData()));
+        }
+    }
+    catch (const Exiv2::Error &error) {
+        qWarning() << "EXIV2:" << error.what();
+        return imageInfo;
+    }
+    catch (const std::exception &error) {
+        // A damaged file can make Exiv2 throw more than its own errors
+        qWarning() << "Error reading image info" << error.what();
+        return imageInfo;
+    }
+
+    // Saves the metadata scan opening the file again
+    if (!metadataCache->hasImageMetadata(imageFileName)) {
+        ImageMetadata imageMetadata;
+        if (MetadataCache::readImageMetadata(*exifImage, imageMetadata)) {
+            metadataCache->insertReadImageMetadata(imageFileName, imageMetadata);
+        }
+    }
+    return imageInfo;
+}
@@ -0,0 +1,87 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMAGE_INFO_READER_H
+#define IMAGE_INFO_READER_H
+
+#include <QtCore>
+#include <atomic>
+#include <memory>
+#include "MetadataCache.h"
+
+struct ImageInfoSection
+{
+    QString title;
+    QVector<QPair<QString, QString>> entries;
+};
+
+// What the info panel shows about a file, apart from what the model knows
+struct ImageInfo
+{
+    QString imageFileName;
+    qint64 lastModified = 0;
+    qint64 fileSize = 0;
+    QString format;
+    QSize size;
+    QString error;
+    QVector<ImageInfoSection> sections;
+};
+
+Q_DECLARE_METATYPE(ImageInfo)
+
+// Reads format, resolution and all Exif, IPTC and XMP entries for the info
+// panel on a background thread. Only the latest request matters: asking for
+// another file drops the one before, and results for it are never delivered.
+// The same Exiv2 read also fills the MetadataCache.
+class ImageInfoReader : public QObject {
+Q_OBJECT
+
+public:
+    explicit ImageInfoReader(const std::shared_ptr<MetadataCache> &metadataCache, QObject *parent = nullptr);
+
+    ~ImageInfoReader() override;
+
+    void read(const QString &imageFileName);
+
+    // Starts a new generation; the request in flight is discarded
+    void cancel();
+
+    int currentGeneration() const {
+        return generation;
+    }
+
+signals:
+
+    void infoRead(int generation, const ImageInfo &imageInfo);
+
+private:
+    class Worker;
+
+    void processRequests();
+
+    ImageInfo readInfo(const QString &imageFileName);
+
+    std::shared_ptr<MetadataCache> metadataCache;
+    QThreadPool threadPool;
+    QMutex mutex;
+    QString pendingFileName;
+    bool isWorkerRunning = false;
+    std::atomic<int> generation{0};
+};
+
+#endif // IMAGE_INFO_READER_H
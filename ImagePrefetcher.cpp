@@ -0,0 +1,212 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ImagePrefetcher.h"
+#include "ImageViewer.h"
+#include "MappedFile.h"
+
+#define PREFETCH_THREADS 2
+#define PREFETCH_MEMORY_BUDGET (768LL * 1024 * 1024)
+
+class ImagePrefetcher::Worker : public QRunnable {
+public:
+    explicit Worker(ImagePrefetcher *prefetcher) : prefetcher(prefetcher) {}
+
+    void run() override {
+        prefetcher->processQueue();
+    }
+
+private:
+    ImagePrefetcher *prefetcher;
+};
+
+ImagePrefetcher::ImagePrefetcher(const std::shared_ptr<MetadataCache> &metadataCache, QObject *parent)
+    : QObject(parent), metadataCache(metadataCache) {
+    threadPool.setMaxThreadCount(PREFETCH_THREADS);
+}
+
+ImagePrefetcher::~ImagePrefetcher() {
+    {
+        QMutexLocker locker(&mutex);
+        queue.clear();
+    }
+    threadPool.waitForDone();
+}
+
+void ImagePrefetcher::setExifRotation(bool exifRotation) {
+    if (exifRotation != this->exifRotation) {
+        images.clear();
+        memoryUsage = 0;
+        this->exifRotation = exifRotation;
+    }
+}
+
+void ImagePrefetcher::startWorkers() {
+    while (activeWorkers < threadPool.maxThreadCount() && activeWorkers < queue.size()) {
+        ++activeWorkers;
+        threadPool.start(new Worker(this));
+    }
+}
+
+void ImagePrefetcher::prefetch(const QStringList &imageFileNames, bool exifRotation) {
+    QMutexLocker locker(&mutex);
+    setExifRotation(exifRotation);
+
+    wantedFiles = imageFileNames;
+    if (!requestedFile.isEmpty()) {
+        wantedFiles.removeAll(requestedFile);
+        wantedFiles.prepend(requestedFile);
+    }
+    queue.clear();
+    for (QHash<QString, PrefetchedImage>::iterator it = images.begin(); it != images.end();) {
+        if (wantedFiles.contains(it.key())) {
+            ++it;
+        } else {
+            memoryUsage -= it->image.sizeInBytes();
+            it = images.erase(it);
+        }
+    }
+    QSet<QString> queuedFiles;
+    QStringList unhintedFiles;
+    for (const QString &imageFileName : wantedFiles) {
+        if (!images.contains(imageFileName) && !decodingFiles.contains(imageFileName)
+            && !queuedFiles.contains(imageFileName)) {
+            queue.append(imageFileName);
+            queuedFiles.insert(imageFileName);
+            if (!hintedFiles.contains(imageFileName)) {
+                unhintedFiles.append(imageFileName);
+            }
+        }
+    }
+    // Files that left the queue are hinted again should they come back
+    hintedFiles = queuedFiles;
+    startWorkers();
+    locker.unlock();
+
+    // Every queued image is decoded in full, the system can start reading them ahead of the workers
+    for (const QString &imageFileName : unhintedFiles) {
+        MappedFile::willNeed(imageFileName);
+    }
+}
+
+void ImagePrefetcher::request(const QString &imageFileName, bool exifRotation) {
+    QMutexLocker locker(&mutex);
+    setExifRotation(exifRotation);
+
+    requestedFile = imageFileName;
+    wantedFiles.removeAll(imageFileName);
+    wantedFiles.prepend(imageFileName);
+    queue.removeAll(imageFileName);
+    if (!images.contains(imageFileName) && !decodingFiles.contains(imageFileName)) {
+        queue.prepend(imageFileName);
+    }
+    startWorkers();
+}
+
+bool ImagePrefetcher::take(const QString &imageFileName, bool exifRotation, QImage &image) {
+    QMutexLocker locker(&mutex);
+    while (decodingFiles.contains(imageFileName)) {
+        decodeFinished.wait(&mutex);
+    }
+
+    if (imageFileName == requestedFile) {
+        requestedFile.clear();
+    }
+
+    QHash<QString, PrefetchedImage>::const_iterator it = images.constFind(imageFileName);
+    if (it == images.constEnd() || it->exifRotation != exifRotation
+        || it->lastModified != QFileInfo(imageFileName).lastModified().toMSecsSinceEpoch()) {
+        return false;
+    }
+
+    image = it->image;
+    return true;
+}
+
+int ImagePrefetcher::priority(const QString &imageFileName) const {
+    const int index = wantedFiles.indexOf(imageFileName);
+    return index < 0 ? INT_MAX : index;
+}
+
+// What just came in may go as well, if everything else is wanted more
+void ImagePrefetcher::evict() {
+    while (memoryUsage > PREFETCH_MEMORY_BUDGET && !images.isEmpty()) {
+        QHash<QString, PrefetchedImage>::iterator leastWanted = images.end();
+        int leastPriority = -1;
+        for (QHash<QString, PrefetchedImage>::iterator it = images.begin(); it != images.end(); ++it) {
+            const int imagePriority = priority(it.key());
+            if (imagePriority > leastPriority) {
+                leastPriority = imagePriority;
+                leastWanted = it;
+            }
+        }
+        memoryUsage -= leastWanted->image.sizeInBytes();
+        images.erase(leastWanted);
+    }
+}
+
+void ImagePrefetcher::processQueue() {
+    forever {
+        QString imageFileName;
+        bool isExifRotated;
+        {
+            QMutexLocker locker(&mutex);
+            if (queue.isEmpty()) {
+                --activeWorkers;
+                return;
+            }
+            imageFileName = queue.takeFirst();
+            hintedFiles.remove(imageFileName);
+            isExifRotated = exifRotation;
+            decodingFiles.insert(imageFileName);
+        }
+
+        PrefetchedImage prefetchedImage;
+        prefetchedImage.lastModified = QFileInfo(imageFileName).lastModified().toMSecsSinceEpoch();
+        prefetchedImage.exifRotation = isExifRotated;
+
+        // Animations are played by AnimationSource, and images too big for the budget are left to the viewer
+        MappedFile imageFile(imageFileName);
+        QBuffer imageBuffer;
+        QImageReader imageReader;
+        imageFile.setReaderDevice(imageReader, imageBuffer);
+        const QSize imageSize = imageReader.size();
+        if (imageSize.isValid() && !imageReader.supportsAnimation()
+            && qint64(imageSize.width()) * imageSize.height() * 4 <= PREFETCH_MEMORY_BUDGET) {
+            imageFile.willNeed();
+            if (imageReader.read(&prefetchedImage.image) && isExifRotated) {
+                ImageViewer::rotateByExifOrientation(prefetchedImage.image,
+                                                     metadataCache->getImageOrientation(imageFileName,
+                                                                                        imageFile.data()));
+            }
+        }
+
+        {
+            QMutexLocker locker(&mutex);
+            decodingFiles.remove(imageFileName);
+            if (!prefetchedImage.image.isNull() && isExifRotated == exifRotation
+                && wantedFiles.contains(imageFileName)) {
+                memoryUsage += prefetchedImage.image.sizeInBytes();
+                images.insert(imageFileName, prefetchedImage);
+                evict();
+            }
+            decodeFinished.wakeAll();
+        }
+        emit imageDecoded(imageFileName);
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMAGE_PREFETCHER_H
+#define IMAGE_PREFETCHER_H
+
+#include <QtCore>
+#include <QImage>
+#include <memory>
+#include "MetadataCache.h"
+
+// Decodes the images the viewer is likely to show next on background
+// threads and keeps them within a memory budget, so stepping through a
+// folder or a slide show does not wait for the decoder.
+class ImagePrefetcher : public QObject {
+Q_OBJECT
+
+public:
+    explicit ImagePrefetcher(const std::shared_ptr<MetadataCache> &metadataCache, QObject *parent = nullptr);
+
+    ~ImagePrefetcher() override;
+
+    // Most wanted first, anything else queued or decoded is dropped
+    void prefetch(const QStringList &imageFileNames, bool exifRotation);
+
+    // Decodes the image ahead of everything prefetched, for when it is already on screen
+    void request(const QString &imageFileName, bool exifRotation);
+
+    // Waits for the image if a worker is decoding it right now. The image stays
+    // prefetched until the next call to prefetch() no longer wants it.
+    bool take(const QString &imageFileName, bool exifRotation, QImage &image);
+
+signals:
+
+    // Also sent when the image could not be decoded or kept
+    void imageDecoded(const QString &imageFileName);
+
+private:
+    struct PrefetchedImage {
+        QImage image;
+        qint64 lastModified = 0;
+        bool exifRotation = false;
+    };
+
+    class Worker;
+
+    void processQueue();
+
+    int priority(const QString &imageFileName) const;
+
+    void evict();
+
+    void setExifRotation(bool exifRotation);
+
+    void startWorkers();
+
+    std::shared_ptr<MetadataCache> metadataCache;
+    QThreadPool threadPool;
+    QMutex mutex;
+    QWaitCondition decodeFinished;
+    QString requestedFile;
+    QStringList wantedFiles;
+    QStringList queue;
+    QSet<QString> decodingFiles;
+    // Queued files the system was already asked to read ahead
+    QSet<QString> hintedFiles;
+    QHash<QString, PrefetchedImage> images;
+    qint64 memoryUsage = 0;
+    bool exifRotation = false;
+    int activeWorkers = 0;
+};
+
+#endif // IMAGE_PREFETCHER_H
@@ -17,17 +17,36 @@
  */
 
 #include "ImagePreview.h"
+#include "ImageViewer.h"
 #include "Settings.h"
 #include "ThumbsViewer.h"
+#include "ExifPreview.h"
+#include "ColorTransforms.h"
+#include "MappedFile.h"
 
-#include <QMovie>
+class ImagePreview::Worker : public QRunnable {
+public:
+    explicit Worker(ImagePreview *preview) : preview(preview) {}
 
-ImagePreview::ImagePreview(QWidget *parent) : QWidget(parent)
+    void run() override {
+        preview->processRequests();
+    }
+
+private:
+    ImagePreview *preview;
+};
+
+ImagePreview::ImagePreview(QWidget *parent, const std::shared_ptr<MetadataCache> &metadataCache)
+    : QWidget(parent), metadataCache(metadataCache)
 {
 
     imageLabel = new QLabel;
     imageLabel->setScaledContents(true);
 
+    // Animations are painted over the label, at its size
+    QVBoxLayout *animationLayout = new QVBoxLayout(imageLabel);
+    animationLayout->setContentsMargins(0, 0, 0, 0);
+
     scrollArea = new QScrollArea;
     scrollArea->setContentsMargins(0, 0, 0, 0);
     scrollArea->setAlignment(Qt::AlignCenter);
@@ -46,46 +65,167 @@ ImagePreview::ImagePreview(QWidget *parent) : QWidget(parent)
     setBackgroundColor();
 
     setLayout(mainLayout);
+
+    threadPool.setMaxThreadCount(1);
+    connect(this, &ImagePreview::imageDecoded, this, &ImagePreview::onImageDecoded, Qt::QueuedConnection);
+}
+
+ImagePreview::~ImagePreview() {
+    {
+        QMutexLocker locker(&mutex);
+        pendingRequest = DecodeRequest();
+        ++generation;
+    }
+    threadPool.waitForDone();
 }
 
-QPixmap& ImagePreview::loadImage(QString imageFileName) {
-    if (animation) {
-        delete animation;
+void ImagePreview::loadImage(const QString &imageFileName, const QPixmap &placeholder) {
+    if (animationView) {
+        delete animationView;
     }
 
-    QImageReader imageReader(imageFileName);
+    this->imageFileName = imageFileName;
+    isDecoded = false;
+    isDownscaled = false;
 
-    if (!imageReader.size().isValid()) {
-        previewPixmap = QIcon::fromTheme("image-missing",
-                                         QIcon(":/images/error_image.png")).pixmap(BAD_IMAGE_SIZE, BAD_IMAGE_SIZE);
-    } else if (Settings::enableAnimations && imageReader.supportsAnimation()){
-        animation = new QMovie(imageFileName);
-        animation->setParent(imageLabel);
-        animation->start();
-        imageLabel->setMovie(animation);
-        previewPixmap = animation->currentPixmap();
-    } else {
-        QSize resize = imageReader.size();
-        resize.scale(QSize(imageLabel->width(), imageLabel->height()), Qt::KeepAspectRatio);
+    if (!placeholder.isNull()) {
+        previewPixmap = placeholder;
+        imageLabel->setPixmap(previewPixmap);
+        QSize placeholderSize = previewPixmap.size();
+        placeholderSize.scale(scrollArea->width(), scrollArea->height(), Qt::KeepAspectRatio);
+        imageLabel->setFixedSize(placeholderSize);
+        imageLabel->adjustSize();
+    }
+
+    // A hidden dock is filled when it is shown
+    if (isVisible()) {
+        requestDecode();
+    }
+}
+
+void ImagePreview::requestDecode() {
+    DecodeRequest request;
+    request.imageFileName = imageFileName;
+    request.targetSize = scrollArea->size() * devicePixelRatioF();
+    request.exifRotation = Settings::exifRotationEnabled;
+    request.animations = Settings::enableAnimations;
+
+    QMutexLocker locker(&mutex);
+    pendingRequest = request;
+    ++generation;
+
+    if (!isWorkerRunning) {
+        isWorkerRunning = true;
+        threadPool.start(new Worker(this));
+    }
+}
+
+void ImagePreview::processRequests() {
+    forever {
+        DecodeRequest request;
+        int requestGeneration;
+        {
+            QMutexLocker locker(&mutex);
+            if (pendingRequest.imageFileName.isEmpty()) {
+                isWorkerRunning = false;
+                return;
+            }
+            request = pendingRequest;
+            pendingRequest = DecodeRequest();
+            requestGeneration = generation;
+        }
+
+        MappedFile imageFile(request.imageFileName);
+        QBuffer imageBuffer;
+        QImageReader imageReader;
+        imageFile.setReaderDevice(imageReader, imageBuffer);
+        QSize imageSize = imageReader.size();
         QImage previewImage;
-        imageReader.read(&previewImage);
-        if (Settings::exifRotationEnabled) {
-            imageViewer->rotateByExifRotation(previewImage, imageFileName);
+        bool isAnimated = false;
+        bool isImageDownscaled = false;
+
+        if (imageSize.isValid()) {
+            // The first frame of an animation is decoded like any image, to size the preview by
+            isAnimated = request.animations && imageReader.supportsAnimation() && imageReader.imageCount() > 1;
+            const long orientation = request.exifRotation && !isAnimated
+                                     ? metadataCache->getImageOrientation(request.imageFileName, imageFile.data())
+                                     : 0;
+
+            // Orientations from 5 on turn the image by 90 degrees
+            QSize targetSize = request.targetSize;
+            if (orientation >= 5) {
+                targetSize.transpose();
+            }
+            if (!targetSize.isEmpty()
+                && (imageSize.width() > targetSize.width() || imageSize.height() > targetSize.height())) {
+                imageSize.scale(targetSize, Qt::KeepAspectRatio);
+                imageReader.setScaledSize(imageSize);
+                isImageDownscaled = true;
+            }
+
+            if (imageReader.read(&previewImage) && orientation) {
+                ImageViewer::rotateByExifOrientation(previewImage, orientation);
+            }
+        } else if (ExifPreview::isRawFile(request.imageFileName)) {
+            // No RAW decoder, the embedded preview is the image
+            QSize rawSize;
+            QByteArray data = ExifPreview::extract(request.imageFileName, request.targetSize, Qt::KeepAspectRatio,
+                                                   rawSize, imageFile.data());
+            if (data.isEmpty()) {
+                data = ExifPreview::extractLargest(request.imageFileName, rawSize, imageFile.data());
+            }
+            if (previewImage.loadFromData(data) && request.exifRotation) {
+                ImageViewer::rotateByExifOrientation(previewImage,
+                                                     metadataCache->getImageOrientation(request.imageFileName,
+                                                                                        imageFile.data()));
+            }
         }
-        previewPixmap = QPixmap::fromImage(previewImage);
+
+        ColorTransforms::convert(previewImage, ColorTransforms::displayColorSpace());
+        if (requestGeneration == generation) {
+            emit imageDecoded(requestGeneration, previewImage, isAnimated, isImageDownscaled);
+        }
+    }
+}
+
+void ImagePreview::onImageDecoded(int generation, const QImage &image, bool isAnimated, bool isDownscaled) {
+    if (generation != this->generation) {
+        return;
     }
-    if (animation) {
-        imageLabel->setMovie(animation);
+
+    isDecoded = true;
+    this->isDownscaled = isDownscaled;
+
+    if (isAnimated && !image.isNull()) {
+        previewPixmap = QPixmap::fromImage(image);
+        imageLabel->clear();
+        animationView = new AnimationView(imageLabel);
+        imageLabel->layout()->addWidget(animationView);
+        animationView->setSource(AnimationSource::forFile(imageFileName), previewPixmap);
+    } else if (image.isNull()) {
+        previewPixmap = QIcon::fromTheme("image-missing",
+                                         QIcon(":/images/error_image.png")).pixmap(BAD_IMAGE_SIZE, BAD_IMAGE_SIZE);
+        imageLabel->setPixmap(previewPixmap);
     } else {
+        previewPixmap = QPixmap::fromImage(image);
         imageLabel->setPixmap(previewPixmap);
     }
 
     resizeImagePreview();
-    return previewPixmap;
+    emit imageLoaded(previewPixmap);
 }
 
 void ImagePreview::clear() {
+    if (animationView) {
+        delete animationView;
+    }
     imageLabel->clear();
+    imageFileName.clear();
+    isDecoded = false;
+
+    QMutexLocker locker(&mutex);
+    pendingRequest = DecodeRequest();
+    ++generation;
 }
 
 void ImagePreview::resizeImagePreview()
@@ -103,6 +243,22 @@ void ImagePreview::resizeImagePreview()
 void ImagePreview::resizeEvent(QResizeEvent *event) {
     QWidget::resizeEvent(event);
     resizeImagePreview();
+
+    // Decoded for a smaller dock, decode again so it does not get blurry
+    if (isDecoded && isDownscaled && !animationView) {
+        QSize fittedSize = previewPixmap.size();
+        fittedSize.scale(scrollArea->size() * devicePixelRatioF(), Qt::KeepAspectRatio);
+        if (fittedSize.width() > previewPixmap.width()) {
+            requestDecode();
+        }
+    }
+}
+
+void ImagePreview::showEvent(QShowEvent *event) {
+    QWidget::showEvent(event);
+    if (!isDecoded && !imageFileName.isEmpty()) {
+        requestDecode();
+    }
 }
 
 void ImagePreview::setBackgroundColor() {
@@ -113,7 +269,3 @@ void ImagePreview::setBackgroundColor() {
     QString ss = "QWidget { " + bgColor + " }";
     scrollArea->setStyleSheet(ss);
 }
-
-void ImagePreview::setImageViewer(ImageViewer *imageViewer) {
-    this->imageViewer = imageViewer;
-}
@@ -20,15 +20,24 @@
 #define IMAGE_PREVIEW_H
 
 #include <QtWidgets>
-#include "ImageViewer.h"
+#include <atomic>
+#include <memory>
+#include "MetadataCache.h"
+#include "AnimationView.h"
 
+// Shows the selected image in the preview dock. Images are decoded at the
+// size of the dock on a background thread, a newer image drops the one in
+// flight. A thumbnail can stand in until the decode is done. Animations play
+// from the same AnimationSource as the viewer's.
 class ImagePreview : public QWidget {
 Q_OBJECT
 
 public:
-    ImagePreview(QWidget *parent);
+    ImagePreview(QWidget *parent, const std::shared_ptr<MetadataCache> &metadataCache);
 
-    QPixmap &loadImage(QString imageFileName);
+    ~ImagePreview() override;
+
+    void loadImage(const QString &imageFileName, const QPixmap &placeholder = QPixmap());
 
     void resizeImagePreview();
 
@@ -36,19 +45,51 @@ public:
 
     void clear();
 
-    void setImageViewer(ImageViewer *imageViewer);
-
     QScrollArea *scrollArea;
 
+signals:
+
+    void imageLoaded(const QPixmap &pixmap);
+
+    // From the decode thread to the GUI thread
+    void imageDecoded(int generation, const QImage &image, bool isAnimated, bool isDownscaled);
+
 protected:
     void resizeEvent(QResizeEvent *event) override;
 
+    void showEvent(QShowEvent *event) override;
+
+private slots:
+
+    void onImageDecoded(int generation, const QImage &image, bool isAnimated, bool isDownscaled);
+
 private:
+    struct DecodeRequest {
+        QString imageFileName;
+        QSize targetSize;
+        bool exifRotation = false;
+        bool animations = false;
+    };
+
+    class Worker;
+
+    void requestDecode();
+
+    void processRequests();
+
+    std::shared_ptr<MetadataCache> metadataCache;
     QLabel *imageLabel;
     QPixmap previewPixmap;
-    ImageViewer *imageViewer;
-    QPointer<QMovie> animation;
+    QPointer<AnimationView> animationView;
+    QString imageFileName;
+    bool isDecoded = false;
+    bool isDownscaled = false;
 
+    QThreadPool threadPool;
+    QMutex mutex;
+    DecodeRequest pendingRequest;
+    bool isWorkerRunning = false;
+    std::atomic<int> generation{0};
 };
 
 #endif // IMAGE_PREVIEW_H
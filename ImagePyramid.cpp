@@ -0,0 +1,206 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ImagePyramid.h"
+
+#define PYRAMID_TILE_SIZE 512
+#define PYRAMID_MIN_SIZE 2048
+
+class ImagePyramid::Worker : public QRunnable {
+public:
+    explicit Worker(ImagePyramid *pyramid) : pyramid(pyramid) {}
+
+    void run() override {
+        pyramid->build();
+    }
+
+private:
+    ImagePyramid *pyramid;
+};
+
+ImagePyramid::ImagePyramid(QObject *parent) : QObject(parent) {
+    threadPool.setMaxThreadCount(1);
+}
+
+ImagePyramid::~ImagePyramid() {
+    setImage(QImage());
+    threadPool.waitForDone();
+}
+
+void ImagePyramid::setImage(const QImage &image) {
+    QMutexLocker locker(&mutex);
+    this->image = image;
+    levels.clear();
+    wantedLevels = 0;
+    ++generation;
+}
+
+int ImagePyramid::levelFor(qreal scale) {
+    QMutexLocker locker(&mutex);
+    const int imageSize = qMax(image.width(), image.height());
+    if (imageSize < PYRAMID_MIN_SIZE) {
+        return 0;
+    }
+
+    // Each level is half the size of the one above, stop once it fits into a tile
+    int level = 0;
+    while (scale <= 0.5 && (imageSize >> (level + 1)) >= PYRAMID_TILE_SIZE) {
+        scale *= 2;
+        ++level;
+    }
+
+    if (level > levels.size() && level > wantedLevels) {
+        wantedLevels = level;
+        if (!isBuilding) {
+            isBuilding = true;
+            threadPool.start(new Worker(this));
+        }
+    }
+    return qMin(level, levels.size());
+}
+
+void ImagePyramid::draw(QPainter &painter, const QRectF &targetRect, const QRectF &sourceRect, int level) {
+    if (level == 0) {
+        painter.drawImage(targetRect, image, sourceRect);
+        return;
+    }
+
+    Level pyramidLevel;
+    QSize imageSize;
+    {
+        QMutexLocker locker(&mutex);
+        if (level > levels.size()) {
+            return;
+        }
+        pyramidLevel = levels.at(level - 1);
+        imageSize = image.size();
+    }
+
+    const qreal scaleX = qreal(pyramidLevel.size.width()) / imageSize.width();
+    const qreal scaleY = qreal(pyramidLevel.size.height()) / imageSize.height();
+    const QRectF levelRect(sourceRect.x() * scaleX, sourceRect.y() * scaleY,
+                           sourceRect.width() * scaleX, sourceRect.height() * scaleY);
+    if (levelRect.isEmpty()) {
+        return;
+    }
+    const qreal targetScaleX = targetRect.width() / levelRect.width();
+    const qreal targetScaleY = targetRect.height() / levelRect.height();
+
+    const int firstColumn = qMax(0, int(levelRect.left() / PYRAMID_TILE_SIZE));
+    const int lastColumn = qMin(pyramidLevel.columns - 1, int(levelRect.right() / PYRAMID_TILE_SIZE));
+    const int firstRow = qMax(0, int(levelRect.top() / PYRAMID_TILE_SIZE));
+    const int lastRow = qMin(pyramidLevel.rows - 1, int(levelRect.bottom() / PYRAMID_TILE_SIZE));
+
+    painter.save();
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    for (int row = firstRow; row <= lastRow; ++row) {
+        for (int column = firstColumn; column <= lastColumn; ++column) {
+            const QImage &tile = pyramidLevel.tiles.at(row * pyramidLevel.columns + column);
+            const QRectF tileRect(column * PYRAMID_TILE_SIZE, row * PYRAMID_TILE_SIZE, tile.width(), tile.height());
+            const QRectF part = tileRect & levelRect;
+            if (part.isEmpty()) {
+                continue;
+            }
+            const QRectF target(targetRect.x() + (part.x() - levelRect.x()) * targetScaleX,
+                                targetRect.y() + (part.y() - levelRect.y()) * targetScaleY,
+                                part.width() * targetScaleX, part.height() * targetScaleY);
+            painter.drawImage(target, tile, part.translated(-tileRect.topLeft()));
+        }
+    }
+    painter.restore();
+}
+
+void ImagePyramid::build() {
+    forever {
+        QImage source;
+        Level previous;
+        int buildGeneration;
+        {
+            QMutexLocker locker(&mutex);
+            if (levels.size() >= wantedLevels) {
+                isBuilding = false;
+                return;
+            }
+            source = image;
+            if (!levels.isEmpty()) {
+                previous = levels.last();
+            }
+            buildGeneration = generation;
+        }
+
+        Level level;
+        if (!buildLevel(source, previous, buildGeneration, level)) {
+            continue;
+        }
+
+        {
+            QMutexLocker locker(&mutex);
+            if (buildGeneration != generation) {
+                continue;
+            }
+            levels.append(level);
+        }
+        emit levelReady();
+    }
+}
+
+// Each tile is a 2x2 block of the level above scaled to half, so only a
+// couple of tiles are ever decoded into a scratch image at once
+bool ImagePyramid::buildLevel(const QImage &source, const Level &previous, int buildGeneration, Level &level) {
+    const QSize sourceSize = previous.tiles.isEmpty() ? source.size() : previous.size;
+    const QImage::Format format = source.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied
+                                                           : QImage::Format_RGB32;
+
+    level.size = QSize((sourceSize.width() + 1) / 2, (sourceSize.height() + 1) / 2);
+    level.columns = (level.size.width() + PYRAMID_TILE_SIZE - 1) / PYRAMID_TILE_SIZE;
+    level.rows = (level.size.height() + PYRAMID_TILE_SIZE - 1) / PYRAMID_TILE_SIZE;
+    level.tiles.reserve(level.columns * level.rows);
+
+    for (int row = 0; row < level.rows; ++row) {
+        for (int column = 0; column < level.columns; ++column) {
+            if (buildGeneration != generation) {
+                return false;
+            }
+
+            const QRect region = QRect(column * 2 * PYRAMID_TILE_SIZE, row * 2 * PYRAMID_TILE_SIZE,
+                                       2 * PYRAMID_TILE_SIZE, 2 * PYRAMID_TILE_SIZE) & QRect(QPoint(), sourceSize);
+            QImage block;
+            if (previous.tiles.isEmpty()) {
+                block = source.copy(region).convertToFormat(format);
+            } else {
+                block = QImage(region.size(), format);
+                QPainter painter(&block);
+                painter.setCompositionMode(QPainter::CompositionMode_Source);
+                for (int y = 0; y < 2; ++y) {
+                    for (int x = 0; x < 2; ++x) {
+                        const int previousColumn = column * 2 + x;
+                        const int previousRow = row * 2 + y;
+                        if (previousColumn < previous.columns && previousRow < previous.rows) {
+                            painter.drawImage(x * PYRAMID_TILE_SIZE, y * PYRAMID_TILE_SIZE,
+                                              previous.tiles.at(previousRow * previous.columns + previousColumn));
+                        }
+                    }
+                }
+            }
+
+            level.tiles.append(block.scaled((region.width() + 1) / 2, (region.height() + 1) / 2,
+                                            Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+        }
+    }
+    return true;
+}
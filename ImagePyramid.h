@@ -0,0 +1,75 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMAGE_PYRAMID_H
+#define IMAGE_PYRAMID_H
+
+#include <QtCore>
+#include <QImage>
+#include <QPainter>
+#include <atomic>
+
+// Halved copies of a large image, cut into tiles and built on a background
+// thread the first time a zoom level needs them. Drawing a zoomed out view
+// then only touches the tiles on screen at about screen resolution.
+class ImagePyramid : public QObject {
+Q_OBJECT
+
+public:
+    explicit ImagePyramid(QObject *parent = nullptr);
+
+    ~ImagePyramid() override;
+
+    // Levels of the previous image are dropped, nothing is built yet
+    void setImage(const QImage &image);
+
+    // The best level already built for drawing at scale, 0 being the image itself.
+    // Missing levels are queued and levelReady() is sent when one is done.
+    int levelFor(qreal scale);
+
+    // sourceRect is in image coordinates whatever the level
+    void draw(QPainter &painter, const QRectF &targetRect, const QRectF &sourceRect, int level);
+
+signals:
+
+    void levelReady();
+
+private:
+    struct Level {
+        QSize size;
+        int columns = 0;
+        int rows = 0;
+        QVector<QImage> tiles;
+    };
+
+    class Worker;
+
+    void build();
+
+    bool buildLevel(const QImage &source, const Level &previous, int generation, Level &level);
+
+    QThreadPool threadPool;
+    QMutex mutex;
+    QImage image;
+    QVector<Level> levels;
+    int wantedLevels = 0;
+    bool isBuilding = false;
+    std::atomic<int> generation{0};
+};
+
+#endif // IMAGE_PYRAMID_H
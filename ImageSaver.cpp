@@ -0,0 +1,159 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <exiv2/exiv2.hpp>
+#include "ImageSaver.h"
+#include "Exiv2Init.h"
+#include "LosslessTransform.h"
+
+class ImageSaver::Worker : public QRunnable {
+public:
+    explicit Worker(ImageSaver *saver) : saver(saver) {}
+
+    void run() override {
+        saver->processQueue();
+    }
+
+private:
+    ImageSaver *saver;
+};
+
+ImageSaver::ImageSaver(const std::shared_ptr<MetadataCache> &metadataCache, QObject *parent)
+    : QObject(parent), metadataCache(metadataCache) {
+    Exiv2Init::ensure();
+    threadPool.setMaxThreadCount(1);
+}
+
+ImageSaver::~ImageSaver() {
+    threadPool.waitForDone();
+}
+
+void ImageSaver::save(const SaveRequest &request) {
+    QMutexLocker locker(&mutex);
+    queue.append(request);
+    if (!isWorkerRunning) {
+        isWorkerRunning = true;
+        threadPool.start(new Worker(this));
+    }
+}
+
+void ImageSaver::processQueue() {
+    forever {
+        SaveRequest request;
+        {
+            QMutexLocker locker(&mutex);
+            if (queue.isEmpty()) {
+                isWorkerRunning = false;
+                return;
+            }
+            request = queue.takeFirst();
+        }
+
+        const SaveResult result = saveImage(request);
+        emit imageSaved(request.savePath, result);
+    }
+}
+
+ImageSaver::SaveResult ImageSaver::saveImage(const SaveRequest &request) {
+    if (request.orientation > 0
+        && LosslessTransform::saveOrientation(request.sourcePath, request.savePath, request.orientation)) {
+        metadataCache->removeImage(request.savePath);
+        return Saved;
+    }
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#if EXIV2_TEST_VERSION(0,28,0)
+    Exiv2::Image::UniquePtr sourceImage;
+#else
+    Exiv2::Image::AutoPtr sourceImage;
+#endif
+#pragma clang diagnostic pop
+
+    ImageMetadata imageMetadata;
+    if (!request.sourcePath.isEmpty()) try {
+        sourceImage = Exiv2::ImageFactory::open(request.sourcePath.toStdString());
+        sourceImage->readMetadata();
+        MetadataCache::readImageMetadata(*sourceImage, imageMetadata);
+    }
+    catch (const Exiv2::Error &error) {
+        qWarning() << "EXIV2:" << error.what();
+        sourceImage.reset();
+    }
+
+    const QByteArray format = request.format.isEmpty() ? QFileInfo(request.savePath).suffix().toLower().toLatin1()
+                                                       : request.format;
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    QImageWriter imageWriter(&buffer, format);
+    imageWriter.setQuality(request.quality);
+    if (!imageWriter.write(request.image)) {
+        qWarning() << "Unable to encode" << request.savePath << imageWriter.errorString();
+        return Failed;
+    }
+    buffer.close();
+
+    bool isMetadataSaved = !sourceImage;
+    if (sourceImage) {
+        try {
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#if EXIV2_TEST_VERSION(0,28,0)
+            Exiv2::Image::UniquePtr savedImage = Exiv2::ImageFactory::open(
+                    reinterpret_cast<const Exiv2::byte *>(data.constData()), data.size());
+#else
+            Exiv2::Image::AutoPtr savedImage = Exiv2::ImageFactory::open(
+                    reinterpret_cast<const Exiv2::byte *>(data.constData()), data.size());
+#endif
+#pragma clang diagnostic pop
+            savedImage->setMetadata(*sourceImage);
+            if (request.resetOrientation && imageMetadata.orientation > 1) {
+                savedImage->exifData()["Exif.Image.Orientation"] = uint16_t(1);
+                imageMetadata.orientation = 1;
+            }
+            // The embedded thumbnail still shows the pixels before the edit
+            Exiv2::ExifThumb thumb(savedImage->exifData());
+            thumb.erase();
+            savedImage->writeMetadata();
+
+            Exiv2::BasicIo &io = savedImage->io();
+            io.open();
+            data = QByteArray(reinterpret_cast<const char *>(io.mmap()), int(io.size()));
+            io.munmap();
+            io.close();
+            isMetadataSaved = true;
+        }
+        catch (const Exiv2::Error &error) {
+            qWarning() << "Failed to save Exif metadata:" << error.what();
+        }
+    }
+
+    // Readers never see a half written image
+    QSaveFile saveFile(request.savePath);
+    if (!saveFile.open(QIODevice::WriteOnly) || saveFile.write(data) != data.size() || !saveFile.commit()) {
+        qWarning() << "Unable to save" << request.savePath << saveFile.errorString();
+        return Failed;
+    }
+
+    metadataCache->removeImage(request.savePath);
+    if (sourceImage && isMetadataSaved) {
+        metadataCache->insertReadImageMetadata(request.savePath, imageMetadata);
+    }
+    return isMetadataSaved || !request.requireMetadata ? Saved : SavedWithoutMetadata;
+}
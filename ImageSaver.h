@@ -0,0 +1,82 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMAGE_SAVER_H
+#define IMAGE_SAVER_H
+
+#include <QtCore>
+#include <QImage>
+#include <memory>
+#include "MetadataCache.h"
+
+struct SaveRequest
+{
+    QString sourcePath;
+    QString savePath;
+    // Empty to go by the suffix of savePath
+    QByteArray format;
+    int quality = -1;
+    QImage image;
+    // Above 0 the pixels of the source are kept and only this orientation tag is written,
+    // image is encoded if that fails
+    int orientation = 0;
+    // The pixels were turned upright by their orientation, which must not be applied again
+    bool resetOrientation = false;
+    // Whether losing the metadata of the source counts as a failure to report
+    bool requireMetadata = false;
+};
+
+// Writes edited images on a background thread, one at a time so saves to the same
+// file keep their order. The pixels are encoded in memory and given the metadata of
+// the source there, so the file is written in one go and never read back.
+class ImageSaver : public QObject {
+Q_OBJECT
+
+public:
+    enum SaveResult {
+        Saved,
+        SavedWithoutMetadata,
+        Failed
+    };
+
+    explicit ImageSaver(const std::shared_ptr<MetadataCache> &metadataCache, QObject *parent = nullptr);
+
+    // Pending saves are finished first
+    ~ImageSaver() override;
+
+    void save(const SaveRequest &request);
+
+signals:
+
+    void imageSaved(const QString &savePath, int result);
+
+private:
+    class Worker;
+
+    void processQueue();
+
+    SaveResult saveImage(const SaveRequest &request);
+
+    std::shared_ptr<MetadataCache> metadataCache;
+    QThreadPool threadPool;
+    QMutex mutex;
+    QList<SaveRequest> queue;
+    bool isWorkerRunning = false;
+};
+
+#endif // IMAGE_SAVER_H
@@ -16,14 +16,22 @@
  *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include "ImageViewer.h"
 #include "Phototonic.h"
 #include "MessageBox.h"
+#include "ThumbnailLoader.h"
+#include "ExifPreview.h"
+#include "LosslessTransform.h"
+#include "BatchTransform.h"
+#include "PerfCounters.h"
+#include "ColorTransforms.h"
+#include "Resampler.h"
 
 #define CLIPBOARD_IMAGE_NAME "clipboard.png"
-#define ROUND(x) ((int) ((x) + 0.5))
-#define MAX(a, b) ((a) > (b) ? (a) : (b))
-#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define PREVIEW_THUMB_SIZE 1024
+#define PREVIEW_ASPECT_TOLERANCE 0.02
+#define REFRESH_STAGES_MEMORY (256 * 1024 * 1024)
 
 namespace { // anonymous, not visible outside of this file
 Q_DECLARE_LOGGING_CATEGORY(PHOTOTONIC_EXIV2_LOG)
@@ -71,11 +79,15 @@ ImageViewer::ImageViewer(QWidget *parent, const std::shared_ptr<MetadataCache> &
 
     this->phototonic = (Phototonic *) parent;
     this->metadataCache = metadataCache;
+    ImagePopUpMenu = nullptr;
+    imagePrefetcher.reset(new ImagePrefetcher(metadataCache));
+    connect(imagePrefetcher.get(), SIGNAL(imageDecoded(QString)), this, SLOT(onImageDecoded(QString)));
+    imageSaver = new ImageSaver(metadataCache, this);
+    connect(imageSaver, SIGNAL(imageSaved(QString, int)), this, SLOT(onImageSaved(QString, int)));
     cursorIsHidden = false;
     moveImageLocked = false;
     mirrorLayout = LayNone;
     imageWidget = new ImageWidget;
-    animation = nullptr;
 
     scrollArea = new MyScrollArea;
     scrollArea->setContentsMargins(0, 0, 0, 0);
@@ -157,8 +169,8 @@ void ImageViewer::resizeImage() {
         return;
     }
     QSize imageSize;
-    if (animation) {
-        imageSize = animation->currentPixmap().size();
+    if (movieWidget) {
+        imageSize = movieWidget->frameSize();
     } else if (imageWidget) {
         imageSize = imageWidget->imageSize();
     } else {
@@ -306,8 +318,12 @@ void ImageViewer::centerImage(QSize &imgSize) {
 }
 
 void ImageViewer::rotateByExifRotation(QImage &image, QString &imageFullPath) {
+    rotateByExifOrientation(image, metadataCache->getImageOrientation(imageFullPath));
+}
+
+// Right angle turns move pixels exactly, there is nothing to smooth
+void ImageViewer::rotateByExifOrientation(QImage &image, long orientation) {
     QTransform trans;
-    long orientation = metadataCache->getImageOrientation(imageFullPath);
 
     switch (orientation) {
         case 1:
@@ -317,339 +333,381 @@ void ImageViewer::rotateByExifRotation(QImage &image, QString &imageFullPath) {
             break;
         case 3:
             trans.rotate(180);
-            image = image.transformed(trans, Qt::SmoothTransformation);
+            image = image.transformed(trans, Qt::FastTransformation);
             break;
         case 4:
             image = image.mirrored(false, true);
             break;
         case 5:
             trans.rotate(90);
-            image = image.transformed(trans, Qt::SmoothTransformation);
+            image = image.transformed(trans, Qt::FastTransformation);
             image = image.mirrored(true, false);
             break;
         case 6:
             trans.rotate(90);
-            image = image.transformed(trans, Qt::SmoothTransformation);
+            image = image.transformed(trans, Qt::FastTransformation);
             break;
         case 7:
             trans.rotate(90);
-            image = image.transformed(trans, Qt::SmoothTransformation);
+            image = image.transformed(trans, Qt::FastTransformation);
             image = image.mirrored(false, true);
             break;
         case 8:
             trans.rotate(270);
-            image = image.transformed(trans, Qt::SmoothTransformation);
+            image = image.transformed(trans, Qt::FastTransformation);
             break;
         default:
             break;
     }
 }
 
-void ImageViewer::transform() {
-    if (!qFuzzyCompare(Settings::rotation, 0)) {
-        QTransform trans;
-        trans.rotate(Settings::rotation);
-        viewerImage = viewerImage.transformed(trans, Qt::SmoothTransformation);
-    }
+// Absolute crops are in full resolution pixels, pixelScale maps them onto a proxy
+void ImageViewer::transform(qreal pixelScale) {
+    TransformRecipe::fromSettings().transform(viewerImage, pixelScale);
+}
 
-    if (Settings::flipH || Settings::flipV) {
-        viewerImage = viewerImage.mirrored(Settings::flipH, Settings::flipV);
-    }
+QVector<MirrorCell> ImageViewer::mirrorCells() const {
+    switch (mirrorLayout) {
+        case LayDual:
+            return {{0, 0, false, false}, {1, 0, true, false}};
+        case LayTriple:
+            return {{0, 0, false, false}, {1, 0, true, false}, {2, 0, false, false}};
+        case LayQuad:
+            return {{0, 0, false, false}, {1, 0, true, false}, {0, 1, false, true}, {1, 1, true, true}};
+        case LayVDual:
+            return {{0, 0, false, false}, {0, 1, false, true}};
+    }
+    return QVector<MirrorCell>();
+}
 
-    int cropLeftPercentPixels = 0, cropTopPercentPixels = 0, cropWidthPercentPixels = 0, cropHeightPercentPixels = 0;
-    bool croppingOn = false;
-    if (Settings::cropLeftPercent || Settings::cropTopPercent
-        || Settings::cropWidthPercent || Settings::cropHeightPercent) {
-        croppingOn = true;
-        cropLeftPercentPixels = (viewerImage.width() * Settings::cropLeftPercent) / 100;
-        cropTopPercentPixels = (viewerImage.height() * Settings::cropTopPercent) / 100;
-        cropWidthPercentPixels = (viewerImage.width() * Settings::cropWidthPercent) / 100;
-        cropHeightPercentPixels = (viewerImage.height() * Settings::cropHeightPercent) / 100;
+// The image widget only draws mirror layouts, this is for when they have to be saved or copied
+QImage ImageViewer::mirroredImage() const {
+    const QVector<MirrorCell> cells = mirrorCells();
+    if (cells.isEmpty()) {
+        return viewerImage;
     }
 
-    if (Settings::cropLeft || Settings::cropTop || Settings::cropWidth || Settings::cropHeight) {
-        viewerImage = viewerImage.copy(
-                Settings::cropLeft + cropLeftPercentPixels,
-                Settings::cropTop + cropTopPercentPixels,
-                viewerImage.width() - Settings::cropLeft - Settings::cropWidth - cropLeftPercentPixels -
-                cropWidthPercentPixels,
-                viewerImage.height() - Settings::cropTop - Settings::cropHeight - cropTopPercentPixels -
-                cropHeightPercentPixels);
-    } else {
-        if (croppingOn) {
-            viewerImage = viewerImage.copy(
-                    cropLeftPercentPixels,
-                    cropTopPercentPixels,
-                    viewerImage.width() - cropLeftPercentPixels - cropWidthPercentPixels,
-                    viewerImage.height() - cropTopPercentPixels - cropHeightPercentPixels);
-        }
+    const QSize grid = ImageWidget::mirrorGrid(cells);
+    QImage image(viewerImage.width() * grid.width(), viewerImage.height() * grid.height(), QImage::Format_ARGB32);
+    QPainter painter(&image);
+    for (const MirrorCell &cell : cells) {
+        painter.drawImage(cell.column * viewerImage.width(), cell.row * viewerImage.height(),
+                          viewerImage.mirrored(cell.flipH, cell.flipV));
     }
+    return image;
 }
 
-void ImageViewer::mirror() {
-    switch (mirrorLayout) {
-        case LayDual: {
-            mirrorImage = QImage(viewerImage.width() * 2, viewerImage.height(),
-                                 QImage::Format_ARGB32);
-            QPainter painter(&mirrorImage);
-            painter.drawImage(0, 0, viewerImage);
-            painter.drawImage(viewerImage.width(), 0, viewerImage.mirrored(true, false));
-            break;
-        }
-
-        case LayTriple: {
-            mirrorImage = QImage(viewerImage.width() * 3, viewerImage.height(),
-                                 QImage::Format_ARGB32);
-            QPainter painter(&mirrorImage);
-            painter.drawImage(0, 0, viewerImage);
-            painter.drawImage(viewerImage.width(), 0, viewerImage.mirrored(true, false));
-            painter.drawImage(viewerImage.width() * 2, 0, viewerImage.mirrored(false, false));
-            break;
-        }
-
-        case LayQuad: {
-            mirrorImage = QImage(viewerImage.width() * 2, viewerImage.height() * 2,
-                                 QImage::Format_ARGB32);
-            QPainter painter(&mirrorImage);
-            painter.drawImage(0, 0, viewerImage);
-            painter.drawImage(viewerImage.width(), 0, viewerImage.mirrored(true, false));
-            painter.drawImage(0, viewerImage.height(), viewerImage.mirrored(false, true));
-            painter.drawImage(viewerImage.width(), viewerImage.height(),
-                              viewerImage.mirrored(true, true));
-            break;
-        }
-
-        case LayVDual: {
-            mirrorImage = QImage(viewerImage.width(), viewerImage.height() * 2,
-                                 QImage::Format_ARGB32);
-            QPainter painter(&mirrorImage);
-            painter.drawImage(0, 0, viewerImage);
-            painter.drawImage(0, viewerImage.height(), viewerImage.mirrored(false, true));
-            break;
-        }
-    }
+void ImageViewer::colorize() {
+    Perf::ScopedTimer timer(Perf::ViewerColorize);
+    ColorEngine::apply(viewerImage, TransformRecipe::colorsFromSettings());
+}
 
-    viewerImage = mirrorImage;
+void ImageViewer::refresh() {
+    Perf::ScopedTimer timer(Perf::ViewerRefresh);
+    refreshImage(proxyPreviewUsers > 0);
 }
 
-static inline int bound0To255(int val) {
-    return ((val > 255) ? 255 : (val < 0) ? 0 : val);
+static QByteArray colorAdjustmentKey(const ColorAdjustment &colorAdjustment) {
+    QByteArray key;
+    QDataStream stream(&key, QIODevice::WriteOnly);
+    stream << colorAdjustment.negateRed << colorAdjustment.negateGreen << colorAdjustment.negateBlue
+           << colorAdjustment.red << colorAdjustment.green << colorAdjustment.blue
+           << colorAdjustment.brightness << colorAdjustment.contrast << colorAdjustment.colorize
+           << colorAdjustment.hue << colorAdjustment.saturation << colorAdjustment.lightness
+           << colorAdjustment.hueRedChannel << colorAdjustment.hueGreenChannel << colorAdjustment.hueBlueChannel;
+    return key;
 }
 
-static inline int hslValue(double n1, double n2, double hue) {
-    double value;
+// Each stage's key extends the one before it, so only the stages after a changed setting run again
+void ImageViewer::refreshImage(bool useProxy) {
+    if (!imageWidget) {
+        return;
+    }
+    finishPreview();
 
-    if (hue > 255) {
-        hue -= 255;
-    } else if (hue < 0) {
-        hue += 255;
+    QImage sourceImage = origImage;
+    qreal pixelScale = 1;
+    isShowingProxy = useProxy && updateProxyImage();
+    if (isShowingProxy) {
+        sourceImage = proxyImage;
+        pixelScale = qreal(proxyImage.width()) / origImage.width();
     }
 
-    if (hue < 42.5) {
-        value = n1 + (n2 - n1) * (hue / 42.5);
-    } else if (hue < 127.5) {
-        value = n2;
-    } else if (hue < 170) {
-        value = n1 + (n2 - n1) * ((170 - hue) / 42.5);
-    } else {
-        value = n1;
+    QByteArray key;
+    {
+        QDataStream stream(&key, QIODevice::WriteOnly);
+        stream << sourceImage.cacheKey() << Settings::scaledWidth << Settings::scaledHeight;
+    }
+    if (!restoreStage(ScaledStage, key)) {
+        viewerImage = sourceImage;
+        TransformRecipe::fromSettings().scale(viewerImage, pixelScale);
+        storeStage(ScaledStage, key);
     }
 
-    return ROUND(value * 255.0);
-}
+    {
+        QDataStream stream(&key, QIODevice::Append);
+        stream << Settings::rotation << Settings::flipH << Settings::flipV
+               << Settings::cropLeft << Settings::cropTop << Settings::cropWidth << Settings::cropHeight
+               << Settings::cropLeftPercent << Settings::cropTopPercent
+               << Settings::cropWidthPercent << Settings::cropHeightPercent;
+    }
+    if (!restoreStage(TransformedStage, key)) {
+        transform(pixelScale);
+        storeStage(TransformedStage, key);
+    }
 
-void rgbToHsl(int r, int g, int b, unsigned char *hue, unsigned char *sat, unsigned char *light) {
-    double h, s, l;
-    int min, max;
-    int delta;
+    imageWidget->setGLBackend(Settings::openGLViewer);
+    const bool isAdjustingColors = Settings::colorsActive || Settings::keepTransform;
+    const bool isAdjustingColorsOnGPU = isAdjustingColors && imageWidget->hasGLBackend();
+    if (isAdjustingColors && !isAdjustingColorsOnGPU) {
+        key += colorAdjustmentKey(TransformRecipe::colorsFromSettings());
+        if (!restoreStage(ColorizedStage, key)) {
+            colorize();
+            storeStage(ColorizedStage, key);
+        }
+    }
 
-    if (r > g) {
-        max = MAX(r, b);
-        min = MIN(g, b);
-    } else {
-        max = MAX(g, b);
-        min = MIN(r, b);
+    // Laid out at the size the full resolution pass will have
+    QSize displaySize;
+    if (isShowingProxy) {
+        displaySize = QSize(qRound(viewerImage.width() / pixelScale), qRound(viewerImage.height() / pixelScale));
     }
 
-    l = (max + min) / 2.0;
+    setImage(viewerImage, displaySize);
+    isColorizePending = isAdjustingColorsOnGPU
+                        && imageWidget->setColorAdjustment(TransformRecipe::colorsFromSettings());
+    resizeImage();
+}
 
-    if (max == min) {
-        s = 0.0;
-        h = 0.0;
-    } else {
-        delta = (max - min);
+bool ImageViewer::restoreStage(int stage, const QByteArray &key) {
+    if (stageKeys[stage] != key || stageImages[stage].isNull()) {
+        return false;
+    }
+    viewerImage = stageImages[stage];
+    return true;
+}
 
-        if (l < 128) {
-            s = 255 * (double) delta / (double) (max + min);
-        } else {
-            s = 255 * (double) delta / (double) (511 - max - min);
+// Stages nearest the output are the most likely to be reused, earlier ones go first when over the cap.
+// Images that are shared with one still in use cost nothing to keep.
+void ImageViewer::storeStage(int stage, const QByteArray &key) {
+    stageKeys[stage] = key;
+    stageImages[stage] = viewerImage;
+    for (int later = stage + 1; later < RefreshStageCount; ++later) {
+        stageKeys[later].clear();
+        stageImages[later] = QImage();
+    }
+
+    QSet<qint64> keptImages;
+    keptImages << origImage.cacheKey() << proxyImage.cacheKey() << viewerImage.cacheKey();
+    qint64 memoryUsage = 0;
+    for (int kept = stage; kept >= 0; --kept) {
+        const QImage &image = stageImages[kept];
+        if (image.isNull() || keptImages.contains(image.cacheKey())) {
+            continue;
         }
-
-        if (r == max) {
-            h = (g - b) / (double) delta;
-        } else if (g == max) {
-            h = 2 + (b - r) / (double) delta;
+        memoryUsage += image.sizeInBytes();
+        if (memoryUsage > REFRESH_STAGES_MEMORY) {
+            stageKeys[kept].clear();
+            stageImages[kept] = QImage();
         } else {
-            h = 4 + (r - g) / (double) delta;
+            keptImages << image.cacheKey();
         }
+    }
+}
 
-        h = h * 42.5;
-        if (h < 0) {
-            h += 255;
-        } else if (h > 255) {
-            h -= 255;
+void ImageViewer::clearStages() {
+    for (int stage = 0; stage < RefreshStageCount; ++stage) {
+        stageKeys[stage].clear();
+        stageImages[stage] = QImage();
+    }
+}
+
+bool ImageViewer::updateProxyImage() {
+    if (proxySourceKey != origImage.cacheKey()) {
+        proxySourceKey = origImage.cacheKey();
+        QSize proxySize = origImage.size();
+        proxySize.scale(size() * devicePixelRatioF(), Qt::KeepAspectRatio);
+        if (proxySize.width() < origImage.width() && !proxySize.isEmpty()) {
+            proxyImage = Resampler::scaled(origImage, proxySize);
+        } else {
+            proxyImage = QImage();
         }
     }
+    return !proxyImage.isNull();
+}
 
-    *hue = ROUND(h);
-    *sat = ROUND(s);
-    *light = ROUND(l);
+void ImageViewer::beginProxyPreview() {
+    ++proxyPreviewUsers;
 }
 
-void hslToRgb(double h, double s, double l,
-              unsigned char *red, unsigned char *green, unsigned char *blue) {
-    if (s == 0) {
-        /* achromatic case */
-        *red = l;
-        *green = l;
-        *blue = l;
-    } else {
-        double m1, m2;
+void ImageViewer::endProxyPreview() {
+    if (--proxyPreviewUsers > 0) {
+        return;
+    }
+    proxyPreviewUsers = 0;
+    proxyImage = QImage();
+    proxySourceKey = 0;
+    if (isShowingProxy) {
+        refreshImage(false);
+    }
+}
 
-        if (l < 128)
-            m2 = (l * (255 + s)) / 65025.0;
-        else
-            m2 = (l + s - (l * s) / 255.0) / 255.0;
+void ImageViewer::setImage(const QImage &image, const QSize &displaySize) {
+    if (movieWidget) {
+        delete movieWidget;
+        movieWidget = nullptr;
+        imageWidget = new ImageWidget;
+        scrollArea->setWidget(imageWidget);
+    }
 
-        m1 = (l / 127.5) - m2;
+    imageWidget->setGLBackend(Settings::openGLViewer);
+    imageWidget->setMirrorCells(mirrorCells());
+    imageWidget->setImage(toDisplay(image), displaySize);
+}
 
-        /* chromatic case */
-        *red = hslValue(m1, m2, h + 85);
-        *green = hslValue(m1, m2, h);
-        *blue = hslValue(m1, m2, h - 85);
+// Only the shown copy is converted, saving keeps the image's own profile
+QImage ImageViewer::toDisplay(const QImage &image) {
+    // Editing the image in place changes its key too
+    if (displaySourceKey != image.cacheKey() || displaySourceSpace != image.colorSpace()) {
+        displaySourceKey = image.cacheKey();
+        displaySourceSpace = image.colorSpace();
+        displayImage = ColorTransforms::toDisplay(image);
     }
+    return displayImage;
 }
 
-void ImageViewer::colorize() {
-    int y, x;
-    unsigned char hr, hg, hb;
-    int r, g, b;
-    QRgb *line;
-    unsigned char h, s, l;
-    static unsigned char contrastTransform[256];
-    static unsigned char brightTransform[256];
-    bool hasAlpha = viewerImage.hasAlphaChannel();
-
-    switch(viewerImage.format()) {
-    case QImage::Format_RGB32:
-    case QImage::Format_ARGB32:
-    case QImage::Format_ARGB32_Premultiplied:
-        break;
-    default:
-        viewerImage = viewerImage.convertToFormat(QImage::Format_RGB32);
-
-    }
-
-    int i;
-    float contrast = ((float) Settings::contrastVal / 100.0);
-    float brightness = ((float) Settings::brightVal / 100.0);
-
-    for (i = 0; i < 256; ++i) {
-        if (i < (int) (128.0f + 128.0f * tan(contrast)) && i > (int) (128.0f - 128.0f * tan(contrast))) {
-            contrastTransform[i] = (i - 128) / tan(contrast) + 128;
-        } else if (i >= (int) (128.0f + 128.0f * tan(contrast))) {
-            contrastTransform[i] = 255;
-        } else {
-            contrastTransform[i] = 0;
-        }
+// The GL backend adjusts colours as it draws, viewerImage only gets them once something needs its pixels
+void ImageViewer::adjustColors(const QSize &displaySize) {
+    isColorizePending = false;
+    if (!Settings::colorsActive && !Settings::keepTransform) {
+        return;
     }
-
-    for (i = 0; i < 256; ++i) {
-        brightTransform[i] = MIN(255, (int) ((255.0 * pow(i / 255.0, 1.0 / brightness)) + 0.5));
+    if (imageWidget->setColorAdjustment(TransformRecipe::colorsFromSettings())) {
+        isColorizePending = true;
+        return;
     }
+    colorize();
+    imageWidget->setImage(toDisplay(viewerImage), displaySize);
+}
 
-    for (y = 0; y < viewerImage.height(); ++y) {
-
-        line = (QRgb *) viewerImage.scanLine(y);
-        for (x = 0; x < viewerImage.width(); ++x) {
-            r = Settings::rNegateEnabled ? bound0To255(255 - qRed(line[x])) : qRed(line[x]);
-            g = Settings::gNegateEnabled ? bound0To255(255 - qGreen(line[x])) : qGreen(line[x]);
-            b = Settings::bNegateEnabled ? bound0To255(255 - qBlue(line[x])) : qBlue(line[x]);
+bool ImageViewer::readImage(QImageReader &imageReader, QImage &image) {
+    if (imagePrefetcher->take(viewerImageFullPath, Settings::exifRotationEnabled, image)) {
+        return true;
+    }
+    if (!imageReader.size().isValid() || !imageReader.read(&image)) {
+        return false;
+    }
+    if (Settings::exifRotationEnabled) {
+        rotateByExifRotation(image, viewerImageFullPath);
+    }
+    return true;
+}
 
-            r = bound0To255((r * (Settings::redVal + 100)) / 100);
-            g = bound0To255((g * (Settings::greenVal + 100)) / 100);
-            b = bound0To255((b * (Settings::blueVal + 100)) / 100);
+// Whatever is quickly at hand and shaped like the image, scaled up until the decoder is done with it
+bool ImageViewer::readPreviewImage(const QSize &imageSize, QImage &preview) {
+    const long orientation = Settings::exifRotationEnabled
+                             ? metadataCache->getImageOrientation(viewerImageFullPath) : 0;
+    QSize fullSize = imageSize;
+    if (orientation >= 5) {
+        fullSize.transpose();
+    }
 
-            r = bound0To255(brightTransform[r]);
-            g = bound0To255(brightTransform[g]);
-            b = bound0To255(brightTransform[b]);
+    const QString thumbnailPath = ThumbnailLoader::locateThumbnail(viewerImageFullPath, PREVIEW_THUMB_SIZE);
+    if (!thumbnailPath.isEmpty() && preview.load(thumbnailPath)) {
+        rotateByExifOrientation(preview, orientation);
+    }
 
-            r = bound0To255(contrastTransform[r]);
-            g = bound0To255(contrastTransform[g]);
-            b = bound0To255(contrastTransform[b]);
+    if (preview.isNull()) {
+        QSize originalSize = imageSize;
+        QByteArray data = ExifPreview::extract(viewerImageFullPath, size() * devicePixelRatioF() / 2,
+                                               Qt::KeepAspectRatio, originalSize);
+        if (!data.isEmpty() && preview.loadFromData(data)) {
+            rotateByExifOrientation(preview, orientation);
+        }
+    }
 
-            rgbToHsl(r, g, b, &h, &s, &l);
-            h = Settings::colorizeEnabled ? Settings::hueVal : h + Settings::hueVal;
-            s = bound0To255(((s * Settings::saturationVal) / 100));
-            l = bound0To255(((l * Settings::lightnessVal) / 100));
-            hslToRgb(h, s, l, &hr, &hg, &hb);
+    if (preview.isNull() && Settings::exifThumbRotationEnabled == Settings::exifRotationEnabled) {
+        preview = phototonic->findLoadedThumbnail(viewerImageFullPath);
+    }
 
-            r = Settings::hueRedChannel ? hr : qRed(line[x]);
-            g = Settings::hueGreenChannel ? hg : qGreen(line[x]);
-            b = Settings::hueBlueChannel ? hb : qBlue(line[x]);
+    if (preview.isNull() || preview.width() >= fullSize.width()) {
+        return false;
+    }
+    const qreal fullAspect = qreal(fullSize.width()) / fullSize.height();
+    const qreal previewAspect = qreal(preview.width()) / preview.height();
+    return qAbs(previewAspect / fullAspect - 1) <= PREVIEW_ASPECT_TOLERANCE;
+}
 
-            if (hasAlpha) {
-                line[x] = qRgba(r, g, b, qAlpha(line[x]));
-            } else {
-                line[x] = qRgb(r, g, b);
-            }
+// Cameras embed a full size JPEG in most RAW files, it decodes in a fraction of the time developing takes
+bool ImageViewer::readRawPreview(const QSize &rawSize, QSize &displaySize) {
+    QSize imageSize = rawSize;
+    const QByteArray data = ExifPreview::extractLargest(viewerImageFullPath, imageSize);
+    QImage preview;
+    if (data.isEmpty() || !preview.loadFromData(data)) {
+        return false;
+    }
+    const long orientation = Settings::exifRotationEnabled
+                             ? metadataCache->getImageOrientation(viewerImageFullPath) : 0;
+    rotateByExifOrientation(preview, orientation);
+    origImage = preview;
+
+    // With a decoder plugin the RAW data is developed on the prefetcher's threads, refresh() swaps it in
+    if (Settings::developRawFiles && rawSize.isValid() && !mirrorLayout && !Settings::keepTransform) {
+        imagePrefetcher->request(viewerImageFullPath, Settings::exifRotationEnabled);
+        displaySize = rawSize;
+        if (orientation >= 5) {
+            displaySize.transpose();
         }
+        isShowingPreview = true;
     }
+    return true;
 }
 
-void ImageViewer::refresh() {
-    if (!imageWidget) {
+void ImageViewer::finishPreview() {
+    if (!isShowingPreview) {
         return;
     }
+    isShowingPreview = false;
 
-    if (Settings::scaledWidth) {
-        viewerImage = origImage.scaled(Settings::scaledWidth, Settings::scaledHeight,
-                                       Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    QImageReader imageReader(viewerImageFullPath);
+    QImage image;
+    if (readImage(imageReader, image)) {
+        origImage = image;
     } else {
-        viewerImage = origImage;
+        setInfo(QFileInfo(imageReader.fileName()).fileName() + ": " + imageReader.errorString());
     }
+}
 
-    transform();
-
-    if (Settings::colorsActive || Settings::keepTransform) {
-        colorize();
+// For anything that works on the image itself rather than on what is on screen
+void ImageViewer::showFullImage() {
+    if (!imageWidget || (!isShowingPreview && !isShowingProxy && !isColorizePending)) {
+        return;
     }
 
-    if (mirrorLayout) {
-        mirror();
+    const qreal rotation = imageWidget->rotation();
+    if (isShowingPreview || isShowingProxy) {
+        refreshImage(false);
     }
-
-    imageWidget->setImage(viewerImage);
-    resizeImage();
+    if (isColorizePending) {
+        isColorizePending = false;
+        colorize();
+        imageWidget->setImage(toDisplay(viewerImage));
+    }
+    imageWidget->setRotation(rotation);
 }
 
-void ImageViewer::setImage(const QImage &image) {
-    if (movieWidget) {
-        delete movieWidget;
-        movieWidget = nullptr;
-        imageWidget = new ImageWidget;
-        scrollArea->setWidget(imageWidget);
+void ImageViewer::onImageDecoded(const QString &imageFileName) {
+    if (isShowingPreview && imageFileName == viewerImageFullPath) {
+        refresh();
     }
-
-    imageWidget->setImage(image);
 }
 
 QImage createImageWithOverlay(const QImage &baseImage, const QImage &overlayImage, int x, int y) {
     QImage imageWithOverlay = QImage(overlayImage.size(), QImage::Format_ARGB32_Premultiplied);
     QPainter painter(&imageWithOverlay);
 
-    QImage scaledImage = baseImage.scaled(overlayImage.width(), overlayImage.height(),
-                                          Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    QImage scaledImage = Resampler::scaled(baseImage, overlayImage.width(), overlayImage.height(),
+                                           Qt::KeepAspectRatio);
 
     painter.setCompositionMode(QPainter::CompositionMode_Source);
     painter.fillRect(imageWithOverlay.rect(), Qt::transparent);
@@ -666,6 +724,11 @@ QImage createImageWithOverlay(const QImage &baseImage, const QImage &overlayImag
 }
 
 void ImageViewer::reload() {
+    Perf::ScopedTimer timer(Perf::ViewerReload);
+    clearStages();
+    isShowingPreview = false;
+    isShowingProxy = false;
+    isColorizePending = false;
     if (Settings::showImageName) {
         if (viewerImageFullPath.left(1) == ":") {
             setInfo("No Image");
@@ -682,72 +745,80 @@ void ImageViewer::reload() {
         Settings::flipH = Settings::flipV = false;
     }
     Settings::scaledWidth = Settings::scaledHeight = 0;
-    if (!batchMode) {
-        Settings::mouseRotateEnabled = false;
-        emit toolsUpdated();
-
-        if (!Settings::keepTransform)
-            Settings::cropLeft = Settings::cropTop = Settings::cropWidth = Settings::cropHeight = 0;
-        if (newImage || viewerImageFullPath.isEmpty()) {
-
-            newImage = true;
-            viewerImageFullPath = CLIPBOARD_IMAGE_NAME;
-            origImage.load(":/images/no_image.png");
-            viewerImage = origImage;
-            setImage(viewerImage);
-            pasteImage();
-            return;
-        }
-    }
+    Settings::mouseRotateEnabled = false;
+    emit toolsUpdated();
 
-    QImageReader imageReader(viewerImageFullPath);
-    if (batchMode && imageReader.supportsAnimation()) {
-        qWarning() << tr("skipping animation in batch mode:") << viewerImageFullPath;
+    if (!Settings::keepTransform)
+        Settings::cropLeft = Settings::cropTop = Settings::cropWidth = Settings::cropHeight = 0;
+    if (newImage || viewerImageFullPath.isEmpty()) {
+
+        newImage = true;
+        viewerImageFullPath = CLIPBOARD_IMAGE_NAME;
+        origImage.load(":/images/no_image.png");
+        viewerImage = origImage;
+        setImage(viewerImage);
+        pasteImage();
         return;
     }
-    if (Settings::enableAnimations && imageReader.supportsAnimation()) {
-        if (animation) {
-            delete animation;
-            animation = nullptr;
-        }
-        animation = new QMovie(viewerImageFullPath);
-
-        if (animation->frameCount() > 1) {
-            if (!movieWidget) {
-                movieWidget = new QLabel();
-                movieWidget->setScaledContents(true);
-                scrollArea->setWidget(movieWidget); // deletes imageWidget
-                imageWidget = nullptr;
-            }
-            movieWidget->setMovie(animation);
-            animation->setParent(movieWidget);
-            animation->start();
-            resizeImage();
-            return;
+
+    QImageReader imageReader(viewerImageFullPath);
+    if (Settings::enableAnimations && imageReader.supportsAnimation() && imageReader.imageCount() > 1) {
+        if (!movieWidget) {
+            movieWidget = new AnimationView();
+            scrollArea->setWidget(movieWidget); // deletes imageWidget
+            imageWidget = nullptr;
         }
+        // Shared with the preview dock when it shows the same file
+        movieWidget->setSource(AnimationSource::forFile(viewerImageFullPath));
+        resizeImage();
+        return;
     }
 
     // It's not a movie
 
-    if (imageReader.size().isValid() && imageReader.read(&origImage)) {
-        if (Settings::exifRotationEnabled) {
-            rotateByExifRotation(origImage, viewerImageFullPath);
+    QSize displaySize;
+    bool isImageRead = !savedImage.isNull();
+    if (isImageRead) {
+        origImage = savedImage;
+        savedImage = QImage();
+    } else {
+        isImageRead = imagePrefetcher->take(viewerImageFullPath, Settings::exifRotationEnabled, origImage);
+    }
+    if (!isImageRead && ExifPreview::isRawFile(viewerImageFullPath)) {
+        isImageRead = readRawPreview(imageReader.size(), displaySize);
+    }
+    if (!isImageRead && Settings::progressiveLoading && !mirrorLayout
+        && !Settings::keepTransform && imageReader.size().isValid()) {
+        QImage preview;
+        if (readPreviewImage(imageReader.size(), preview)) {
+            imagePrefetcher->request(viewerImageFullPath, Settings::exifRotationEnabled);
+            displaySize = imageReader.size();
+            if (Settings::exifRotationEnabled && metadataCache->getImageOrientation(viewerImageFullPath) >= 5) {
+                displaySize.transpose();
+            }
+            origImage = preview;
+            isShowingPreview = true;
+            isImageRead = true;
         }
-        viewerImage = origImage;
+    }
+    if (!isImageRead) {
+        isImageRead = readImage(imageReader, origImage);
+    }
 
-        if (Settings::colorsActive || Settings::keepTransform) {
-            colorize();
-        }
-        if (mirrorLayout) {
-            mirror();
-        }
+    if (isImageRead) {
+        viewerImage = origImage;
     } else {
         viewerImage = QIcon::fromTheme("image-missing",
                                         QIcon(":/images/error_image.png")).pixmap(BAD_IMAGE_SIZE, BAD_IMAGE_SIZE).toImage();
         setInfo(QFileInfo(imageReader.fileName()).fileName() + ": " + imageReader.errorString());
     }
 
-    setImage(viewerImage);
+    setImage(viewerImage, displaySize);
+    if (isImageRead) {
+        adjustColors(displaySize);
+    } else {
+        isColorizePending = false;
+    }
     resizeImage();
     if (Settings::keepTransform) {
         if (Settings::cropLeft || Settings::cropTop || Settings::cropWidth || Settings::cropHeight)
@@ -756,8 +827,8 @@ void ImageViewer::reload() {
     }
     if (Settings::setWindowIcon) {
         QPixmap icon;
-        icon.convertFromImage(viewerImage.scaled(WINDOW_ICON_SIZE, WINDOW_ICON_SIZE,
-                                                 Qt::KeepAspectRatio, Qt::SmoothTransformation));
+        icon.convertFromImage(Resampler::scaled(viewerImage, WINDOW_ICON_SIZE, WINDOW_ICON_SIZE,
+                                                Qt::KeepAspectRatio));
         phototonic->setWindowIcon(icon);
     }
 }
@@ -799,7 +870,20 @@ void ImageViewer::loadImage(QString imageFileName) {
     reload();
 }
 
+void ImageViewer::prefetchImages(const QStringList &imageFileNames) {
+    // Left undeveloped, RAW files are shown from their embedded previews, which need no prefetching
+    QStringList wantedFiles = imageFileNames;
+    if (!Settings::developRawFiles) {
+        wantedFiles.erase(std::remove_if(wantedFiles.begin(), wantedFiles.end(), ExifPreview::isRawFile),
+                          wantedFiles.end());
+    }
+    imagePrefetcher->prefetch(wantedFiles, Settings::exifRotationEnabled);
+}
+
 void ImageViewer::clearImage() {
+    clearStages();
+    isShowingProxy = false;
+    isColorizePending = false;
     origImage.load(":/images/no_image.png");
     viewerImage = origImage;
     setImage(viewerImage);
@@ -900,6 +984,7 @@ void ImageViewer::applyCropAndRotation() {
     if (!imageWidget) {
         return;
     }
+    showFullImage();
 
     bool didSomething = false;
     if (cropRubberBand && cropRubberBand->isVisible()) {
@@ -909,10 +994,12 @@ void ImageViewer::applyCropAndRotation() {
 
         bandTopLeft = imageWidget->mapToImage(imageWidget->mapFromGlobal(bandTopLeft));
         bandBottomRight = imageWidget->mapToImage(imageWidget->mapFromGlobal(bandBottomRight));
+        const QSize grid = ImageWidget::mirrorGrid(mirrorCells());
+        const QSize imageSize(viewerImage.width() * grid.width(), viewerImage.height() * grid.height());
         double scaledX = imageWidget->width();
         double scaledY = imageWidget->height();
-        scaledX = viewerImage.width() / scaledX;
-        scaledY = viewerImage.height() / scaledY;
+        scaledX = imageSize.width() / scaledX;
+        scaledY = imageSize.height() / scaledY;
 
         bandTopLeft.setX(int(bandTopLeft.x() * scaledX));
         bandTopLeft.setY(int(bandTopLeft.y() * scaledY));
@@ -921,8 +1008,8 @@ void ImageViewer::applyCropAndRotation() {
 
         Settings::cropLeft = bandTopLeft.x();
         Settings::cropTop = bandTopLeft.y();
-        Settings::cropWidth = viewerImage.width() - bandBottomRight.x();
-        Settings::cropHeight = viewerImage.height() - bandBottomRight.y();
+        Settings::cropWidth = imageSize.width() - bandBottomRight.x();
+        Settings::cropHeight = imageSize.height() - bandBottomRight.y();
         Settings::rotation = imageWidget->rotation();
 
         cropRubberBand->hide();
@@ -1070,101 +1157,73 @@ void ImageViewer::keyMoveEvent(int direction) {
 }
 
 void ImageViewer::saveImage() {
-#if __clang__
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-#endif
-#if EXIV2_TEST_VERSION(0,28,0)
-    Exiv2::Image::UniquePtr image;
-#else
-    Exiv2::Image::AutoPtr image;
-#endif
-#if __clang__
-#pragma GCC diagnostic pop
-#endif
-
-    bool exifError = false;
-    static bool showExifError = true;
+    showFullImage();
 
     if (newImage) {
         saveImageAs();
         return;
     }
 
-    setFeedback(tr("Saving..."));
+    setFeedback(tr("Saving..."), false);
 
-    try {
-        image = Exiv2::ImageFactory::open(viewerImageFullPath.toStdString());
-        image->readMetadata();
+    SaveRequest request;
+    request.sourcePath = viewerImageFullPath;
+    request.savePath = viewerImageFullPath;
+    if (!Settings::saveDirectory.isEmpty()) {
+        QDir saveDir(Settings::saveDirectory);
+        request.savePath = saveDir.filePath(QFileInfo(viewerImageFullPath).fileName());
     }
-    catch (const Exiv2::Error &error) {
-        qWarning() << "EXIV2:" << error.what();
-        exifError = true;
+    request.format = QImageReader::imageFormat(viewerImageFullPath);
+    request.quality = Settings::defaultSaveQuality;
+    request.requireMetadata = true;
+
+    // Turning or flipping a JPEG only needs a new orientation tag, the pixels stay as they were encoded
+    if (isOrientationOnlyEdit(request.format)) {
+        request.orientation = LosslessTransform::combinedOrientation(
+                metadataCache->getImageOrientation(viewerImageFullPath),
+                Settings::rotation, Settings::flipH, Settings::flipV);
     }
+    request.image = mirroredImage();
+    request.resetOrientation = Settings::exifRotationEnabled;
+    imageSaver->save(request);
 
-    QImageReader imageReader(viewerImageFullPath);
-    QString savePath = viewerImageFullPath;
-    if (!Settings::saveDirectory.isEmpty()) {
-        QDir saveDir(Settings::saveDirectory);
-        savePath = saveDir.filePath(QFileInfo(viewerImageFullPath).fileName());
+    // What gets written is what is on screen already, there is nothing to decode again.
+    // Without Exif rotation a new orientation tag changes nothing the viewer shows.
+    if (request.savePath != viewerImageFullPath) {
+        savedImage = origImage;
+    } else if (request.orientation <= 0 || Settings::exifRotationEnabled) {
+        savedImage = request.image;
     }
-    if (!viewerImage.save(savePath, imageReader.format().toUpper(), Settings::defaultSaveQuality)) {
+    reload();
+}
+
+void ImageViewer::onImageSaved(const QString &savePath, int result) {
+    static bool showExifError = true;
+
+    if (result == ImageSaver::Failed) {
+        unsetFeedback();
         MessageBox msgBox(this);
-        msgBox.critical(tr("Error"), tr("Failed to save image."));
+        msgBox.critical(tr("Error"), tr("Failed to save image.") + "\n" + savePath);
         return;
     }
 
-    if (!exifError) {
-        try {
-            if (Settings::saveDirectory.isEmpty()) {
-                image->writeMetadata();
-            } else {
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wdeprecated-declarations"
-#if EXIV2_TEST_VERSION(0,28,0)
-                Exiv2::Image::UniquePtr imageOut = Exiv2::ImageFactory::open(savePath.toStdString());
-#else
-                Exiv2::Image::AutoPtr imageOut = Exiv2::ImageFactory::open(savePath.toStdString());
-#endif
-#pragma clang diagnostic pop
-
-                imageOut->setMetadata(*image);
-                Exiv2::ExifThumb thumb(imageOut->exifData());
-                thumb.erase();
-                // TODO: thumb.setJpegThumbnail(thumbnailPath);
-                imageOut->writeMetadata();
-            }
-        }
-        catch (Exiv2::Error &error) {
-            if (showExifError) {
-                MessageBox msgBox(this);
-                QCheckBox cb(tr("Don't show this message again"));
-                msgBox.setCheckBox(&cb);
-                msgBox.critical(tr("Error"), tr("Failed to save Exif metadata."));
-                showExifError = !(cb.isChecked());
-            } else {
-                qWarning() << tr("Failed to safe Exif metadata:") << error.what();
-            }
-        }
+    if (result == ImageSaver::SavedWithoutMetadata && showExifError) {
+        MessageBox msgBox(this);
+        QCheckBox cb(tr("Don't show this message again"));
+        msgBox.setCheckBox(&cb);
+        msgBox.critical(tr("Error"), tr("Failed to save Exif metadata."));
+        showExifError = !(cb.isChecked());
     }
-
-    reload();
     setFeedback(tr("Image saved."));
 }
 
+bool ImageViewer::isOrientationOnlyEdit(const QByteArray &format) {
+    return !mirrorLayout && TransformRecipe::fromSettings().isOrientationOnly()
+           && LosslessTransform::supportsFormat(format);
+}
+
 void ImageViewer::saveImageAs() {
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wdeprecated-declarations"
-#if EXIV2_TEST_VERSION(0,28,0)
-    Exiv2::Image::UniquePtr exifImage;
-    Exiv2::Image::UniquePtr newExifImage;
-#else
-    Exiv2::Image::AutoPtr exifImage;
-    Exiv2::Image::AutoPtr newExifImage;
-#endif
-#pragma clang diagnostic pop
-
-    bool exifError = false;
+    showFullImage();
 
     setCursorHiding(false);
 
@@ -1175,33 +1234,15 @@ void ImageViewer::saveImageAs() {
                                                     " (*.jpg *.jpeg *.png *.bmp *.tif *.tiff *.ppm *.pgm *.pbm *.xbm *.xpm *.cur *.ico *.icns *.wbmp *.webp)");
 
     if (!fileName.isEmpty()) {
-        try {
-            exifImage = Exiv2::ImageFactory::open(viewerImageFullPath.toStdString());
-            exifImage->readMetadata();
-        }
-        catch (const Exiv2::Error &error) {
-            qWarning() << "EXIV2" << error.what();
-            exifError = true;
-        }
-
-
-        if (!viewerImage.save(fileName, 0, Settings::defaultSaveQuality)) {
-            MessageBox msgBox(this);
-            msgBox.critical(tr("Error"), tr("Failed to save image."));
-        } else {
-            if (!exifError) {
-                try {
-                    newExifImage = Exiv2::ImageFactory::open(fileName.toStdString());
-                    newExifImage->setMetadata(*exifImage);
-                    newExifImage->writeMetadata();
-                }
-                catch (Exiv2::Error &error) {
-                    exifError = true;
-                }
-            }
+        setFeedback(tr("Saving..."), false);
 
-            setFeedback(tr("Image saved."));
-        }
+        SaveRequest request;
+        request.sourcePath = newImage ? QString() : viewerImageFullPath;
+        request.savePath = fileName;
+        request.quality = Settings::defaultSaveQuality;
+        request.image = mirroredImage();
+        request.resetOrientation = Settings::exifRotationEnabled;
+        imageSaver->save(request);
     }
     if (phototonic->isFullScreen()) {
         setCursorHiding(true);
@@ -1213,14 +1254,19 @@ void ImageViewer::contextMenuEvent(QContextMenuEvent *) {
         QApplication::restoreOverrideCursor();
     }
     contextMenuPosition = QCursor::pos();
+    if (!ImagePopUpMenu) {
+        ImagePopUpMenu = phototonic->createImagePopUpMenu();
+    }
     ImagePopUpMenu->exec(contextMenuPosition);
 }
 
 int ImageViewer::getImageWidthPreCropped() {
+    showFullImage();
     return origImage.width();
 }
 
 int ImageViewer::getImageHeightPreCropped() {
+    showFullImage();
     return origImage.height();
 }
 
@@ -1229,7 +1275,8 @@ bool ImageViewer::isNewImage() {
 }
 
 void ImageViewer::copyImage() {
-    QApplication::clipboard()->setImage(viewerImage);
+    showFullImage();
+    QApplication::clipboard()->setImage(mirroredImage());
 }
 
 void ImageViewer::pasteImage() {
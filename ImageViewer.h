@@ -25,6 +25,9 @@
 #include "CropRubberband.h"
 #include "ImageWidget.h"
 #include "MetadataCache.h"
+#include "ImagePrefetcher.h"
+#include "ImageSaver.h"
+#include "AnimationView.h"
 
 class Phototonic;
 
@@ -33,7 +36,6 @@ Q_OBJECT
 
 public:
     bool tempDisableResize;
-    bool batchMode = false;
     int mirrorLayout;
     QString viewerImageFullPath;
     QMenu *ImagePopUpMenu;
@@ -57,6 +59,13 @@ public:
         LayVDual
     };
 
+    enum RefreshStages {
+        ScaledStage = 0,
+        TransformedStage,
+        ColorizedStage,
+        RefreshStageCount
+    };
+
     enum Movement {
         MoveUp = 0,
         MoveDown,
@@ -68,6 +77,9 @@ public:
 
     void loadImage(QString imageFileName);
 
+    // Decodes these in the background, most wanted first, so loading them later is instant
+    void prefetchImages(const QStringList &imageFileNames);
+
     void clearImage();
 
     void resizeImage();
@@ -76,6 +88,11 @@ public:
 
     void refresh();
 
+    // Until the matching end, refresh() works on a screen sized copy so dialogs can adjust live
+    void beginProxyPreview();
+
+    void endProxyPreview();
+
     void reload();
 
     int getImageWidthPreCropped();
@@ -88,6 +105,8 @@ public:
 
     void rotateByExifRotation(QImage &image, QString &imageFullPath);
 
+    static void rotateByExifOrientation(QImage &image, long orientation);
+
     void setInfo(QString infoString);
 
     void setFeedback(QString feedbackString, bool timeLimited = true);
@@ -117,6 +136,10 @@ private slots:
 
     void unsetFeedback();
 
+    void onImageDecoded(const QString &imageFileName);
+
+    void onImageSaved(const QString &savePath, int result);
+
     void updateRubberBandFeedback(QRect geom);
 
 protected:
@@ -136,14 +159,26 @@ protected:
 
 private:
     Phototonic *phototonic;
-    QLabel *movieWidget = nullptr;
+    AnimationView *movieWidget = nullptr;
     ImageWidget *imageWidget = nullptr;
     QImage origImage;
     QImage viewerImage;
-    QImage mirrorImage;
+    QImage proxyImage;
+    // Shown by the next reload() instead of decoding the file it was written to
+    QImage savedImage;
+    QByteArray stageKeys[RefreshStageCount];
+    QImage stageImages[RefreshStageCount];
+    qint64 proxySourceKey = 0;
+    // The last image converted for the screen, refreshing it again does not convert it again
+    QImage displayImage;
+    qint64 displaySourceKey = 0;
+    QColorSpace displaySourceSpace;
+    int proxyPreviewUsers = 0;
     QTimer *mouseMovementTimer;
-    QPointer<QMovie> animation;
     bool newImage;
+    bool isShowingPreview = false;
+    bool isColorizePending = false;
+    bool isShowingProxy = false;
     bool cursorIsHidden;
     bool moveImageLocked;
     qreal initialRotation = 0;
@@ -155,17 +190,48 @@ private:
     QPoint cropOrigin;
     QPoint contextMenuPosition;
     std::shared_ptr<MetadataCache> metadataCache;
+    std::unique_ptr<ImagePrefetcher> imagePrefetcher;
+    ImageSaver *imageSaver;
 
     void setMouseMoveData(bool lockMove, int lMouseX, int lMouseY);
 
     void centerImage(QSize &imgSize);
 
-    void transform();
+    void transform(qreal pixelScale);
+
+    QVector<MirrorCell> mirrorCells() const;
 
-    void mirror();
+    QImage mirroredImage() const;
 
     void colorize();
-    void setImage(const QImage &image);
+
+    void refreshImage(bool useProxy);
+
+    bool updateProxyImage();
+
+    bool restoreStage(int stage, const QByteArray &key);
+
+    void storeStage(int stage, const QByteArray &key);
+
+    void clearStages();
+
+    void setImage(const QImage &image, const QSize &displaySize = QSize());
+
+    QImage toDisplay(const QImage &image);
+
+    bool readImage(QImageReader &imageReader, QImage &image);
+
+    bool readPreviewImage(const QSize &imageSize, QImage &preview);
+
+    bool readRawPreview(const QSize &rawSize, QSize &displaySize);
+
+    void finishPreview();
+
+    void adjustColors(const QSize &displaySize);
+
+    void showFullImage();
+
+    bool isOrientationOnlyEdit(const QByteArray &format);
 };
 
 #endif // IMAGE_VIEWER_H
@@ -17,12 +17,23 @@
  */
 
 #include "ImageWidget.h"
+#include "ImagePyramid.h"
+#include "ImageGLView.h"
 #include <QDebug>
 #include <QPainter>
 #include <QPaintEvent>
+#include <QtMath>
 
-ImageWidget::ImageWidget(QWidget *parent) : QWidget(parent)
+#define SCALED_TILE_SIZE 256
+#define SCALED_TILES_MEMORY_KB (64 * 1024)
+
+// Once the shaders failed to build there is no point in trying again
+static bool isGLUnavailable = false;
+
+ImageWidget::ImageWidget(QWidget *parent) : QWidget(parent), m_scaledTiles(SCALED_TILES_MEMORY_KB)
 {
+    m_pyramid = new ImagePyramid(this);
+    connect(m_pyramid, SIGNAL(levelReady()), this, SLOT(update()));
 }
 
 bool ImageWidget::empty()
@@ -35,9 +46,16 @@ QImage ImageWidget::image()
     return m_image;
 }
 
-void ImageWidget::setImage(const QImage &i)
+void ImageWidget::setImage(const QImage &i, const QSize &displaySize)
 {
     m_image = i;
+    m_displaySize = displaySize;
+    m_pyramid->setImage(i);
+    m_scaledTiles.clear();
+    if (m_glView) {
+        m_glView->setImage(i);
+        m_glView->setColorAdjustment(ColorAdjustment());
+    }
     m_rotation = 0;
     update();
 }
@@ -45,6 +63,9 @@ void ImageWidget::setImage(const QImage &i)
 void ImageWidget::setRotation(qreal r)
 {
     m_rotation = r;
+    if (m_glView) {
+        m_glView->setRotation(r);
+    }
     update();
 }
 
@@ -52,58 +73,236 @@ QPoint ImageWidget::mapToImage(QPoint p)
 {
     QPoint upperLeft;
     QPoint center(width() / 2, height() / 2);
-    if (width() > m_image.width())
-        upperLeft.setX(center.x() - m_image.width() / 2);
-    if (height() > m_image.height())
-        upperLeft.setY(center.y() - m_image.height() / 2);
+    const QSize size = imageSize();
+    if (width() > size.width())
+        upperLeft.setX(center.x() - size.width() / 2);
+    if (height() > size.height())
+        upperLeft.setY(center.y() - size.height() / 2);
     return QPoint(p.x() - upperLeft.x(), p.y() - upperLeft.y());
 }
 
 QSize ImageWidget::imageSize() const
 {
-    return m_image.size();
+    const QSize size = m_displaySize.isValid() ? m_displaySize : m_image.size();
+    const QSize grid = mirrorGrid(m_mirrorCells);
+    return QSize(size.width() * grid.width(), size.height() * grid.height());
+}
+
+void ImageWidget::setMirrorCells(const QVector<MirrorCell> &cells)
+{
+    m_mirrorCells = cells;
+    if (m_glView) {
+        m_glView->setMirrorCells(cells);
+    }
+    update();
+}
+
+QSize ImageWidget::mirrorGrid(const QVector<MirrorCell> &cells)
+{
+    QSize grid(1, 1);
+    for (const MirrorCell &cell : cells) {
+        grid = grid.expandedTo(QSize(cell.column + 1, cell.row + 1));
+    }
+    return grid;
 }
 
 QSize ImageWidget::sizeHint() const
 {
-    return m_image.size();
+    return imageSize();
+}
+
+void ImageWidget::setGLBackend(bool enabled)
+{
+    enabled = enabled && !isGLUnavailable;
+    if (enabled == (m_glView != nullptr)) {
+        return;
+    }
+
+    if (enabled) {
+        m_glView = new ImageGLView(this);
+        connect(m_glView, SIGNAL(failed()), this, SLOT(onGLFailed()));
+        m_glView->setImage(m_image);
+        m_glView->setMirrorCells(m_mirrorCells);
+        m_glView->setRotation(m_rotation);
+        updateGLViewGeometry();
+        m_glView->show();
+    } else {
+        delete m_glView;
+        m_glView = nullptr;
+        update();
+    }
+}
+
+bool ImageWidget::setColorAdjustment(const ColorAdjustment &colorAdjustment)
+{
+    if (!m_glView) {
+        return false;
+    }
+    m_glView->setColorAdjustment(colorAdjustment);
+    return true;
+}
+
+void ImageWidget::onGLFailed()
+{
+    isGLUnavailable = true;
+    if (m_glView) {
+        m_glView->deleteLater();
+        m_glView = nullptr;
+    }
+    update();
+}
+
+// A GL surface as big as a zoomed in image would not fit in video memory, it only covers what is on screen
+void ImageWidget::updateGLViewGeometry()
+{
+    if (!m_glView) {
+        return;
+    }
+    QRect visibleRect = rect();
+    if (parentWidget()) {
+        visibleRect &= QRect(mapFromParent(QPoint(0, 0)), parentWidget()->size());
+    }
+    m_glView->setGeometry(visibleRect);
+    m_glView->update();
+}
+
+void ImageWidget::resizeEvent(QResizeEvent *event)
+{
+    QWidget::resizeEvent(event);
+    updateGLViewGeometry();
+}
+
+void ImageWidget::moveEvent(QMoveEvent *event)
+{
+    QWidget::moveEvent(event);
+    updateGLViewGeometry();
+}
+
+// Scales the pixels under tileRect plus the partial ones around its edges, then cuts the tile out
+QImage ImageWidget::scaledTile(const QRect &tileRect, float scale)
+{
+    const QRectF sourceRect(tileRect.x() / scale, tileRect.y() / scale,
+                            tileRect.width() / scale, tileRect.height() / scale);
+    const QRect sourcePixels = sourceRect.toAlignedRect() & m_image.rect();
+    if (sourcePixels.isEmpty()) {
+        return QImage();
+    }
+    const QSize scaledSize(qMax(1, qRound(sourcePixels.width() * scale)),
+                           qMax(1, qRound(sourcePixels.height() * scale)));
+    const QPoint scaledOrigin(qRound(sourcePixels.x() * scale), qRound(sourcePixels.y() * scale));
+    return m_image.copy(sourcePixels).scaled(scaledSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation)
+            .copy(tileRect.translated(-scaledOrigin));
 }
 
+// Mirror layouts share one image, its tiles and its pyramid, each cell is drawn with its own flips
 void ImageWidget::paintEvent(QPaintEvent *ev)
 {
-    float scale = qMax(float(width()) / m_image.width(), float(height()) / m_image.height());
+    if (m_glView) {
+        return;
+    }
+
+    const QSize grid = mirrorGrid(m_mirrorCells);
+    const QVector<MirrorCell> cells = m_mirrorCells.isEmpty() ? QVector<MirrorCell>({{0, 0, false, false}})
+                                                              : m_mirrorCells;
+    float scale = qMax(float(width()) / (m_image.width() * grid.width()),
+                       float(height()) / (m_image.height() * grid.height()));
 
     QPainter painter(this);
+    const int level = m_pyramid->levelFor(scale * devicePixelRatioF());
 
     if (qFuzzyIsNull(m_rotation)) {
-        const float sx = qMax(-x() / scale, 0.f);
-        const float sy = qMax(-y() / scale, 0.f);
-        const float sw = qMin<float>(width() / scale, m_image.width());
-        const float sh = qMin<float>(height() / scale, m_image.height());
+        QRect visibleRect = rect() & ev->rect();
+        if (parentWidget()) {
+            visibleRect &= QRect(mapFromParent(QPoint(0, 0)), parentWidget()->size());
+        }
 
-        QRectF sourceRect(sx, sy, sw, sh);
-        QRectF targetRect = rect();
-        targetRect &= ev->rect();
-        sourceRect &= QRectF(ev->rect().x() / scale, ev->rect().y() / scale, ev->rect().width() / scale, ev->rect().height() / scale);
+        const QSizeF cellSize(m_image.width() * scale, m_image.height() * scale);
+        for (const MirrorCell &cell : cells) {
+            const QRectF cellRect(QPointF(cell.column * cellSize.width(), cell.row * cellSize.height()), cellSize);
+            QRectF exposed = cellRect & QRectF(visibleRect);
+            if (exposed.isEmpty()) {
+                continue;
+            }
 
-        if (sourceRect.width() * sourceRect.height() < 500 * 500) {
-            painter.drawImage(targetRect.topLeft(), m_image.copy(sourceRect.toRect()).scaled(targetRect.toRect().size(), Qt::KeepAspectRatioByExpanding, Qt::SmoothTransformation));
+            // In the cell's own coordinates, as if it was not flipped
+            exposed.translate(-cellRect.topLeft());
+            if (cell.flipH) {
+                exposed.moveLeft(cellSize.width() - exposed.right());
+            }
+            if (cell.flipV) {
+                exposed.moveTop(cellSize.height() - exposed.bottom());
+            }
 
-        } else {
-            painter.drawImage(targetRect, m_image, sourceRect);
+            painter.save();
+            painter.translate(cellRect.topLeft());
+            if (cell.flipH || cell.flipV) {
+                painter.translate(cell.flipH ? cellSize.width() : 0, cell.flipV ? cellSize.height() : 0);
+                painter.scale(cell.flipH ? -1 : 1, cell.flipV ? -1 : 1);
+            }
+            drawCell(painter, exposed, scale, level);
+            painter.restore();
         }
-
         return;
     }
+
+    const QSize compositeSize(m_image.width() * grid.width(), m_image.height() * grid.height());
     painter.scale(scale, scale);
     QPoint center(width() / 2, height() / 2);
     painter.translate(center);
     painter.rotate(m_rotation);
     painter.translate(center * -1);
     QPoint upperLeft;
-    if (width() > m_image.width() * scale)
-        upperLeft.setX(center.x() - scale*m_image.width() / 2);
-    if (height() > m_image.height() * scale)
-        upperLeft.setY(center.y() - scale*m_image.height() / 2);
-    painter.drawImage(upperLeft, m_image);
+    if (width() > compositeSize.width() * scale)
+        upperLeft.setX(center.x() - scale*compositeSize.width() / 2);
+    if (height() > compositeSize.height() * scale)
+        upperLeft.setY(center.y() - scale*compositeSize.height() / 2);
+    for (const MirrorCell &cell : cells) {
+        painter.save();
+        painter.translate(upperLeft + QPoint(cell.column * m_image.width(), cell.row * m_image.height()));
+        if (cell.flipH || cell.flipV) {
+            painter.translate(cell.flipH ? m_image.width() : 0, cell.flipV ? m_image.height() : 0);
+            painter.scale(cell.flipH ? -1 : 1, cell.flipV ? -1 : 1);
+        }
+        m_pyramid->draw(painter, QRectF(QPointF(), m_image.size()), m_image.rect(), level);
+        painter.restore();
+    }
+}
+
+void ImageWidget::drawCell(QPainter &painter, const QRectF &exposed, float scale, int level)
+{
+    const QRectF sourceRect = QRectF(exposed.x() / scale, exposed.y() / scale,
+                                     exposed.width() / scale, exposed.height() / scale) & QRectF(m_image.rect());
+    const QRectF targetRect(sourceRect.topLeft() * scale, sourceRect.size() * scale);
+    if (sourceRect.isEmpty()) {
+        return;
+    }
+
+    if (level > 0) {
+        m_pyramid->draw(painter, targetRect, sourceRect, level);
+    } else if (sourceRect.width() * sourceRect.height() < 500 * 500) {
+        if (scale != m_tileScale) {
+            m_scaledTiles.clear();
+            m_tileScale = scale;
+        }
+        const QRect cellRect(0, 0, qCeil(m_image.width() * scale), qCeil(m_image.height() * scale));
+        const QRect tilesExposed = targetRect.toAlignedRect() & cellRect;
+        for (int row = tilesExposed.top() / SCALED_TILE_SIZE; row <= tilesExposed.bottom() / SCALED_TILE_SIZE; ++row) {
+            for (int column = tilesExposed.left() / SCALED_TILE_SIZE; column <= tilesExposed.right() / SCALED_TILE_SIZE; ++column) {
+                const QRect tileRect = QRect(column * SCALED_TILE_SIZE, row * SCALED_TILE_SIZE,
+                                             SCALED_TILE_SIZE, SCALED_TILE_SIZE) & cellRect;
+                const quint64 key = (quint64(row) << 32) | quint32(column);
+                QImage *tile = m_scaledTiles.object(key);
+                if (!tile) {
+                    tile = new QImage(scaledTile(tileRect, scale));
+                    m_scaledTiles.insert(key, tile, qMax(1, int(tile->sizeInBytes() / 1024)));
+                    tile = m_scaledTiles.object(key);
+                }
+                if (tile) {
+                    painter.drawImage(tileRect.topLeft(), *tile);
+                }
+            }
+        }
+    } else {
+        painter.drawImage(targetRect, m_image, sourceRect);
+    }
 }
@@ -20,6 +20,20 @@
 #define IMAGEWIDGET_H
 
 #include <QWidget>
+#include <QCache>
+#include "ColorEngine.h"
+
+class ImagePyramid;
+class ImageGLView;
+
+// One copy of the image in a mirror layout, at a column and row in units of the image size
+struct MirrorCell
+{
+    int column;
+    int row;
+    bool flipH;
+    bool flipV;
+};
 
 class ImageWidget : public QWidget
 {
@@ -28,20 +42,55 @@ public:
     explicit ImageWidget(QWidget *parent = nullptr);
     bool empty();
     QImage image();
-    void setImage(const QImage &i);
+    // A valid displaySize lays the image out at that size, for previews standing in for the full image
+    void setImage(const QImage &i, const QSize &displaySize = QSize());
     qreal rotation() { return m_rotation; }
     void setRotation(qreal r);
     QPoint mapToImage(QPoint p);
     QSize imageSize() const;
 
+    // Draws the image once per cell instead of once, an empty list draws it plainly
+    void setMirrorCells(const QVector<MirrorCell> &cells);
+    static QSize mirrorGrid(const QVector<MirrorCell> &cells);
+
+    // Draws with OpenGL when possible, or on the CPU otherwise
+    void setGLBackend(bool enabled);
+
+    // Returns false if the image has to be adjusted on the CPU instead.
+    // Setting a new image drops the adjustment.
+    bool setColorAdjustment(const ColorAdjustment &colorAdjustment);
+
+    bool hasGLBackend() const { return m_glView; }
+
 protected:
 
     QSize sizeHint() const override;
 
     void paintEvent(QPaintEvent *event) override;
 
+    void resizeEvent(QResizeEvent *event) override;
+
+    void moveEvent(QMoveEvent *event) override;
+
+private slots:
+
+    void onGLFailed();
+
 private:
+    void updateGLViewGeometry();
+
+    QImage scaledTile(const QRect &tileRect, float scale);
+
+    void drawCell(QPainter &painter, const QRectF &exposed, float scale, int level);
+
     QImage m_image;
+    QSize m_displaySize;
+    QVector<MirrorCell> m_mirrorCells;
+    ImagePyramid *m_pyramid;
+    ImageGLView *m_glView = nullptr;
+    // Smoothly scaled pieces of the widget at m_tileScale, so panning only blits them
+    QCache<quint64, QImage> m_scaledTiles;
+    float m_tileScale = 0;
     qreal m_rotation = 0;
 };
 
@@ -0,0 +1,117 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <exiv2/exiv2.hpp>
+#include "LosslessTransform.h"
+
+namespace LosslessTransform {
+
+// Where each orientation sends the stored x and y axes, as a 2x2 matrix in y down coordinates.
+// Follows ImageViewer::rotateByExifOrientation(), index 0 is unused.
+static const int orientationMatrices[9][4] = {
+        {1, 0, 0, 1},
+        {1, 0, 0, 1},
+        {-1, 0, 0, 1},
+        {-1, 0, 0, -1},
+        {1, 0, 0, -1},
+        {0, 1, 1, 0},
+        {0, -1, 1, 0},
+        {0, -1, -1, 0},
+        {0, 1, -1, 0}
+};
+
+static void multiply(const int a[4], const int b[4], int result[4]) {
+    result[0] = a[0] * b[0] + a[1] * b[2];
+    result[1] = a[0] * b[1] + a[1] * b[3];
+    result[2] = a[2] * b[0] + a[3] * b[2];
+    result[3] = a[2] * b[1] + a[3] * b[3];
+}
+
+int combinedOrientation(long orientation, qreal rotation, bool flipH, bool flipV) {
+    if (!qFuzzyIsNull(std::fmod(rotation, 90))) {
+        return 0;
+    }
+    if (orientation < 1 || orientation > 8) {
+        orientation = 1;
+    }
+
+    int matrix[4] = {1, 0, 0, 1};
+    int product[4];
+    const int quarterTurns = ((qRound(rotation) / 90) % 4 + 4) % 4;
+    memcpy(matrix, orientationMatrices[orientation], sizeof(matrix));
+    for (int turn = 0; turn < quarterTurns; ++turn) {
+        multiply(orientationMatrices[6], matrix, product);
+        memcpy(matrix, product, sizeof(matrix));
+    }
+    const int flip[4] = {flipH ? -1 : 1, 0, 0, flipV ? -1 : 1};
+    multiply(flip, matrix, product);
+
+    for (int candidate = 1; candidate <= 8; ++candidate) {
+        if (!memcmp(product, orientationMatrices[candidate], sizeof(product))) {
+            return candidate;
+        }
+    }
+    return 0;
+}
+
+bool supportsFormat(const QByteArray &format) {
+    const QByteArray lowerFormat = format.toLower();
+    return lowerFormat == "jpeg" || lowerFormat == "jpg" || lowerFormat == "tif" || lowerFormat == "tiff";
+}
+
+bool saveOrientation(const QString &sourcePath, const QString &targetPath, int orientation) {
+    if (orientation < 1 || orientation > 8) {
+        return false;
+    }
+
+    if (QFileInfo(sourcePath) != QFileInfo(targetPath)) {
+        QFile::remove(targetPath);
+        if (!QFile::copy(sourcePath, targetPath)) {
+            qWarning() << "Unable to copy" << sourcePath << "to" << targetPath;
+            return false;
+        }
+    }
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#if EXIV2_TEST_VERSION(0,28,0)
+    Exiv2::Image::UniquePtr exifImage;
+#else
+    Exiv2::Image::AutoPtr exifImage;
+#endif
+#pragma clang diagnostic pop
+
+    try {
+        exifImage = Exiv2::ImageFactory::open(targetPath.toStdString());
+        exifImage->readMetadata();
+        exifImage->exifData()["Exif.Image.Orientation"] = uint16_t(orientation);
+        Exiv2::XmpData &xmpData = exifImage->xmpData();
+        if (xmpData.findKey(Exiv2::XmpKey("Xmp.tiff.Orientation")) != xmpData.end()) {
+            xmpData["Xmp.tiff.Orientation"] = std::to_string(orientation);
+        }
+        exifImage->writeMetadata();
+    }
+    catch (const Exiv2::Error &error) {
+        qWarning() << "EXIV2:" << error.what();
+        return false;
+    }
+    return true;
+}
+
+}
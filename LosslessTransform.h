@@ -0,0 +1,40 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOSSLESS_TRANSFORM_H
+#define LOSSLESS_TRANSFORM_H
+
+#include <QtCore>
+
+// Right angle edits saved by changing the orientation tag instead of the pixels
+namespace LosslessTransform {
+
+// The orientation showing the stored pixels as they look after being shown with orientation,
+// rotated clockwise by rotation degrees and then flipped. 0 if rotation is not a right angle.
+int combinedOrientation(long orientation, qreal rotation, bool flipH, bool flipV);
+
+// Whether the format keeps its orientation tag where other viewers read it
+bool supportsFormat(const QByteArray &format);
+
+// Copies sourcePath to targetPath unless they are the same file, then writes only the
+// orientation tag. Returns false if nothing could be written.
+bool saveOrientation(const QString &sourcePath, const QString &targetPath, int orientation);
+
+}
+
+#endif // LOSSLESS_TRANSFORM_H
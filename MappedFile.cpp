@@ -0,0 +1,93 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <limits>
+#include "MappedFile.h"
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Below this a single read is cheaper than setting up a mapping
+#define MIN_MAPPED_SIZE 65536
+
+MappedFile::MappedFile(const QString &filePath) : file(filePath) {
+}
+
+const QByteArray &MappedFile::data() {
+    if (isOpened) {
+        return contents;
+    }
+    isOpened = true;
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        return contents;
+    }
+    const qint64 size = file.size();
+    if (size > std::numeric_limits<int>::max()) {
+        return contents;
+    }
+    if (size >= MIN_MAPPED_SIZE) {
+        mapping = file.map(0, size);
+    }
+    if (mapping) {
+        contents = QByteArray::fromRawData(reinterpret_cast<const char *>(mapping), int(size));
+    } else {
+        contents = file.readAll();
+    }
+    return contents;
+}
+
+void MappedFile::setReaderDevice(QImageReader &reader, QBuffer &buffer) {
+    if (data().isEmpty()) {
+        reader.setFormat(QByteArray());
+        reader.setFileName(file.fileName());
+        return;
+    }
+    if (!buffer.isOpen()) {
+        buffer.setData(contents);
+        buffer.open(QIODevice::ReadOnly);
+    }
+    buffer.seek(0);
+    reader.setDevice(&buffer);
+    reader.setFormat(QFileInfo(file.fileName()).suffix().toLower().toLatin1());
+}
+
+void MappedFile::willNeed() {
+#ifdef Q_OS_UNIX
+    if (data().isEmpty() || !mapping) {
+        return;
+    }
+    madvise(mapping, size_t(contents.size()), MADV_WILLNEED);
+#endif
+}
+
+void MappedFile::willNeed(const QString &filePath) {
+#ifdef Q_OS_LINUX
+    const int descriptor = ::open(QFile::encodeName(filePath).constData(), O_RDONLY | O_CLOEXEC);
+    if (descriptor < 0) {
+        return;
+    }
+    posix_fadvise(descriptor, 0, 0, POSIX_FADV_WILLNEED);
+    ::close(descriptor);
+#else
+    Q_UNUSED(filePath)
+#endif
+}
@@ -0,0 +1,56 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <QtCore>
+#include <QImageReader>
+
+// A file's contents for Exiv2 and the image decoders to share, so it is opened
+// and read once. Large files are memory mapped, small ones read in one go.
+// The data is only valid for as long as the MappedFile lives.
+class MappedFile {
+
+public:
+    explicit MappedFile(const QString &filePath);
+
+    Q_DISABLE_COPY(MappedFile)
+
+    // Empty if the file could not be read, it is opened on first use
+    const QByteArray &data();
+
+    // Points reader at data() through buffer, or at the file when there is no data. The suffix
+    // is passed on as the format, as when the reader opens the file by name.
+    void setReaderDevice(QImageReader &reader, QBuffer &buffer);
+
+    // Starts reading all of the file in the background, for when it is about to be decoded
+    void willNeed();
+
+    // The same for a file that is not open yet, such as the next one in a queue
+    static void willNeed(const QString &filePath);
+
+private:
+    QFile file;
+    uchar *mapping = nullptr;
+    QByteArray contents;
+    bool isOpened = false;
+};
+
+#endif // MAPPED_FILE_H
@@ -19,51 +19,352 @@
 #include <exiv2/exiv2.hpp>
 #include "Settings.h"
 #include "MetadataCache.h"
+#include "MetadataDatabase.h"
+#include "PerfCounters.h"
 
-void MetadataCache::updateImageTags(QString &imageFileName, QSet<QString> tags) {
-    cache[imageFileName].tags = tags;
+MetadataCache::Shard &MetadataCache::shardFor(const QString &imageFileName) const {
+    return shards[qHash(imageFileName) % METADATA_CACHE_SHARDS];
 }
 
-bool MetadataCache::removeTagFromImage(QString &imageFileName, const QString &tagName) {
-    return cache[imageFileName].tags.remove(tagName);
+quint32 MetadataCache::imageId(const QString &imageFileName) {
+    QHash<QString, quint32>::const_iterator it = imageIds.constFind(imageFileName);
+    if (it != imageIds.constEnd()) {
+        return *it;
+    }
+    imageIds.insert(imageFileName, nextImageId);
+    return nextImageId++;
+}
+
+void MetadataCache::indexTags(const QString &imageFileName, const QSet<QString> &oldTags,
+                              const QSet<QString> &newTags) {
+    if (oldTags.isEmpty() && newTags.isEmpty()) {
+        return;
+    }
+
+    QMutexLocker locker(&indexMutex);
+    const quint32 id = imageId(imageFileName);
+    for (const QString &tagName : oldTags) {
+        if (!newTags.contains(tagName)) {
+            QHash<QString, QSet<quint32>>::iterator it = tagImages.find(tagName);
+            if (it != tagImages.end()) {
+                it->remove(id);
+                if (it->isEmpty()) {
+                    tagImages.erase(it);
+                }
+            }
+        }
+    }
+    for (const QString &tagName : newTags) {
+        if (!oldTags.contains(tagName)) {
+            QSet<quint32> &images = tagImages[tagName];
+            if (images.isEmpty()) {
+                unpublishedTags.insert(tagName);
+            }
+            images.insert(id);
+        }
+    }
 }
 
-void MetadataCache::removeImage(QString &imageFileName) {
-    cache.remove(imageFileName);
+void MetadataCache::updateImageTags(const QString &imageFileName, const QSet<QString> &tags) {
+    setImageTags(imageFileName, tags);
 }
 
-QSet<QString> &MetadataCache::getImageTags(QString &imageFileName) {
-    return cache[imageFileName].tags;
+bool MetadataCache::removeTagFromImage(const QString &imageFileName, const QString &tagName) {
+    // The edit goes on top of the tags in the file, those have to be known first
+    loadImageMetadata(imageFileName);
+    Shard &shard = shardFor(imageFileName);
+    QMutexLocker locker(&shard.mutex);
+    ImageMetadata &imageMetadata = shard.images[imageFileName];
+    if (!imageMetadata.tags.contains(tagName)) {
+        return false;
+    }
+    indexTags(imageFileName, QSet<QString>() << tagName, QSet<QString>());
+    return imageMetadata.tags.remove(tagName);
 }
 
-long MetadataCache::getImageOrientation(QString &imageFileName) {
-    if (cache.contains(imageFileName) || loadImageMetadata(imageFileName)) {
-        return cache[imageFileName].orientation;
+void MetadataCache::removeImage(const QString &imageFileName) {
+    Shard &shard = shardFor(imageFileName);
+    QMutexLocker locker(&shard.mutex);
+    QHash<QString, ImageMetadata>::iterator it = shard.images.find(imageFileName);
+    if (it == shard.images.end()) {
+        return;
     }
+    indexTags(imageFileName, it->tags, QSet<QString>());
+    shard.images.erase(it);
+}
+
+QSet<QString> MetadataCache::getImageTags(const QString &imageFileName) const {
+    Shard &shard = shardFor(imageFileName);
+    QMutexLocker locker(&shard.mutex);
+    return shard.images.value(imageFileName).tags;
+}
 
-    return 0;
+bool MetadataCache::hasAnyTag(const QString &imageFileName, const QSet<QString> &tags) const {
+    QMutexLocker locker(&indexMutex);
+    QHash<QString, quint32>::const_iterator idIt = imageIds.constFind(imageFileName);
+    if (idIt == imageIds.constEnd()) {
+        return false;
+    }
+    for (const QString &tagName : tags) {
+        QHash<QString, QSet<quint32>>::const_iterator it = tagImages.constFind(tagName);
+        if (it != tagImages.constEnd() && it->contains(*idIt)) {
+            return true;
+        }
+    }
+    return false;
 }
 
-void MetadataCache::setImageTags(const QString &imageFileName, QSet<QString> tags) {
+long MetadataCache::getImageOrientation(const QString &imageFileName, const QByteArray &fileData) {
     ImageMetadata imageMetadata;
+    loadImageMetadata(imageFileName, &imageMetadata, fileData);
+    return imageMetadata.orientation;
+}
 
+long MetadataCache::getCachedImageOrientation(const QString &imageFileName) const {
+    Shard &shard = shardFor(imageFileName);
+    QMutexLocker locker(&shard.mutex);
+    return shard.images.value(imageFileName).orientation;
+}
+
+bool MetadataCache::hasImageMetadata(const QString &imageFileName) const {
+    Shard &shard = shardFor(imageFileName);
+    QMutexLocker locker(&shard.mutex);
+    return shard.images.value(imageFileName).loaded;
+}
+
+void MetadataCache::setImageTags(const QString &imageFileName, const QSet<QString> &tags) {
+    Shard &shard = shardFor(imageFileName);
+    QMutexLocker locker(&shard.mutex);
+    ImageMetadata &imageMetadata = shard.images[imageFileName];
+    indexTags(imageFileName, imageMetadata.tags, tags);
     imageMetadata.tags = tags;
-    cache.insert(imageFileName, imageMetadata);
 }
 
-void MetadataCache::addTagToImage(QString &imageFileName, QString &tagName) {
-    if (cache[imageFileName].tags.contains(tagName)) {
+void MetadataCache::addTagToImage(const QString &imageFileName, const QString &tagName) {
+    loadImageMetadata(imageFileName);
+    Shard &shard = shardFor(imageFileName);
+    QMutexLocker locker(&shard.mutex);
+    ImageMetadata &imageMetadata = shard.images[imageFileName];
+    if (imageMetadata.tags.contains(tagName)) {
         return;
     }
 
-    cache[imageFileName].tags.insert(tagName);
+    indexTags(imageFileName, QSet<QString>(), QSet<QString>() << tagName);
+    imageMetadata.tags.insert(tagName);
 }
 
 void MetadataCache::clear() {
-    cache.clear();
+    for (Shard &shard : shards) {
+        QMutexLocker locker(&shard.mutex);
+        // Loads in flight insert into the cleared shard, the result is still current
+        shard.images.clear();
+    }
+
+    QMutexLocker locker(&indexMutex);
+    imageIds.clear();
+    tagImages.clear();
+    unpublishedTags.clear();
+    nextImageId = 0;
+}
+
+void MetadataCache::insertReadImageMetadata(const QString &imageFullPath, const ImageMetadata &imageMetadata) {
+    ImageMetadata readMetadata = imageMetadata;
+    readSidecarTags(imageFullPath, readMetadata.tags);
+    const QFileInfo fileInfo(imageFullPath);
+    readMetadata.lastModified = fileInfo.lastModified().toMSecsSinceEpoch();
+    readMetadata.readable = true;
+    readMetadata.loaded = true;
+
+    {
+        Shard &shard = shardFor(imageFullPath);
+        QMutexLocker locker(&shard.mutex);
+        if (shard.images.value(imageFullPath).loaded || shard.loadingImages.contains(imageFullPath)) {
+            return;
+        }
+        insertImageMetadata(shard, imageFullPath, readMetadata);
+    }
+
+    // The database has its own lock, the shard is not kept waiting on its disk writes
+    if (isDatabaseEnabled) {
+        MetadataDatabase::instance()->insert(imageFullPath, readMetadata.lastModified, fileInfo.size(),
+                                             readMetadata);
+    }
+}
+
+void MetadataCache::setDatabaseEnabled(bool enabled) {
+    isDatabaseEnabled = enabled;
+}
+
+void MetadataCache::setSidecarsEnabled(bool enabled) {
+    isSidecarsEnabled = enabled;
+}
+
+bool MetadataCache::sidecarsEnabled() const {
+    return isSidecarsEnabled;
+}
+
+void MetadataCache::imageTagsWritten(const QString &imageFullPath) {
+    const QFileInfo fileInfo(imageFullPath);
+    ImageMetadata writtenMetadata;
+    {
+        Shard &shard = shardFor(imageFullPath);
+        QMutexLocker locker(&shard.mutex);
+        QHash<QString, ImageMetadata>::iterator it = shard.images.find(imageFullPath);
+        if (it == shard.images.end() || !it->loaded) {
+            // The orientation is still to be read, the tags will be found in the file then
+            return;
+        }
+        it->lastModified = fileInfo.lastModified().toMSecsSinceEpoch();
+        writtenMetadata = *it;
+    }
+
+    if (isDatabaseEnabled) {
+        MetadataDatabase::instance()->insert(imageFullPath, writtenMetadata.lastModified, fileInfo.size(),
+                                             writtenMetadata);
+    }
+}
+
+void MetadataCache::imageMetadataRemoved(const QString &imageFullPath) {
+    const QFileInfo fileInfo(imageFullPath);
+    ImageMetadata imageMetadata;
+    imageMetadata.lastModified = fileInfo.lastModified().toMSecsSinceEpoch();
+    imageMetadata.readable = true;
+    imageMetadata.loaded = true;
+
+    {
+        Shard &shard = shardFor(imageFullPath);
+        QMutexLocker locker(&shard.mutex);
+        insertImageMetadata(shard, imageFullPath, imageMetadata);
+    }
+
+    if (isDatabaseEnabled) {
+        MetadataDatabase::instance()->insert(imageFullPath, imageMetadata.lastModified, fileInfo.size(),
+                                             imageMetadata);
+    }
+}
+
+void MetadataCache::removeChangedImages(const QFileInfoList &files) {
+    for (const QFileInfo &fileInfo : files) {
+        const QString imageFileName = fileInfo.filePath();
+        Shard &shard = shardFor(imageFileName);
+        QMutexLocker locker(&shard.mutex);
+        QHash<QString, ImageMetadata>::iterator it = shard.images.find(imageFileName);
+        if (it == shard.images.end() || !it->loaded
+            || it->lastModified == fileInfo.lastModified().toMSecsSinceEpoch()) {
+            continue;
+        }
+        indexTags(imageFileName, it->tags, QSet<QString>());
+        shard.images.erase(it);
+    }
+}
+
+bool MetadataCache::loadImageMetadata(const QString &imageFullPath, ImageMetadata *imageMetadata,
+                                      const QByteArray &fileData) {
+    Shard &shard = shardFor(imageFullPath);
+    {
+        QMutexLocker locker(&shard.mutex);
+        forever {
+            QHash<QString, ImageMetadata>::const_iterator it = shard.images.constFind(imageFullPath);
+            if (it != shard.images.constEnd() && it->loaded) {
+                if (imageMetadata) {
+                    *imageMetadata = *it;
+                }
+                Perf::count(Perf::MetadataMemoryHits);
+                return it->readable;
+            }
+            if (!shard.loadingImages.contains(imageFullPath)) {
+                break;
+            }
+            shard.loadFinished.wait(&shard.mutex);
+        }
+        shard.loadingImages.insert(imageFullPath);
+    }
+
+    // Whatever the read throws, the image must come off the loading list or its waiters never wake
+    struct LoadingGuard {
+        Shard &shard;
+        const QString &imageFullPath;
+        bool isActive;
+
+        ~LoadingGuard() {
+            if (isActive) {
+                QMutexLocker locker(&shard.mutex);
+                shard.loadingImages.remove(imageFullPath);
+                shard.loadFinished.wakeAll();
+            }
+        }
+    } loadingGuard = {shard, imageFullPath, true};
+
+    // Exiv2 runs without any lock held
+    Perf::ScopedTimer timer(Perf::MetadataLoad);
+    const QFileInfo fileInfo(imageFullPath);
+    const qint64 lastModified = fileInfo.lastModified().toMSecsSinceEpoch();
+    const bool useDatabase = isDatabaseEnabled;
+    ImageMetadata readMetadata;
+    if (useDatabase
+        && MetadataDatabase::instance()->find(imageFullPath, lastModified, fileInfo.size(), readMetadata)) {
+        Perf::count(Perf::MetadataDatabaseHits);
+    } else {
+        Perf::count(Perf::MetadataReads);
+        readMetadata.lastModified = lastModified;
+        readMetadata.readable = readImageMetadata(imageFullPath, readMetadata, fileData);
+        readMetadata.loaded = true;
+        if (useDatabase) {
+            MetadataDatabase::instance()->insert(imageFullPath, lastModified, fileInfo.size(), readMetadata);
+        }
+    }
+
+    QMutexLocker locker(&shard.mutex);
+    shard.loadingImages.remove(imageFullPath);
+    insertImageMetadata(shard, imageFullPath, readMetadata);
+    shard.loadFinished.wakeAll();
+    loadingGuard.isActive = false;
+
+    if (imageMetadata) {
+        *imageMetadata = shard.images.value(imageFullPath);
+    }
+    return readMetadata.readable;
+}
+
+void MetadataCache::insertImageMetadata(Shard &shard, const QString &imageFullPath,
+                                        const ImageMetadata &imageMetadata) {
+    QHash<QString, ImageMetadata>::iterator it = shard.images.find(imageFullPath);
+    if (it == shard.images.end()) {
+        indexTags(imageFullPath, QSet<QString>(), imageMetadata.tags);
+        shard.images.insert(imageFullPath, imageMetadata);
+        return;
+    }
+
+    // Tags set before the file was read are edits still on their way to it, they win
+    const QSet<QString> pendingTags = it->tags;
+    const bool hasPendingTags = !it->loaded;
+    *it = imageMetadata;
+    if (hasPendingTags) {
+        it->tags = pendingTags;
+    } else {
+        indexTags(imageFullPath, pendingTags, imageMetadata.tags);
+    }
+}
+
+bool MetadataCache::publishNewTags() {
+    QSet<QString> tags;
+    {
+        QMutexLocker locker(&indexMutex);
+        tags.swap(unpublishedTags);
+    }
+
+    bool newTagsFound = false;
+    for (const QString &tagName : tags) {
+        if (!Settings::knownTags.contains(tagName)) {
+            Settings::knownTags.insert(tagName);
+            newTagsFound = true;
+        }
+    }
+    return newTagsFound;
 }
 
-bool MetadataCache::loadImageMetadata(const QString &imageFullPath) {
+bool MetadataCache::readImageMetadata(const QString &imageFullPath, ImageMetadata &imageMetadata,
+                                      const QByteArray &fileData) {
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdeprecated-declarations"
 #if EXIV2_TEST_VERSION(0,28,0)
@@ -73,24 +374,75 @@ bool MetadataCache::loadImageMetadata(const QString &imageFullPath) {
 #endif
 #pragma clang diagnostic pop
 
-    QSet<QString> tags;
-    long orientation = 0;
-
     try {
-        exifImage = Exiv2::ImageFactory::open(imageFullPath.toStdString());
+        exifImage = fileData.isEmpty()
+                    ? Exiv2::ImageFactory::open(imageFullPath.toStdString())
+                    : Exiv2::ImageFactory::open(reinterpret_cast<const Exiv2::byte *>(fileData.constData()),
+                                                fileData.size());
         exifImage->readMetadata();
-    } catch (Exiv2::Error &error) {
+    } catch (const std::exception &error) {
+        // Exiv2::Error, or whatever else a damaged file makes it throw
         qWarning() << "Error loading image for reading metadata" << error.what();
+        // The sidecar still has the tags of a file Exiv2 cannot parse
+        readSidecarTags(imageFullPath, imageMetadata.tags);
+        return false;
+    }
+
+    const bool isReadable = readImageMetadata(*exifImage, imageMetadata);
+    readSidecarTags(imageFullPath, imageMetadata.tags);
+    return isReadable;
+}
+
+QString MetadataCache::sidecarPath(const QString &imageFullPath) {
+    return imageFullPath + QLatin1String(".xmp");
+}
+
+bool MetadataCache::readSidecarTags(const QString &imageFullPath, QSet<QString> &tags) {
+    const QString sidecarFullPath = sidecarPath(imageFullPath);
+    if (!QFile::exists(sidecarFullPath)) {
+        return false;
+    }
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#if EXIV2_TEST_VERSION(0,28,0)
+    Exiv2::Image::UniquePtr sidecar;
+#else
+    Exiv2::Image::AutoPtr sidecar;
+#endif
+#pragma clang diagnostic pop
+
+    QSet<QString> sidecarTags;
+    try {
+        sidecar = Exiv2::ImageFactory::open(sidecarFullPath.toStdString());
+        sidecar->readMetadata();
+        Exiv2::XmpData &xmpData = sidecar->xmpData();
+        Exiv2::XmpData::const_iterator it = xmpData.findKey(Exiv2::XmpKey("Xmp.dc.subject"));
+        if (it != xmpData.end()) {
+            for (long i = 0; i < long(it->count()); ++i) {
+                sidecarTags.insert(QString::fromUtf8(it->toString(i).c_str()));
+            }
+        }
+    } catch (const Exiv2::Error &error) {
+        qWarning() << "Failed to read XMP sidecar" << sidecarFullPath << error.what();
         return false;
     }
 
-    if (!exifImage->good()) {
+    tags = sidecarTags;
+    return true;
+}
+
+bool MetadataCache::readImageMetadata(Exiv2::Image &exifImage, ImageMetadata &imageMetadata) {
+    QSet<QString> tags;
+    long orientation = 0;
+
+    if (!exifImage.good()) {
         return false;
     }
 
-    if (exifImage->supportsMetadata(Exiv2::mdExif)) try {
-        Exiv2::ExifData::const_iterator it = Exiv2::orientation(exifImage->exifData());
-        if (it != exifImage->exifData().end()) {
+    if (exifImage.supportsMetadata(Exiv2::mdExif)) try {
+        Exiv2::ExifData::const_iterator it = Exiv2::orientation(exifImage.exifData());
+        if (it != exifImage.exifData().end()) {
 #if EXIV2_TEST_VERSION(0,28,0)
             orientation = it->toUint32();
 #else
@@ -101,8 +453,8 @@ bool MetadataCache::loadImageMetadata(const QString &imageFullPath) {
         qWarning() << "Failed to read Exif metadata" << error.what();
     }
 
-    if (exifImage->supportsMetadata(Exiv2::mdIptc)) try {
-        Exiv2::IptcData &iptcData = exifImage->iptcData();
+    if (exifImage.supportsMetadata(Exiv2::mdIptc)) try {
+        Exiv2::IptcData &iptcData = exifImage.iptcData();
         if (!iptcData.empty()) {
             QString key;
             Exiv2::IptcData::iterator end = iptcData.end();
@@ -114,28 +466,15 @@ bool MetadataCache::loadImageMetadata(const QString &imageFullPath) {
                     continue;
                 }
 
-                QString tagName = QString::fromUtf8(iptcIt->toString().c_str());
-                tags.insert(tagName);
-                Settings::knownTags.insert(tagName);
+                tags.insert(QString::fromUtf8(iptcIt->toString().c_str()));
             }
         }
     } catch (Exiv2::Error &error) {
         qWarning() << "Failed to read Iptc metadata";
     }
 
-    ImageMetadata imageMetadata;
-    if (tags.size()) {
-        imageMetadata.tags = tags;
-    }
-
-    if (orientation) {
-        imageMetadata.orientation = orientation;
-    }
-
-    if (tags.size() || orientation) {
-        cache.insert(imageFullPath, imageMetadata);
-    }
-
+    imageMetadata.tags = tags;
+    imageMetadata.orientation = orientation;
     return true;
 }
 
@@ -20,36 +20,124 @@
 #define META_DATA_CACHE_H
 
 #include <QtWidgets>
+#include <atomic>
+
+#define METADATA_CACHE_SHARDS 16
+
+namespace Exiv2 {
+    class Image;
+}
 
 class ImageMetadata {
 public:
     QSet<QString> tags;
-    long orientation;
+    long orientation = 0;
+    qint64 lastModified = 0;
+    bool loaded = false;
+    // Images Exiv2 could not read are remembered as well, so they are not tried again
+    bool readable = false;
 };
 
+Q_DECLARE_METATYPE(ImageMetadata)
+
+// Tags and orientation per image, safe to use from any thread. Images are
+// spread over shards with a lock each so workers rarely wait on each other,
+// and each file is read by Exiv2 at most once until it changes on disk.
+// An inverted index from each tag to the images carrying it answers tag
+// filters with set lookups instead of going through every image's tags.
 class MetadataCache {
 
 private:
-    QMap<QString, ImageMetadata> cache;
+    struct Shard {
+        QMutex mutex;
+        QWaitCondition loadFinished;
+        QHash<QString, ImageMetadata> images;
+        QSet<QString> loadingImages;
+    };
+
+    mutable Shard shards[METADATA_CACHE_SHARDS];
+
+    // Always taken after a shard's lock, never before
+    mutable QMutex indexMutex;
+    QHash<QString, quint32> imageIds;
+    QHash<QString, QSet<quint32>> tagImages;
+    QSet<QString> unpublishedTags;
+    quint32 nextImageId = 0;
+    std::atomic<bool> isDatabaseEnabled{false};
+    std::atomic<bool> isSidecarsEnabled{false};
+
+    Shard &shardFor(const QString &imageFileName) const;
+
+    quint32 imageId(const QString &imageFileName);
+
+    void indexTags(const QString &imageFileName, const QSet<QString> &oldTags, const QSet<QString> &newTags);
+
+    void insertImageMetadata(Shard &shard, const QString &imageFullPath, const ImageMetadata &imageMetadata);
 
 public:
-    void updateImageTags(QString &imageFileName, QSet<QString> tags);
+    void updateImageTags(const QString &imageFileName, const QSet<QString> &tags);
 
-    void addTagToImage(QString &imageFileName, QString &tagName);
+    void addTagToImage(const QString &imageFileName, const QString &tagName);
 
-    bool removeTagFromImage(QString &imageFileName, const QString &tagName);
+    bool removeTagFromImage(const QString &imageFileName, const QString &tagName);
 
-    void removeImage(QString &imageFileName);
+    void removeImage(const QString &imageFileName);
 
-    QSet<QString> &getImageTags(QString &imageFileName);
+    QSet<QString> getImageTags(const QString &imageFileName) const;
 
-    void setImageTags(const QString &imageFileName, QSet<QString> tags);
+    bool hasAnyTag(const QString &imageFileName, const QSet<QString> &tags) const;
+
+    void setImageTags(const QString &imageFileName, const QSet<QString> &tags);
 
     void clear();
 
-    bool loadImageMetadata(const QString &imageFullPath);
+    // Whether reads go through the MetadataDatabase, so they last beyond the session
+    void setDatabaseEnabled(bool enabled);
+
+    // Whether tag edits go to XMP sidecars instead of the images. Sidecars are read either way.
+    void setSidecarsEnabled(bool enabled);
+
+    bool sidecarsEnabled() const;
+
+    // "photo.jpg.xmp", the name other tools use as well
+    static QString sidecarPath(const QString &imageFullPath);
+
+    // A sidecar that exists has the final say on the tags. Returns false if there is none.
+    static bool readSidecarTags(const QString &imageFullPath, QSet<QString> &tags);
+
+    // Call after writing the cached tags to the image, its modification time changed with that
+    void imageTagsWritten(const QString &imageFullPath);
+
+    // Call after stripping all metadata from the image
+    void imageMetadataRemoved(const QString &imageFullPath);
+
+    // Forgets images whose modification time differs from the one in the listing
+    void removeChangedImages(const QFileInfoList &files);
+
+    // Reads the image unless that was done before, concurrent calls for the same
+    // image wait for the first one. Returns false if Exiv2 could not read it.
+    // With fileData Exiv2 parses that instead of opening the file again.
+    bool loadImageMetadata(const QString &imageFullPath, ImageMetadata *imageMetadata = nullptr,
+                           const QByteArray &fileData = QByteArray());
+
+    // Does not touch the cache
+    static bool readImageMetadata(const QString &imageFullPath, ImageMetadata &imageMetadata,
+                                  const QByteArray &fileData = QByteArray());
+
+    static bool readImageMetadata(Exiv2::Image &exifImage, ImageMetadata &imageMetadata);
+
+    // Takes metadata from an image someone else had to open anyway, unless it is known already
+    void insertReadImageMetadata(const QString &imageFullPath, const ImageMetadata &imageMetadata);
+
+    // Adds the tags found since the last call to Settings::knownTags. Returns true
+    // if any of them were not known before. Only to be called from the GUI thread.
+    bool publishNewTags();
+
+    bool hasImageMetadata(const QString &imageFileName) const;
+
+    long getImageOrientation(const QString &imageFileName, const QByteArray &fileData = QByteArray());
 
-    long getImageOrientation(QString &imageFileName);
+    long getCachedImageOrientation(const QString &imageFileName) const;
 
 };
 
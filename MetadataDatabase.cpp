@@ -0,0 +1,114 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "MetadataDatabase.h"
+
+#define DATABASE_VERSION 2
+#define DATABASE_RECORD_MAGIC 0x4154454d
+
+MetadataDatabase *MetadataDatabase::instance() {
+    static MetadataDatabase database;
+    return &database;
+}
+
+MetadataDatabase::MetadataDatabase()
+    : records(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) +
+              QLatin1String("/phototonic/metadata.db"), QByteArray("PHTMETA1"), DATABASE_VERSION, parseRecord) {
+}
+
+qint64 MetadataDatabase::parseRecord(const uchar *data, qint64 available, RecordFile::FileId &id) {
+    RecordHeader header;
+    if (available < qint64(sizeof(header))) {
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != DATABASE_RECORD_MAGIC) {
+        return 0;
+    }
+    id = {header.device, header.inode};
+    return qint64(sizeof(header)) + header.length;
+}
+
+qint64 MetadataDatabase::sidecarModified(const QString &filePath) {
+    // Other tools edit the sidecar without touching the image
+    const QFileInfo sidecarInfo(MetadataCache::sidecarPath(filePath));
+    return sidecarInfo.exists() ? sidecarInfo.lastModified().toMSecsSinceEpoch() : 0;
+}
+
+bool MetadataDatabase::find(const QString &filePath, qint64 lastModified, qint64 fileSize,
+                            ImageMetadata &imageMetadata) {
+    RecordFile::FileId id;
+    if (!RecordFile::fileId(filePath, id)) {
+        return false;
+    }
+
+    QMutexLocker locker(&mutex);
+    const qint64 offset = records.find(id);
+    RecordHeader header;
+    if (offset < 0 || !records.read(offset, &header, sizeof(header))
+        || header.lastModified != lastModified || header.fileSize != fileSize
+        || header.sidecarModified != sidecarModified(filePath)) {
+        return false;
+    }
+    const QByteArray tags = records.read(offset + qint64(sizeof(header)), header.length);
+    if (tags.size() != int(header.length)) {
+        return false;
+    }
+
+    imageMetadata = ImageMetadata();
+    const QList<QByteArray> tagNames = tags.split('\0');
+    for (const QByteArray &tagName : tagNames) {
+        if (!tagName.isEmpty()) {
+            imageMetadata.tags.insert(QString::fromUtf8(tagName));
+        }
+    }
+    imageMetadata.orientation = header.orientation;
+    imageMetadata.lastModified = lastModified;
+    imageMetadata.readable = header.flags & IsReadable;
+    imageMetadata.loaded = true;
+    return true;
+}
+
+void MetadataDatabase::insert(const QString &filePath, qint64 lastModified, qint64 fileSize,
+                              const ImageMetadata &imageMetadata) {
+    RecordFile::FileId id;
+    if (!RecordFile::fileId(filePath, id)) {
+        return;
+    }
+
+    QByteArray tags;
+    for (const QString &tagName : imageMetadata.tags) {
+        tags.append(tagName.toUtf8());
+        tags.append('\0');
+    }
+
+    const RecordHeader header = {DATABASE_RECORD_MAGIC, quint32(tags.size()), id.device, id.inode, lastModified,
+                                 fileSize, sidecarModified(filePath), qint32(imageMetadata.orientation),
+                                 imageMetadata.readable ? quint32(IsReadable) : 0};
+    QByteArray record(reinterpret_cast<const char *>(&header), sizeof(header));
+    record.append(tags);
+
+    QMutexLocker locker(&mutex);
+    records.append(id, record);
+}
+
+void MetadataDatabase::flush() {
+    QMutexLocker locker(&mutex);
+    records.flush();
+}
@@ -0,0 +1,71 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef METADATA_DATABASE_H
+#define METADATA_DATABASE_H
+
+#include <QtCore>
+#include "MetadataCache.h"
+#include "RecordFile.h"
+
+// On-disk index of tags and orientation, so folders visited before do not
+// have to be read by Exiv2 again. Kept in a RecordFile like the feature
+// database, a record only applies while the image's size and modification
+// time match, and those of the XMP sidecar merged into it.
+class MetadataDatabase {
+
+public:
+    static MetadataDatabase *instance();
+
+    bool find(const QString &filePath, qint64 lastModified, qint64 fileSize, ImageMetadata &imageMetadata);
+
+    // Buffered, flush() writes the records out
+    void insert(const QString &filePath, qint64 lastModified, qint64 fileSize, const ImageMetadata &imageMetadata);
+
+    void flush();
+
+private:
+    enum RecordFlags {
+        IsReadable = 1
+    };
+
+    // Followed by the tags in UTF-8, each terminated by a null byte
+    struct RecordHeader {
+        quint32 magic;
+        quint32 length;
+        quint64 device;
+        quint64 inode;
+        qint64 lastModified;
+        qint64 fileSize;
+        // 0 without a sidecar
+        qint64 sidecarModified;
+        qint32 orientation;
+        quint32 flags;
+    };
+
+    MetadataDatabase();
+
+    static qint64 parseRecord(const uchar *data, qint64 available, RecordFile::FileId &id);
+
+    static qint64 sidecarModified(const QString &filePath);
+
+    QMutex mutex;
+    RecordFile records;
+};
+
+#endif // METADATA_DATABASE_H
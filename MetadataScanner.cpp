@@ -0,0 +1,140 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <exiv2/exiv2.hpp>
+#include "MetadataScanner.h"
+#include "Exiv2Init.h"
+
+#define SCAN_BATCH_SIZE 64
+
+class MetadataScanner::Worker : public QRunnable {
+public:
+    explicit Worker(MetadataScanner *scanner) : scanner(scanner) {}
+
+    void run() override {
+        scanner->processQueue();
+    }
+
+private:
+    MetadataScanner *scanner;
+};
+
+class MetadataScanner::BlockingWorker : public QRunnable {
+public:
+    BlockingWorker(MetadataCache *metadataCache, QVector<ScannedMetadata> *results, int first, int last)
+        : metadataCache(metadataCache), results(results), first(first), last(last) {}
+
+    void run() override {
+        for (int i = first; i < last; ++i) {
+            ScannedMetadata &result = (*results)[i];
+            result.isValid = metadataCache->loadImageMetadata(result.imageFileName, &result.metadata);
+        }
+    }
+
+private:
+    MetadataCache *metadataCache;
+    QVector<ScannedMetadata> *results;
+    int first;
+    int last;
+};
+
+MetadataScanner::MetadataScanner(const std::shared_ptr<MetadataCache> &metadataCache, QObject *parent)
+    : QObject(parent), metadataCache(metadataCache) {
+    qRegisterMetaType<ScannedMetadata>();
+    qRegisterMetaType<QVector<ScannedMetadata>>();
+
+    Exiv2Init::ensure();
+    threadPool.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+MetadataScanner::~MetadataScanner() {
+    cancel();
+    threadPool.waitForDone();
+}
+
+void MetadataScanner::scan(const QStringList &imageFileNames) {
+    if (imageFileNames.isEmpty()) {
+        return;
+    }
+
+    QMutexLocker locker(&mutex);
+    queue.append(imageFileNames);
+
+    const int wantedWorkers = (queue.size() + SCAN_BATCH_SIZE - 1) / SCAN_BATCH_SIZE;
+    while (activeWorkers < threadPool.maxThreadCount() && activeWorkers < wantedWorkers) {
+        ++activeWorkers;
+        threadPool.start(new Worker(this));
+    }
+}
+
+QVector<ScannedMetadata> MetadataScanner::scanBlocking(const QStringList &imageFileNames) {
+    QVector<ScannedMetadata> results(imageFileNames.size());
+    for (int i = 0; i < imageFileNames.size(); ++i) {
+        results[i].imageFileName = imageFileNames.at(i);
+    }
+
+    // A separate pool, background scans queued before must not hold this up
+    QThreadPool blockingPool;
+    const int threads = QThread::idealThreadCount();
+    const int sliceSize = qMax(1, (results.size() + threads - 1) / threads);
+    for (int first = 0; first < results.size(); first += sliceSize) {
+        blockingPool.start(new BlockingWorker(metadataCache.get(), &results, first, qMin(first + sliceSize, results.size())));
+    }
+    blockingPool.waitForDone();
+
+    return results;
+}
+
+void MetadataScanner::cancel() {
+    QMutexLocker locker(&mutex);
+    queue.clear();
+    ++generation;
+}
+
+void MetadataScanner::processQueue() {
+    forever {
+        QStringList imageFileNames;
+        int batchGeneration;
+        {
+            QMutexLocker locker(&mutex);
+            if (queue.isEmpty()) {
+                --activeWorkers;
+                return;
+            }
+            imageFileNames = queue.mid(0, SCAN_BATCH_SIZE);
+            queue.erase(queue.begin(), queue.begin() + imageFileNames.size());
+            batchGeneration = generation;
+        }
+
+        QVector<ScannedMetadata> results;
+        results.reserve(imageFileNames.size());
+        for (const QString &imageFileName : imageFileNames) {
+            if (batchGeneration != generation) {
+                break;
+            }
+            ScannedMetadata result;
+            result.imageFileName = imageFileName;
+            result.isValid = metadataCache->loadImageMetadata(imageFileName, &result.metadata);
+            results.append(result);
+        }
+
+        if (batchGeneration == generation) {
+            emit metadataScanned(results);
+        }
+    }
+}
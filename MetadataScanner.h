@@ -0,0 +1,75 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef METADATA_SCANNER_H
+#define METADATA_SCANNER_H
+
+#include <QtCore>
+#include <atomic>
+#include <memory>
+#include "MetadataCache.h"
+
+struct ScannedMetadata
+{
+    QString imageFileName;
+    ImageMetadata metadata;
+    bool isValid = false;
+};
+
+Q_DECLARE_METATYPE(ScannedMetadata)
+
+// Reads tags and orientation into the MetadataCache on a pool of worker
+// threads. Images the cache already knows are not read again. Results are
+// also delivered in batches through queued signals, so the receiver can
+// update what it shows.
+class MetadataScanner : public QObject {
+Q_OBJECT
+
+public:
+    explicit MetadataScanner(const std::shared_ptr<MetadataCache> &metadataCache, QObject *parent = nullptr);
+
+    ~MetadataScanner() override;
+
+    void scan(const QStringList &imageFileNames);
+
+    // Reads everything in parallel and waits for it, for when the caller cannot go on without the tags
+    QVector<ScannedMetadata> scanBlocking(const QStringList &imageFileNames);
+
+    // Starts a new generation; everything queued or in flight is discarded
+    void cancel();
+
+signals:
+
+    void metadataScanned(const QVector<ScannedMetadata> &results);
+
+private:
+    class Worker;
+
+    class BlockingWorker;
+
+    void processQueue();
+
+    std::shared_ptr<MetadataCache> metadataCache;
+    QThreadPool threadPool;
+    QMutex mutex;
+    QStringList queue;
+    int activeWorkers = 0;
+    std::atomic<int> generation{0};
+};
+
+#endif // METADATA_SCANNER_H
@@ -0,0 +1,194 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QtCore>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QColorSpace>
+#include "PackedThumbnail.h"
+#include "Resampler.h"
+
+#define PACKED_THUMBNAIL_MAGIC 0x4d485450
+#define JPEG_QUALITY 85
+#define RAW_MAX_SIZE 256
+#define PAYLOAD_ALIGNMENT 8
+
+namespace {
+
+struct Header {
+    quint32 magic;
+    quint16 encoding;
+    quint16 textSize;
+    quint32 width;
+    quint32 height;
+    quint32 bytesPerLine;
+    quint32 reserved;
+};
+
+// Pixels of raw records start on an 8 byte boundary of the record, which the pack keeps in the file
+int payloadOffset(const Header &header) {
+    return (int(sizeof(Header)) + header.textSize + PAYLOAD_ALIGNMENT - 1) & ~(PAYLOAD_ALIGNMENT - 1);
+}
+
+bool readHeader(const QByteArray &data, Header &header) {
+    if (data.size() < int(sizeof(Header))) {
+        return false;
+    }
+    memcpy(&header, data.constData(), sizeof(header));
+    if (header.magic != PACKED_THUMBNAIL_MAGIC || header.encoding > PackedThumbnail::Raw
+        || header.width > INT_MAX / 4 || header.height > INT_MAX / 4 || payloadOffset(header) > data.size()) {
+        return false;
+    }
+    // Raw sizes are bounded first, so width * 4 cannot wrap around
+    return header.encoding != PackedThumbnail::Raw
+           || (header.width <= RAW_MAX_SIZE && header.height <= RAW_MAX_SIZE
+               && header.bytesPerLine >= header.width * 4
+               && qint64(header.bytesPerLine) * header.height <= data.size() - payloadOffset(header));
+}
+
+// Key and value pairs, each one followed by a zero byte
+QByteArray encodeText(const QImage &image) {
+    QByteArray text;
+    for (const QString &key : image.textKeys()) {
+        text += key.toUtf8() + '\0' + image.text(key).toUtf8() + '\0';
+    }
+    return text;
+}
+
+void decodeText(const QByteArray &data, const Header &header, QImage &image) {
+    const QList<QByteArray> fields = QByteArray::fromRawData(data.constData() + sizeof(Header),
+                                                             header.textSize).split('\0');
+    for (int i = 0; i + 1 < fields.size(); i += 2) {
+        image.setText(QString::fromUtf8(fields.at(i)), QString::fromUtf8(fields.at(i + 1)));
+    }
+}
+
+const char *formatName(PackedThumbnail::Encoding encoding) {
+    switch (encoding) {
+    case PackedThumbnail::Jpeg:
+        return "jpeg";
+    case PackedThumbnail::WebP:
+        return "webp";
+    default:
+        return "png";
+    }
+}
+
+// What is actually used, for thumbnails the encoding cannot store well
+PackedThumbnail::Encoding effectiveEncoding(const QImage &thumbnail, PackedThumbnail::Encoding encoding) {
+    if (!PackedThumbnail::isSupported(encoding)
+        || (encoding == PackedThumbnail::Jpeg && thumbnail.hasAlphaChannel())
+        || (encoding == PackedThumbnail::Raw && qMax(thumbnail.width(), thumbnail.height()) > RAW_MAX_SIZE)) {
+        return PackedThumbnail::Png;
+    }
+    return encoding;
+}
+
+} // anonymous namespace
+
+namespace PackedThumbnail {
+
+bool isSupported(Encoding encoding) {
+    static const bool hasWebP = QImageWriter::supportedImageFormats().contains("webp")
+                                && QImageReader::supportedImageFormats().contains("webp");
+    return encoding != WebP || hasWebP;
+}
+
+QByteArray encode(const QImage &thumbnail, Encoding encoding) {
+    if (thumbnail.isNull()) {
+        return QByteArray();
+    }
+
+    const QByteArray text = encodeText(thumbnail);
+    if (text.size() > 0xffff) {
+        return QByteArray();
+    }
+    Header header = {PACKED_THUMBNAIL_MAGIC, quint16(effectiveEncoding(thumbnail, encoding)), quint16(text.size()),
+                     quint32(thumbnail.width()), quint32(thumbnail.height()), 0, 0};
+
+    QByteArray data(payloadOffset(header), '\0');
+    if (header.encoding == Raw) {
+        const QImage pixels = thumbnail.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        header.bytesPerLine = quint32(pixels.width() * 4);
+        data.reserve(data.size() + int(header.bytesPerLine) * pixels.height());
+        for (int y = 0; y < pixels.height(); ++y) {
+            data.append(reinterpret_cast<const char *>(pixels.constScanLine(y)), int(header.bytesPerLine));
+        }
+    } else {
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::WriteOnly | QIODevice::Append);
+        QImageWriter writer(&buffer, formatName(Encoding(header.encoding)));
+        if (header.encoding != Png) {
+            writer.setQuality(JPEG_QUALITY);
+        }
+        if (!writer.write(thumbnail)) {
+            qWarning() << "Unable to encode packed thumbnail" << writer.errorString();
+            return QByteArray();
+        }
+    }
+
+    memcpy(data.data(), &header, sizeof(header));
+    memcpy(data.data() + sizeof(header), text.constData(), size_t(text.size()));
+    return data;
+}
+
+QSize size(const QByteArray &data) {
+    Header header;
+    if (!readHeader(data, header)) {
+        return QSize();
+    }
+    return QSize(int(header.width), int(header.height));
+}
+
+QImage decode(const QByteArray &data, const QSize &scaledSize) {
+    Header header;
+    if (!readHeader(data, header)) {
+        return QImage();
+    }
+
+    QImage image;
+    if (header.encoding == Raw) {
+        const char *pixels = data.constData() + payloadOffset(header);
+        QByteArray alignedPixels;
+        if (quintptr(pixels) % 4) {
+            alignedPixels = QByteArray(pixels, int(header.bytesPerLine * header.height));
+            pixels = alignedPixels.constData();
+        }
+        const QImage stored(reinterpret_cast<const uchar *>(pixels), int(header.width), int(header.height),
+                            int(header.bytesPerLine), QImage::Format_ARGB32_Premultiplied);
+        image = scaledSize.isValid() && scaledSize != stored.size() ? Resampler::scaled(stored, scaledSize)
+                                                                      : stored.copy();
+        image.setColorSpace(QColorSpace(QColorSpace::SRgb));
+    } else {
+        QByteArray payload = QByteArray::fromRawData(data.constData() + payloadOffset(header),
+                                                     data.size() - payloadOffset(header));
+        QBuffer buffer(&payload);
+        QImageReader reader(&buffer, formatName(Encoding(header.encoding)));
+        if (scaledSize.isValid()) {
+            reader.setScaledSize(scaledSize);
+        }
+        if (!reader.read(&image)) {
+            return QImage();
+        }
+    }
+    decodeText(data, header, image);
+    return image;
+}
+
+}
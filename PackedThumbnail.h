@@ -0,0 +1,53 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PACKED_THUMBNAIL_H
+#define PACKED_THUMBNAIL_H
+
+#include <QImage>
+
+// The encoding of thumbnails in the packed store. Every record starts with a
+// small header holding the size and the text of the thumbnail, so neither
+// needs a decoder. The freedesktop cache is always PNG, whatever is used here.
+namespace PackedThumbnail {
+
+enum Encoding {
+    Png = 0,
+    // Quality 85, thumbnails with alpha are stored as PNG
+    Jpeg,
+    // Stored as PNG when Qt has no WebP plugin
+    WebP,
+    // Premultiplied ARGB, read back with a copy. Thumbnails above the large size are stored as PNG.
+    Raw
+};
+
+bool isSupported(Encoding encoding);
+
+QByteArray encode(const QImage &thumbnail, Encoding encoding);
+
+// Invalid when data is not a packed thumbnail
+QSize size(const QByteArray &data);
+
+// At scaledSize, or the stored size when that is invalid. Raw thumbnails are copied or scaled
+// straight out of data, which does not have to outlive the result.
+QImage decode(const QByteArray &data, const QSize &scaledSize = QSize());
+
+}
+
+#endif // PACKED_THUMBNAIL_H
@@ -0,0 +1,255 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <atomic>
+#include "PerfCounters.h"
+
+namespace {
+    const char *const timerNames[] = {
+        "thumbnailLoad",
+        "thumbnailCacheLookup",
+        "thumbnailDecode",
+        "thumbnailRotate",
+        "thumbnailSmartCrop",
+        "thumbnailStore",
+        "metadataLoad",
+        "viewerReload",
+        "viewerRefresh",
+        "viewerColorize",
+        "findDuplicates",
+        "sortBySimilarity",
+        "copyMoveFile",
+        "tagWrite",
+        "colorTransform",
+        "resample"
+    };
+    static_assert(sizeof(timerNames) / sizeof(timerNames[0]) == Perf::TimerCount, "Every timer needs a name");
+
+    const char *const counterNames[] = {
+        "thumbnailPackHits",
+        "thumbnailCacheHits",
+        "thumbnailCacheMisses",
+        "metadataMemoryHits",
+        "metadataDatabaseHits",
+        "metadataReads",
+        "colorTransformHits",
+        "colorTransformBuilds"
+    };
+    static_assert(sizeof(counterNames) / sizeof(counterNames[0]) == Perf::CounterCount, "Every counter needs a name");
+
+    const char *const gaugeNames[] = {
+        "thumbnailQueue",
+        "thumbnailWriterQueue",
+        "tagWriterQueue"
+    };
+    static_assert(sizeof(gaugeNames) / sizeof(gaugeNames[0]) == Perf::GaugeCount, "Every gauge needs a name");
+
+    // Only its own thread writes to a block, so updates need no read-modify-write
+    struct ThreadBlock {
+        ThreadBlock() {
+            for (int i = 0; i < Perf::TimerCount; ++i) {
+                timerCounts[i].store(0, std::memory_order_relaxed);
+                timerTotals[i].store(0, std::memory_order_relaxed);
+                timerMaxima[i].store(0, std::memory_order_relaxed);
+            }
+            for (int i = 0; i < Perf::CounterCount; ++i) {
+                counters[i].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        std::atomic<quint64> timerCounts[Perf::TimerCount];
+        std::atomic<quint64> timerTotals[Perf::TimerCount];
+        std::atomic<quint64> timerMaxima[Perf::TimerCount];
+        std::atomic<quint64> counters[Perf::CounterCount];
+    };
+
+    struct Registry {
+        Registry() {
+            for (int i = 0; i < Perf::GaugeCount; ++i) {
+                gauges[i].store(0, std::memory_order_relaxed);
+            }
+            uptime.start();
+        }
+
+        QMutex mutex;
+        QList<ThreadBlock *> blocks;
+        // What finished threads counted, their blocks are gone
+        Perf::Snapshot retired;
+        std::atomic<qint64> gauges[Perf::GaugeCount];
+        QElapsedTimer uptime;
+    };
+
+    Registry &registry() {
+        static Registry registry;
+        return registry;
+    }
+
+    // Starts the uptime clock while static objects are constructed, before main() runs
+    const Registry &processStart = registry();
+
+    void addBlock(Perf::Snapshot &snapshot, const ThreadBlock &block) {
+        for (int i = 0; i < Perf::TimerCount; ++i) {
+            Perf::TimerStats &stats = snapshot.timers[i];
+            stats.count += block.timerCounts[i].load(std::memory_order_relaxed);
+            stats.totalNanoseconds += block.timerTotals[i].load(std::memory_order_relaxed);
+            stats.maxNanoseconds = qMax(stats.maxNanoseconds, block.timerMaxima[i].load(std::memory_order_relaxed));
+        }
+        for (int i = 0; i < Perf::CounterCount; ++i) {
+            snapshot.counters[i] += block.counters[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    // Folds the block into the retired totals when its thread finishes, so pool threads
+    // coming and going do not leave a block behind each
+    struct ThreadBlockOwner {
+        ThreadBlock *block = nullptr;
+
+        ~ThreadBlockOwner() {
+            if (!block) {
+                return;
+            }
+            Registry &perfRegistry = registry();
+            QMutexLocker locker(&perfRegistry.mutex);
+            addBlock(perfRegistry.retired, *block);
+            perfRegistry.blocks.removeOne(block);
+            delete block;
+        }
+    };
+
+    ThreadBlock &threadBlock() {
+        thread_local ThreadBlockOwner owner;
+        if (!owner.block) {
+            owner.block = new ThreadBlock;
+            Registry &perfRegistry = registry();
+            QMutexLocker locker(&perfRegistry.mutex);
+            perfRegistry.blocks.append(owner.block);
+        }
+        return *owner.block;
+    }
+
+    inline void increase(std::atomic<quint64> &value, quint64 amount) {
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    double hitRate(quint64 hits, quint64 misses) {
+        return hits + misses ? double(hits) / double(hits + misses) : qQNaN();
+    }
+}
+
+namespace Perf {
+    void addTime(Timer timer, quint64 nanoseconds) {
+        ThreadBlock &block = threadBlock();
+        increase(block.timerCounts[timer], 1);
+        increase(block.timerTotals[timer], nanoseconds);
+        if (nanoseconds > block.timerMaxima[timer].load(std::memory_order_relaxed)) {
+            block.timerMaxima[timer].store(nanoseconds, std::memory_order_relaxed);
+        }
+    }
+
+    void count(Counter counter, quint64 events) {
+        increase(threadBlock().counters[counter], events);
+    }
+
+    void setGauge(Gauge gauge, qint64 value) {
+        registry().gauges[gauge].store(value, std::memory_order_relaxed);
+    }
+
+    Snapshot snapshot() {
+        Registry &perfRegistry = registry();
+        QMutexLocker locker(&perfRegistry.mutex);
+        Snapshot snapshot = perfRegistry.retired;
+        for (const ThreadBlock *block : perfRegistry.blocks) {
+            addBlock(snapshot, *block);
+        }
+        for (int i = 0; i < GaugeCount; ++i) {
+            snapshot.gauges[i] = perfRegistry.gauges[i].load(std::memory_order_relaxed);
+        }
+        snapshot.uptimeMilliseconds = perfRegistry.uptime.elapsed();
+        return snapshot;
+    }
+
+    double thumbnailCacheHitRate(const Snapshot &snapshot) {
+        return hitRate(snapshot.counters[ThumbnailPackHits] + snapshot.counters[ThumbnailCacheHits],
+                       snapshot.counters[ThumbnailCacheMisses]);
+    }
+
+    double metadataCacheHitRate(const Snapshot &snapshot) {
+        return hitRate(snapshot.counters[MetadataMemoryHits] + snapshot.counters[MetadataDatabaseHits],
+                       snapshot.counters[MetadataReads]);
+    }
+
+    const char *name(Timer timer) {
+        return timerNames[timer];
+    }
+
+    const char *name(Counter counter) {
+        return counterNames[counter];
+    }
+
+    const char *name(Gauge gauge) {
+        return gaugeNames[gauge];
+    }
+
+    QJsonObject toJson(const Snapshot &snapshot) {
+        QJsonObject timers;
+        for (int i = 0; i < TimerCount; ++i) {
+            const TimerStats &stats = snapshot.timers[i];
+            QJsonObject timer;
+            timer.insert(QStringLiteral("count"), double(stats.count));
+            timer.insert(QStringLiteral("totalMs"), stats.totalNanoseconds / 1e6);
+            timer.insert(QStringLiteral("meanMs"), stats.count ? stats.totalNanoseconds / 1e6 / stats.count : 0.0);
+            timer.insert(QStringLiteral("maxMs"), stats.maxNanoseconds / 1e6);
+            timers.insert(QLatin1String(timerNames[i]), timer);
+        }
+
+        QJsonObject counters;
+        for (int i = 0; i < CounterCount; ++i) {
+            counters.insert(QLatin1String(counterNames[i]), double(snapshot.counters[i]));
+        }
+
+        QJsonObject gauges;
+        for (int i = 0; i < GaugeCount; ++i) {
+            gauges.insert(QLatin1String(gaugeNames[i]), double(snapshot.gauges[i]));
+        }
+
+        // Written as null before the first lookup
+        QJsonObject hitRates;
+        hitRates.insert(QStringLiteral("thumbnailCache"), thumbnailCacheHitRate(snapshot));
+        hitRates.insert(QStringLiteral("metadataCache"), metadataCacheHitRate(snapshot));
+
+        QJsonObject json;
+        json.insert(QStringLiteral("uptimeMs"), double(snapshot.uptimeMilliseconds));
+        json.insert(QStringLiteral("timers"), timers);
+        json.insert(QStringLiteral("counters"), counters);
+        json.insert(QStringLiteral("gauges"), gauges);
+        json.insert(QStringLiteral("hitRates"), hitRates);
+        return json;
+    }
+
+    bool writeJson(const QString &filePath) {
+        QSaveFile file(filePath);
+        if (!file.open(QIODevice::WriteOnly)
+            || file.write(QJsonDocument(toJson(snapshot())).toJson()) < 0
+            || !file.commit()) {
+            qWarning() << "Unable to write performance log" << filePath << file.errorString();
+            return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,124 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <QtCore>
+#include <chrono>
+
+// Scoped timers and event counters for the hot paths. Every thread adds to
+// its own block with plain relaxed stores, blocks are only summed up when a
+// snapshot is taken and folded into the totals when their thread exits.
+// Gauges are set by whoever owns the queue they describe.
+namespace Perf {
+    enum Timer {
+        ThumbnailLoad,
+        ThumbnailCacheLookup,
+        ThumbnailDecode,
+        ThumbnailRotate,
+        ThumbnailSmartCrop,
+        ThumbnailStore,
+        MetadataLoad,
+        ViewerReload,
+        ViewerRefresh,
+        ViewerColorize,
+        FindDuplicates,
+        SortBySimilarity,
+        CopyMoveFile,
+        TagWrite,
+        ColorTransform,
+        Resample,
+        TimerCount
+    };
+
+    enum Counter {
+        ThumbnailPackHits,
+        ThumbnailCacheHits,
+        ThumbnailCacheMisses,
+        MetadataMemoryHits,
+        MetadataDatabaseHits,
+        MetadataReads,
+        ColorTransformHits,
+        ColorTransformBuilds,
+        CounterCount
+    };
+
+    enum Gauge {
+        ThumbnailQueue,
+        ThumbnailWriterQueue,
+        TagWriterQueue,
+        GaugeCount
+    };
+
+    struct TimerStats {
+        quint64 count = 0;
+        quint64 totalNanoseconds = 0;
+        quint64 maxNanoseconds = 0;
+    };
+
+    struct Snapshot {
+        TimerStats timers[TimerCount];
+        quint64 counters[CounterCount] = {};
+        qint64 gauges[GaugeCount] = {};
+        qint64 uptimeMilliseconds = 0;
+    };
+
+    void addTime(Timer timer, quint64 nanoseconds);
+
+    void count(Counter counter, quint64 events = 1);
+
+    void setGauge(Gauge gauge, qint64 value);
+
+    Snapshot snapshot();
+
+    // The share of lookups a cache served, NaN before the first one
+    double thumbnailCacheHitRate(const Snapshot &snapshot);
+
+    double metadataCacheHitRate(const Snapshot &snapshot);
+
+    const char *name(Timer timer);
+
+    const char *name(Counter counter);
+
+    const char *name(Gauge gauge);
+
+    // Timers, counters, gauges and the cache hit rates derived from them
+    QJsonObject toJson(const Snapshot &snapshot);
+
+    bool writeJson(const QString &filePath);
+
+    class ScopedTimer {
+    public:
+        explicit ScopedTimer(Timer timer) : timer(timer), start(std::chrono::steady_clock::now()) {}
+
+        Q_DISABLE_COPY(ScopedTimer)
+
+        ~ScopedTimer() {
+            addTime(timer, quint64(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count()));
+        }
+
+    private:
+        Timer timer;
+        std::chrono::steady_clock::time_point start;
+    };
+}
+
+#endif // PERF_COUNTERS_H
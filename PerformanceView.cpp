@@ -0,0 +1,103 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "PerformanceView.h"
+
+#define REFRESH_INTERVAL 1000
+
+enum Columns {
+    NameColumn,
+    CountColumn,
+    MeanColumn,
+    MaxColumn,
+    TotalColumn
+};
+
+PerformanceView::PerformanceView(QWidget *parent) : QTreeWidget(parent) {
+    setHeaderLabels({tr("Name"), tr("Count"), tr("Mean ms"), tr("Max ms"), tr("Total ms")});
+    setRootIsDecorated(false);
+    setUniformRowHeights(true);
+    setSelectionMode(QAbstractItemView::NoSelection);
+
+    QTreeWidgetItem *timers = addGroup(tr("Timers"));
+    for (int i = 0; i < Perf::TimerCount; ++i) {
+        timerItems[i] = new QTreeWidgetItem(timers, {QString::fromLatin1(Perf::name(Perf::Timer(i)))});
+    }
+    QTreeWidgetItem *counters = addGroup(tr("Counters"));
+    for (int i = 0; i < Perf::CounterCount; ++i) {
+        counterItems[i] = new QTreeWidgetItem(counters, {QString::fromLatin1(Perf::name(Perf::Counter(i)))});
+    }
+    QTreeWidgetItem *gauges = addGroup(tr("Queues"));
+    for (int i = 0; i < Perf::GaugeCount; ++i) {
+        gaugeItems[i] = new QTreeWidgetItem(gauges, {QString::fromLatin1(Perf::name(Perf::Gauge(i)))});
+    }
+    QTreeWidgetItem *hitRates = addGroup(tr("Hit rates"));
+    thumbnailHitRateItem = new QTreeWidgetItem(hitRates, {tr("Thumbnail cache")});
+    metadataHitRateItem = new QTreeWidgetItem(hitRates, {tr("Metadata cache")});
+    expandAll();
+
+    refreshTimer.setInterval(REFRESH_INTERVAL);
+    connect(&refreshTimer, &QTimer::timeout, this, &PerformanceView::refresh);
+}
+
+QTreeWidgetItem *PerformanceView::addGroup(const QString &title) {
+    QTreeWidgetItem *group = new QTreeWidgetItem(this, {title});
+    QFont font = group->font(NameColumn);
+    font.setBold(true);
+    group->setFont(NameColumn, font);
+    return group;
+}
+
+void PerformanceView::showEvent(QShowEvent *event) {
+    refresh();
+    refreshTimer.start();
+    QTreeWidget::showEvent(event);
+}
+
+void PerformanceView::hideEvent(QHideEvent *event) {
+    refreshTimer.stop();
+    QTreeWidget::hideEvent(event);
+}
+
+static QString percentage(double rate) {
+    return qIsNaN(rate) ? QStringLiteral("-") : QString::number(100.0 * rate, 'f', 1) + QLatin1Char('%');
+}
+
+void PerformanceView::refresh() {
+    const Perf::Snapshot snapshot = Perf::snapshot();
+
+    for (int i = 0; i < Perf::TimerCount; ++i) {
+        const Perf::TimerStats &stats = snapshot.timers[i];
+        QTreeWidgetItem *item = timerItems[i];
+        item->setText(CountColumn, QString::number(stats.count));
+        item->setText(MeanColumn, stats.count ? QString::number(stats.totalNanoseconds / 1e6 / stats.count, 'f', 2)
+                                              : QString());
+        item->setText(MaxColumn, QString::number(stats.maxNanoseconds / 1e6, 'f', 2));
+        item->setText(TotalColumn, QString::number(stats.totalNanoseconds / 1e6, 'f', 0));
+    }
+    for (int i = 0; i < Perf::CounterCount; ++i) {
+        counterItems[i]->setText(CountColumn, QString::number(snapshot.counters[i]));
+    }
+    for (int i = 0; i < Perf::GaugeCount; ++i) {
+        gaugeItems[i]->setText(CountColumn, QString::number(snapshot.gauges[i]));
+    }
+
+    thumbnailHitRateItem->setText(CountColumn, percentage(Perf::thumbnailCacheHitRate(snapshot)));
+    metadataHitRateItem->setText(CountColumn, percentage(Perf::metadataCacheHitRate(snapshot)));
+}
@@ -0,0 +1,52 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PERFORMANCE_VIEW_H
+#define PERFORMANCE_VIEW_H
+
+#include <QtWidgets>
+#include "PerfCounters.h"
+
+// Live table of the performance counters. Snapshots are only taken while
+// it is visible.
+class PerformanceView : public QTreeWidget {
+Q_OBJECT
+
+public:
+    explicit PerformanceView(QWidget *parent = nullptr);
+
+protected:
+    void showEvent(QShowEvent *event) override;
+
+    void hideEvent(QHideEvent *event) override;
+
+private:
+    QTreeWidgetItem *addGroup(const QString &title);
+
+    void refresh();
+
+    QTimer refreshTimer;
+    QTreeWidgetItem *timerItems[Perf::TimerCount];
+    QTreeWidgetItem *counterItems[Perf::CounterCount];
+    QTreeWidgetItem *gaugeItems[Perf::GaugeCount];
+    QTreeWidgetItem *thumbnailHitRateItem;
+    QTreeWidgetItem *metadataHitRateItem;
+};
+
+#endif // PERFORMANCE_VIEW_H
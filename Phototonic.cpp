@@ -25,6 +25,7 @@
 #include "ColorsDialog.h"
 #include "ExternalAppsDialog.h"
 #include "ProgressDialog.h"
+#include "BatchTransform.h"
 #include "RangeInputDialog.h"
 #include "ImagePreview.h"
 #include "FileListWidget.h"
@@ -32,24 +33,53 @@
 #include "RenameDialog.h"
 #include "Trashcan.h"
 #include "MessageBox.h"
+#include "PerformanceView.h"
+#include "StartupTimer.h"
+#include "PackedThumbnail.h"
 
-Phototonic::Phototonic(QStringList argumentsList, int filesStartAt, QWidget *parent) : QMainWindow(parent) {
+#define PREFETCH_AHEAD 3
+#define PREFETCH_BEHIND 1
+#define FILE_LIST_APPEND_RETRY_MS 100
+
+Phototonic::Phototonic(QStringList argumentsList, int filesStartAt, const QString &fileListPath, QWidget *parent)
+        : QMainWindow(parent) {
+    StartupTimer::mark("constructor");
     Settings::appSettings = new QSettings("phototonic", "phototonic");
     setDockOptions(QMainWindow::AllowNestedDocks);
     readSettings();
+    StartupTimer::mark("settings");
     createThumbsViewer();
+
+    // The listing only needs the directory, it runs while the rest of the window is built
+    const QString startupDir = fileListPath.isEmpty() ? startupDirectory(argumentsList, filesStartAt) : QString();
+    if (!startupDir.isEmpty()) {
+        thumbsViewer->prefetchDirectory(startupDir);
+    }
+    StartupTimer::mark("thumbnail view");
+
+    cacheIndexer = new CacheIndexer(this);
+    connect(cacheIndexer, &CacheIndexer::finished, this, [this]() {
+        setStatus(tr("Background indexing finished"));
+    });
+    fileListReader = new FileListReader(this);
+    connect(fileListReader, &FileListReader::pathsRead, this, &Phototonic::onFileListRead);
+    connect(fileListReader, &FileListReader::finished, this, &Phototonic::onFileListFinished);
     createActions();
     createMenus();
     createToolBars();
     createStatusBar();
+    StartupTimer::mark("actions and menus");
     createFileSystemDock();
     createBookmarksDock();
     createImagePreviewDock();
     createImageTagsDock();
+    createPerformanceDock();
+    StartupTimer::mark("docks");
     createImageViewer();
     updateExternalApps();
     loadShortcuts();
     setupDocks();
+    StartupTimer::mark("image viewer");
 
     connect(qApp, SIGNAL(focusChanged(QWidget * , QWidget * )), this, SLOT(updateActions()));
 
@@ -64,7 +94,11 @@ Phototonic::Phototonic(QStringList argumentsList, int filesStartAt, QWidget *par
     stackedLayout->addWidget(imageViewer);
     stackedLayoutWidget->setLayout(stackedLayout);
     setCentralWidget(stackedLayoutWidget);
-    processStartupArguments(argumentsList, filesStartAt);
+    if (fileListPath.isEmpty()) {
+        processStartupArguments(argumentsList, filesStartAt, startupDir);
+    } else {
+        readStartupFileList(fileListPath);
+    }
 
     copyMoveToDialog = nullptr;
     colorsDialog = nullptr;
@@ -79,30 +113,52 @@ Phototonic::Phototonic(QStringList argumentsList, int filesStartAt, QWidget *par
     if (Settings::layoutMode == ThumbViewWidget) {
         thumbsViewer->setFocus(Qt::OtherFocusReason);
     }
+    StartupTimer::mark("window");
+
+    // Trees left unfinished last session, once startup is out of the way
+    QTimer::singleShot(10000, cacheIndexer, &CacheIndexer::resume);
 }
 
-void Phototonic::processStartupArguments(QStringList argumentsList, int filesStartAt) {
+QString Phototonic::startupDirectory(const QStringList &argumentsList, int filesStartAt) {
     if (argumentsList.size() > filesStartAt) {
         QFileInfo firstArgument(argumentsList.at(filesStartAt));
         if (firstArgument.isDir()) {
             // Confusingly we need the absoluteFile and not absolutePath if it's a directory
-            Settings::currentDirectory = firstArgument.absoluteFilePath();
+            return firstArgument.absoluteFilePath();
         } else if (argumentsList.size() > filesStartAt + 1) {
+            // A list of files, there is no directory to show
+            return QString();
+        }
+        return firstArgument.absolutePath();
+    }
+
+    if (Settings::startupDir == Settings::SpecifiedDir) {
+        return Settings::specifiedStartDir;
+    } else if (Settings::startupDir == Settings::RememberLastDir) {
+        return Settings::appSettings->value(Settings::optionLastDir).toString();
+    }
+    return Settings::currentDirectory;
+}
+
+void Phototonic::processStartupArguments(QStringList argumentsList, int filesStartAt, const QString &startupDir) {
+    QFileInfo firstArgument;
+    bool isFileArgument = false;
+    if (argumentsList.size() > filesStartAt) {
+        firstArgument.setFile(argumentsList.at(filesStartAt));
+        isFileArgument = !firstArgument.isDir();
+        if (isFileArgument && argumentsList.size() > filesStartAt + 1) {
             loadStartupFileList(argumentsList, filesStartAt);
             return;
-        } else {
-            Settings::currentDirectory = firstArgument.absolutePath();
-            QString cliFileName = Settings::currentDirectory + QDir::separator() + firstArgument.fileName();
-            loadImageFromCliArguments(cliFileName);
-            QTimer::singleShot(1000, this, SLOT(updateIndexByViewerImage()));
-        }
-    } else {
-        if (Settings::startupDir == Settings::SpecifiedDir) {
-            Settings::currentDirectory = Settings::specifiedStartDir;
-        } else if (Settings::startupDir == Settings::RememberLastDir) {
-            Settings::currentDirectory = Settings::appSettings->value(Settings::optionLastDir).toString();
         }
     }
+
+    Settings::currentDirectory = startupDir;
+    if (isFileArgument) {
+        QString cliFileName = Settings::currentDirectory + QDir::separator() + firstArgument.fileName();
+        loadImageFromCliArguments(cliFileName);
+        StartupTimer::mark("startup image");
+        QTimer::singleShot(1000, this, SLOT(updateIndexByViewerImage()));
+    }
     selectCurrentViewDir();
 }
 
@@ -110,21 +166,94 @@ QIcon &Phototonic::getDefaultWindowIcon() {
     return defaultApplicationIcon;
 }
 
+QImage Phototonic::findLoadedThumbnail(const QString &imageFileName) {
+    const int currentRow = thumbsViewer->getCurrentRow();
+    if (Settings::thumbsLayout != ThumbsViewer::Classic || currentRow < 0
+        || currentRow >= thumbsViewer->thumbsViewerModel->rowCount()
+        || thumbsViewer->thumbsViewerModel->filePath(currentRow) != imageFileName
+        || !thumbsViewer->thumbsViewerModel->isLoaded(currentRow)) {
+        return QImage();
+    }
+    return thumbsViewer->thumbsViewerModel->thumbnail(currentRow).toImage();
+}
+
 void Phototonic::loadStartupFileList(QStringList argumentsList, int filesStartAt) {
     Settings::filesList.clear();
+    Settings::filesListIndex.clear();
+    QStringList paths;
     for (int i = filesStartAt; i < argumentsList.size(); i++) {
-        QFile currentFileFullPath(argumentsList[i]);
-        QFileInfo currentFileInfo(currentFileFullPath);
-
-        if (!Settings::filesList.contains(currentFileInfo.absoluteFilePath())) {
-            Settings::filesList << currentFileInfo.absoluteFilePath();
-        }
+        paths << QFileInfo(argumentsList[i]).absoluteFilePath();
     }
+    addToFilesList(paths);
+    fileSystemTree->clearSelection();
+    fileListWidget->itemAt(0, 0)->setSelected(true);
+    Settings::isFileListLoaded = true;
+}
+
+void Phototonic::readStartupFileList(const QString &fileListPath) {
+    Settings::filesList.clear();
+    Settings::filesListIndex.clear();
+    fileListReader->read(fileListPath);
     fileSystemTree->clearSelection();
     fileListWidget->itemAt(0, 0)->setSelected(true);
     Settings::isFileListLoaded = true;
 }
 
+QStringList Phototonic::addToFilesList(const QStringList &paths) {
+    QStringList addedPaths;
+    for (const QString &path : paths) {
+        if (!Settings::filesListIndex.contains(path)) {
+            Settings::filesListIndex.insert(path);
+            addedPaths.append(path);
+        }
+    }
+    Settings::filesList.append(addedPaths);
+    return addedPaths;
+}
+
+void Phototonic::onFileListRead(int generation, const QStringList &paths) {
+    if (generation != fileListReader->currentGeneration()) {
+        return;
+    }
+
+    addToFilesList(paths);
+    appendReadFileList();
+}
+
+void Phototonic::onFileListFinished(int generation) {
+    if (generation != fileListReader->currentGeneration()) {
+        return;
+    }
+
+    isFileListTagsPending = true;
+    appendReadFileList();
+}
+
+void Phototonic::appendReadFileList() {
+    if (!Settings::isFileListLoaded) {
+        isFileListTagsPending = false;
+        return;
+    }
+
+    if (thumbsViewer->isBusy) {
+        // Tried again until the pass that keeps the view busy is over
+        if (!isFileListAppendScheduled) {
+            isFileListAppendScheduled = true;
+            QTimer::singleShot(FILE_LIST_APPEND_RETRY_MS, this, [this]() {
+                isFileListAppendScheduled = false;
+                appendReadFileList();
+            });
+        }
+        return;
+    }
+
+    thumbsViewer->appendNewFileListPaths();
+    if (isFileListTagsPending) {
+        isFileListTagsPending = false;
+        thumbsViewer->imageTags->populateTagsTree();
+    }
+}
+
 bool Phototonic::event(QEvent *event) {
     if (event->type() == QEvent::ActivationChange ||
         (Settings::layoutMode == ThumbViewWidget && event->type() == QEvent::MouseButtonRelease)) {
@@ -136,6 +265,8 @@ bool Phototonic::event(QEvent *event) {
 
 void Phototonic::createThumbsViewer() {
     metadataCache = std::make_shared<MetadataCache>();
+    metadataCache->setDatabaseEnabled(Settings::metadataDatabase);
+    metadataCache->setSidecarsEnabled(Settings::tagSidecars);
     thumbsViewer = new ThumbsViewer(this, metadataCache);
     thumbsViewer->thumbsSortFlags = (QDir::SortFlags) Settings::appSettings->value(
             Settings::optionThumbsSortFlags).toInt();
@@ -165,7 +296,6 @@ void Phototonic::createImageViewer() {
     connect(pasteImageAction, SIGNAL(triggered()), imageViewer, SLOT(pasteImage()));
     connect(applyCropAndRotationAction, SIGNAL(triggered()), imageViewer, SLOT(applyCropAndRotation()));
     connect(imageViewer, &ImageViewer::toolsUpdated, this, &Phototonic::onToolsUpdated);
-    imageViewer->ImagePopUpMenu = new QMenu();
 
     // Widget actions
     imageViewer->addAction(slideShowAction);
@@ -219,21 +349,35 @@ void Phototonic::createImageViewer() {
     imageViewer->addAction(showViewerToolbarAction);
     imageViewer->addAction(externalAppsAction);
 
-    // Actions
-    addMenuSeparator(imageViewer->ImagePopUpMenu);
-    imageViewer->ImagePopUpMenu->addAction(nextImageAction);
-    imageViewer->ImagePopUpMenu->addAction(prevImageAction);
-    imageViewer->ImagePopUpMenu->addAction(firstImageAction);
-    imageViewer->ImagePopUpMenu->addAction(lastImageAction);
-    imageViewer->ImagePopUpMenu->addAction(randomImageAction);
-    imageViewer->ImagePopUpMenu->addAction(slideShowAction);
+    mirroringActionGroup = new QActionGroup(this);
+    mirroringActionGroup->addAction(mirrorDisabledAction);
+    mirroringActionGroup->addAction(mirrorDualAction);
+    mirroringActionGroup->addAction(mirrorTripleAction);
+    mirroringActionGroup->addAction(mirrorDualVerticalAction);
+    mirroringActionGroup->addAction(mirrorQuadAction);
+
+    imageViewer->setContextMenuPolicy(Qt::DefaultContextMenu);
+    Settings::isFullScreen = Settings::appSettings->value(Settings::optionFullScreenMode).toBool();
+    fullScreenAction->setChecked(Settings::isFullScreen);
+    thumbsViewer->setImageViewer(imageViewer);
+}
 
-    addMenuSeparator(imageViewer->ImagePopUpMenu);
+QMenu *Phototonic::createImagePopUpMenu() {
+    QMenu *popUpMenu = new QMenu();
+    addMenuSeparator(popUpMenu);
+    popUpMenu->addAction(nextImageAction);
+    popUpMenu->addAction(prevImageAction);
+    popUpMenu->addAction(firstImageAction);
+    popUpMenu->addAction(lastImageAction);
+    popUpMenu->addAction(randomImageAction);
+    popUpMenu->addAction(slideShowAction);
+
+    addMenuSeparator(popUpMenu);
     zoomSubMenu = new QMenu(tr("Zoom"));
     zoomSubMenuAction = new QAction(tr("Zoom"), this);
     zoomSubMenuAction->setIcon(QIcon::fromTheme("edit-find", QIcon(":/images/zoom.png")));
     zoomSubMenuAction->setMenu(zoomSubMenu);
-    imageViewer->ImagePopUpMenu->addAction(zoomSubMenuAction);
+    popUpMenu->addAction(zoomSubMenuAction);
     zoomSubMenu->addAction(zoomInAction);
     zoomSubMenu->addAction(zoomOutAction);
     zoomSubMenu->addAction(origZoomAction);
@@ -244,12 +388,6 @@ void Phototonic::createImageViewer() {
     MirroringSubMenu = new QMenu(tr("Mirroring"));
     mirrorSubMenuAction = new QAction(tr("Mirroring"), this);
     mirrorSubMenuAction->setMenu(MirroringSubMenu);
-    mirroringActionGroup = new QActionGroup(this);
-    mirroringActionGroup->addAction(mirrorDisabledAction);
-    mirroringActionGroup->addAction(mirrorDualAction);
-    mirroringActionGroup->addAction(mirrorTripleAction);
-    mirroringActionGroup->addAction(mirrorDualVerticalAction);
-    mirroringActionGroup->addAction(mirrorQuadAction);
     MirroringSubMenu->addActions(mirroringActionGroup->actions());
 
     guideSubMenu = new QMenu(tr("Guides"));
@@ -265,9 +403,9 @@ void Phototonic::createImageViewer() {
     transformSubMenu = new QMenu(tr("Transform"));
     transformSubMenuAction = new QAction(tr("Transform"), this);
     transformSubMenuAction->setMenu(transformSubMenu);
-    imageViewer->ImagePopUpMenu->addAction(resizeAction);
-    imageViewer->ImagePopUpMenu->addAction(applyCropAndRotationAction);
-    imageViewer->ImagePopUpMenu->addAction(transformSubMenuAction);
+    popUpMenu->addAction(resizeAction);
+    popUpMenu->addAction(applyCropAndRotationAction);
+    popUpMenu->addAction(transformSubMenuAction);
     transformSubMenu->addAction(colorsAction);
     transformSubMenu->addAction(rotateRightAction);
     transformSubMenu->addAction(rotateLeftAction);
@@ -279,41 +417,36 @@ void Phototonic::createImageViewer() {
 
     addMenuSeparator(transformSubMenu);
     transformSubMenu->addAction(keepTransformAction);
-    imageViewer->ImagePopUpMenu->addAction(mirrorSubMenuAction);
-    imageViewer->ImagePopUpMenu->addAction(guideSubMenuAction);
-
-    addMenuSeparator(imageViewer->ImagePopUpMenu);
-    imageViewer->ImagePopUpMenu->addAction(copyToAction);
-    imageViewer->ImagePopUpMenu->addAction(moveToAction);
-    imageViewer->ImagePopUpMenu->addAction(saveAction);
-    imageViewer->ImagePopUpMenu->addAction(saveAsAction);
-    imageViewer->ImagePopUpMenu->addAction(renameAction);
-    imageViewer->ImagePopUpMenu->addAction(deleteAction);
-    imageViewer->ImagePopUpMenu->addAction(deletePermanentlyAction);
-    imageViewer->ImagePopUpMenu->addAction(openWithMenuAction);
-
-    addMenuSeparator(imageViewer->ImagePopUpMenu);
+    popUpMenu->addAction(mirrorSubMenuAction);
+    popUpMenu->addAction(guideSubMenuAction);
+
+    addMenuSeparator(popUpMenu);
+    popUpMenu->addAction(copyToAction);
+    popUpMenu->addAction(moveToAction);
+    popUpMenu->addAction(saveAction);
+    popUpMenu->addAction(saveAsAction);
+    popUpMenu->addAction(renameAction);
+    popUpMenu->addAction(deleteAction);
+    popUpMenu->addAction(deletePermanentlyAction);
+    popUpMenu->addAction(openWithMenuAction);
+
+    addMenuSeparator(popUpMenu);
     viewSubMenu = new QMenu(tr("View"));
     viewSubMenuAction = new QAction(tr("View"), this);
     viewSubMenuAction->setMenu(viewSubMenu);
-    imageViewer->ImagePopUpMenu->addAction(viewSubMenuAction);
+    popUpMenu->addAction(viewSubMenuAction);
     viewSubMenu->addAction(fullScreenAction);
     viewSubMenu->addAction(showClipboardAction);
     viewSubMenu->addAction(showViewerToolbarAction);
     viewSubMenu->addAction(refreshAction);
-    imageViewer->ImagePopUpMenu->addAction(copyImageAction);
-    imageViewer->ImagePopUpMenu->addAction(pasteImageAction);
-    imageViewer->ImagePopUpMenu->addAction(CloseImageAction);
-    imageViewer->ImagePopUpMenu->addAction(exitAction);
-
-    addMenuSeparator(imageViewer->ImagePopUpMenu);
-    imageViewer->ImagePopUpMenu->addAction(settingsAction);
+    popUpMenu->addAction(copyImageAction);
+    popUpMenu->addAction(pasteImageAction);
+    popUpMenu->addAction(CloseImageAction);
+    popUpMenu->addAction(exitAction);
 
-    imageViewer->setContextMenuPolicy(Qt::DefaultContextMenu);
-    Settings::isFullScreen = Settings::appSettings->value(Settings::optionFullScreenMode).toBool();
-    fullScreenAction->setChecked(Settings::isFullScreen);
-    thumbsViewer->setImageViewer(imageViewer);
-    thumbsViewer->imagePreview->setImageViewer(imageViewer);
+    addMenuSeparator(popUpMenu);
+    popUpMenu->addAction(settingsAction);
+    return popUpMenu;
 }
 
 void Phototonic::createActions() {
@@ -605,6 +738,10 @@ void Phototonic::createActions() {
     addBookmarkAction->setIcon(QIcon(":/images/new_bookmark.png"));
     connect(addBookmarkAction, SIGNAL(triggered()), this, SLOT(addNewBookmark()));
 
+    indexDirectoryAction = new QAction(tr("Index for Fast Browsing"), this);
+    indexDirectoryAction->setObjectName("indexDirectory");
+    connect(indexDirectoryAction, SIGNAL(triggered()), this, SLOT(indexDirectoryTree()));
+
     removeBookmarkAction = new QAction(tr("Delete Bookmark"), this);
     removeBookmarkAction->setObjectName("deleteBookmark");
     removeBookmarkAction->setIcon(QIcon::fromTheme("edit-delete", QIcon(":/images/delete.png")));
@@ -1020,6 +1157,7 @@ void Phototonic::createFileSystemDock() {
     addMenuSeparator(fileSystemTree);
     fileSystemTree->addAction(openWithMenuAction);
     fileSystemTree->addAction(addBookmarkAction);
+    fileSystemTree->addAction(indexDirectoryAction);
     fileSystemTree->setContextMenuPolicy(Qt::ActionsContextMenu);
 
     connect(
@@ -1086,6 +1224,7 @@ void Phototonic::createBookmarksDock() {
 
     bookmarks->addAction(pasteAction);
     bookmarks->addAction(removeBookmarkAction);
+    bookmarks->addAction(indexDirectoryAction);
     bookmarks->setContextMenuPolicy(Qt::ActionsContextMenu);
 }
 
@@ -1106,8 +1245,20 @@ void Phototonic::createImageTagsDock() {
 
     connect(tagsDock->toggleViewAction(), SIGNAL(triggered()), this, SLOT(setTagsDockVisibility()));
     connect(tagsDock, SIGNAL(visibilityChanged(bool)), this, SLOT(setTagsDockVisibility()));
-    connect(thumbsViewer->imageTags, SIGNAL(reloadThumbs()), this, SLOT(onReloadThumbs()));
+    connect(thumbsViewer->imageTags, SIGNAL(tagFilterChanged()), this, SLOT(onTagFilterChanged()));
     connect(thumbsViewer->imageTags->removeTagAction, SIGNAL(triggered()), this, SLOT(deleteOperation()));
+    connect(thumbsViewer->imageTags, &ImageTags::tagsWriteFailed, this, [this](const QStringList &failedImages) {
+        setStatus(tr("Failed to save tags to %n image(s)", "", failedImages.size()));
+    });
+}
+
+void Phototonic::createPerformanceDock() {
+    performanceDock = new QDockWidget(tr("Performance"), this);
+    performanceDock->setObjectName("Performance");
+    performanceDock->setWidget(new PerformanceView(performanceDock));
+    addDockWidget(Qt::RightDockWidgetArea, performanceDock);
+    // Only shown on request, restoreState() brings it back if it was open last time
+    performanceDock->hide();
 }
 
 void Phototonic::sortThumbnails() {
@@ -1217,8 +1368,7 @@ void Phototonic::runExternalApp() {
 
             for (int tn = selectedIdxList.size() - 1; tn >= 0; --tn) {
                 arguments +=
-                                     thumbsViewer->thumbsViewerModel->item(selectedIdxList[tn].row())->data(
-                                             thumbsViewer->FileNameRole).toString();
+                                     thumbsViewer->thumbsViewerModel->filePath(selectedIdxList[tn].row());
             }
         }
     }
@@ -1293,10 +1443,13 @@ void Phototonic::showSettings() {
     imageViewer->setCursorHiding(false);
 
     SettingsDialog *settingsDialog = new SettingsDialog(this);
+    settingsDialog->setThumbsMemoryUsage(thumbsViewer->thumbsViewerModel->thumbnailMemoryUsage());
     if (settingsDialog->exec()) {
         imageViewer->setBackgroundColor();
         thumbsViewer->setThumbColors();
         thumbsViewer->imagePreview->setBackgroundColor();
+        metadataCache->setDatabaseEnabled(Settings::metadataDatabase);
+        metadataCache->setSidecarsEnabled(Settings::tagSidecars);
         Settings::imageZoomFactor = 1.0;
         imageViewer->imageInfoLabel->setVisible(Settings::showImageName);
 
@@ -1357,8 +1510,7 @@ void Phototonic::copyOrCutThumbs(bool isCopyOperation) {
 
     QList<QUrl> urlList;
     for (int thumb = 0; thumb < copyCutThumbsCount; ++thumb) {
-        const QString filePath = thumbsViewer->thumbsViewerModel->item(Settings::copyCutIndexList[thumb].
-                row())->data(thumbsViewer->FileNameRole).toString();
+        const QString filePath = thumbsViewer->thumbsViewerModel->filePath(Settings::copyCutIndexList[thumb].row());
         Settings::copyCutFileList.append(filePath);
 
         urlList.append(QUrl::fromLocalFile(filePath)); // The standard apparently is URLs even for local files...
@@ -1450,21 +1602,19 @@ void Phototonic::copyOrMoveImages(bool isMoveOperation) {
 
 void Phototonic::thumbsZoomIn() {
     if (thumbsViewer->thumbSize < THUMB_SIZE_MAX) {
-        thumbsViewer->thumbSize += THUMB_SIZE_MIN;
+        thumbsViewer->setThumbSize(thumbsViewer->thumbSize + THUMB_SIZE_MIN);
         thumbsZoomOutAction->setEnabled(true);
         if (thumbsViewer->thumbSize == THUMB_SIZE_MAX)
             thumbsZoomInAction->setEnabled(false);
-        refreshThumbs(false);
     }
 }
 
 void Phototonic::thumbsZoomOut() {
     if (thumbsViewer->thumbSize > THUMB_SIZE_MIN) {
-        thumbsViewer->thumbSize -= THUMB_SIZE_MIN;
+        thumbsViewer->setThumbSize(thumbsViewer->thumbSize - THUMB_SIZE_MIN);
         thumbsZoomInAction->setEnabled(true);
         if (thumbsViewer->thumbSize == THUMB_SIZE_MIN)
             thumbsZoomOutAction->setEnabled(false);
-        refreshThumbs(false);
     }
 }
 
@@ -1617,6 +1767,7 @@ void Phototonic::scaleImage() {
     connect(resizeDialog, SIGNAL(rejected()), this, SLOT(cleanupResizeDialog()));
 
     resizeDialog->show();
+    imageViewer->beginProxyPreview();
     setInterfaceEnabled(false);
 }
 
@@ -1655,16 +1806,50 @@ void Phototonic::batchTransform() {
     msgBox.setStandardButtons(QMessageBox::Ok | QMessageBox::Cancel);
     msgBox.setDefaultButton(QMessageBox::Ok);
     if (msgBox.exec() == QMessageBox::Ok) {
+        QStringList imageFileNames;
+        for (const QModelIndex &index : idxs) {
+            imageFileNames << thumbsViewer->thumbsViewerModel->filePath(index.row());
+        }
+
+        // The viewer used to be driven through each image with the transform kept, colours included
         bool keepTransformWas = Settings::keepTransform;
-        imageViewer->batchMode = true;
         Settings::keepTransform = true;
-        for (QModelIndex i : idxs) {
-            loadSelectedThumbImage(i);
-            imageViewer->applyCropAndRotation();
-            imageViewer->saveImage();
-        }
+        const TransformRecipe recipe = TransformRecipe::fromSettings();
         Settings::keepTransform = keepTransformWas;
-        imageViewer->batchMode = false;
+
+        ProgressDialog *progressDialog = new ProgressDialog(this);
+        progressDialog->setModal(true);
+        progressDialog->opLabel->setText(tr("Transforming %n image(s)", "", imageFileNames.size()));
+        progressDialog->show();
+
+        BatchTransformer batchTransformer(metadataCache);
+        QEventLoop eventLoop;
+        int failedCount = 0;
+        connect(&batchTransformer, &BatchTransformer::progress, progressDialog, [&](int done, int total) {
+            progressDialog->opLabel->setText(tr("Transformed %1 of %2 images").arg(done).arg(total));
+            if (progressDialog->abortOp) {
+                batchTransformer.cancel();
+            }
+        });
+        connect(&batchTransformer, &BatchTransformer::finished, &eventLoop, [&](int failed) {
+            failedCount = failed;
+            eventLoop.quit();
+        });
+        batchTransformer.start(imageFileNames, recipe);
+        eventLoop.exec();
+
+        progressDialog->close();
+        progressDialog->deleteLater();
+
+        if (failedCount) {
+            MessageBox errorBox(this);
+            errorBox.critical(tr("Error"), tr("Failed to transform %n image(s).", "", failedCount));
+        }
+        setStatus(tr("Transformed") + " " + tr("%n image(s)", "", imageFileNames.size() - failedCount));
+        if (Settings::layoutMode == ImageViewWidget) {
+            imageViewer->reload();
+        }
+        refreshThumbs(false);
     }
 }
 
@@ -1681,6 +1866,7 @@ void Phototonic::showColorsDialog() {
 
     Settings::colorsActive = true;
     colorsDialog->show();
+    imageViewer->beginProxyPreview();
     colorsDialog->applyColors(0);
     setInterfaceEnabled(false);
 }
@@ -1806,7 +1992,7 @@ void Phototonic::pasteThumbs() {
     Settings::copyCutFileList.clear();
     pasteAction->setEnabled(false);
 
-    thumbsViewer->loadVisibleThumbs();
+    thumbsViewer->refreshVisibleThumbs();
 }
 
 void Phototonic::loadCurrentImage(int currentRow) {
@@ -1818,8 +2004,7 @@ void Phototonic::loadCurrentImage(int currentRow) {
     }
 
     if (thumbsViewer->getNextRow() < 0 && currentRow > 0) {
-        imageViewer->loadImage(thumbsViewer->thumbsViewerModel->item(currentRow - 1)->
-                data(thumbsViewer->FileNameRole).toString());
+        imageViewer->loadImage(thumbsViewer->thumbsViewerModel->filePath(currentRow - 1));
     } else {
         if (thumbsViewer->thumbsViewerModel->rowCount() == 0) {
             hideViewer();
@@ -1830,8 +2015,7 @@ void Phototonic::loadCurrentImage(int currentRow) {
         if (currentRow > (thumbsViewer->thumbsViewerModel->rowCount() - 1))
             currentRow = thumbsViewer->thumbsViewerModel->rowCount() - 1;
 
-        imageViewer->loadImage(thumbsViewer->thumbsViewerModel->item(currentRow)->
-                data(thumbsViewer->FileNameRole).toString());
+        imageViewer->loadImage(thumbsViewer->thumbsViewerModel->filePath(currentRow));
     }
 
     Settings::wrapImageList = wrapImageListTmp;
@@ -1874,55 +2058,102 @@ void Phototonic::deleteImages(bool trash) {
     ProgressDialog *progressDialog = new ProgressDialog(this);
 
     int deleteFilesCount = 0;
-    bool deleteOk;
     QList<int> rows;
-    int row;
-    QModelIndexList indexesList;
-    while ((indexesList = thumbsViewer->selectionModel()->selectedIndexes()).size()) {
-        QString fileNameFullPath = thumbsViewer->thumbsViewerModel->item(
-                indexesList.first().row())->data(thumbsViewer->FileNameRole).toString();
-
-        // Only show if it takes a lot of time, since popping this up for just
-        // deleting a single image is annoying
-        if (timer.elapsed() > 100) {
-            progressDialog->opLabel->setText("Deleting " + fileNameFullPath);
-            progressDialog->show();
+    QSet<QString> deletedFiles;
+    QList<int> selectedRows;
+    for (const QModelIndex &index : thumbsViewer->selectionModel()->selectedIndexes()) {
+        selectedRows.append(index.row());
+    }
+    std::sort(selectedRows.begin(), selectedRows.end());
+
+    bool deleteOk = true;
+    QString deleteError;
+    if (trash) {
+        // Trash directories may be on other disks, so the moves are done on a worker thread
+        QStringList filePaths;
+        for (int selectedRow : selectedRows) {
+            filePaths.append(thumbsViewer->thumbsViewerModel->filePath(selectedRow));
         }
 
-        QString deleteError;
-        if (trash) {
-            deleteOk = Trash::moveToTrash(fileNameFullPath, deleteError) == Trash::Success;
-        } else {
+        TrashMover trashMover;
+        QEventLoop eventLoop;
+        connect(&trashMover, &TrashMover::fileTrashed, &eventLoop,
+                [&](const QString &filePath, int result, const QString &error) {
+            if (result == Trash::Success) {
+                rows << selectedRows.at(deleteFilesCount);
+                deletedFiles.insert(filePath);
+            } else {
+                deleteOk = false;
+                deleteError = error;
+            }
+            ++deleteFilesCount;
+
+            if (timer.elapsed() > 100) {
+                progressDialog->opLabel->setText("Deleting " + filePath);
+                progressDialog->show();
+            }
+            if (progressDialog->abortOp) {
+                trashMover.cancel();
+            }
+        });
+        connect(&trashMover, &TrashMover::finished, &eventLoop, &QEventLoop::quit);
+        trashMover.start(filePaths);
+        eventLoop.exec(QEventLoop::ExcludeUserInputEvents);
+    } else {
+        for (int selectedRow : selectedRows) {
+            QString fileNameFullPath = thumbsViewer->thumbsViewerModel->filePath(selectedRow);
+
+            // Only show if it takes a lot of time, since popping this up for just
+            // deleting a single image is annoying
+            if (timer.elapsed() > 100) {
+                progressDialog->opLabel->setText("Deleting " + fileNameFullPath);
+                progressDialog->show();
+            }
+
             QFile fileToRemove(fileNameFullPath);
             deleteOk = fileToRemove.remove();
+            ++deleteFilesCount;
             if (!deleteOk) {
                 deleteError = fileToRemove.errorString();
+                break;
             }
-        }
+            rows << selectedRow;
+            deletedFiles.insert(fileNameFullPath);
 
-        ++deleteFilesCount;
-        if (deleteOk) {
-            row = indexesList.first().row();
-            rows << row;
-            thumbsViewer->thumbsViewerModel->removeRow(row);
-        } else {
-            MessageBox msgBox(this);
-            msgBox.critical(tr("Error"),
-                            (trash ? tr("Failed to move image to the trash.") : tr("Failed to delete image.")) + "\n" +
-                            deleteError);
-            break;
+            if (progressDialog->abortOp) {
+                break;
+            }
         }
+    }
 
-        Settings::filesList.removeOne(fileNameFullPath);
-
-        if (progressDialog->abortOp) {
-            break;
+    if (!deleteOk) {
+        MessageBox msgBox(this);
+        msgBox.critical(tr("Error"),
+                        (trash ? tr("Failed to move image to the trash.") : tr("Failed to delete image.")) + "\n" +
+                        deleteError);
+    }
+
+    // Rows are only removed once all files are gone, so the selection is not rebuilt for each of them
+    thumbsViewer->thumbsViewerModel->removeRowList(rows);
+    if (!deletedFiles.isEmpty()) {
+        // Only the deleted files that are on the list cost a pass over it
+        bool isListChanged = false;
+        for (const QString &filePath : deletedFiles) {
+            isListChanged |= Settings::filesListIndex.remove(filePath);
+        }
+        if (isListChanged) {
+            QStringList remainingFiles;
+            for (const QString &filePath : Settings::filesList) {
+                if (!deletedFiles.contains(filePath)) {
+                    remainingFiles.append(filePath);
+                }
+            }
+            Settings::filesList.swap(remainingFiles);
         }
     }
 
     if (thumbsViewer->thumbsViewerModel->rowCount() && rows.count()) {
-        std::sort(rows.begin(), rows.end());
-        row = rows.at(0);
+        int row = rows.at(0);
 
         if (row >= thumbsViewer->thumbsViewerModel->rowCount()) {
             row = thumbsViewer->thumbsViewerModel->rowCount() - 1;
@@ -2204,6 +2435,17 @@ void Phototonic::writeSettings() {
     Settings::appSettings->setValue(Settings::optionShowViewerToolbar, (bool) Settings::showViewerToolbar);
     Settings::appSettings->setValue(Settings::optionSetWindowIcon, (bool) Settings::setWindowIcon);
     Settings::appSettings->setValue(Settings::optionUpscalePreview, (bool) Settings::upscalePreview);
+    Settings::appSettings->setValue(Settings::optionPackedThumbnails, (bool) Settings::packedThumbnails);
+    Settings::appSettings->setValue(Settings::optionPackedThumbnailEncoding, (int) Settings::packedThumbnailEncoding);
+    Settings::appSettings->setValue(Settings::optionMetadataDatabase, (bool) Settings::metadataDatabase);
+    Settings::appSettings->setValue(Settings::optionTagSidecars, (bool) Settings::tagSidecars);
+    Settings::appSettings->setValue(Settings::optionPreciseSimilarity, (bool) Settings::preciseSimilarity);
+    Settings::appSettings->setValue(Settings::optionProgressiveLoading, (bool) Settings::progressiveLoading);
+    Settings::appSettings->setValue(Settings::optionDevelopRawFiles, (bool) Settings::developRawFiles);
+    Settings::appSettings->setValue(Settings::optionOpenGLViewer, (bool) Settings::openGLViewer);
+    Settings::appSettings->setValue(Settings::optionThumbsMemoryLimit, (int) Settings::thumbsMemoryLimit);
+    Settings::appSettings->setValue(Settings::optionDupesHammingDistance, (int) Settings::dupesHammingDistance);
+    Settings::appSettings->setValue(Settings::optionDupesMode, (int) Settings::dupesMode);
 
     /* Action shortcuts */
     Settings::appSettings->beginGroup(Settings::optionShortcuts);
@@ -2288,6 +2530,17 @@ void Phototonic::readSettings() {
         Settings::appSettings->setValue(Settings::optionShowViewerToolbar, (bool) false);
         Settings::appSettings->setValue(Settings::optionSmallToolbarIcons, (bool) true);
         Settings::appSettings->setValue(Settings::optionUpscalePreview, (bool) false);
+        Settings::appSettings->setValue(Settings::optionPackedThumbnails, (bool) false);
+        Settings::appSettings->setValue(Settings::optionPackedThumbnailEncoding, (int) PackedThumbnail::Png);
+        Settings::appSettings->setValue(Settings::optionMetadataDatabase, (bool) true);
+        Settings::appSettings->setValue(Settings::optionTagSidecars, (bool) false);
+        Settings::appSettings->setValue(Settings::optionPreciseSimilarity, (bool) false);
+        Settings::appSettings->setValue(Settings::optionProgressiveLoading, (bool) true);
+        Settings::appSettings->setValue(Settings::optionDevelopRawFiles, (bool) false);
+        Settings::appSettings->setValue(Settings::optionOpenGLViewer, (bool) false);
+        Settings::appSettings->setValue(Settings::optionThumbsMemoryLimit, (int) 512);
+        Settings::appSettings->setValue(Settings::optionDupesHammingDistance, (int) 0);
+        Settings::appSettings->setValue(Settings::optionDupesMode, (int) Settings::SimilarImages);
         Settings::bookmarkPaths.insert(QDir::homePath());
         const QString picturesLocation = QStandardPaths::writableLocation(QStandardPaths::PicturesLocation);
         if (!picturesLocation.isEmpty()) {
@@ -2339,6 +2592,19 @@ void Phototonic::readSettings() {
     Settings::showViewerToolbar = Settings::appSettings->value(Settings::optionShowViewerToolbar).toBool();
     Settings::setWindowIcon = Settings::appSettings->value(Settings::optionSetWindowIcon).toBool();
     Settings::upscalePreview = Settings::appSettings->value(Settings::optionUpscalePreview).toBool();
+    Settings::packedThumbnails = Settings::appSettings->value(Settings::optionPackedThumbnails).toBool();
+    Settings::packedThumbnailEncoding = Settings::appSettings->value(Settings::optionPackedThumbnailEncoding).toInt();
+    Settings::metadataDatabase = Settings::appSettings->value(Settings::optionMetadataDatabase, true).toBool();
+    Settings::tagSidecars = Settings::appSettings->value(Settings::optionTagSidecars).toBool();
+    Settings::preciseSimilarity = Settings::appSettings->value(Settings::optionPreciseSimilarity).toBool();
+    Settings::progressiveLoading = Settings::appSettings->value(Settings::optionProgressiveLoading, true).toBool();
+    Settings::developRawFiles = Settings::appSettings->value(Settings::optionDevelopRawFiles).toBool();
+    Settings::openGLViewer = Settings::appSettings->value(Settings::optionOpenGLViewer).toBool();
+    Settings::thumbsMemoryLimit = Settings::appSettings->value(Settings::optionThumbsMemoryLimit, 512).toUInt();
+    Settings::dupesHammingDistance = qMin(Settings::appSettings->value(Settings::optionDupesHammingDistance).toUInt(),
+                                          16u);
+    Settings::dupesMode = (Settings::DupesMode) qBound(0, Settings::appSettings->value(Settings::optionDupesMode).toInt(),
+                                                       (int) Settings::IdenticalAndSimilar);
 
     /* read external apps */
     Settings::appSettings->beginGroup(Settings::optionExternalApps);
@@ -2382,11 +2648,13 @@ void Phototonic::setupDocks() {
     imagePreviewDockOrigWidget = imagePreviewDock->titleBarWidget();
     tagsDockOrigWidget = tagsDock->titleBarWidget();
     imageInfoDockOrigWidget = imageInfoDock->titleBarWidget();
+    performanceDockOrigWidget = performanceDock->titleBarWidget();
     fileSystemDockEmptyWidget = new QWidget;
     bookmarksDockEmptyWidget = new QWidget;
     imagePreviewDockEmptyWidget = new QWidget;
     tagsDockEmptyWidget = new QWidget;
     imageInfoDockEmptyWidget = new QWidget;
+    performanceDockEmptyWidget = new QWidget;
     lockDocks();
 }
 
@@ -2400,12 +2668,14 @@ void Phototonic::lockDocks() {
         imagePreviewDock->setTitleBarWidget(imagePreviewDockEmptyWidget);
         tagsDock->setTitleBarWidget(tagsDockEmptyWidget);
         imageInfoDock->setTitleBarWidget(imageInfoDockEmptyWidget);
+        performanceDock->setTitleBarWidget(performanceDockEmptyWidget);
     } else {
         fileSystemDock->setTitleBarWidget(fileSystemDockOrigWidget);
         bookmarksDock->setTitleBarWidget(bookmarksDockOrigWidget);
         imagePreviewDock->setTitleBarWidget(imagePreviewDockOrigWidget);
         tagsDock->setTitleBarWidget(tagsDockOrigWidget);
         imageInfoDock->setTitleBarWidget(imageInfoDockOrigWidget);
+        performanceDock->setTitleBarWidget(performanceDockOrigWidget);
     }
 }
 
@@ -2482,6 +2752,7 @@ void Phototonic::loadShortcuts() {
     Settings::actionKeys[includeSubDirectoriesAction->objectName()] = includeSubDirectoriesAction;
     Settings::actionKeys[createDirectoryAction->objectName()] = createDirectoryAction;
     Settings::actionKeys[addBookmarkAction->objectName()] = addBookmarkAction;
+    Settings::actionKeys[indexDirectoryAction->objectName()] = indexDirectoryAction;
     Settings::actionKeys[removeMetadataAction->objectName()] = removeMetadataAction;
     Settings::actionKeys[externalAppsAction->objectName()] = externalAppsAction;
     Settings::actionKeys[goHomeAction->objectName()] = goHomeAction;
@@ -2578,6 +2849,8 @@ void Phototonic::loadShortcuts() {
 
 void Phototonic::closeEvent(QCloseEvent *event) {
     thumbsViewer->abort(true);
+    cacheIndexer->stop();
+    thumbsViewer->imageTags->waitForPendingWrites();
     writeSettings();
     hide();
     QClipboard *clip = QApplication::clipboard();
@@ -2708,8 +2981,7 @@ void Phototonic::viewImage() {
                 return;
             }
 
-            selectedImageIndex = thumbsViewer->thumbsViewerModel->indexFromItem(
-                    thumbsViewer->thumbsViewerModel->item(0));
+            selectedImageIndex = thumbsViewer->thumbsViewerModel->index(0, 0);
             thumbsViewer->selectionModel()->select(selectedImageIndex, QItemSelectionModel::Toggle);
             thumbsViewer->setCurrentRow(0);
         }
@@ -2813,8 +3085,9 @@ void Phototonic::loadSelectedThumbImage(const QModelIndex &idx) {
     thumbsViewer->setCurrentRow(idx.row());
     showViewer();
     imageViewer->loadImage(
-            thumbsViewer->thumbsViewerModel->item(idx.row())->data(thumbsViewer->FileNameRole).toString());
+            thumbsViewer->thumbsViewerModel->filePath(idx.row()));
     thumbsViewer->setImageViewerWindowTitle();
+    prefetchImages(1);
 }
 
 void Phototonic::loadImageFromCliArguments(QString cliFileName) {
@@ -2876,8 +3149,9 @@ void Phototonic::slideShowHandler() {
         } else {
             int currentRow = thumbsViewer->getCurrentRow();
             imageViewer->loadImage(
-                    thumbsViewer->thumbsViewerModel->item(currentRow)->data(thumbsViewer->FileNameRole).toString());
+                    thumbsViewer->thumbsViewerModel->filePath(currentRow));
             thumbsViewer->setImageViewerWindowTitle();
+            prefetchImages(1);
 
             if (thumbsViewer->getNextRow() > 0) {
                 thumbsViewer->setCurrentRow(thumbsViewer->getNextRow());
@@ -2908,11 +3182,12 @@ void Phototonic::loadNextImage() {
 
     if (Settings::layoutMode == ImageViewWidget) {
         imageViewer->loadImage(
-                thumbsViewer->thumbsViewerModel->item(nextThumb)->data(thumbsViewer->FileNameRole).toString());
+                thumbsViewer->thumbsViewerModel->filePath(nextThumb));
     }
 
     thumbsViewer->setCurrentRow(nextThumb);
     thumbsViewer->setImageViewerWindowTitle();
+    prefetchImages(1);
 
     if (Settings::layoutMode == ThumbViewWidget) {
         thumbsViewer->selectThumbByRow(nextThumb);
@@ -2935,11 +3210,12 @@ void Phototonic::loadPreviousImage() {
 
     if (Settings::layoutMode == ImageViewWidget) {
         imageViewer->loadImage(
-                thumbsViewer->thumbsViewerModel->item(previousThumb)->data(thumbsViewer->FileNameRole).toString());
+                thumbsViewer->thumbsViewerModel->filePath(previousThumb));
     }
 
     thumbsViewer->setCurrentRow(previousThumb);
     thumbsViewer->setImageViewerWindowTitle();
+    prefetchImages(-1);
 
     if (Settings::layoutMode == ThumbViewWidget) {
         thumbsViewer->selectThumbByRow(previousThumb);
@@ -2951,9 +3227,10 @@ void Phototonic::loadFirstImage() {
         return;
     }
 
-    imageViewer->loadImage(thumbsViewer->thumbsViewerModel->item(0)->data(thumbsViewer->FileNameRole).toString());
+    imageViewer->loadImage(thumbsViewer->thumbsViewerModel->filePath(0));
     thumbsViewer->setCurrentRow(0);
     thumbsViewer->setImageViewerWindowTitle();
+    prefetchImages(1);
 
     if (Settings::layoutMode == ThumbViewWidget) {
         thumbsViewer->selectThumbByRow(0);
@@ -2966,9 +3243,10 @@ void Phototonic::loadLastImage() {
     }
 
     int lastRow = thumbsViewer->getLastRow();
-    imageViewer->loadImage(thumbsViewer->thumbsViewerModel->item(lastRow)->data(thumbsViewer->FileNameRole).toString());
+    imageViewer->loadImage(thumbsViewer->thumbsViewerModel->filePath(lastRow));
     thumbsViewer->setCurrentRow(lastRow);
     thumbsViewer->setImageViewerWindowTitle();
+    prefetchImages(-1);
 
     if (Settings::layoutMode == ThumbViewWidget) {
         thumbsViewer->selectThumbByRow(lastRow);
@@ -2982,15 +3260,54 @@ void Phototonic::loadRandomImage() {
 
     int randomRow = thumbsViewer->getRandomRow();
     imageViewer->loadImage(
-            thumbsViewer->thumbsViewerModel->item(randomRow)->data(thumbsViewer->FileNameRole).toString());
+            thumbsViewer->thumbsViewerModel->filePath(randomRow));
     thumbsViewer->setCurrentRow(randomRow);
     thumbsViewer->setImageViewerWindowTitle();
+    prefetchImages(0);
 
     if (Settings::layoutMode == ThumbViewWidget) {
         thumbsViewer->selectThumbByRow(randomRow);
     }
 }
 
+// Direction 0 is random order
+void Phototonic::prefetchImages(int direction) {
+    const int rowCount = thumbsViewer->thumbsViewerModel->rowCount();
+    if (Settings::layoutMode != ImageViewWidget || rowCount <= 1) {
+        return;
+    }
+
+    QStringList imageFileNames;
+    if (!direction) {
+        imageFileNames.append(thumbsViewer->thumbsViewerModel->filePath(thumbsViewer->peekRandomRow()));
+        imageViewer->prefetchImages(imageFileNames);
+        return;
+    }
+
+    const int currentRow = thumbsViewer->getCurrentRow();
+    auto addRow = [&](int offset) {
+        int row = currentRow + offset;
+        if (row < 0 || row >= rowCount) {
+            if (!Settings::wrapImageList) {
+                return;
+            }
+            row = (row % rowCount + rowCount) % rowCount;
+        }
+        const QString imageFileName = thumbsViewer->thumbsViewerModel->filePath(row);
+        if (row != currentRow && !imageFileNames.contains(imageFileName)) {
+            imageFileNames.append(imageFileName);
+        }
+    };
+
+    for (int i = 1; i <= PREFETCH_AHEAD; ++i) {
+        addRow(i * direction);
+    }
+    for (int i = 1; i <= PREFETCH_BEHIND; ++i) {
+        addRow(-i * direction);
+    }
+    imageViewer->prefetchImages(imageFileNames);
+}
+
 void Phototonic::setViewerKeyEventsEnabled(bool enabled) {
     nextImageAction->setEnabled(enabled);
     prevImageAction->setEnabled(enabled);
@@ -3020,6 +3337,8 @@ void Phototonic::hideViewer() {
     restoreState(Settings::appSettings->value(Settings::optionWindowState).toByteArray());
 
     Settings::layoutMode = ThumbViewWidget;
+    // Frees what was decoded ahead
+    imageViewer->prefetchImages(QStringList());
     stackedLayout->setCurrentWidget(thumbsViewer);
 
     setDocksVisibility(true);
@@ -3186,6 +3505,13 @@ void Phototonic::addPathHistoryRecord(QString dir) {
     }
 }
 
+void Phototonic::onTagFilterChanged() {
+    // Rows are shown and hidden in place where the listing allows it
+    if (!thumbsViewer->applyTagFilter()) {
+        onReloadThumbs();
+    }
+}
+
 void Phototonic::onReloadThumbs() {
     if (thumbsViewer->isBusy || !initComplete) {
         thumbsViewer->abort();
@@ -3333,16 +3659,16 @@ void Phototonic::rename() {
         QString newFileNameFullPath = currentFileInfo.absolutePath() + QDir::separator() + newFileName;
         if (currentFileFullPath.rename(newFileNameFullPath)) {
             QModelIndexList indexesList = thumbsViewer->selectionModel()->selectedIndexes();
-            thumbsViewer->thumbsViewerModel->item(indexesList.first().row())->setData(newFileNameFullPath,
-                                                                                      thumbsViewer->FileNameRole);
-            thumbsViewer->thumbsViewerModel->item(indexesList.first().row())->setData(newFileName, Qt::DisplayRole);
+            thumbsViewer->thumbsViewerModel->setData(indexesList.first(), newFileNameFullPath,
+                                                     thumbsViewer->FileNameRole);
 
             imageViewer->setInfo(newFileName);
             imageViewer->viewerImageFullPath = newFileNameFullPath;
 
-            if (Settings::filesList.contains(currentFileInfo.absoluteFilePath())) {
+            if (Settings::filesListIndex.remove(currentFileInfo.absoluteFilePath())) {
                 Settings::filesList.replace(Settings::filesList.indexOf(currentFileInfo.absoluteFilePath()),
                                             newFileNameFullPath);
+                Settings::filesListIndex.insert(newFileNameFullPath);
             }
 
             if (Settings::layoutMode == ImageViewWidget) {
@@ -3366,8 +3692,7 @@ void Phototonic::removeMetadata() {
     copyCutThumbsCount = indexList.size();
 
     for (int thumb = 0; thumb < copyCutThumbsCount; ++thumb) {
-        fileList.append(thumbsViewer->thumbsViewerModel->item(indexList[thumb].
-                row())->data(thumbsViewer->FileNameRole).toString());
+        fileList.append(thumbsViewer->thumbsViewerModel->filePath(indexList[thumb].row()));
     }
 
     if (fileList.isEmpty()) {
@@ -3405,7 +3730,7 @@ void Phototonic::removeMetadata() {
                 image = Exiv2::ImageFactory::open(fileList[file].toStdString());
                 image->clearMetadata();
                 image->writeMetadata();
-                metadataCache->removeImage(fileList[file]);
+                metadataCache->imageMetadataRemoved(fileList[file]);
             }
             catch (Exiv2::Error &error) {
                 msgBox.critical(tr("Error"), tr("Failed to remove Exif metadata."));
@@ -3413,6 +3738,7 @@ void Phototonic::removeMetadata() {
             }
         }
 
+        thumbsViewer->imageTags->updateImagesTags(fileList);
         thumbsViewer->onSelectionChanged();
         QString state = QString(tr("Metadata removed from selected images"));
         setStatus(state);
@@ -3585,11 +3911,13 @@ void Phototonic::cleanupResizeDialog() {
         resizeDialog->deleteLater();
     }
     resizeDialog = nullptr;
+    imageViewer->endProxyPreview();
     setInterfaceEnabled(true);
 }
 
 void Phototonic::cleanupColorsDialog() {
     Settings::colorsActive = false;
+    imageViewer->endProxyPreview();
     setInterfaceEnabled(true);
 }
 
@@ -3638,6 +3966,24 @@ void Phototonic::addNewBookmark() {
     addBookmark(getSelectedPath());
 }
 
+void Phototonic::indexDirectoryTree() {
+    QString directoryPath;
+    if (QApplication::focusWidget() == bookmarks) {
+        if (bookmarks->currentItem()) {
+            directoryPath = bookmarks->currentItem()->toolTip(0);
+        }
+    } else {
+        directoryPath = getSelectedPath();
+    }
+
+    if (!isValidPath(directoryPath)) {
+        setStatus(tr("Invalid directory."));
+        return;
+    }
+    cacheIndexer->index(directoryPath, thumbsViewer->thumbSize);
+    setStatus(tr("Indexing %1 in the background").arg(directoryPath));
+}
+
 void Phototonic::addBookmark(QString path) {
     Settings::bookmarkPaths.insert(path);
     bookmarks->reloadBookmarks();
@@ -29,6 +29,8 @@
 #include "ResizeDialog.h"
 #include "FileListWidget.h"
 #include "FileSystemTree.h"
+#include "CacheIndexer.h"
+#include "FileListReader.h"
 #include <QStackedLayout>
 
 #include <memory>
@@ -42,16 +44,24 @@ public:
 
     int copyCutThumbsCount;
 
-    Phototonic(QStringList argumentsList, int filesStartAt, QWidget *parent = 0);
+    // With fileListPath the file list is read from there instead of taking files from the arguments
+    Phototonic(QStringList argumentsList, int filesStartAt, const QString &fileListPath = QString(),
+               QWidget *parent = 0);
 
     QMenu *createPopupMenu();
 
+    // The viewer's context menu, built the first time it is opened
+    QMenu *createImagePopUpMenu();
+
     void setStatus(QString state);
 
     void showBusyAnimation(bool busy);
 
     QIcon &getDefaultWindowIcon();
 
+    // The uncropped thumbnail of the current image if it is loaded, null otherwise
+    QImage findLoadedThumbnail(const QString &imageFileName);
+
     enum CentralWidgets {
         ThumbViewWidget = 0,
         ImageViewWidget
@@ -100,6 +110,8 @@ private slots:
 
     void onReloadThumbs();
 
+    void onTagFilterChanged();
+
     void findDuplicateImages();
 
     void renameDir();
@@ -116,6 +128,8 @@ private slots:
 
     void addNewBookmark();
 
+    void indexDirectoryTree();
+
     void deleteDirectory(bool trash);
 
     void createSubDirectory();
@@ -286,6 +300,10 @@ private slots:
 
     void onFileListSelected();
 
+    void onFileListRead(int generation, const QStringList &paths);
+
+    void onFileListFinished(int generation);
+
     void setSquareThumbs();
 
     void setCompactThumbs();
@@ -333,6 +351,7 @@ private:
     QAction *pasteImageAction;
     QAction *showClipboardAction;
     QAction *addBookmarkAction;
+    QAction *indexDirectoryAction;
     QAction *removeBookmarkAction;
 
     QActionGroup *thumbLayoutsGroup;
@@ -433,8 +452,13 @@ private:
     FileSystemTree *fileSystemTree;
     BookMarks *bookmarks;
     QDockWidget *imageInfoDock;
+    QDockWidget *performanceDock;
     ThumbsViewer *thumbsViewer;
     ImageViewer *imageViewer;
+    CacheIndexer *cacheIndexer;
+    FileListReader *fileListReader;
+    bool isFileListAppendScheduled = false;
+    bool isFileListTagsPending = false;
     QList<QString> pathHistoryList;
     QTimer *SlideShowTimer;
     QPointer<CopyMoveToDialog> copyMoveToDialog;
@@ -443,11 +467,13 @@ private:
     QWidget *imagePreviewDockOrigWidget;
     QWidget *tagsDockOrigWidget;
     QWidget *imageInfoDockOrigWidget;
+    QWidget *performanceDockOrigWidget;
     QWidget *fileSystemDockEmptyWidget;
     QWidget *bookmarksDockEmptyWidget;
     QWidget *imagePreviewDockEmptyWidget;
     QWidget *tagsDockEmptyWidget;
     QWidget *imageInfoDockEmptyWidget;
+    QWidget *performanceDockEmptyWidget;
     bool interfaceDisabled;
     std::shared_ptr<MetadataCache> metadataCache;
     FileListWidget *fileListWidget;
@@ -485,10 +511,21 @@ private:
 
     void selectCurrentViewDir();
 
-    void processStartupArguments(QStringList argumentsList, int filesStartAt);
+    // The directory to show first, null when a list of files was given
+    QString startupDirectory(const QStringList &argumentsList, int filesStartAt);
+
+    void processStartupArguments(QStringList argumentsList, int filesStartAt, const QString &startupDir);
 
     void loadStartupFileList(QStringList argumentsList, int filesStartAt);
 
+    void readStartupFileList(const QString &fileListPath);
+
+    // Adds the paths filesList does not have yet and returns them
+    static QStringList addToFilesList(const QStringList &paths);
+
+    // Shows what the file list reader added since, once the thumbnail view is not busy
+    void appendReadFileList();
+
     void addMenuSeparator(QWidget *widget);
 
     void createImageViewer();
@@ -511,6 +548,8 @@ private:
 
     void createImageTagsDock();
 
+    void createPerformanceDock();
+
     void writeSettings();
 
     void readSettings();
@@ -538,6 +577,8 @@ private:
     void copyOrMoveImages(bool move);
 
     void setViewerKeyEventsEnabled(bool enabled);
+
+    void prefetchImages(int direction);
 };
 
 #endif // PHOTOTONIC_H
@@ -0,0 +1,234 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "RecordFile.h"
+
+#if defined(Q_OS_UNIX)
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+#define MIN_STALE_RECORDS_TO_COMPACT 256
+#define MAX_PENDING_RECORD_BYTES (64 * 1024)
+
+RecordFile::RecordFile(const QString &fileName, const QByteArray &signature, quint32 version,
+                       const RecordParser &parseRecord) : header(signature), parseRecord(parseRecord) {
+    const quint32 reserved = 0;
+    header.append(reinterpret_cast<const char *>(&version), sizeof(version));
+    header.append(reinterpret_cast<const char *>(&reserved), sizeof(reserved));
+    file.setFileName(fileName);
+}
+
+RecordFile::~RecordFile() {
+    flush();
+    file.close();
+}
+
+bool RecordFile::fileId(const QString &filePath, FileId &id) {
+#if defined(Q_OS_UNIX)
+    struct stat fileStat;
+    if (stat(QFile::encodeName(filePath).constData(), &fileStat) != 0) {
+        return false;
+    }
+    id.device = quint64(fileStat.st_dev);
+    id.inode = quint64(fileStat.st_ino);
+#else
+    // No inode to go by, the canonical path has to do
+    const QString canonicalPath = QFileInfo(filePath).canonicalFilePath();
+    if (canonicalPath.isEmpty()) {
+        return false;
+    }
+    const QByteArray pathHash = QCryptographicHash::hash(canonicalPath.toUtf8(), QCryptographicHash::Md5);
+    memcpy(&id.device, pathHash.constData(), sizeof(id.device));
+    memcpy(&id.inode, pathHash.constData() + sizeof(id.device), sizeof(id.inode));
+#endif
+    return true;
+}
+
+bool RecordFile::open() {
+    isOpened = true;
+    if (!QDir().mkpath(QFileInfo(file.fileName()).absolutePath())
+        || !file.open(QIODevice::ReadWrite)) {
+        qWarning() << "Unable to open record file" << file.fileName() << file.errorString();
+        return false;
+    }
+
+    if (file.size() < header.size() || file.read(header.size()) != header) {
+        // New file, or one written by an incompatible version
+        if (!file.resize(0) || !file.seek(0) || file.write(header) != header.size() || !file.flush()) {
+            qWarning() << "Unable to initialize record file" << file.fileName() << file.errorString();
+            file.close();
+            return false;
+        }
+    }
+
+    const int staleRecords = scan();
+    if (staleRecords >= MIN_STALE_RECORDS_TO_COMPACT && staleRecords > index.size()) {
+        compact();
+    }
+
+    return file.isOpen();
+}
+
+int RecordFile::scan() {
+    int staleRecords = 0;
+    qint64 offset = header.size();
+    const qint64 fileSize = file.size();
+
+    index.clear();
+    fileEnd = fileSize;
+    if (fileSize <= offset) {
+        return 0;
+    }
+
+    uchar *data = file.map(0, fileSize);
+    if (!data) {
+        qWarning() << "Unable to map record file" << file.fileName() << file.errorString();
+        return 0;
+    }
+
+    while (offset < fileSize) {
+        FileId id;
+        const qint64 recordSize = parseRecord(data + offset, fileSize - offset, id);
+
+        if (recordSize <= 0 || recordSize > fileSize - offset) {
+            // Torn write from a previous session, drop it
+            qWarning() << "Truncating damaged record file" << file.fileName() << "at" << offset;
+            file.unmap(data);
+            data = nullptr;
+            file.resize(offset);
+            fileEnd = offset;
+            break;
+        }
+
+        if (index.contains(id)) {
+            ++staleRecords;
+        }
+        index.insert(id, offset);
+        offset += recordSize;
+    }
+
+    if (data) {
+        file.unmap(data);
+    }
+    return staleRecords;
+}
+
+bool RecordFile::compact() {
+    flush();
+    QSaveFile compacted(file.fileName());
+    uchar *data = file.map(0, fileEnd);
+    if (!data || !compacted.open(QIODevice::WriteOnly)) {
+        qWarning() << "Unable to compact record file" << file.fileName() << compacted.errorString();
+        if (data) {
+            file.unmap(data);
+        }
+        return false;
+    }
+
+    compacted.write(header);
+    for (QHash<FileId, qint64>::const_iterator it = index.constBegin(); it != index.constEnd(); ++it) {
+        FileId id;
+        const qint64 recordSize = parseRecord(data + *it, fileEnd - *it, id);
+        compacted.write(reinterpret_cast<const char *>(data + *it), recordSize);
+    }
+    file.unmap(data);
+
+    if (!compacted.commit()) {
+        qWarning() << "Unable to compact record file" << file.fileName() << compacted.errorString();
+        return false;
+    }
+
+    file.close();
+    if (!file.open(QIODevice::ReadWrite)) {
+        qWarning() << "Unable to reopen record file" << file.fileName() << file.errorString();
+        return false;
+    }
+    scan();
+    return true;
+}
+
+qint64 RecordFile::find(const FileId &id) {
+    if (!isOpened) {
+        isValid = open();
+    }
+    if (!isValid) {
+        return -1;
+    }
+    return index.value(id, -1);
+}
+
+bool RecordFile::read(qint64 offset, void *data, qint64 size) {
+    if (offset >= fileEnd) {
+        // Not written out yet
+        const qint64 pendingOffset = offset - fileEnd;
+        if (pendingOffset + size > pendingRecords.size()) {
+            return false;
+        }
+        memcpy(data, pendingRecords.constData() + pendingOffset, size_t(size));
+        return true;
+    }
+    return file.seek(offset) && file.read(reinterpret_cast<char *>(data), size) == size;
+}
+
+QByteArray RecordFile::read(qint64 offset, qint64 size) {
+    QByteArray data(int(size), Qt::Uninitialized);
+    if (!read(offset, data.data(), size)) {
+        return QByteArray();
+    }
+    return data;
+}
+
+void RecordFile::append(const FileId &id, const QByteArray &record) {
+    if (!isOpened) {
+        isValid = open();
+    }
+    if (!isValid) {
+        return;
+    }
+
+    index.insert(id, fileEnd + pendingRecords.size());
+    pendingRecords.append(record);
+    if (pendingRecords.size() >= MAX_PENDING_RECORD_BYTES) {
+        flush();
+    }
+}
+
+void RecordFile::flush() {
+    if (pendingRecords.isEmpty()) {
+        return;
+    }
+
+    if (!file.seek(fileEnd) || file.write(pendingRecords) != pendingRecords.size() || !file.flush()) {
+        qWarning() << "Unable to write record file" << file.fileName() << file.errorString();
+        file.resize(fileEnd);
+        // Forget the records that did not make it
+        QHash<FileId, qint64>::iterator it = index.begin();
+        while (it != index.end()) {
+            if (*it >= fileEnd) {
+                it = index.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    } else {
+        fileEnd += pendingRecords.size();
+    }
+    pendingRecords.clear();
+}
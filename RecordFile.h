@@ -0,0 +1,89 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RECORD_FILE_H
+#define RECORD_FILE_H
+
+#include <QtCore>
+#include <functional>
+
+// Append-only file of records about image files, what the feature and
+// metadata databases are kept in. A 16 byte header names the format and its
+// version, a file written by another version is started over. Records are
+// indexed by the device and inode of the image they describe, the latest
+// one for an image wins. A torn record at the end is cut off when the file
+// is opened, and once most records are superseded the live ones are copied
+// to a new file. Appends are buffered until flush(). Not thread safe.
+class RecordFile {
+
+public:
+    struct FileId {
+        quint64 device;
+        quint64 inode;
+
+        bool operator==(const FileId &other) const {
+            return device == other.device && inode == other.inode;
+        }
+    };
+
+    friend uint qHash(const FileId &fileId, uint seed) {
+        return qHash(qMakePair(fileId.device, fileId.inode), seed);
+    }
+
+    // Returns the size of the record at data and sets the file it is about,
+    // or returns 0 if no intact record of this format starts there
+    typedef std::function<qint64(const uchar *data, qint64 available, FileId &id)> RecordParser;
+
+    RecordFile(const QString &fileName, const QByteArray &signature, quint32 version,
+               const RecordParser &parseRecord);
+
+    ~RecordFile();
+
+    // Returns false if the file is gone
+    static bool fileId(const QString &filePath, FileId &id);
+
+    // Offset of the latest record for the file, -1 if there is none
+    qint64 find(const FileId &id);
+
+    bool read(qint64 offset, void *data, qint64 size);
+
+    QByteArray read(qint64 offset, qint64 size);
+
+    void append(const FileId &id, const QByteArray &record);
+
+    // Writes the buffered records out
+    void flush();
+
+private:
+    bool open();
+
+    int scan();
+
+    bool compact();
+
+    QFile file;
+    QByteArray header;
+    RecordParser parseRecord;
+    QHash<FileId, qint64> index;
+    QByteArray pendingRecords;
+    qint64 fileEnd = 0;
+    bool isOpened = false;
+    bool isValid = false;
+};
+
+#endif // RECORD_FILE_H
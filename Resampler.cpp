@@ -0,0 +1,475 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QtCore>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include "Resampler.h"
+#include "PerfCounters.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define WEIGHT_BITS 14
+#define BOX_REDUCE_GAP 3
+#define RESAMPLE_ROWS_PER_BLOCK 16
+#define RESAMPLE_PARALLEL_PIXELS (512 * 512)
+
+namespace {
+
+const double pi = 3.14159265358979323846;
+
+struct Pixels {
+    uchar *bits;
+    int bytesPerLine;
+    int width;
+    int height;
+};
+
+// For every output pixel the first input pixel it is made of and the weights of the ones from there
+struct Weights {
+    QVector<int> first;
+    QVector<int> count;
+    QVector<qint16> values;
+    int stride = 0;
+};
+
+double filterSupport(Resampler::Filter filter) {
+    return filter == Resampler::Lanczos3 ? 3 : 2;
+}
+
+double filterValue(Resampler::Filter filter, double x) {
+    x = std::fabs(x);
+    if (filter == Resampler::Lanczos3) {
+        if (x < 1e-8) {
+            return 1;
+        }
+        if (x >= 3) {
+            return 0;
+        }
+        const double px = pi * x;
+        return 3 * std::sin(px) * std::sin(px / 3) / (px * px);
+    }
+
+    // B = C = 1/3
+    const double b = 1. / 3, c = 1. / 3;
+    if (x < 1) {
+        return ((12 - 9 * b - 6 * c) * x * x * x + (-18 + 12 * b + 6 * c) * x * x + (6 - 2 * b)) / 6;
+    }
+    if (x < 2) {
+        return ((-b - 6 * c) * x * x * x + (6 * b + 30 * c) * x * x + (-12 * b - 48 * c) * x + (8 * b + 24 * c)) / 6;
+    }
+    return 0;
+}
+
+// inputSize is in input pixels and may end part way into the last one, after a box reduction
+Weights computeWeights(Resampler::Filter filter, double inputSize, int inputPixels, int outputSize) {
+    const double scale = inputSize / outputSize;
+    const double filterScale = qMax(1.0, scale);
+    const double support = filterSupport(filter) * filterScale;
+
+    Weights weights;
+    weights.stride = int(std::ceil(support)) * 2 + 1;
+    weights.first.resize(outputSize);
+    weights.count.resize(outputSize);
+    weights.values.resize(outputSize * weights.stride);
+    QVector<double> taps(weights.stride);
+    for (int output = 0; output < outputSize; ++output) {
+        const double center = (output + 0.5) * scale;
+        const int first = qMax(0, int(center - support + 0.5));
+        const int count = qMin(qMin(inputPixels, int(center + support + 0.5)) - first, weights.stride);
+
+        double sum = 0;
+        for (int i = 0; i < count; ++i) {
+            taps[i] = filterValue(filter, (first + i + 0.5 - center) / filterScale);
+            sum += taps[i];
+        }
+
+        // Rounding is corrected on the largest weight, so flat areas keep their exact value
+        qint16 *values = weights.values.data() + output * weights.stride;
+        int total = 0;
+        int largest = 0;
+        for (int i = 0; i < count; ++i) {
+            values[i] = qint16(std::lround(sum > 0 ? taps[i] / sum * (1 << WEIGHT_BITS) : 0));
+            total += values[i];
+            if (values[i] > values[largest]) {
+                largest = i;
+            }
+        }
+        values[largest] = qint16(values[largest] + (1 << WEIGHT_BITS) - total);
+        weights.first[output] = first;
+        weights.count[output] = count;
+    }
+    return weights;
+}
+
+inline uchar clampChannel(int value) {
+    return uchar(qBound(0, value >> WEIGHT_BITS, 255));
+}
+
+#if defined(__SSE2__)
+// Two weights in each 32-bit lane, the way madd pairs them with interleaved channels
+inline __m128i packWeights(const qint16 *weights) {
+    const quint32 pair = quint32(quint16(weights[0])) | (quint32(quint16(weights[1])) << 16);
+    return _mm_set1_epi32(int(pair));
+}
+#endif
+
+// One output pixel from count input pixels, the same weight for all four channels
+inline quint32 convolvePixel(const quint32 *pixels, const qint16 *weights, int count) {
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum = _mm_set1_epi32(1 << (WEIGHT_BITS - 1));
+    int i = 0;
+    for (; i + 1 < count; i += 2) {
+        // Channels of the two pixels next to each other, so madd multiplies and adds them in one go
+        const __m128i pair = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(pixels + i)), zero);
+        const __m128i channels = _mm_unpacklo_epi16(pair, _mm_srli_si128(pair, 8));
+        const __m128i weightPair = packWeights(weights + i);
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(channels, weightPair));
+    }
+    if (i < count) {
+        const __m128i channels = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(int(pixels[i])), zero), zero);
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(channels, _mm_set1_epi32(int(quint16(weights[i])))));
+    }
+    const __m128i words = _mm_packs_epi32(_mm_srai_epi32(sum, WEIGHT_BITS), zero);
+    return quint32(_mm_cvtsi128_si32(_mm_packus_epi16(words, zero)));
+#elif defined(__ARM_NEON)
+    int32x4_t sum = vdupq_n_s32(1 << (WEIGHT_BITS - 1));
+    for (int i = 0; i < count; ++i) {
+        const int16x4_t channels = vget_low_s16(vreinterpretq_s16_u16(
+                vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(pixels[i])))));
+        sum = vmlal_n_s16(sum, channels, weights[i]);
+    }
+    const int16x4_t words = vqshrn_n_s32(sum, WEIGHT_BITS);
+    return vget_lane_u32(vreinterpret_u32_u8(vqmovun_s16(vcombine_s16(words, words))), 0);
+#else
+    int sum[4] = {1 << (WEIGHT_BITS - 1), 1 << (WEIGHT_BITS - 1), 1 << (WEIGHT_BITS - 1), 1 << (WEIGHT_BITS - 1)};
+    for (int i = 0; i < count; ++i) {
+        const uchar *channels = reinterpret_cast<const uchar *>(pixels + i);
+        for (int c = 0; c < 4; ++c) {
+            sum[c] += channels[c] * weights[i];
+        }
+    }
+    quint32 pixel;
+    uchar *channels = reinterpret_cast<uchar *>(&pixel);
+    for (int c = 0; c < 4; ++c) {
+        channels[c] = clampChannel(sum[c]);
+    }
+    return pixel;
+#endif
+}
+
+// Negative lobes can leave a colour brighter than its alpha allows
+void clampToAlpha(quint32 *pixels, int width) {
+    for (int x = 0; x < width; ++x) {
+        const quint32 alpha = pixels[x] >> 24;
+        const quint32 red = qMin((pixels[x] >> 16) & 0xff, alpha);
+        const quint32 green = qMin((pixels[x] >> 8) & 0xff, alpha);
+        const quint32 blue = qMin(pixels[x] & 0xff, alpha);
+        pixels[x] = (alpha << 24) | (red << 16) | (green << 8) | blue;
+    }
+}
+
+// The pass that comes last clamps premultiplied pixels, clamping earlier would be undone by the next one
+void resampleRowsHorizontally(const Pixels &source, const Pixels &target, const Weights &weights, bool isPremultiplied,
+                              int firstRow, int lastRow) {
+    for (int y = firstRow; y < lastRow; ++y) {
+        const quint32 *input = reinterpret_cast<const quint32 *>(source.bits + y * source.bytesPerLine);
+        quint32 *output = reinterpret_cast<quint32 *>(target.bits + y * target.bytesPerLine);
+        for (int x = 0; x < target.width; ++x) {
+            output[x] = convolvePixel(input + weights.first.at(x), weights.values.constData() + x * weights.stride,
+                                      weights.count.at(x));
+        }
+        if (isPremultiplied) {
+            clampToAlpha(output, target.width);
+        }
+    }
+}
+
+// A row of bytes from count input rows, starting at first
+void convolveRows(const Pixels &source, int first, const qint16 *weights, int count, uchar *output) {
+    const int bytes = source.width * 4;
+    int x = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= bytes; x += 16) {
+        __m128i sums[4];
+        for (__m128i &sum : sums) {
+            sum = _mm_set1_epi32(1 << (WEIGHT_BITS - 1));
+        }
+        int i = 0;
+        for (; i + 1 < count; i += 2) {
+            // Bytes of the two rows interleaved, madd multiplies and adds each pair
+            const uchar *line = source.bits + (first + i) * source.bytesPerLine + x;
+            const __m128i row0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(line));
+            const __m128i row1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(line + source.bytesPerLine));
+            const __m128i weightPair = packWeights(weights + i);
+            const __m128i low = _mm_unpacklo_epi8(row0, row1);
+            const __m128i high = _mm_unpackhi_epi8(row0, row1);
+            sums[0] = _mm_add_epi32(sums[0], _mm_madd_epi16(_mm_unpacklo_epi8(low, zero), weightPair));
+            sums[1] = _mm_add_epi32(sums[1], _mm_madd_epi16(_mm_unpackhi_epi8(low, zero), weightPair));
+            sums[2] = _mm_add_epi32(sums[2], _mm_madd_epi16(_mm_unpacklo_epi8(high, zero), weightPair));
+            sums[3] = _mm_add_epi32(sums[3], _mm_madd_epi16(_mm_unpackhi_epi8(high, zero), weightPair));
+        }
+        if (i < count) {
+            const __m128i row = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(source.bits + (first + i) * source.bytesPerLine + x));
+            const __m128i weight = _mm_set1_epi32(int(quint16(weights[i])));
+            const __m128i low = _mm_unpacklo_epi8(row, zero);
+            const __m128i high = _mm_unpackhi_epi8(row, zero);
+            sums[0] = _mm_add_epi32(sums[0], _mm_madd_epi16(_mm_unpacklo_epi16(low, zero), weight));
+            sums[1] = _mm_add_epi32(sums[1], _mm_madd_epi16(_mm_unpackhi_epi16(low, zero), weight));
+            sums[2] = _mm_add_epi32(sums[2], _mm_madd_epi16(_mm_unpacklo_epi16(high, zero), weight));
+            sums[3] = _mm_add_epi32(sums[3], _mm_madd_epi16(_mm_unpackhi_epi16(high, zero), weight));
+        }
+        const __m128i words0 = _mm_packs_epi32(_mm_srai_epi32(sums[0], WEIGHT_BITS),
+                                               _mm_srai_epi32(sums[1], WEIGHT_BITS));
+        const __m128i words1 = _mm_packs_epi32(_mm_srai_epi32(sums[2], WEIGHT_BITS),
+                                               _mm_srai_epi32(sums[3], WEIGHT_BITS));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(output + x), _mm_packus_epi16(words0, words1));
+    }
+#elif defined(__ARM_NEON)
+    for (; x + 8 <= bytes; x += 8) {
+        int32x4_t sum0 = vdupq_n_s32(1 << (WEIGHT_BITS - 1));
+        int32x4_t sum1 = sum0;
+        for (int i = 0; i < count; ++i) {
+            const int16x8_t row = vreinterpretq_s16_u16(
+                    vmovl_u8(vld1_u8(source.bits + (first + i) * source.bytesPerLine + x)));
+            sum0 = vmlal_n_s16(sum0, vget_low_s16(row), weights[i]);
+            sum1 = vmlal_n_s16(sum1, vget_high_s16(row), weights[i]);
+        }
+        vst1_u8(output + x, vqmovun_s16(vcombine_s16(vqshrn_n_s32(sum0, WEIGHT_BITS),
+                                                     vqshrn_n_s32(sum1, WEIGHT_BITS))));
+    }
+#endif
+    for (; x < bytes; ++x) {
+        int sum = 1 << (WEIGHT_BITS - 1);
+        for (int i = 0; i < count; ++i) {
+            sum += source.bits[(first + i) * source.bytesPerLine + x] * weights[i];
+        }
+        output[x] = clampChannel(sum);
+    }
+}
+
+void resampleRowsVertically(const Pixels &source, const Pixels &target, const Weights &weights, bool isPremultiplied,
+                            int firstRow, int lastRow) {
+    for (int y = firstRow; y < lastRow; ++y) {
+        uchar *output = target.bits + y * target.bytesPerLine;
+        convolveRows(source, weights.first.at(y), weights.values.constData() + y * weights.stride,
+                     weights.count.at(y), output);
+
+        if (isPremultiplied) {
+            clampToAlpha(reinterpret_cast<quint32 *>(output), target.width);
+        }
+    }
+}
+
+// Averages blocks of factorX by factorY pixels, the ones at the right and bottom edges may be smaller
+void boxReduceRows(const Pixels &source, const Pixels &target, int factorX, int factorY, int firstRow, int lastRow) {
+    for (int y = firstRow; y < lastRow; ++y) {
+        const int top = y * factorY;
+        const int rows = qMin(factorY, source.height - top);
+        uchar *output = target.bits + y * target.bytesPerLine;
+        for (int x = 0; x < target.width; ++x) {
+            const int left = x * factorX;
+            const int columns = qMin(factorX, source.width - left);
+            quint32 sum[4] = {0, 0, 0, 0};
+            for (int row = 0; row < rows; ++row) {
+                const uchar *input = source.bits + (top + row) * source.bytesPerLine + left * 4;
+                for (int i = 0; i < columns * 4; i += 4) {
+                    sum[0] += input[i];
+                    sum[1] += input[i + 1];
+                    sum[2] += input[i + 2];
+                    sum[3] += input[i + 3];
+                }
+            }
+            const quint32 count = quint32(rows * columns);
+            for (int c = 0; c < 4; ++c) {
+                output[x * 4 + c] = uchar((sum[c] + count / 2) / count);
+            }
+        }
+    }
+}
+
+class RowWorker : public QRunnable {
+public:
+    RowWorker(const std::function<void(int, int)> &processRows, int rows, std::atomic<int> &nextRow,
+              QSemaphore &done)
+        : processRows(processRows), rows(rows), nextRow(nextRow), done(done) {}
+
+    void run() override {
+        processBlocks(processRows, rows, nextRow);
+        done.release();
+    }
+
+    static void processBlocks(const std::function<void(int, int)> &processRows, int rows,
+                              std::atomic<int> &nextRow) {
+        forever {
+            const int firstRow = nextRow.fetch_add(RESAMPLE_ROWS_PER_BLOCK);
+            if (firstRow >= rows) {
+                return;
+            }
+            processRows(firstRow, qMin(firstRow + RESAMPLE_ROWS_PER_BLOCK, rows));
+        }
+    }
+
+private:
+    const std::function<void(int, int)> &processRows;
+    int rows;
+    std::atomic<int> &nextRow;
+    QSemaphore &done;
+};
+
+// Thumbnails are scaled on the loader's and the writer's threads already
+void forEachRowBlock(int rows, qint64 pixels, const std::function<void(int, int)> &processRows) {
+    std::atomic<int> nextRow{0};
+    if (pixels < RESAMPLE_PARALLEL_PIXELS) {
+        RowWorker::processBlocks(processRows, rows, nextRow);
+        return;
+    }
+
+    static QThreadPool threadPool;
+    QSemaphore done;
+    const int blocks = (rows + RESAMPLE_ROWS_PER_BLOCK - 1) / RESAMPLE_ROWS_PER_BLOCK;
+    const int workers = qMax(0, qMin(QThread::idealThreadCount(), blocks) - 1);
+    for (int i = 0; i < workers; ++i) {
+        threadPool.start(new RowWorker(processRows, rows, nextRow, done));
+    }
+    RowWorker::processBlocks(processRows, rows, nextRow);
+    done.acquire(workers);
+}
+
+// Inputs are only read, so a shared image is not detached for them
+Pixels inputPixels(const QImage &image) {
+    return {const_cast<uchar *>(image.constBits()), int(image.bytesPerLine()), image.width(), image.height()};
+}
+
+Pixels outputPixels(QImage &image) {
+    return {image.bits(), int(image.bytesPerLine()), image.width(), image.height()};
+}
+
+bool isDeep(const QImage &image) {
+    switch (image.format()) {
+    case QImage::Format_BGR30:
+    case QImage::Format_A2BGR30_Premultiplied:
+    case QImage::Format_RGB30:
+    case QImage::Format_A2RGB30_Premultiplied:
+    case QImage::Format_Grayscale16:
+        return true;
+    default:
+        return image.depth() > 32;
+    }
+}
+
+} // anonymous namespace
+
+namespace Resampler {
+
+QImage scaled(const QImage &image, const QSize &size, Qt::AspectRatioMode aspectMode, Filter filter) {
+    const QSize targetSize = image.size().scaled(size, aspectMode);
+    if (image.isNull() || targetSize.isEmpty()) {
+        return QImage();
+    }
+    if (targetSize == image.size()) {
+        return image;
+    }
+    if (isDeep(image)) {
+        return image.scaled(targetSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+
+    Perf::ScopedTimer timer(Perf::Resample);
+    const bool hasAlpha = image.hasAlphaChannel();
+    const QImage::Format format = hasAlpha ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+    QImage source = image.format() == format ? image : image.convertToFormat(format);
+    double sourceWidth = source.width();
+    double sourceHeight = source.height();
+
+    // The filter only has to cover a few input pixels for each output pixel after this
+    const int factorX = qMax(1, source.width() / (targetSize.width() * BOX_REDUCE_GAP));
+    const int factorY = qMax(1, source.height() / (targetSize.height() * BOX_REDUCE_GAP));
+    if (factorX > 1 || factorY > 1) {
+        QImage reduced((source.width() + factorX - 1) / factorX, (source.height() + factorY - 1) / factorY, format);
+        if (reduced.isNull()) {
+            return QImage();
+        }
+        const Pixels input = inputPixels(source);
+        const Pixels output = outputPixels(reduced);
+        forEachRowBlock(output.height, qint64(input.width) * input.height, [&](int firstRow, int lastRow) {
+            boxReduceRows(input, output, factorX, factorY, firstRow, lastRow);
+        });
+        source = reduced;
+        sourceWidth /= factorX;
+        sourceHeight /= factorY;
+    }
+
+    // The horizontal pass keeps the height, so whether the vertical one runs is known already
+    const bool isResampledVertically = targetSize.height() != source.height() || sourceHeight != source.height();
+    if (targetSize.width() != source.width() || sourceWidth != source.width()) {
+        QImage resampled(targetSize.width(), source.height(), format);
+        if (resampled.isNull()) {
+            return QImage();
+        }
+        const Weights weights = computeWeights(filter, sourceWidth, source.width(), targetSize.width());
+        const Pixels input = inputPixels(source);
+        const Pixels output = outputPixels(resampled);
+        forEachRowBlock(output.height, qint64(output.width) * weights.stride * output.height,
+                        [&](int firstRow, int lastRow) {
+            resampleRowsHorizontally(input, output, weights, hasAlpha && !isResampledVertically, firstRow, lastRow);
+        });
+        source = resampled;
+    }
+
+    if (isResampledVertically) {
+        QImage resampled(targetSize, format);
+        if (resampled.isNull()) {
+            return QImage();
+        }
+        const Weights weights = computeWeights(filter, sourceHeight, source.height(), targetSize.height());
+        const Pixels input = inputPixels(source);
+        const Pixels output = outputPixels(resampled);
+        forEachRowBlock(output.height, qint64(output.width) * weights.stride * output.height,
+                        [&](int firstRow, int lastRow) {
+            resampleRowsVertically(input, output, weights, hasAlpha, firstRow, lastRow);
+        });
+        source = resampled;
+    }
+
+    source.setDotsPerMeterX(image.dotsPerMeterX());
+    source.setDotsPerMeterY(image.dotsPerMeterY());
+    source.setOffset(image.offset());
+    source.setDevicePixelRatio(image.devicePixelRatio());
+    for (const QString &key : image.textKeys()) {
+        source.setText(key, image.text(key));
+    }
+    if (image.colorSpace().isValid()) {
+        source.setColorSpace(image.colorSpace());
+    }
+    return source;
+}
+
+QImage scaled(const QImage &image, int width, int height, Qt::AspectRatioMode aspectMode, Filter filter) {
+    return scaled(image, QSize(width, height), aspectMode, filter);
+}
+
+}
@@ -0,0 +1,47 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <QImage>
+
+namespace Resampler {
+
+enum Filter {
+    // Sharpest, for reductions
+    Lanczos3,
+    // Rings less than Lanczos when enlarging
+    Mitchell
+};
+
+// Separable resampling through precomputed fixed point weights, a band of rows per core for
+// large images. Large reductions are box averaged first, down to a few times the final size.
+// Behaves like QImage::scaled() with Qt::SmoothTransformation: the result is RGB32, or
+// ARGB32_Premultiplied for images with alpha, and keeps the metadata of the image.
+// Images with more than 8 bits per channel are left to Qt, so they keep their depth.
+QImage scaled(const QImage &image, const QSize &size, Qt::AspectRatioMode aspectMode = Qt::IgnoreAspectRatio,
+              Filter filter = Lanczos3);
+
+QImage scaled(const QImage &image, int width, int height, Qt::AspectRatioMode aspectMode = Qt::IgnoreAspectRatio,
+              Filter filter = Lanczos3);
+
+}
+
+#endif // RESAMPLER_H
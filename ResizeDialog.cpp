@@ -28,6 +28,8 @@ ResizeDialog::ResizeDialog(QWidget *parent, ImageViewer *imageViewer) : QDialog(
     setWindowTitle(tr("Scale Image"));
     setWindowIcon(QIcon::fromTheme("transform-scale", QIcon(":/images/phototonic.png")));
     newWidth = newHeight = 0;
+    initialScaledWidth = Settings::scaledWidth;
+    initialScaledHeight = Settings::scaledHeight;
 
     if (Settings::dialogLastX) {
         move(Settings::dialogLastX, Settings::dialogLastY);
@@ -181,6 +183,12 @@ void ResizeDialog::adjustSizes() {
 
     newSizePixelsLabel->setText(QString::number(newWidth) + " x " + QString::number(newHeight));
     busy = false;
+
+    if (isVisible() && newWidth > 0 && newHeight > 0) {
+        Settings::scaledWidth = newWidth;
+        Settings::scaledHeight = newHeight;
+        imageViewer->refresh();
+    }
 }
 
 void ResizeDialog::ok() {
@@ -195,3 +203,12 @@ void ResizeDialog::ok() {
 void ResizeDialog::abort() {
     reject();
 }
+
+void ResizeDialog::reject() {
+    if (Settings::scaledWidth != initialScaledWidth || Settings::scaledHeight != initialScaledHeight) {
+        Settings::scaledWidth = initialScaledWidth;
+        Settings::scaledHeight = initialScaledHeight;
+        imageViewer->refresh();
+    }
+    QDialog::reject();
+}
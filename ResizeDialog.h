@@ -39,6 +39,8 @@ public slots:
 
     void adjustSizes();
 
+    void reject() override;
+
 private:
     int width;
     int height;
@@ -48,6 +50,8 @@ private:
     bool pixelUnits;
     int newWidth;
     int newHeight;
+    int initialScaledWidth;
+    int initialScaledHeight;
 
     QSpinBox *widthSpinBox;
     QSpinBox *heightSpinBox;
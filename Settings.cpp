@@ -69,6 +69,17 @@ namespace Settings {
     const char optionSetWindowIcon[] = "setWindowIcon";
     const char optionUpscalePreview[] = "upscalePreview";
     const char optionScrollZooms[] = "scrollZooms";
+    const char optionPackedThumbnails[] = "packedThumbnails";
+    const char optionPackedThumbnailEncoding[] = "packedThumbnailEncoding";
+    const char optionMetadataDatabase[] = "metadataDatabase";
+    const char optionTagSidecars[] = "tagSidecars";
+    const char optionPreciseSimilarity[] = "preciseSimilarity";
+    const char optionProgressiveLoading[] = "progressiveLoading";
+    const char optionDevelopRawFiles[] = "developRawFiles";
+    const char optionOpenGLViewer[] = "openGLViewer";
+    const char optionThumbsMemoryLimit[] = "thumbsMemoryLimit";
+    const char optionDupesHammingDistance[] = "dupesHammingDistance";
+    const char optionDupesMode[] = "dupesMode";
 
     QSettings *appSettings;
     unsigned int layoutMode;
@@ -150,9 +161,21 @@ namespace Settings {
     QString thumbsBackgroundImage;
     bool thumbsRepeatBackgroundImage;
     QStringList filesList;
+    QSet<QString> filesListIndex;
     bool isFileListLoaded;
     bool setWindowIcon;
     bool upscalePreview;
     bool scrollZooms;
+    bool packedThumbnails;
+    int packedThumbnailEncoding;
+    bool metadataDatabase;
+    bool tagSidecars;
+    bool preciseSimilarity;
+    bool progressiveLoading;
+    bool developRawFiles;
+    bool openGLViewer;
+    unsigned int thumbsMemoryLimit;
+    unsigned int dupesHammingDistance;
+    DupesMode dupesMode;
 }
 
@@ -37,6 +37,12 @@ namespace Settings {
         SpecifiedDir
     };
 
+    enum DupesMode {
+        SimilarImages = 0,
+        IdenticalFiles,
+        IdenticalAndSimilar
+    };
+
     extern const char optionThumbsSortFlags[];
     extern const char optionThumbsZoomLevel[];
     extern const char optionFullScreenMode[];
@@ -86,6 +92,17 @@ namespace Settings {
     extern const char optionSetWindowIcon[];
     extern const char optionUpscalePreview[];
     extern const char optionScrollZooms[];
+    extern const char optionPackedThumbnails[];
+    extern const char optionMetadataDatabase[];
+    extern const char optionTagSidecars[];
+    extern const char optionPreciseSimilarity[];
+    extern const char optionProgressiveLoading[];
+    extern const char optionDevelopRawFiles[];
+    extern const char optionOpenGLViewer[];
+    extern const char optionThumbsMemoryLimit[];
+    extern const char optionDupesHammingDistance[];
+    extern const char optionDupesMode[];
+    extern const char optionPackedThumbnailEncoding[];
 
     extern QSettings *appSettings;
     extern unsigned int layoutMode;
@@ -167,10 +184,23 @@ namespace Settings {
     extern QString thumbsBackgroundImage;
     extern bool thumbsRepeatBackgroundImage;
     extern QStringList filesList;
+    // The paths in filesList, for lookups that would otherwise scan it
+    extern QSet<QString> filesListIndex;
     extern bool isFileListLoaded;
     extern bool setWindowIcon;
     extern bool upscalePreview;
     extern bool scrollZooms;
+    extern bool packedThumbnails;
+    extern int packedThumbnailEncoding;
+    extern bool metadataDatabase;
+    extern bool tagSidecars;
+    extern bool preciseSimilarity;
+    extern bool progressiveLoading;
+    extern bool developRawFiles;
+    extern bool openGLViewer;
+    extern unsigned int thumbsMemoryLimit;
+    extern unsigned int dupesHammingDistance;
+    extern DupesMode dupesMode;
 }
 
 #endif // SETTINGS_H
@@ -17,6 +17,7 @@
  */
 
 #include "SettingsDialog.h"
+#include "PackedThumbnail.h"
 
 SettingsDialog::SettingsDialog(QWidget *parent) : QDialog(parent) {
     setWindowTitle(tr("Preferences"));
@@ -85,6 +86,18 @@ SettingsDialog::SettingsDialog(QWidget *parent) : QDialog(parent) {
     enableAnimCheckBox = new QCheckBox(tr("Enable GIF animation"), this);
     enableAnimCheckBox->setChecked(Settings::enableAnimations);
 
+    // Progressive loading
+    progressiveLoadingCheckBox = new QCheckBox(tr("Show a preview while large images load"), this);
+    progressiveLoadingCheckBox->setChecked(Settings::progressiveLoading);
+
+    // RAW files
+    developRawFilesCheckBox = new QCheckBox(tr("Develop RAW files in full when a decoder is installed"), this);
+    developRawFilesCheckBox->setChecked(Settings::developRawFiles);
+
+    // OpenGL
+    openGLViewerCheckBox = new QCheckBox(tr("Draw images with OpenGL"), this);
+    openGLViewerCheckBox->setChecked(Settings::openGLViewer);
+
     // Enable image Exif rotation
     enableExifCheckBox = new QCheckBox(tr("Rotate image according to Exif orientation value"), this);
     enableExifCheckBox->setChecked(Settings::exifRotationEnabled);
@@ -107,6 +120,9 @@ SettingsDialog::SettingsDialog(QWidget *parent) : QDialog(parent) {
     viewerOptsBox->addWidget(showImageNameCheckBox);
     viewerOptsBox->addWidget(wrapListCheckBox);
     viewerOptsBox->addWidget(enableAnimCheckBox);
+    viewerOptsBox->addWidget(progressiveLoadingCheckBox);
+    viewerOptsBox->addWidget(developRawFilesCheckBox);
+    viewerOptsBox->addWidget(openGLViewerCheckBox);
     viewerOptsBox->addLayout(saveQualityHbox);
     viewerOptsBox->addStretch(1);
 
@@ -170,6 +186,43 @@ SettingsDialog::SettingsDialog(QWidget *parent) : QDialog(parent) {
     thumbPagesReadLayout->addWidget(thumbPagesSpinBox);
     thumbPagesReadLayout->addStretch(1);
 
+    // Memory budget for loaded thumbnails
+    QLabel *thumbsMemoryLimitLabel = new QLabel(tr("Memory for loaded thumbnails:"));
+    thumbsMemoryLimitSpinBox = new QSpinBox;
+    thumbsMemoryLimitSpinBox->setRange(64, 65536);
+    thumbsMemoryLimitSpinBox->setSingleStep(64);
+    thumbsMemoryLimitSpinBox->setSuffix(tr(" MB"));
+    thumbsMemoryLimitSpinBox->setValue(Settings::thumbsMemoryLimit);
+    thumbsMemoryUsageLabel = new QLabel;
+    QHBoxLayout *thumbsMemoryLimitLayout = new QHBoxLayout;
+    thumbsMemoryLimitLayout->addWidget(thumbsMemoryLimitLabel);
+    thumbsMemoryLimitLayout->addWidget(thumbsMemoryLimitSpinBox);
+    thumbsMemoryLimitLayout->addWidget(thumbsMemoryUsageLabel);
+    thumbsMemoryLimitLayout->addStretch(1);
+
+    // How far apart two images may be to count as duplicates
+    QLabel *dupesHammingDistanceLabel = new QLabel(tr("Differing hash bits allowed between duplicates:"));
+    dupesHammingDistanceSpinBox = new QSpinBox;
+    dupesHammingDistanceSpinBox->setRange(0, 16);
+    dupesHammingDistanceSpinBox->setSpecialValueText(tr("Exact"));
+    dupesHammingDistanceSpinBox->setValue(Settings::dupesHammingDistance);
+    QHBoxLayout *dupesHammingDistanceLayout = new QHBoxLayout;
+    dupesHammingDistanceLayout->addWidget(dupesHammingDistanceLabel);
+    dupesHammingDistanceLayout->addWidget(dupesHammingDistanceSpinBox);
+    dupesHammingDistanceLayout->addStretch(1);
+
+    // Identical files are found from their content, without decoding them
+    QLabel *dupesModeLabel = new QLabel(tr("Duplicates:"));
+    dupesModeComboBox = new QComboBox;
+    dupesModeComboBox->addItem(tr("Similar images"), Settings::SimilarImages);
+    dupesModeComboBox->addItem(tr("Identical files"), Settings::IdenticalFiles);
+    dupesModeComboBox->addItem(tr("Identical files, then similar images"), Settings::IdenticalAndSimilar);
+    dupesModeComboBox->setCurrentIndex(dupesModeComboBox->findData(Settings::dupesMode));
+    QHBoxLayout *dupesModeLayout = new QHBoxLayout;
+    dupesModeLayout->addWidget(dupesModeLabel);
+    dupesModeLayout->addWidget(dupesModeComboBox);
+    dupesModeLayout->addStretch(1);
+
     enableThumbExifCheckBox = new QCheckBox(tr("Rotate thumbnail according to Exif orientation value"), this);
     enableThumbExifCheckBox->setChecked(Settings::exifThumbRotationEnabled);
 
@@ -177,6 +230,38 @@ SettingsDialog::SettingsDialog(QWidget *parent) : QDialog(parent) {
     upscalePreviewCheckBox = new QCheckBox(tr("Scale up small images in preview"), this);
     upscalePreviewCheckBox->setChecked(Settings::upscalePreview);
 
+    // Packed thumbnail cache
+    packedThumbnailsCheckBox = new QCheckBox(tr("Keep a packed thumbnail cache file for each folder"), this);
+    packedThumbnailsCheckBox->setChecked(Settings::packedThumbnails);
+    QLabel *packedThumbnailEncodingLabel = new QLabel(tr("Packed thumbnail encoding:"));
+    packedThumbnailEncodingComboBox = new QComboBox;
+    packedThumbnailEncodingComboBox->addItem(tr("PNG"), PackedThumbnail::Png);
+    packedThumbnailEncodingComboBox->addItem(tr("JPEG"), PackedThumbnail::Jpeg);
+    if (PackedThumbnail::isSupported(PackedThumbnail::WebP)) {
+        packedThumbnailEncodingComboBox->addItem(tr("WebP"), PackedThumbnail::WebP);
+    }
+    packedThumbnailEncodingComboBox->addItem(tr("Uncompressed, fastest to load"), PackedThumbnail::Raw);
+    packedThumbnailEncodingComboBox->setCurrentIndex(
+            qMax(0, packedThumbnailEncodingComboBox->findData(Settings::packedThumbnailEncoding)));
+    packedThumbnailEncodingComboBox->setEnabled(Settings::packedThumbnails);
+    connect(packedThumbnailsCheckBox, &QCheckBox::toggled, packedThumbnailEncodingComboBox, &QWidget::setEnabled);
+    QHBoxLayout *packedThumbnailEncodingLayout = new QHBoxLayout;
+    packedThumbnailEncodingLayout->addWidget(packedThumbnailEncodingLabel);
+    packedThumbnailEncodingLayout->addWidget(packedThumbnailEncodingComboBox);
+    packedThumbnailEncodingLayout->addStretch(1);
+
+    // Persistent metadata index
+    metadataDatabaseCheckBox = new QCheckBox(tr("Remember image tags and orientation between sessions"), this);
+    metadataDatabaseCheckBox->setChecked(Settings::metadataDatabase);
+
+    // Tags in XMP sidecars
+    tagSidecarsCheckBox = new QCheckBox(tr("Save tags to XMP sidecar files instead of the images"), this);
+    tagSidecarsCheckBox->setChecked(Settings::tagSidecars);
+
+    // Full histograms for the similarity sort
+    preciseSimilarityCheckBox = new QCheckBox(tr("Compare full color histograms when sorting by similarity"), this);
+    preciseSimilarityCheckBox->setChecked(Settings::preciseSimilarity);
+
     // Thumbnail options
     QVBoxLayout *thumbsOptsBox = new QVBoxLayout;
     thumbsOptsBox->addLayout(thumbsBackgroundColorLayout);
@@ -187,7 +272,15 @@ SettingsDialog::SettingsDialog(QWidget *parent) : QDialog(parent) {
     thumbsOptsBox->addLayout(thumbsLabelColorLayout);
     thumbsOptsBox->addWidget(enableThumbExifCheckBox);
     thumbsOptsBox->addLayout(thumbPagesReadLayout);
+    thumbsOptsBox->addLayout(thumbsMemoryLimitLayout);
+    thumbsOptsBox->addLayout(dupesModeLayout);
+    thumbsOptsBox->addLayout(dupesHammingDistanceLayout);
     thumbsOptsBox->addWidget(upscalePreviewCheckBox);
+    thumbsOptsBox->addWidget(packedThumbnailsCheckBox);
+    thumbsOptsBox->addLayout(packedThumbnailEncodingLayout);
+    thumbsOptsBox->addWidget(metadataDatabaseCheckBox);
+    thumbsOptsBox->addWidget(tagSidecarsCheckBox);
+    thumbsOptsBox->addWidget(preciseSimilarityCheckBox);
     thumbsOptsBox->addStretch(1);
 
     // Mouse settings
@@ -334,6 +427,10 @@ SettingsDialog::SettingsDialog(QWidget *parent) : QDialog(parent) {
     setLayout(mainLayout);
 }
 
+void SettingsDialog::setThumbsMemoryUsage(qint64 bytes) {
+    thumbsMemoryUsageLabel->setText(tr("(%1 MB in use)").arg(QString::number(bytes / (1024.0 * 1024.0), 'f', 1)));
+}
+
 void SettingsDialog::saveSettings() {
     unsigned int i;
 
@@ -359,11 +456,17 @@ void SettingsDialog::saveSettings() {
     Settings::thumbsBackgroundImage = thumbsBackgroundImageLineEdit->text();
     Settings::thumbsRepeatBackgroundImage = thumbsRepeatBackgroundImageCheckBox->isChecked();
     Settings::thumbsPagesReadCount = (unsigned int) thumbPagesSpinBox->value();
+    Settings::thumbsMemoryLimit = (unsigned int) thumbsMemoryLimitSpinBox->value();
+    Settings::dupesHammingDistance = (unsigned int) dupesHammingDistanceSpinBox->value();
+    Settings::dupesMode = (Settings::DupesMode) dupesModeComboBox->currentData().toInt();
     Settings::wrapImageList = wrapListCheckBox->isChecked();
     Settings::defaultSaveQuality = saveQualitySpinBox->value();
     Settings::slideShowDelay = slideDelaySpinBox->value();
     Settings::slideShowRandom = slideRandomCheckBox->isChecked();
     Settings::enableAnimations = enableAnimCheckBox->isChecked();
+    Settings::progressiveLoading = progressiveLoadingCheckBox->isChecked();
+    Settings::developRawFiles = developRawFilesCheckBox->isChecked();
+    Settings::openGLViewer = openGLViewerCheckBox->isChecked();
     Settings::exifRotationEnabled = enableExifCheckBox->isChecked();
     Settings::exifThumbRotationEnabled = enableThumbExifCheckBox->isChecked();
     Settings::showImageName = showImageNameCheckBox->isChecked();
@@ -372,6 +475,11 @@ void SettingsDialog::saveSettings() {
     Settings::deleteConfirm = deleteConfirmCheckBox->isChecked();
     Settings::setWindowIcon = setWindowIconCheckBox->isChecked();
     Settings::upscalePreview = upscalePreviewCheckBox->isChecked();
+    Settings::packedThumbnails = packedThumbnailsCheckBox->isChecked();
+    Settings::packedThumbnailEncoding = packedThumbnailEncodingComboBox->currentData().toInt();
+    Settings::metadataDatabase = metadataDatabaseCheckBox->isChecked();
+    Settings::tagSidecars = tagSidecarsCheckBox->isChecked();
+    Settings::preciseSimilarity = preciseSimilarityCheckBox->isChecked();
 
     if (startupDirectoryRadioButtons[Settings::RememberLastDir]->isChecked()) {
         Settings::startupDir = Settings::RememberLastDir;
@@ -31,6 +31,8 @@ public:
 
     SettingsDialog(QWidget *parent);
 
+    void setThumbsMemoryUsage(qint64 bytes);
+
 private slots:
 
     void pickColor();
@@ -56,12 +58,19 @@ private:
     QToolButton *thumbsColorPickerButton;
     QToolButton *thumbsLabelColorButton;
     QSpinBox *thumbPagesSpinBox;
+    QSpinBox *thumbsMemoryLimitSpinBox;
+    QLabel *thumbsMemoryUsageLabel;
+    QSpinBox *dupesHammingDistanceSpinBox;
+    QComboBox *dupesModeComboBox;
     QSpinBox *saveQualitySpinBox;
     QColor imageViewerBackgroundColor;
     QColor thumbsBackgroundColor;
     QColor thumbsTextColor;
     QCheckBox *wrapListCheckBox;
     QCheckBox *enableAnimCheckBox;
+    QCheckBox *progressiveLoadingCheckBox;
+    QCheckBox *developRawFilesCheckBox;
+    QCheckBox *openGLViewerCheckBox;
     QCheckBox *enableExifCheckBox;
     QCheckBox *enableThumbExifCheckBox;
     QCheckBox *showImageNameCheckBox;
@@ -76,6 +85,11 @@ private:
     QCheckBox *thumbsRepeatBackgroundImageCheckBox;
     QCheckBox *setWindowIconCheckBox;
     QCheckBox *upscalePreviewCheckBox;
+    QCheckBox *packedThumbnailsCheckBox;
+    QComboBox *packedThumbnailEncodingComboBox;
+    QCheckBox *metadataDatabaseCheckBox;
+    QCheckBox *tagSidecarsCheckBox;
+    QCheckBox *preciseSimilarityCheckBox;
 
     void setButtonBgColor(QColor &color, QToolButton *button);
 };
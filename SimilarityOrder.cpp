@@ -0,0 +1,366 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <vector>
+#include "SimilarityOrder.h"
+
+#define EMBEDDING_BINS 16
+#define EMBEDDING_SIZE (3 * EMBEDDING_BINS)
+#define NEIGHBOUR_CANDIDATES 16
+#define NEIGHBOURS 8
+#define PARALLEL_CHUNK_SIZE 32
+#define PROGRESS_INTERVAL_MS 100
+
+namespace {
+
+typedef std::array<float, EMBEDDING_SIZE> Embedding;
+
+// Square roots of the coarse bin masses, the euclidean distance between two
+// of these approximates the Hellinger distance between the full histograms.
+// Histogram bins already hold square roots of normalised counts.
+Embedding embed(const Histogram &histogram) {
+    Embedding embedding;
+    const float *channels[3] = {histogram.red, histogram.green, histogram.blue};
+    for (int channel = 0; channel < 3; ++channel) {
+        for (int bin = 0; bin < EMBEDDING_BINS; ++bin) {
+            float mass = 0.f;
+            for (int i = bin * (256 / EMBEDDING_BINS); i < (bin + 1) * (256 / EMBEDDING_BINS); ++i) {
+                mass += channels[channel][i] * channels[channel][i];
+            }
+            embedding[channel * EMBEDDING_BINS + bin] = std::sqrt(mass);
+        }
+    }
+    return embedding;
+}
+
+// The same from the quantised roots of a descriptor
+Embedding embed(const ColorDescriptor &descriptor) {
+    Embedding embedding;
+    for (int channel = 0; channel < 3; ++channel) {
+        for (int bin = 0; bin < EMBEDDING_BINS; ++bin) {
+            float mass = 0.f;
+            const int first = channel * DESCRIPTOR_BINS + bin * (DESCRIPTOR_BINS / EMBEDDING_BINS);
+            for (int i = first; i < first + DESCRIPTOR_BINS / EMBEDDING_BINS; ++i) {
+                const float root = descriptor.bins[i] / 255.f;
+                mass += root * root;
+            }
+            embedding[channel * EMBEDDING_BINS + bin] = std::sqrt(mass);
+        }
+    }
+    return embedding;
+}
+
+float distance(const Embedding &a, const Embedding &b) {
+    float sum = 0.f;
+    for (int i = 0; i < EMBEDDING_SIZE; ++i) {
+        const float difference = a[i] - b[i];
+        sum += difference * difference;
+    }
+    return std::sqrt(sum);
+}
+
+class VantagePointTree {
+public:
+    explicit VantagePointTree(const QVector<Embedding> &embeddings)
+        : embeddings(embeddings), removed(embeddings.size(), false) {
+        QVector<int> items(embeddings.size());
+        std::iota(items.begin(), items.end(), 0);
+        itemNodes.resize(embeddings.size());
+        nodes.reserve(embeddings.size());
+        build(items, 0, items.size(), -1);
+    }
+
+    // The nearest items to item, closest first, not including item itself
+    QVector<int> nearest(int item, int count) const {
+        std::vector<std::pair<float, int>> heap;
+        float tau = std::numeric_limits<float>::max();
+        searchNearest(0, item, count, heap, tau);
+        std::sort_heap(heap.begin(), heap.end());
+
+        QVector<int> result;
+        result.reserve(int(heap.size()));
+        for (const std::pair<float, int> &candidate : heap) {
+            result.append(candidate.second);
+        }
+        return result;
+    }
+
+    // The nearest item to item that has not been removed yet, -1 if there is none
+    int nearestAlive(int item) const {
+        int best = -1;
+        float tau = std::numeric_limits<float>::max();
+        searchAlive(0, item, best, tau);
+        return best;
+    }
+
+    void remove(int item) {
+        removed[item] = true;
+        for (int node = itemNodes.at(item); node >= 0; node = nodes.at(node).parent) {
+            --nodes[node].alive;
+        }
+    }
+
+private:
+    struct Node {
+        int item;
+        float threshold;
+        int inside;
+        int outside;
+        int parent;
+        int alive;
+    };
+
+    int build(QVector<int> &items, int begin, int end, int parent) {
+        if (begin >= end) {
+            return -1;
+        }
+
+        const int node = nodes.size();
+        const int vantage = items.at(begin);
+        nodes.append({vantage, 0.f, -1, -1, parent, end - begin});
+        itemNodes[vantage] = node;
+        if (end - begin == 1) {
+            return node;
+        }
+
+        std::vector<std::pair<float, int>> byDistance;
+        byDistance.reserve(end - begin - 1);
+        for (int i = begin + 1; i < end; ++i) {
+            byDistance.emplace_back(distance(embeddings.at(vantage), embeddings.at(items.at(i))), items.at(i));
+        }
+        const int median = int(byDistance.size()) / 2;
+        std::nth_element(byDistance.begin(), byDistance.begin() + median, byDistance.end());
+        for (int i = 0; i < int(byDistance.size()); ++i) {
+            items[begin + 1 + i] = byDistance[i].second;
+        }
+
+        nodes[node].threshold = byDistance[median].first;
+        const int inside = build(items, begin + 1, begin + 1 + median, node);
+        const int outside = build(items, begin + 1 + median, end, node);
+        nodes[node].inside = inside;
+        nodes[node].outside = outside;
+        return node;
+    }
+
+    void searchNearest(int node, int item, int count, std::vector<std::pair<float, int>> &heap, float &tau) const {
+        if (node < 0) {
+            return;
+        }
+
+        const Node &current = nodes.at(node);
+        const float d = distance(embeddings.at(item), embeddings.at(current.item));
+        if (current.item != item && d < tau) {
+            heap.emplace_back(d, current.item);
+            std::push_heap(heap.begin(), heap.end());
+            if (int(heap.size()) > count) {
+                std::pop_heap(heap.begin(), heap.end());
+                heap.pop_back();
+            }
+            if (int(heap.size()) == count) {
+                tau = heap.front().first;
+            }
+        }
+
+        if (d < current.threshold) {
+            searchNearest(current.inside, item, count, heap, tau);
+            if (d + tau >= current.threshold) {
+                searchNearest(current.outside, item, count, heap, tau);
+            }
+        } else {
+            searchNearest(current.outside, item, count, heap, tau);
+            if (d - tau <= current.threshold) {
+                searchNearest(current.inside, item, count, heap, tau);
+            }
+        }
+    }
+
+    void searchAlive(int node, int item, int &best, float &tau) const {
+        if (node < 0 || nodes.at(node).alive == 0) {
+            return;
+        }
+
+        const Node &current = nodes.at(node);
+        const float d = distance(embeddings.at(item), embeddings.at(current.item));
+        if (d < tau && !removed.at(current.item)) {
+            best = current.item;
+            tau = d;
+        }
+
+        if (d < current.threshold) {
+            searchAlive(current.inside, item, best, tau);
+            if (d + tau >= current.threshold) {
+                searchAlive(current.outside, item, best, tau);
+            }
+        } else {
+            searchAlive(current.outside, item, best, tau);
+            if (d - tau <= current.threshold) {
+                searchAlive(current.inside, item, best, tau);
+            }
+        }
+    }
+
+    const QVector<Embedding> &embeddings;
+    QVector<Node> nodes;
+    QVector<int> itemNodes;
+    QVector<bool> removed;
+};
+
+class ChunkWorker : public QRunnable {
+public:
+    ChunkWorker(std::atomic<int> *next, std::atomic<int> *done, int count, const std::function<void(int)> &work)
+        : next(next), done(done), count(count), work(work) {}
+
+    void run() override {
+        forever {
+            const int first = next->fetch_add(PARALLEL_CHUNK_SIZE);
+            if (first >= count) {
+                return;
+            }
+            const int last = qMin(first + PARALLEL_CHUNK_SIZE, count);
+            for (int i = first; i < last; ++i) {
+                work(i);
+            }
+            done->fetch_add(last - first);
+        }
+    }
+
+private:
+    std::atomic<int> *next;
+    std::atomic<int> *done;
+    int count;
+    const std::function<void(int)> &work;
+};
+
+} // namespace
+
+bool SimilarityOrder::forEachInParallel(int count, const std::function<void(int)> &work, Stage stage,
+                                        const Progress &progress) {
+    std::atomic<int> next{0};
+    std::atomic<int> done{0};
+    QThreadPool threadPool;
+    for (int i = 0; i < threadPool.maxThreadCount(); ++i) {
+        threadPool.start(new ChunkWorker(&next, &done, count, work));
+    }
+
+    bool cancelled = false;
+    while (!threadPool.waitForDone(PROGRESS_INTERVAL_MS)) {
+        if (!cancelled && !progress(stage, done, count)) {
+            // Let the workers run dry, then report the cancellation
+            cancelled = true;
+            next = count;
+        }
+    }
+    return !cancelled;
+}
+
+namespace {
+
+// featureAt(i) returns anything embed() takes that has a compare() for the exact distance
+template <typename FeatureAt>
+QVector<int> chainFeatures(int count, FeatureAt featureAt, const SimilarityOrder::Progress &progress) {
+    using namespace SimilarityOrder;
+    if (count < 3) {
+        QVector<int> order(count);
+        std::iota(order.begin(), order.end(), 0);
+        return order;
+    }
+
+    if (!progress(BuildingIndex, 0, count)) {
+        return QVector<int>();
+    }
+    QVector<Embedding> embeddings(count);
+    for (int i = 0; i < count; ++i) {
+        embeddings[i] = embed(featureAt(i));
+    }
+    VantagePointTree tree(embeddings);
+
+    // Candidates come from the coarse embedding, the exact distance picks the best of them
+    QVector<QVector<int>> neighbours(count);
+    QVector<int> *neighbourLists = neighbours.data();
+    const bool completed = forEachInParallel(count, [&](int item) {
+        QVector<std::pair<float, int>> candidates;
+        for (int candidate : tree.nearest(item, NEIGHBOUR_CANDIDATES)) {
+            candidates.append({featureAt(item).compare(featureAt(candidate)), candidate});
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        QVector<int> &itemNeighbours = neighbourLists[item];
+        for (int i = 0; i < qMin(NEIGHBOURS, candidates.size()); ++i) {
+            itemNeighbours.append(candidates.at(i).second);
+        }
+    }, FindingNeighbours, progress);
+    if (!completed) {
+        return QVector<int>();
+    }
+
+    QVector<int> order;
+    order.reserve(count);
+    QVector<bool> visited(count, false);
+    int current = 0;
+    QElapsedTimer progressTimer;
+    progressTimer.start();
+    forever {
+        order.append(current);
+        visited[current] = true;
+        tree.remove(current);
+        if (order.size() == count) {
+            break;
+        }
+
+        int next = -1;
+        for (int neighbour : neighbours.at(current)) {
+            if (!visited.at(neighbour)) {
+                next = neighbour;
+                break;
+            }
+        }
+        if (next < 0) {
+            next = tree.nearestAlive(current);
+        }
+        current = next;
+
+        if (progressTimer.elapsed() > PROGRESS_INTERVAL_MS) {
+            progressTimer.restart();
+            if (!progress(Chaining, order.size(), count)) {
+                return QVector<int>();
+            }
+        }
+    }
+
+    return order;
+}
+
+} // namespace
+
+QVector<int> SimilarityOrder::chain(const QVector<const Histogram *> &histograms, const Progress &progress) {
+    return chainFeatures(histograms.size(), [&histograms](int i) -> const Histogram & {
+        return *histograms.at(i);
+    }, progress);
+}
+
+QVector<int> SimilarityOrder::chain(const QVector<ColorDescriptor> &descriptors, const Progress &progress) {
+    return chainFeatures(descriptors.size(), [&descriptors](int i) -> const ColorDescriptor & {
+        return descriptors.at(i);
+    }, progress);
+}
@@ -0,0 +1,54 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIMILARITY_ORDER_H
+#define SIMILARITY_ORDER_H
+
+#include <QtCore>
+#include <functional>
+#include "Histogram.h"
+
+// Orders images so that similar ones end up next to each other, without
+// comparing every pair. Histograms are projected to a coarse embedding and
+// indexed in a vantage point tree; a k nearest neighbour graph is built from
+// it in parallel, reranked with the exact histogram distance, and the chain
+// walks through that graph. The tree is only searched again when all
+// neighbours of the current image have been used.
+namespace SimilarityOrder {
+
+    enum Stage {
+        ComputingHistograms,
+        BuildingIndex,
+        FindingNeighbours,
+        Chaining
+    };
+
+    // Called on the calling thread; returning false cancels
+    typedef std::function<bool(Stage stage, int done, int total)> Progress;
+
+    // Returns indexes into histograms in chain order, or an empty list if cancelled
+    QVector<int> chain(const QVector<const Histogram *> &histograms, const Progress &progress);
+
+    // The same for compact descriptors, kept in one block so the distances stream through the cache
+    QVector<int> chain(const QVector<ColorDescriptor> &descriptors, const Progress &progress);
+
+    // Runs work(0 .. count - 1) on a thread pool, reporting progress while waiting
+    bool forEachInParallel(int count, const std::function<void(int)> &work, Stage stage, const Progress &progress);
+}
+
+#endif // SIMILARITY_ORDER_H
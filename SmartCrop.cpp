@@ -2,6 +2,15 @@
 #include <QDebug>
 #include <QtMath>
 #include <QElapsedTimer>
+#include <QThreadPool>
+#include <QSemaphore>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#define SMART_CROP_CROPS_PER_BLOCK 16
+// Multiply-adds of importance and weight below which the calling thread scores all crops itself
+#define SMART_CROP_PARALLEL_WORK (1 << 18)
 
 namespace SmartCrop {
 
@@ -9,152 +18,153 @@ static inline qreal cie(qreal r, qreal g, qreal b) {
     return 0.5126 * b + 0.7152 * g + 0.0722 * r;
 }
 
-static inline qreal sample(const uchar *id, int p) {
-    return cie(id[p], id[p + 1], id[p + 2]);
-}
-
-static void edgeDetect(const QImage &i, QImage &o) {
-    const int bpl = i.bytesPerLine();//: width();
-    const uchar *id = i.scanLine(0);
-    const int h = i.height();
-
-    for (int y = 0; y < h; y++) {
-        uchar *od = o.scanLine(y);
-        for (int x = 0; x < i.width(); x++) {
-            int p = y * bpl + x * 4;
-            qreal lightness;
-
-            if (x == 0 || x >= i.width() - 1 || y == 0 || y >= h - 1) {
-                lightness = sample(id, p);
-            } else {
-                lightness = sample(id, p) * 4. -
-                        sample(id, p - bpl) -
-                        sample(id, p - 4) -
-                        sample(id, p + 4) -
-                        sample(id, p + bpl);
-            }
+// Feature values per cell of the score grid, folded into the one weight score() needs
+struct ScoreGrid {
+    int width = 0;
+    int height = 0;
+    int cellSize = 1;
+    QVector<float> weights;
+    // Summed area table of the weights, (width + 1) * (height + 1) with a zero first row and column
+    QVector<double> integral;
+
+    double sum(int left, int top, int right, int bottom) const {
+        const int stride = width + 1;
+        return integral[bottom * stride + right] - integral[top * stride + right]
+               - integral[bottom * stride + left] + integral[top * stride + left];
+    }
+};
 
-            od[x * 4 + 1] = qMax<int>(lightness, 0);
-        }
+static inline void lightnessRow(const QImage &image, int y, float *row) {
+    const uchar *id = image.constScanLine(y);
+    for (int x = 0; x < image.width(); x++) {
+        row[x] = float(cie(id[x * 4], id[x * 4 + 1], id[x * 4 + 2]));
     }
 }
 
-static qreal skinColor(const CropOptions &options, qreal r,qreal g, qreal b) {
-    qreal mag = sqrt(r * r + g * g + b * b);
-    if (Q_UNLIKELY(mag == 0.)) {
-        return 0.;
+// Edge, skin and saturation detection and the down sampling for the score in one pass
+// over the rows, with each pixel's lightness computed once. Values are rounded to bytes
+// where the separate passes stored them in images, to pick the same crops.
+static void detectFeatures(const CropOptions &options, const QImage &image, ScoreGrid &grid) {
+    const int ds = grid.cellSize;
+    const int w = image.width();
+    const int h = image.height();
+    grid.width = w / ds;
+    grid.height = h / ds;
+    grid.weights.fill(0, grid.width * grid.height);
+
+    const float skinColor[3] = {float(options.skinColor[0]), float(options.skinColor[1]),
+                                float(options.skinColor[2])};
+    const float skinColorLength2 = skinColor[0] * skinColor[0] + skinColor[1] * skinColor[1]
+                                   + skinColor[2] * skinColor[2];
+    const float skinDistanceMax = float(1 - options.skinThreshold);
+    const float skinScale = float(255. / (1. - options.skinThreshold));
+    const float saturationScale = float(255. / (1. - options.saturationThreshold));
+    const float skinBrightnessMin = float(options.skinBrightnessMin * 255);
+    const float skinBrightnessMax = float(options.skinBrightnessMax * 255);
+    const float saturationBrightnessMin = float(options.saturationBrightnessMin * 255);
+    const float saturationBrightnessMax = float(options.saturationBrightnessMax * 255);
+
+    // Lightness of the rows above, at and below the current one
+    QVector<float> lightness(w * 3);
+    float *rows[3] = {lightness.data(), lightness.data() + w, lightness.data() + 2 * w};
+    lightnessRow(image, 0, rows[1]);
+    if (h > 1) {
+        lightnessRow(image, 1, rows[2]);
     }
-    qreal rd = r / mag - options.skinColor[0];
-    qreal gd = g / mag - options.skinColor[1];
-    qreal bd = b / mag - options.skinColor[2];
-    qreal d = sqrt(rd * rd + gd * gd + bd * bd);
-    return 1 - d;
-}
 
-static void skinDetect(const CropOptions &options, const QImage &i, QImage &o) {
-    int w = i.width();
-    int h = i.height();
-
-    for (int y = 0; y < h; y++) {
-        uchar *od = o.scanLine(y);
-        const uchar *id = i.scanLine(y) ;
-        for (int x = 0; x < w; x++) {
-            int p = x * 4;
-            qreal lightness = cie(id[p], id[p + 1], id[p + 2]) / 255.;
-            qreal skin = skinColor(options, id[p], id[p + 1], id[p + 2]);
-            bool isSkinColor = skin > options.skinThreshold;
-            bool isSkinBrightness =
-                    lightness >= options.skinBrightnessMin &&
-                    lightness <= options.skinBrightnessMax;
-            if (isSkinColor && isSkinBrightness) {
-                od[p] =
-                        (skin - options.skinThreshold) *
-                        (255. / (1. - options.skinThreshold));
-            } else {
-                od[p] = 0;
+    QVector<int> cells(grid.width * 6);
+    int *sumSkin = cells.data();
+    int *maxSkin = sumSkin + grid.width;
+    int *sumEdge = maxSkin + grid.width;
+    int *maxEdge = sumEdge + grid.width;
+    int *sumSaturation = maxEdge + grid.width;
+    int *sumAlpha = sumSaturation + grid.width;
+    const float cellArea = float(ds * ds);
+
+    for (int y = 0; y < grid.height * ds; y++) {
+        if (y > 0) {
+            std::rotate(rows, rows + 1, rows + 3);
+            if (y + 1 < h) {
+                lightnessRow(image, y + 1, rows[2]);
             }
         }
-    }
-}
-static qreal saturation(qreal r, qreal g, qreal b) {
-    qreal maximum = qMax(r / 255., qMax(g / 255., b / 255.));
-    qreal minimum = qMin(r / 255., qMin(g / 255., b / 255.));
+        const float *above = rows[0];
+        const float *current = rows[1];
+        const float *below = rows[2];
+        const uchar *id = image.constScanLine(y);
+        const bool isBorderRow = y == 0 || y >= h - 1;
+
+        for (int x = 0; x < grid.width * ds; x++) {
+            const int r = id[x * 4];
+            const int g = id[x * 4 + 1];
+            const int b = id[x * 4 + 2];
+            const float l = current[x];
+
+            float edge = l;
+            if (!isBorderRow && x > 0 && x < w - 1) {
+                edge = l * 4 - above[x] - current[x - 1] - current[x + 1] - below[x];
+            }
+            const int edgeValue = qBound(0, int(edge), 255);
+
+            // |rgb / |rgb| - skinColor|^2 without the square roots, those are only taken for skin
+            int skinValue = 0;
+            const int magnitude2 = r * r + g * g + b * b;
+            if (l >= skinBrightnessMin && l <= skinBrightnessMax && magnitude2) {
+                const float dot = (r * skinColor[0] + g * skinColor[1] + b * skinColor[2])
+                                  / std::sqrt(float(magnitude2));
+                const float distance2 = qMax(0.f, 1 + skinColorLength2 - 2 * dot);
+                if (distance2 < skinDistanceMax * skinDistanceMax) {
+                    skinValue = int((skinDistanceMax - std::sqrt(distance2)) * skinScale);
+                }
+            }
 
-    if (qFuzzyCompare(maximum, minimum)) {
-        return 0;
-    }
+            int saturationValue = 0;
+            const int maximum = qMax(r, qMax(g, b));
+            const int minimum = qMin(r, qMin(g, b));
+            if (maximum != minimum && l >= saturationBrightnessMin && l <= saturationBrightnessMax) {
+                const int sum = maximum + minimum;
+                const float sat = float(maximum - minimum) / (sum > 255 ? 510 - sum : sum);
+                if (sat > options.saturationThreshold) {
+                    saturationValue = int((sat - float(options.saturationThreshold)) * saturationScale);
+                }
+            }
 
-    qreal l = (maximum + minimum) / 2.;
-    qreal d = maximum - minimum;
+            const int cell = x / ds;
+            sumSkin[cell] += skinValue;
+            maxSkin[cell] = qMax(maxSkin[cell], skinValue);
+            sumEdge[cell] += edgeValue;
+            maxEdge[cell] = qMax(maxEdge[cell], edgeValue);
+            sumSaturation[cell] += saturationValue;
+            sumAlpha[cell] += id[x * 4 + 3];
+        }
 
-    return l > 0.5 ? d / (2. - maximum - minimum) : d / (maximum + minimum);
-}
-static void saturationDetect(const CropOptions &options, const QImage &i, QImage &o) {
-    int w = i.width();
-    int h = i.height();
-    for (int y = 0; y < h; y++) {
-        uchar *od = o.scanLine(y);
-        const uchar *id = i.scanLine(y);
-        for (int x = 0; x < w; x++) {
-            int p = x * 4;
-
-            qreal lightness = cie(id[p], id[p + 1], id[p + 2]) / 255.;
-            qreal sat = saturation(id[p], id[p + 1], id[p + 2]);
-
-            bool acceptableSaturation = sat > options.saturationThreshold;
-            bool acceptableLightness =
-                    lightness >= options.saturationBrightnessMin &&
-                    lightness <= options.saturationBrightnessMax;
-            if (acceptableLightness && acceptableSaturation) {
-                od[p + 2] =
-                        (sat - options.saturationThreshold) *
-                        (255. / (1 - options.saturationThreshold));
-            } else {
-                od[p + 2] = 0;
-            }
+        if (y % ds != ds - 1) {
+            continue;
         }
+        // Skin (r) and detail (g) keep some of their peaks, saturation (b) does not get this boost
+        float *weights = grid.weights.data() + (y / ds) * grid.width;
+        for (int cell = 0; cell < grid.width; cell++) {
+            const float skin = int(sumSkin[cell] / cellArea * 0.5f + maxSkin[cell] * 0.5f) / 255.f;
+            const float detail = int(sumEdge[cell] / cellArea * 0.7f + maxEdge[cell] * 0.3f) / 255.f;
+            const float saturation = int(sumSaturation[cell] / cellArea) / 255.f;
+            const float boost = int(sumAlpha[cell] / cellArea) / 255.f;
+            weights[cell] = float(detail * options.detailWeight
+                                  + skin * (detail + options.skinBias) * options.skinWeight
+                                  + saturation * (detail + options.saturationBias) * options.saturationWeight
+                                  + boost * options.boostWeight);
+        }
+        cells.fill(0);
     }
-}
 
-static QImage downSample(QImage &input, qreal factor) {
-    int width = qFloor(input.width() / factor);
-    int height = qFloor(input.height() / factor);
-    QImage output(width, height, QImage::Format_RGBA8888);
-    qreal ifactor2 = 1. / (factor * factor);
-    for (int y = 0; y < height; y++) {
-        uchar *data = output.scanLine(y);
-        for (int x = 0; x < width; x++) {
-            int i = x * 4;
-
-            qreal r = 0;
-            qreal g = 0;
-            qreal b = 0;
-            qreal a = 0;
-
-            qreal mr = 0;
-            qreal mg = 0;
-
-            for (int v = 0; v < factor; v++) {
-                uchar *idata = input.scanLine(y * factor + v);
-                for (int u = 0; u < factor; u++) {
-                    int j = (x * factor + u) * 4;
-                    r += idata[j];
-                    g += idata[j + 1];
-                    b += idata[j + 2];
-                    a += idata[j + 3];
-                    mr = qMax(mr, qreal(idata[j]));
-                    mg = qMax(mg, qreal(idata[j + 1]));
-                }
-            }
-            // this is some funky magic to preserve detail a bit more for
-            // skin (r) and detail (g). Saturation (b) does not get this boost.
-            data[i] = r * ifactor2 * 0.5 + mr * 0.5;
-            data[i + 1] = g * ifactor2 * 0.7 + mg * 0.3;
-            data[i + 2] = b * ifactor2;
-            data[i + 3] = a * ifactor2;
+    const int stride = grid.width + 1;
+    grid.integral.fill(0, stride * (grid.height + 1));
+    for (int y = 0; y < grid.height; y++) {
+        double rowSum = 0;
+        for (int x = 0; x < grid.width; x++) {
+            rowSum += grid.weights[y * grid.width + x];
+            grid.integral[(y + 1) * stride + x + 1] = grid.integral[y * stride + x + 1] + rowSum;
         }
     }
-    return output;
 }
 
 struct ScoreResult {
@@ -209,38 +219,143 @@ static QList<QRectF> generateCrops(const CropOptions &options, qreal width, qrea
     return results;
 }
 
-static float score(const CropOptions &options, const QImage &output, const QRectF &crop) {
-    qreal detail = 0;
-    qreal saturation = 0;
-    qreal skin = 0;
-    qreal boost = 0;
-
-    qreal downSample = options.scoreDownSample;
-    qreal invDownSample = 1. / downSample;
-    qreal outputHeightDownSample = output.height() * downSample;
-    qreal outputWidthDownSample = output.width() * downSample;
-
-    for (int y = 0; y < outputHeightDownSample; y += downSample) {
-        const uchar *od = output.scanLine(qFloor(y * invDownSample));
-        for (int x = 0; x < outputWidthDownSample; x += downSample) {
-            int p = (qFloor(x * invDownSample)) * 4;
-            qreal i = importance(options, crop, x, y);
-            qreal dtl = od[p + 1] / 255.;
-
-            skin += (od[p] / 255.) * (dtl + options.skinBias) * i;
-            detail += dtl * i;
-            saturation +=
-                    (od[p + 2] / 255) * (dtl + options.saturationBias) * i;
-            boost += (od[p + 3] / 255.) * i;
+// Importance of the grid cells inside a crop, which only depends on where the crop
+// starts within a cell and on its size, so crops of one scale share it
+struct ImportanceKernel {
+    qreal offsetX;
+    qreal offsetY;
+    qreal width;
+    qreal height;
+    int columns;
+    int rows;
+    QVector<float> values;
+};
+
+struct CropCells {
+    int left;
+    int top;
+    int right;
+    int bottom;
+    int kernel;
+};
+
+static CropCells cropCells(const ScoreGrid &grid, const QRectF &crop) {
+    const int ds = grid.cellSize;
+    CropCells cells;
+    cells.left = qMin(grid.width, qCeil(crop.x() / ds));
+    cells.top = qMin(grid.height, qCeil(crop.y() / ds));
+    cells.right = qMin(grid.width, qCeil((crop.x() + crop.width()) / ds));
+    cells.bottom = qMin(grid.height, qCeil((crop.y() + crop.height()) / ds));
+    cells.kernel = -1;
+    return cells;
+}
+
+static int findKernel(const CropOptions &options, const ScoreGrid &grid, const QRectF &crop,
+                      const CropCells &cells, QVector<ImportanceKernel> &kernels) {
+    const qreal offsetX = cells.left * grid.cellSize - crop.x();
+    const qreal offsetY = cells.top * grid.cellSize - crop.y();
+    const int columns = cells.right - cells.left;
+    const int rows = cells.bottom - cells.top;
+    for (int i = 0; i < kernels.size(); i++) {
+        const ImportanceKernel &kernel = kernels.at(i);
+        if (kernel.columns == columns && kernel.rows == rows && qFuzzyCompare(kernel.width, crop.width())
+            && qFuzzyCompare(kernel.height, crop.height()) && qFuzzyCompare(kernel.offsetX + 1, offsetX + 1)
+            && qFuzzyCompare(kernel.offsetY + 1, offsetY + 1)) {
+            return i;
+        }
+    }
+
+    ImportanceKernel kernel = {offsetX, offsetY, crop.width(), crop.height(), columns, rows, QVector<float>()};
+    kernel.values.resize(columns * rows);
+    const QRectF origin(0, 0, crop.width(), crop.height());
+    for (int v = 0; v < rows; v++) {
+        for (int u = 0; u < columns; u++) {
+            kernel.values[v * columns + u] = float(importance(options, origin, offsetX + u * grid.cellSize,
+                                                              offsetY + v * grid.cellSize));
+        }
+    }
+    kernels.append(kernel);
+    return kernels.size() - 1;
+}
+
+// Cells outside the crop all have the same importance, their sum comes from the summed area table
+static float score(const CropOptions &options, const ScoreGrid &grid, const ImportanceKernel &kernel,
+                   const QRectF &crop, const CropCells &cells) {
+    const double inside = grid.sum(cells.left, cells.top, cells.right, cells.bottom);
+    const double outside = grid.sum(0, 0, grid.width, grid.height) - inside;
+
+    double weighted = 0;
+    for (int v = 0; v < kernel.rows; v++) {
+        const float *weights = grid.weights.constData() + (cells.top + v) * grid.width + cells.left;
+        const float *importances = kernel.values.constData() + v * kernel.columns;
+        float rowSum = 0;
+        for (int u = 0; u < kernel.columns; u++) {
+            rowSum += weights[u] * importances[u];
         }
+        weighted += rowSum;
     }
 
-    return
-            (detail * options.detailWeight +
-             skin * options.skinWeight +
-             saturation * options.saturationWeight +
-             boost * options.boostWeight) /
-            (crop.width() * crop.height());
+    return float((weighted + outside * options.outsideImportance) / (crop.width() * crop.height()));
+}
+
+struct ScoreJob {
+    ScoreJob(const CropOptions &options, const ScoreGrid &grid, const QList<QRectF> &crops,
+             const QVector<CropCells> &cells, const QVector<ImportanceKernel> &kernels, QVector<float> &scores)
+        : options(options), grid(grid), crops(crops), cells(cells), kernels(kernels), scores(scores) {}
+
+    const CropOptions &options;
+    const ScoreGrid &grid;
+    const QList<QRectF> &crops;
+    const QVector<CropCells> &cells;
+    const QVector<ImportanceKernel> &kernels;
+    QVector<float> &scores;
+    std::atomic<int> nextCrop{0};
+
+    void scoreCrops() {
+        forever {
+            const int first = nextCrop.fetch_add(SMART_CROP_CROPS_PER_BLOCK);
+            if (first >= crops.size()) {
+                return;
+            }
+            const int last = qMin(first + SMART_CROP_CROPS_PER_BLOCK, crops.size());
+            for (int i = first; i < last; i++) {
+                scores[i] = score(options, grid, kernels.at(cells.at(i).kernel), crops.at(i), cells.at(i));
+            }
+        }
+    }
+};
+
+class ScoreWorker : public QRunnable {
+public:
+    ScoreWorker(ScoreJob &job, QSemaphore &done) : job(job), done(done) {}
+
+    void run() override {
+        job.scoreCrops();
+        done.release();
+    }
+
+private:
+    ScoreJob &job;
+    QSemaphore &done;
+};
+
+// The work per crop is no more than the cells it covers, only many crops are worth other threads
+static void scoreCrops(ScoreJob &job) {
+    qint64 work = 0;
+    for (const CropCells &cells : job.cells) {
+        work += qint64(cells.right - cells.left) * (cells.bottom - cells.top);
+    }
+
+    // A pool of its own like the colour engine, thumbnail workers calling in must not wait behind each other
+    static QThreadPool threadPool;
+    QSemaphore done;
+    const int blocks = (job.crops.size() + SMART_CROP_CROPS_PER_BLOCK - 1) / SMART_CROP_CROPS_PER_BLOCK;
+    const int workers = work < SMART_CROP_PARALLEL_WORK ? 0 : qMax(0, qMin(QThread::idealThreadCount(), blocks) - 1);
+    for (int i = 0; i < workers; i++) {
+        threadPool.start(new ScoreWorker(job, done));
+    }
+    job.scoreCrops();
+    done.acquire(workers);
 }
 
 QRect smartCropRect(const QImage &input, CropOptions options)
@@ -288,26 +403,30 @@ QRect smartCropRect(const QImage &input, CropOptions options)
     }
     image = image.convertToFormat(QImage::Format_RGBA8888);
 
-    QImage filtered = image.copy();
-    if (filtered.isNull()) {
-        qWarning() << "Failed to copy image!";
-        return input.rect();
-    }
+    ScoreGrid grid;
+    grid.cellSize = qMax(1, qRound(options.scoreDownSample));
+    detectFeatures(options, image, grid);
 
-    edgeDetect(image, filtered);
-    skinDetect(options, image, filtered);
-    saturationDetect(options, image, filtered);
-    QImage toScore = downSample(filtered, options.scoreDownSample);
+    const QList<QRectF> crops = generateCrops(options, image.width(), image.height());
+    QVector<CropCells> cells;
+    QVector<ImportanceKernel> kernels;
+    cells.reserve(crops.size());
+    for (const QRectF &crop : crops) {
+        CropCells cropCell = cropCells(grid, crop);
+        cropCell.kernel = findKernel(options, grid, crop, cropCell, kernels);
+        cells.append(cropCell);
+    }
 
-    QList<QRectF> crops = generateCrops(options, image.width(), image.height());
+    QVector<float> scores(crops.size());
+    ScoreJob job(options, grid, crops, cells, kernels, scores);
+    scoreCrops(job);
 
     QRectF topCrop;
     qreal topScore = -1;
-    for (const QRectF &crop : crops) {
-        float scr = score(options, toScore, crop);
-        if (scr > topScore || topCrop.isEmpty()) {
-            topCrop = crop;
-            topScore = scr;
+    for (int i = 0; i < crops.size(); i++) {
+        if (scores.at(i) > topScore || topCrop.isEmpty()) {
+            topCrop = crops.at(i);
+            topScore = scores.at(i);
         }
     }
 
@@ -0,0 +1,59 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "StartupTimer.h"
+
+Q_LOGGING_CATEGORY(startupTiming, "phototonic.startup", QtWarningMsg)
+
+namespace {
+    struct StartupClock {
+        StartupClock() {
+            timer.start();
+        }
+
+        QElapsedTimer timer;
+        qint64 lastMark = 0;
+        bool isFinished = false;
+    };
+
+    StartupClock &startupClock() {
+        static StartupClock clock;
+        return clock;
+    }
+
+    // Starts the clock while static objects are constructed, before main() runs
+    const StartupClock &processStart = startupClock();
+}
+
+namespace StartupTimer {
+    void mark(const char *stage) {
+        StartupClock &clock = startupClock();
+        if (clock.isFinished) {
+            return;
+        }
+        const qint64 now = clock.timer.elapsed();
+        qCInfo(startupTiming, "%-24s %6lld ms  (+%lld ms)", stage, now, now - clock.lastMark);
+        clock.lastMark = now;
+    }
+
+    void finish(const char *stage) {
+        mark(stage);
+        startupClock().isFinished = true;
+    }
+}
@@ -0,0 +1,37 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef STARTUP_TIMER_H
+#define STARTUP_TIMER_H
+
+#include <QtCore>
+
+Q_DECLARE_LOGGING_CATEGORY(startupTiming)
+
+// Time since the process started, logged per startup stage under the
+// phototonic.startup category, which is off by default. Enable it with
+// QT_LOGGING_RULES="phototonic.startup.info=true".
+namespace StartupTimer {
+    void mark(const char *stage);
+
+    // Logs the last stage; later marks are ignored
+    void finish(const char *stage);
+}
+
+#endif // STARTUP_TIMER_H
@@ -0,0 +1,149 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "SubdirectoryProbe.h"
+
+#define MAX_PROBE_THREADS 4
+#define MAX_PROBED_DIRECTORIES 2048
+
+class SubdirectoryProbe::Worker : public QRunnable {
+public:
+    explicit Worker(SubdirectoryProbe *probe) : probe(probe) {}
+
+    void run() override {
+        probe->processQueue();
+    }
+
+private:
+    SubdirectoryProbe *probe;
+};
+
+SubdirectoryProbe *SubdirectoryProbe::instance() {
+    // Owned by the application so it is gone before its watcher's backend
+    static SubdirectoryProbe *probe = new SubdirectoryProbe(QCoreApplication::instance());
+    return probe;
+}
+
+SubdirectoryProbe::SubdirectoryProbe(QObject *parent) : QObject(parent) {
+    // Several threads, so one unresponsive mount does not hold up the others
+    threadPool.setMaxThreadCount(MAX_PROBE_THREADS);
+
+    watcher = new QFileSystemWatcher(this);
+    connect(watcher, &QFileSystemWatcher::directoryChanged, this, &SubdirectoryProbe::invalidate);
+    connect(this, &SubdirectoryProbe::probed, this, &SubdirectoryProbe::watch);
+}
+
+SubdirectoryProbe::~SubdirectoryProbe() {
+    {
+        QMutexLocker locker(&mutex);
+        isShutDown = true;
+        queue.clear();
+    }
+    threadPool.waitForDone();
+}
+
+SubdirectoryProbe::State SubdirectoryProbe::state(const QString &path, bool includeHidden) {
+    QMutexLocker locker(&mutex);
+    QHash<QString, Entry>::const_iterator it = entries.constFind(path);
+    if (it != entries.constEnd()) {
+        const bool hasSubdirectories = it->hasVisible || (includeHidden && it->hasHidden);
+        return hasSubdirectories ? HasSubdirectories : NoSubdirectories;
+    }
+
+    if (!queuedPaths.contains(path)) {
+        queuedPaths.insert(path);
+        // Newest first, the view asks for what it is showing right now last
+        queue.prepend(path);
+        if (activeWorkers < threadPool.maxThreadCount()) {
+            ++activeWorkers;
+            threadPool.start(new Worker(this));
+        }
+    }
+    return Unknown;
+}
+
+void SubdirectoryProbe::invalidate(const QString &path) {
+    {
+        QMutexLocker locker(&mutex);
+        if (!entries.remove(path)) {
+            return;
+        }
+    }
+    if (watchedPaths.remove(path)) {
+        watcher->removePath(path);
+    }
+    emit probed(path);
+}
+
+void SubdirectoryProbe::watch(const QString &path) {
+    {
+        QMutexLocker locker(&mutex);
+        if (!entries.contains(path)) {
+            return;
+        }
+        if (entries.size() > MAX_PROBED_DIRECTORIES) {
+            // Everything is probed again on demand, it is cheaper than tracking what was used last
+            entries.clear();
+            locker.unlock();
+            if (!watchedPaths.isEmpty()) {
+                watcher->removePaths(watchedPaths.values());
+                watchedPaths.clear();
+            }
+            return;
+        }
+    }
+
+    if (!watchedPaths.contains(path) && watcher->addPath(path)) {
+        watchedPaths.insert(path);
+    }
+}
+
+void SubdirectoryProbe::processQueue() {
+    forever {
+        QString path;
+        {
+            QMutexLocker locker(&mutex);
+            if (queue.isEmpty() || isShutDown) {
+                --activeWorkers;
+                return;
+            }
+            path = queue.takeFirst();
+        }
+
+        // Stops at the first visible subdirectory, hidden ones are only remembered in passing
+        Entry entry;
+        QDirIterator it(path, QDir::AllDirs | QDir::NoDotAndDotDot | QDir::Hidden);
+        while (it.hasNext()) {
+            it.next();
+            if (it.fileName().startsWith(QLatin1Char('.'))) {
+                entry.hasHidden = true;
+            } else {
+                entry.hasVisible = true;
+                break;
+            }
+        }
+
+        {
+            QMutexLocker locker(&mutex);
+            queuedPaths.remove(path);
+            entries.insert(path, entry);
+        }
+        emit probed(path);
+    }
+}
@@ -0,0 +1,77 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SUBDIRECTORY_PROBE_H
+#define SUBDIRECTORY_PROBE_H
+
+#include <QtCore>
+
+// Remembers which directories have subdirectories, so views can draw expand
+// arrows without listing anything on the GUI thread. Unknown directories are
+// listed in the background and watched until they change.
+class SubdirectoryProbe : public QObject {
+Q_OBJECT
+
+public:
+    enum State {
+        Unknown,
+        HasSubdirectories,
+        NoSubdirectories
+    };
+
+    static SubdirectoryProbe *instance();
+
+    ~SubdirectoryProbe() override;
+
+    // Never blocks; directories that are not known yet are queued and reported through probed()
+    State state(const QString &path, bool includeHidden);
+
+    void invalidate(const QString &path);
+
+signals:
+
+    void probed(const QString &path);
+
+private:
+    struct Entry {
+        bool hasVisible = false;
+        bool hasHidden = false;
+    };
+
+    class Worker;
+
+    explicit SubdirectoryProbe(QObject *parent);
+
+    void processQueue();
+
+    void watch(const QString &path);
+
+    QThreadPool threadPool;
+    QMutex mutex;
+    QHash<QString, Entry> entries;
+    QSet<QString> queuedPaths;
+    QList<QString> queue;
+    int activeWorkers = 0;
+    bool isShutDown = false;
+    QFileSystemWatcher *watcher;
+    // Only touched on the GUI thread
+    QSet<QString> watchedPaths;
+};
+
+#endif // SUBDIRECTORY_PROBE_H
@@ -0,0 +1,241 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <exiv2/exiv2.hpp>
+#include "TagWriter.h"
+#include "Exiv2Init.h"
+#include "PerfCounters.h"
+
+// Writing is mostly disk bound, more threads only seek around
+#define TAG_WRITER_THREADS 4
+
+class TagWriter::Worker : public QRunnable {
+public:
+    explicit Worker(TagWriter *writer) : writer(writer) {}
+
+    void run() override {
+        writer->processQueue();
+    }
+
+private:
+    TagWriter *writer;
+};
+
+TagWriter::TagWriter(const std::shared_ptr<MetadataCache> &metadataCache, QObject *parent)
+    : QObject(parent), metadataCache(metadataCache) {
+    Exiv2Init::ensure();
+    threadPool.setMaxThreadCount(qMin(TAG_WRITER_THREADS, QThread::idealThreadCount()));
+}
+
+TagWriter::~TagWriter() {
+    // Pending edits are only in the cache, they must reach the files before quitting.
+    // ImageTags::waitForPendingWrites() shows progress for this when the window closes.
+    threadPool.waitForDone();
+}
+
+void TagWriter::enqueue(const QStringList &imageFileNames) {
+    QMutexLocker locker(&mutex);
+    for (const QString &imageFileName : imageFileNames) {
+        if (!queuedImages.contains(imageFileName)) {
+            queuedImages.insert(imageFileName);
+            queue.append(imageFileName);
+        }
+    }
+    Perf::setGauge(Perf::TagWriterQueue, queue.size());
+
+    while (activeWorkers < threadPool.maxThreadCount() && activeWorkers < queue.size()) {
+        ++activeWorkers;
+        threadPool.start(new Worker(this));
+    }
+}
+
+int TagWriter::pendingCount() const {
+    QMutexLocker locker(&mutex);
+    return queue.size() + writingImages.size();
+}
+
+void TagWriter::processQueue() {
+    forever {
+        QString imageFileName;
+        {
+            QMutexLocker locker(&mutex);
+            // A file being written by another worker waits, that one picks it up again when done
+            for (int i = 0; i < queue.size(); ++i) {
+                if (!writingImages.contains(queue.at(i))) {
+                    imageFileName = queue.takeAt(i);
+                    Perf::setGauge(Perf::TagWriterQueue, queue.size());
+                    break;
+                }
+            }
+
+            if (imageFileName.isEmpty()) {
+                --activeWorkers;
+                if (activeWorkers > 0 || !queue.isEmpty()) {
+                    return;
+                }
+                QStringList failed;
+                failed.swap(failedImages);
+                locker.unlock();
+                emit finished(failed);
+                return;
+            }
+            queuedImages.remove(imageFileName);
+            writingImages.insert(imageFileName);
+        }
+
+        // Only the tags the cache holds end up in the file, those read from it must be among them
+        metadataCache->loadImageMetadata(imageFileName);
+        bool isWritten;
+        {
+            Perf::ScopedTimer timer(Perf::TagWrite);
+            isWritten = writeTagsToImage(imageFileName, metadataCache->getImageTags(imageFileName),
+                                         metadataCache->sidecarsEnabled());
+        }
+        if (isWritten) {
+            metadataCache->imageTagsWritten(imageFileName);
+        } else {
+            // Go back to what is in the file
+            metadataCache->removeImage(imageFileName);
+            metadataCache->loadImageMetadata(imageFileName);
+            QMutexLocker locker(&mutex);
+            failedImages.append(imageFileName);
+        }
+
+        QMutexLocker locker(&mutex);
+        writingImages.remove(imageFileName);
+    }
+}
+
+bool TagWriter::writeTagsToSidecar(const QString &imageFileName, const QSet<QString> &newTags) {
+    const QString sidecarFullPath = MetadataCache::sidecarPath(imageFileName);
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#if EXIV2_TEST_VERSION(0,28,0)
+    Exiv2::Image::UniquePtr sidecar;
+#else
+    Exiv2::Image::AutoPtr sidecar;
+#endif
+#pragma clang diagnostic pop
+
+    try {
+        if (QFile::exists(sidecarFullPath)) {
+            sidecar = Exiv2::ImageFactory::open(sidecarFullPath.toStdString());
+            sidecar->readMetadata();
+        } else {
+            sidecar = Exiv2::ImageFactory::create(Exiv2::ImageType::xmp, sidecarFullPath.toStdString());
+        }
+
+        Exiv2::XmpData &xmpData = sidecar->xmpData();
+        const Exiv2::XmpKey key("Xmp.dc.subject");
+        Exiv2::XmpData::iterator it = xmpData.findKey(key);
+        if (it != xmpData.end()) {
+            xmpData.erase(it);
+        }
+
+        if (!newTags.isEmpty()) {
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#if EXIV2_TEST_VERSION(0,28,0)
+            Exiv2::Value::UniquePtr value = Exiv2::Value::create(Exiv2::xmpBag);
+#else
+            Exiv2::Value::AutoPtr value = Exiv2::Value::create(Exiv2::xmpBag);
+#endif
+#pragma clang diagnostic pop
+
+            // Each read adds one item to the bag
+            for (const QString &tag : newTags) {
+                value->read(tag.toStdString());
+            }
+            xmpData.add(key, value.get());
+        }
+
+        sidecar->writeMetadata();
+    }
+    catch (const Exiv2::Error &) {
+        return false;
+    }
+
+    return true;
+}
+
+bool TagWriter::writeTagsToImage(const QString &imageFileName, const QSet<QString> &newTags, bool useSidecar) {
+    if (useSidecar) {
+        // A few KB, whatever the size of the image
+        return writeTagsToSidecar(imageFileName, newTags);
+    }
+
+    // An existing sidecar overrides the image, it has to follow along
+    if (QFile::exists(MetadataCache::sidecarPath(imageFileName)) && !writeTagsToSidecar(imageFileName, newTags)) {
+        return false;
+    }
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#if EXIV2_TEST_VERSION(0,28,0)
+    Exiv2::Image::UniquePtr exifImage;
+#else
+    Exiv2::Image::AutoPtr exifImage;
+#endif
+#pragma clang diagnostic pop
+
+    try {
+        exifImage = Exiv2::ImageFactory::open(imageFileName.toStdString());
+        exifImage->readMetadata();
+
+        Exiv2::IptcData newIptcData;
+
+        /* copy existing data */
+        Exiv2::IptcData &iptcData = exifImage->iptcData();
+        if (!iptcData.empty()) {
+            Exiv2::IptcData::iterator end = iptcData.end();
+            for (Exiv2::IptcData::iterator iptcIt = iptcData.begin(); iptcIt != end; ++iptcIt) {
+                if (iptcIt->tagName() != "Keywords") {
+                    newIptcData.add(*iptcIt);
+                }
+            }
+        }
+
+        /* add new tags */
+        QSetIterator<QString> newTagsIt(newTags);
+        while (newTagsIt.hasNext()) {
+            QString tag = newTagsIt.next();
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#if EXIV2_TEST_VERSION(0,28,0)
+            Exiv2::Value::UniquePtr value = Exiv2::Value::create(Exiv2::string);
+#else
+            Exiv2::Value::AutoPtr value = Exiv2::Value::create(Exiv2::string);
+#endif
+#pragma clang diagnostic pop
+
+            value->read(tag.toStdString());
+            Exiv2::IptcKey key("Iptc.Application2.Keywords");
+            newIptcData.add(key, value.get());
+        }
+
+        exifImage->setIptcData(newIptcData);
+        exifImage->writeMetadata();
+    }
+    catch (const Exiv2::Error &) {
+        return false;
+    }
+
+    return true;
+}
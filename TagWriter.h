@@ -0,0 +1,67 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TAG_WRITER_H
+#define TAG_WRITER_H
+
+#include <QtCore>
+#include <memory>
+#include "MetadataCache.h"
+
+// Write-behind queue for tag edits. The MetadataCache is updated by the
+// caller right away; files are rewritten later on a small pool of threads
+// with whatever tags the cache holds for them by then, so repeated edits
+// of a file still waiting in the queue cost a single write.
+class TagWriter : public QObject {
+Q_OBJECT
+
+public:
+    explicit TagWriter(const std::shared_ptr<MetadataCache> &metadataCache, QObject *parent = nullptr);
+
+    ~TagWriter() override;
+
+    void enqueue(const QStringList &imageFileNames);
+
+    int pendingCount() const;
+
+    // With useSidecar set only the image's XMP sidecar is written
+    static bool writeTagsToImage(const QString &imageFileName, const QSet<QString> &tags, bool useSidecar);
+
+    static bool writeTagsToSidecar(const QString &imageFileName, const QSet<QString> &tags);
+
+signals:
+
+    // Emitted when the queue runs dry, with the images whose files could not be written
+    void finished(const QStringList &failedImages);
+
+private:
+    class Worker;
+
+    void processQueue();
+
+    std::shared_ptr<MetadataCache> metadataCache;
+    QThreadPool threadPool;
+    mutable QMutex mutex;
+    QStringList queue;
+    QSet<QString> queuedImages;
+    QSet<QString> writingImages;
+    QStringList failedImages;
+    int activeWorkers = 0;
+};
+
+#endif // TAG_WRITER_H
@@ -18,7 +18,6 @@
 
 #include "Tags.h"
 #include "Settings.h"
-#include "ProgressDialog.h"
 #include "MessageBox.h"
 
 ImageTags::ImageTags(QWidget *parent, ThumbsViewer *thumbsViewer, const std::shared_ptr<MetadataCache> &metadataCache) : QWidget(parent) {
@@ -31,6 +30,9 @@ ImageTags::ImageTags(QWidget *parent, ThumbsViewer *thumbsViewer, const std::sha
     this->thumbView = thumbsViewer;
     this->metadataCache = metadataCache;
     negateFilterEnabled = false;
+    isSelectionCounted = false;
+    tagWriter = new TagWriter(metadataCache, this);
+    connect(tagWriter, &TagWriter::finished, this, &ImageTags::onTagsWritten);
 
     tabs = new QTabBar(this);
     tabs->addTab(tr("Selection"));
@@ -134,88 +136,25 @@ void ImageTags::addTag(QString tagName, bool tagChecked) {
     tagsTree->addTopLevelItem(tagItem);
 }
 
-bool ImageTags::writeTagsToImage(QString &imageFileName, QSet<QString> &newTags) {
-    QSet<QString> imageTags;
-
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wdeprecated-declarations"
-#if EXIV2_TEST_VERSION(0,28,0)
-    Exiv2::Image::UniquePtr exifImage;
-#else
-    Exiv2::Image::AutoPtr exifImage;
-#endif
-#pragma clang diagnostic pop
-
-    try {
-        exifImage = Exiv2::ImageFactory::open(imageFileName.toStdString());
-        exifImage->readMetadata();
-
-        Exiv2::IptcData newIptcData;
-
-        /* copy existing data */
-        Exiv2::IptcData &iptcData = exifImage->iptcData();
-        if (!iptcData.empty()) {
-            QString key;
-            Exiv2::IptcData::iterator end = iptcData.end();
-            for (Exiv2::IptcData::iterator iptcIt = iptcData.begin(); iptcIt != end; ++iptcIt) {
-                if (iptcIt->tagName() != "Keywords") {
-                    newIptcData.add(*iptcIt);
-                }
-            }
-        }
-
-        /* add new tags */
-        QSetIterator<QString> newTagsIt(newTags);
-        while (newTagsIt.hasNext()) {
-            QString tag = newTagsIt.next();
-
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wdeprecated-declarations"
-#if EXIV2_TEST_VERSION(0,28,0)
-            Exiv2::Value::UniquePtr value = Exiv2::Value::create(Exiv2::string);
-#else
-            Exiv2::Value::AutoPtr value = Exiv2::Value::create(Exiv2::string);
-#endif
-#pragma clang diagnostic pop
-
-            value->read(tag.toStdString());
-            Exiv2::IptcKey key("Iptc.Application2.Keywords");
-            newIptcData.add(key, value.get());
-        }
-
-        exifImage->setIptcData(newIptcData);
-        exifImage->writeMetadata();
-    }
-    catch (Exiv2::Error &error) {
-        MessageBox msgBox(this);
-        msgBox.critical(tr("Error"), tr("Failed to save tags to ") + imageFileName);
-        return false;
-    }
-
-    return true;
-}
-
 void ImageTags::showSelectedImagesTags() {
     static bool busy = false;
     if (busy)
         return;
     busy = true;
-    QStringList selectedThumbs = thumbView->getSelectedThumbsList();
 
     setActiveViewMode(SelectionTagsDisplay);
 
-    int selectedThumbsNum = selectedThumbs.size();
-    QMap<QString, int> tagsCount;
-    for (int i = 0; i < selectedThumbsNum; ++i) {
-        QSetIterator<QString> imageTagsIter(metadataCache->getImageTags(selectedThumbs[i]));
-        while (imageTagsIter.hasNext()) {
-            QString imageTag = imageTagsIter.next();
-            tagsCount[imageTag]++;
-
-            if (!Settings::knownTags.contains(imageTag)) {
-                addTag(imageTag, true);
-                Settings::knownTags.insert(imageTag);
-            }
+    // Rows can leave the selection without a signal, when they are removed in bulk or the model is cleared
+    int selectedThumbsNum = thumbView->getSelectedThumbsCount();
+    if (!isSelectionCounted || countedImageTags.size() != selectedThumbsNum) {
+        countSelectionTags();
+    }
+
+    for (QHash<QString, int>::const_iterator tagIt = selectionTagCounts.constBegin();
+         tagIt != selectionTagCounts.constEnd(); ++tagIt) {
+        if (!Settings::knownTags.contains(tagIt.key())) {
+            addTag(tagIt.key(), true);
+            Settings::knownTags.insert(tagIt.key());
         }
     }
 
@@ -223,7 +162,7 @@ void ImageTags::showSelectedImagesTags() {
     QTreeWidgetItemIterator it(tagsTree);
     while (*it) {
         QString tagName = (*it)->text(0);
-        int tagCountTotal = tagsCount[tagName];
+        int tagCountTotal = selectionTagCounts.value(tagName);
 
         if (selectedThumbsNum == 0) {
             (*it)->setCheckState(0, Qt::Unchecked);
@@ -262,6 +201,81 @@ void ImageTags::showSelectedImagesTags() {
     busy = false;
 }
 
+void ImageTags::countImageTags(const QString &imageFileName) {
+    if (countedImageTags.contains(imageFileName)) {
+        return;
+    }
+
+    const QSet<QString> tags = metadataCache->getImageTags(imageFileName);
+    for (const QString &tag : tags) {
+        ++selectionTagCounts[tag];
+    }
+    countedImageTags.insert(imageFileName, tags);
+}
+
+void ImageTags::uncountImageTags(const QString &imageFileName) {
+    QHash<QString, QSet<QString>>::iterator imageIt = countedImageTags.find(imageFileName);
+    if (imageIt == countedImageTags.end()) {
+        return;
+    }
+
+    for (const QString &tag : *imageIt) {
+        QHash<QString, int>::iterator tagIt = selectionTagCounts.find(tag);
+        if (tagIt != selectionTagCounts.end() && --(*tagIt) <= 0) {
+            selectionTagCounts.erase(tagIt);
+        }
+    }
+    countedImageTags.erase(imageIt);
+}
+
+void ImageTags::countSelectionTags() {
+    selectionTagCounts.clear();
+    countedImageTags.clear();
+    for (const QItemSelectionRange &range : thumbView->selectionModel()->selection()) {
+        for (int row = range.top(); row <= range.bottom(); ++row) {
+            countImageTags(thumbView->thumbsViewerModel->filePath(row));
+        }
+    }
+    isSelectionCounted = true;
+}
+
+void ImageTags::updateSelectionTags(const QItemSelection &selected, const QItemSelection &deselected) {
+    if (!isSelectionCounted) {
+        return;
+    }
+    if (!isVisible()) {
+        // Counted again from scratch once shown
+        invalidateSelectionTags();
+        return;
+    }
+
+    for (const QItemSelectionRange &range : deselected) {
+        for (int row = range.top(); row <= range.bottom(); ++row) {
+            uncountImageTags(thumbView->thumbsViewerModel->filePath(row));
+        }
+    }
+    for (const QItemSelectionRange &range : selected) {
+        for (int row = range.top(); row <= range.bottom(); ++row) {
+            countImageTags(thumbView->thumbsViewerModel->filePath(row));
+        }
+    }
+}
+
+void ImageTags::updateImagesTags(const QStringList &imageFileNames) {
+    for (const QString &imageFileName : imageFileNames) {
+        if (countedImageTags.contains(imageFileName)) {
+            uncountImageTags(imageFileName);
+            countImageTags(imageFileName);
+        }
+    }
+}
+
+void ImageTags::invalidateSelectionTags() {
+    isSelectionCounted = false;
+    selectionTagCounts.clear();
+    countedImageTags.clear();
+}
+
 void ImageTags::showTagsFilter() {
     static bool busy = false;
     if (busy)
@@ -317,13 +331,8 @@ void ImageTags::setActiveViewMode(TagsDisplayMode mode) {
 }
 
 bool ImageTags::isImageFilteredOut(QString imageFileName) {
-    QSet<QString> imageTags = metadataCache->getImageTags(imageFileName);
-
-    QSetIterator<QString> filteredTagsIt(imageFilteringTags);
-    while (filteredTagsIt.hasNext()) {
-        if (imageTags.contains(filteredTagsIt.next())) {
-            return negateFilterEnabled;
-        }
+    if (metadataCache->hasAnyTag(imageFileName, imageFilteringTags)) {
+        return negateFilterEnabled;
     }
 
     return !negateFilterEnabled;
@@ -331,7 +340,7 @@ bool ImageTags::isImageFilteredOut(QString imageFileName) {
 
 void ImageTags::resetTagsState() {
     tagsTree->clear();
-    metadataCache->clear();
+    invalidateSelectionTags();
 }
 
 QSet<QString> ImageTags::getCheckedTags(Qt::CheckState tagState) {
@@ -362,7 +371,7 @@ void ImageTags::applyTagFiltering() {
         tabs->setTabIcon(1, QIcon(":/images/tag_filter_off.png"));
     }
 
-    emit reloadThumbs();
+    emit tagFilterChanged();
 }
 
 void ImageTags::applyUserAction(QTreeWidgetItem *item) {
@@ -372,40 +381,59 @@ void ImageTags::applyUserAction(QTreeWidgetItem *item) {
 }
 
 void ImageTags::applyUserAction(QList<QTreeWidgetItem *> tagsList) {
-    ProgressDialog *progressDialog = new ProgressDialog(this);
-    progressDialog->show();
+    for (int i = tagsList.size() - 1; i > -1; --i) {
+        setTagIcon(tagsList.at(i), (tagsList.at(i)->checkState(0) == Qt::Checked ? TagIconEnabled : TagIconDisabled));
+    }
 
     QStringList currentSelectedImages = thumbView->getSelectedThumbsList();
     for (int currentImage = 0; currentImage < currentSelectedImages.size(); ++currentImage) {
-
-        QString imageName = currentSelectedImages[currentImage];
+        const QString &imageName = currentSelectedImages[currentImage];
         for (int i = tagsList.size() - 1; i > -1; --i) {
-            Qt::CheckState tagState = tagsList.at(i)->checkState(0);
-            setTagIcon(tagsList.at(i), (tagState == Qt::Checked ? TagIconEnabled : TagIconDisabled));
             QString tagName = tagsList.at(i)->text(0);
-
-            if (tagState == Qt::Checked) {
-                progressDialog->opLabel->setText(tr("Tagging ") + imageName);
+            if (tagsList.at(i)->checkState(0) == Qt::Checked) {
                 metadataCache->addTagToImage(imageName, tagName);
             } else {
-                progressDialog->opLabel->setText(tr("Untagging ") + imageName);
                 metadataCache->removeTagFromImage(imageName, tagName);
             }
         }
+    }
 
-        if (!writeTagsToImage(imageName, metadataCache->getImageTags(imageName))) {
-            metadataCache->removeImage(imageName);
-        }
+    // The cache already has the new tags, the files catch up in the background
+    updateImagesTags(currentSelectedImages);
+    tagWriter->enqueue(currentSelectedImages);
+}
 
-        QApplication::processEvents();
+void ImageTags::waitForPendingWrites() {
+    int pendingWrites = tagWriter->pendingCount();
+    if (!pendingWrites) {
+        return;
+    }
 
-        if (progressDialog->abortOp) {
-            break;
-        }
+    // Nothing to cancel, dropping the queue would lose the edits
+    QProgressDialog progress(tr("Writing tags to %n image(s)...", "", pendingWrites), QString(), 0,
+                             pendingWrites, this);
+    progress.setWindowModality(Qt::WindowModal);
+    progress.setMinimumDuration(0);
+    const int totalWrites = pendingWrites;
+    while (pendingWrites > 0) {
+        progress.setValue(totalWrites - pendingWrites);
+        QApplication::processEvents(QEventLoop::AllEvents, 50);
+        QThread::msleep(20);
+        pendingWrites = tagWriter->pendingCount();
+    }
+}
+
+void ImageTags::onTagsWritten(const QStringList &failedImages) {
+    if (failedImages.isEmpty()) {
+        return;
     }
 
-    progressDialog->close();
-    delete (progressDialog);
+    // Those images went back to the tags in their files
+    updateImagesTags(failedImages);
+    if (currentDisplayMode == SelectionTagsDisplay) {
+        showSelectedImagesTags();
+    }
+    emit tagsWriteFailed(failedImages);
 }
 
 void ImageTags::saveLastChangedTag(QTreeWidgetItem *item, int) {
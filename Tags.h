@@ -23,6 +23,7 @@
 #include <exiv2/exiv2.hpp>
 #include "ThumbsViewer.h"
 #include "MetadataCache.h"
+#include "TagWriter.h"
 
 class ThumbsViewer;
 
@@ -60,6 +61,17 @@ public:
 
     void populateTagsTree();
 
+    // Keeps the per tag counts over the selection current, in time proportional to the change
+    void updateSelectionTags(const QItemSelection &selected, const QItemSelection &deselected);
+
+    // For when the tags of these images changed in the cache
+    void updateImagesTags(const QStringList &imageFileNames);
+
+    void invalidateSelectionTags();
+
+    // Blocks behind a progress dialog until the queued tag edits are in the files
+    void waitForPendingWrites();
+
     QMenu *tagsMenu;
     QTreeWidget *tagsTree;
     bool dirFilteringActive;
@@ -67,8 +79,6 @@ public:
     TagsDisplayMode currentDisplayMode;
 
 private:
-    bool writeTagsToImage(QString &imageFileName, QSet<QString> &tags);
-
     QSet<QString> getCheckedTags(Qt::CheckState tagState);
 
     void setTagIcon(QTreeWidgetItem *tagItem, TagIcons icon);
@@ -81,6 +91,12 @@ private:
 
     void redrawTagTree();
 
+    void countImageTags(const QString &imageFileName);
+
+    void uncountImageTags(const QString &imageFileName);
+
+    void countSelectionTags();
+
     QSet<QString> imageFilteringTags;
     QAction *actionAddTag;
     QAction *addToSelectionAction;
@@ -91,7 +107,12 @@ private:
     ThumbsViewer *thumbView;
     QTabBar *tabs;
     std::shared_ptr<MetadataCache> metadataCache;
+    TagWriter *tagWriter;
     bool negateFilterEnabled;
+    // How many selected images carry each tag, and the tags counted for each image
+    QHash<QString, int> selectionTagCounts;
+    QHash<QString, QSet<QString>> countedImageTags;
+    bool isSelectionCounted;
 
 private slots:
 
@@ -115,9 +136,13 @@ private slots:
 
     void tabsChanged(int index);
 
+    void onTagsWritten(const QStringList &failedImages);
+
 signals:
 
-    void reloadThumbs();
+    void tagFilterChanged();
+
+    void tagsWriteFailed(const QStringList &failedImages);
 
 };
 
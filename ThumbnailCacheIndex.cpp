@@ -0,0 +1,81 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ThumbnailCacheIndex.h"
+
+ThumbnailCacheIndex *ThumbnailCacheIndex::instance() {
+    static ThumbnailCacheIndex cacheIndex;
+    return &cacheIndex;
+}
+
+ThumbnailCacheIndex::ThumbnailCacheIndex() {
+    basePath = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) +
+        QLatin1String("/thumbnails/");
+}
+
+QString ThumbnailCacheIndex::filePath(const QString &folder, const QString &fileName) const {
+    return basePath + folder + fileName;
+}
+
+void ThumbnailCacheIndex::scan(const QString &folderName, Folder &folder) {
+    // Only names are needed here, which readdir() provides without a stat per file
+    QDirIterator iterator(basePath + folderName, QDir::Files);
+    while (iterator.hasNext()) {
+        iterator.next();
+        folder.entries.insert(iterator.fileName(), QDateTime());
+    }
+    folder.isScanned = true;
+}
+
+QDateTime ThumbnailCacheIndex::lastModified(const QString &folderName, const QString &fileName) {
+    {
+        QMutexLocker locker(&mutex);
+        Folder &folder = folders[folderName];
+        if (!folder.isScanned) {
+            scan(folderName, folder);
+        }
+
+        QHash<QString, QDateTime>::const_iterator it = folder.entries.constFind(fileName);
+        if (it == folder.entries.constEnd()) {
+            return QDateTime();
+        }
+        if (it->isValid()) {
+            return *it;
+        }
+    }
+
+    const QFileInfo info(filePath(folderName, fileName));
+    const QDateTime modified = info.exists() ? info.lastModified() : QDateTime();
+
+    QMutexLocker locker(&mutex);
+    if (modified.isValid()) {
+        folders[folderName].entries.insert(fileName, modified);
+    } else {
+        // Removed behind our back
+        folders[folderName].entries.remove(fileName);
+    }
+    return modified;
+}
+
+void ThumbnailCacheIndex::insert(const QString &folderName, const QString &fileName, const QDateTime &lastModified) {
+    QMutexLocker locker(&mutex);
+    Folder &folder = folders[folderName];
+    if (folder.isScanned) {
+        folder.entries.insert(fileName, lastModified);
+    }
+}
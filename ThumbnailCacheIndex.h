@@ -0,0 +1,55 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THUMBNAIL_CACHE_INDEX_H
+#define THUMBNAIL_CACHE_INDEX_H
+
+#include <QtCore>
+
+// In-memory view of the freedesktop thumbnail cache. Each size folder is
+// listed once on first use; a thumbnail is only stat'ed the first time it is
+// looked up, after that its modification time is served from memory.
+class ThumbnailCacheIndex {
+
+public:
+    static ThumbnailCacheIndex *instance();
+
+    // Returns the cached thumbnail's modification time, or an invalid QDateTime if there is none
+    QDateTime lastModified(const QString &folder, const QString &fileName);
+
+    void insert(const QString &folder, const QString &fileName, const QDateTime &lastModified);
+
+    QString filePath(const QString &folder, const QString &fileName) const;
+
+private:
+    struct Folder {
+        bool isScanned = false;
+        // Invalid until the entry has been stat'ed
+        QHash<QString, QDateTime> entries;
+    };
+
+    ThumbnailCacheIndex();
+
+    void scan(const QString &folderName, Folder &folder);
+
+    QMutex mutex;
+    QHash<QString, Folder> folders;
+    QString basePath;
+};
+
+#endif // THUMBNAIL_CACHE_INDEX_H
@@ -0,0 +1,439 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ThumbnailLoader.h"
+#include "Exiv2Init.h"
+#include "ImageViewer.h"
+#include "SmartCrop.h"
+#include "BrightnessScanner.h"
+#include "ThumbnailWriter.h"
+#include "ThumbnailCacheIndex.h"
+#include "ExifPreview.h"
+#include "MetadataCache.h"
+#include "PerfCounters.h"
+#include "ColorTransforms.h"
+#include "Resampler.h"
+
+// Kept next to Thumb::Image::Width in the cached PNG, as fractions of the thumbnail
+#define SMART_CROP_TEXT_KEY "X-Phototonic::SmartCrop"
+#define READ_AHEAD_REQUESTS 8
+
+class ThumbnailLoader::Worker : public QRunnable {
+public:
+    explicit Worker(ThumbnailLoader *loader) : loader(loader) {}
+
+    void run() override {
+        loader->processQueue();
+    }
+
+private:
+    ThumbnailLoader *loader;
+};
+
+ThumbnailLoader::ThumbnailLoader(const std::shared_ptr<MetadataCache> &metadataCache, QObject *parent)
+    : QObject(parent), metadataCache(metadataCache) {
+    qRegisterMetaType<Histogram>();
+
+    Exiv2Init::ensure();
+    threadPool.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+ThumbnailLoader::~ThumbnailLoader() {
+    cancel();
+    threadPool.waitForDone();
+}
+
+void ThumbnailLoader::enqueue(const QList<ThumbnailRequest> &requests) {
+    if (requests.isEmpty()) {
+        return;
+    }
+
+    QMutexLocker locker(&mutex);
+    for (ThumbnailRequest request : requests) {
+        request.generation = generation;
+        queue.append(request);
+    }
+    Perf::setGauge(Perf::ThumbnailQueue, queue.size());
+
+    while (activeWorkers < threadPool.maxThreadCount() && activeWorkers < queue.size()) {
+        ++activeWorkers;
+        threadPool.start(new Worker(this));
+    }
+}
+
+QList<quint64> ThumbnailLoader::clearQueue() {
+    QMutexLocker locker(&mutex);
+    QList<quint64> tickets;
+    for (const ThumbnailRequest &request : queue) {
+        tickets.append(request.ticket);
+    }
+    queue.clear();
+    Perf::setGauge(Perf::ThumbnailQueue, 0);
+    return tickets;
+}
+
+void ThumbnailLoader::cancel() {
+    QMutexLocker locker(&mutex);
+    queue.clear();
+    Perf::setGauge(Perf::ThumbnailQueue, 0);
+    ++generation;
+}
+
+void ThumbnailLoader::processQueue() {
+    forever {
+        ThumbnailRequest request;
+        {
+            QMutexLocker locker(&mutex);
+            if (queue.isEmpty()) {
+                --activeWorkers;
+                return;
+            }
+            request = queue.takeFirst();
+            Perf::setGauge(Perf::ThumbnailQueue, queue.size());
+        }
+
+        if (request.generation != generation) {
+            continue;
+        }
+
+        // Exiv2 and the decoder share one read of the file
+        MappedFile imageFile(request.imageFileName);
+        if (request.readOrientation) {
+            // The metadata scan has not got to this image yet, it will find it cached
+            request.orientation = metadataCache->hasImageMetadata(request.imageFileName)
+                                  ? metadataCache->getImageOrientation(request.imageFileName)
+                                  : metadataCache->getImageOrientation(request.imageFileName, imageFile.data());
+        }
+
+        QImage thumb;
+        qreal brightness = 0;
+        if (!loadThumbnail(request, imageFile, thumb, brightness)) {
+            if (request.generation == generation) {
+                emit thumbnailFailed(request.ticket);
+            }
+            continue;
+        }
+
+        const Histogram histogram = Histogram::fromImage(thumb);
+
+        if (request.generation == generation) {
+            emit thumbnailLoaded(request.ticket, thumb, brightness, histogram);
+        }
+    }
+}
+
+// Misses come in runs, a directory without cached thumbnails has the next requests miss as well.
+// Their originals are read in by the system while this one decodes.
+void ThumbnailLoader::readAheadQueue() {
+    QStringList filePaths;
+    {
+        QMutexLocker locker(&mutex);
+        for (int i = 0; i < qMin(queue.size(), READ_AHEAD_REQUESTS); ++i) {
+            if (!queue.at(i).isReadAhead) {
+                queue[i].isReadAhead = true;
+                filePaths.append(queue.at(i).imageFileName);
+            }
+        }
+    }
+    for (const QString &filePath : filePaths) {
+        MappedFile::willNeed(filePath);
+    }
+}
+
+bool ThumbnailLoader::loadPackedThumbnail(const ThumbnailRequest &request, ThumbnailPack *pack, QImage &thumb,
+                                          QString &cachedCrop) {
+    const QByteArray data = pack->find(QFileInfo(request.imageFileName).fileName(), request.lastModified,
+                                       request.fileSize, nullptr);
+    QSize currentThumbSize = PackedThumbnail::size(data);
+    if (!currentThumbSize.isValid()) {
+        return false;
+    }
+
+    // Same rule as locateThumbnail(), 128px thumbnails look bad when upscaled further
+    if (qMax(currentThumbSize.width(), currentThumbSize.height()) < 256 && request.thumbSize > 200) {
+        return false;
+    }
+    currentThumbSize.scale(QSize(request.thumbSize, request.thumbSize),
+                           request.smartCrop ? Qt::KeepAspectRatioByExpanding : Qt::KeepAspectRatio);
+    thumb = PackedThumbnail::decode(data, currentThumbSize);
+    if (thumb.isNull()) {
+        qWarning() << "Invalid packed thumbnail for" << request.imageFileName;
+        return false;
+    }
+    cachedCrop = thumb.text(SMART_CROP_TEXT_KEY);
+    return true;
+}
+
+static QRectF parseSmartCrop(const QString &text) {
+    const QStringList values = text.split(',');
+    if (values.size() != 4) {
+        return QRectF();
+    }
+    const QRectF crop(values.at(0).toDouble(), values.at(1).toDouble(), values.at(2).toDouble(),
+                      values.at(3).toDouble());
+    if (crop.isEmpty() || crop.left() < 0 || crop.top() < 0 || crop.right() > 1.001 || crop.bottom() > 1.001) {
+        return QRectF();
+    }
+    return crop;
+}
+
+// Crops found before are kept relative to the thumbnail, any size of it can use them without
+// another analysis. New ones go into the thumbnail's text, to be cached along with it.
+QRectF ThumbnailLoader::smartCropRect(const ThumbnailRequest &request, const QString &cachedCrop, QImage &thumb) {
+    Perf::ScopedTimer timer(Perf::ThumbnailSmartCrop);
+    QRectF crop = parseSmartCrop(cachedCrop);
+    if (crop.isNull()) {
+        const QRect rect = SmartCrop::smartCropRect(thumb, QSize(request.thumbSize, request.thumbSize));
+        crop = QRectF(qreal(rect.x()) / thumb.width(), qreal(rect.y()) / thumb.height(),
+                      qreal(rect.width()) / thumb.width(), qreal(rect.height()) / thumb.height());
+        thumb.setText(SMART_CROP_TEXT_KEY, QString("%1,%2,%3,%4").arg(crop.x(), 0, 'f', 5).arg(crop.y(), 0, 'f', 5)
+                                                  .arg(crop.width(), 0, 'f', 5).arg(crop.height(), 0, 'f', 5));
+    }
+    return crop;
+}
+
+// Brightness is of the whole thumbnail, the crop is taken before turning it upright
+void ThumbnailLoader::finishThumbnail(const ThumbnailRequest &request, const QRectF &crop, QImage &thumb,
+                                      qreal &brightness) {
+    Perf::ScopedTimer timer(Perf::ThumbnailRotate);
+    brightness = BrightnessScanner::imageBrightness(thumb);
+    if (request.smartCrop && !crop.isNull()) {
+        thumb = thumb.copy(QRectF(crop.x() * thumb.width(), crop.y() * thumb.height(),
+                                  crop.width() * thumb.width(), crop.height() * thumb.height()).toRect());
+    }
+    if (request.orientation) {
+        ImageViewer::rotateByExifOrientation(thumb, request.orientation);
+    }
+}
+
+bool ThumbnailLoader::loadEmbeddedPreview(const ThumbnailRequest &request, const QByteArray &fileData,
+                                          QSize &originalSize, QImage &thumb) {
+    const QSize targetSize(request.thumbSize, request.thumbSize);
+    const Qt::AspectRatioMode aspectRatioMode = request.smartCrop ? Qt::KeepAspectRatioByExpanding
+                                                                  : Qt::KeepAspectRatio;
+    QByteArray preview = ExifPreview::extract(request.imageFileName, targetSize, aspectRatioMode, originalSize,
+                                              fileData);
+    if (preview.isEmpty()) {
+        return false;
+    }
+
+    QBuffer buffer(&preview);
+    QImageReader previewReader(&buffer);
+    previewReader.setQuality(50);
+    QSize previewSize = previewReader.size();
+    if (!previewSize.isValid()) {
+        return false;
+    }
+    previewSize.scale(targetSize, aspectRatioMode);
+    previewReader.setScaledSize(previewSize);
+    if (!previewReader.read(&thumb)) {
+        return false;
+    }
+
+    if (!originalSize.isValid()) {
+        originalSize = previewReader.size();
+    }
+    return true;
+}
+
+bool ThumbnailLoader::loadThumbnail(const ThumbnailRequest &request, MappedFile &imageFile, QImage &thumb,
+                                    qreal &brightness) {
+    Perf::ScopedTimer loadTimer(Perf::ThumbnailLoad);
+    // Outlives the reader that reads from it
+    QBuffer imageBuffer;
+    QImageReader thumbReader;
+    const QString &imageFileName = request.imageFileName;
+    bool imageReadOk = false;
+    bool shouldStoreThumbnail = false;
+    QString cachedCrop;
+
+    // Packs stay alive while we read out of their mapping
+    std::shared_ptr<ThumbnailPack> pack;
+    if (request.usePack) {
+        bool isPacked;
+        {
+            Perf::ScopedTimer lookupTimer(Perf::ThumbnailCacheLookup);
+            pack = ThumbnailPack::forDirectory(QFileInfo(imageFileName).absolutePath());
+            isPacked = loadPackedThumbnail(request, pack.get(), thumb, cachedCrop);
+        }
+        if (isPacked) {
+            Perf::count(Perf::ThumbnailPackHits);
+            const QRectF crop = request.smartCrop ? smartCropRect(request, cachedCrop, thumb) : QRectF();
+            finishThumbnail(request, crop, thumb, brightness);
+            return true;
+        }
+    }
+
+    imageFile.setReaderDevice(thumbReader, imageBuffer);
+    thumbReader.setQuality(50); // 50 is the threshold where Qt does fast decoding, but still good scaling
+    const QSize origThumbSize = thumbReader.size();
+    QSize currentThumbSize = origThumbSize;
+    QSize originalSize = origThumbSize;
+
+    {
+        Perf::ScopedTimer lookupTimer(Perf::ThumbnailCacheLookup);
+        QString thumbnailPath = locateThumbnail(imageFileName, request.thumbSize);
+        if (!thumbnailPath.isEmpty()) {
+            if (QImageReader(thumbnailPath).canRead()) {
+                thumbReader.setFormat(QByteArray());
+                thumbReader.setFileName(thumbnailPath);
+            } else {
+                qWarning() << "Invalid thumbnail" << thumbnailPath;
+                shouldStoreThumbnail = true;
+            }
+        } else {
+            shouldStoreThumbnail = true;
+        }
+    }
+    Perf::count(shouldStoreThumbnail ? Perf::ThumbnailCacheMisses : Perf::ThumbnailCacheHits);
+    if (shouldStoreThumbnail) {
+        imageFile.willNeed();
+        readAheadQueue();
+    }
+
+    {
+        Perf::ScopedTimer decodeTimer(Perf::ThumbnailDecode);
+        if (shouldStoreThumbnail) {
+            imageReadOk = loadEmbeddedPreview(request, imageFile.data(), originalSize, thumb);
+        }
+
+        if (!imageReadOk && currentThumbSize.isValid()) {
+            if (currentThumbSize.width() != request.thumbSize || currentThumbSize.height() != request.thumbSize) {
+                currentThumbSize.scale(QSize(request.thumbSize, request.thumbSize),
+                                       request.smartCrop ? Qt::KeepAspectRatioByExpanding : Qt::KeepAspectRatio);
+            }
+
+            thumbReader.setScaledSize(currentThumbSize);
+            imageReadOk = thumbReader.read(&thumb);
+
+            if (imageReadOk && !shouldStoreThumbnail) {
+                int w = thumb.text("Thumb::Image::Width").toInt();
+                int h = thumb.text("Thumb::Image::Height").toInt();
+                if (origThumbSize != QSize(w, h)) {
+                    qWarning() << "Invalid size in stored thumbnail" << w << h << "vs" << origThumbSize;
+                    shouldStoreThumbnail = true;
+                    imageFile.setReaderDevice(thumbReader, imageBuffer);
+                    imageReadOk = thumbReader.read(&thumb);
+                } else {
+                    cachedCrop = thumb.text(SMART_CROP_TEXT_KEY);
+                }
+            }
+        }
+    }
+
+    if (!imageReadOk) {
+        return false;
+    }
+    // Before anything is stored, so every cached copy is sRGB
+    ColorTransforms::convert(thumb, QColorSpace(QColorSpace::SRgb));
+
+    const QRectF crop = request.smartCrop ? smartCropRect(request, cachedCrop, thumb) : QRectF();
+
+    // With the packed store in use the freedesktop copy is only there for other viewers.
+    // Files Qt cannot read, such as RAW files served from their preview, could never be matched to it.
+    if (shouldStoreThumbnail && origThumbSize.isValid()) {
+        ThumbnailWriter::instance()->storeThumbnail(imageFileName, thumb, originalSize,
+                                                    pack ? ThumbnailWriter::LowPriority
+                                                         : ThumbnailWriter::HighPriority);
+    }
+    if (pack) {
+        ThumbnailWriter::instance()->storePackedThumbnail(pack, imageFileName, request.lastModified,
+                                                          request.fileSize, thumb, originalSize,
+                                                          request.packEncoding, ThumbnailWriter::HighPriority);
+    }
+    finishThumbnail(request, crop, thumb, brightness);
+
+    return true;
+}
+
+QString ThumbnailLoader::thumbnailFileName(const QString &originalPath)
+{
+    QFileInfo info(originalPath);
+    QString canonicalPath = info.canonicalFilePath();
+    if (canonicalPath.isEmpty()) {
+        qWarning() << originalPath << "does not exist!";
+        canonicalPath = info.absoluteFilePath();
+    }
+    QUrl url = QUrl::fromLocalFile(canonicalPath);
+    QCryptographicHash md5(QCryptographicHash::Md5);
+    md5.addData(QFile::encodeName(url.adjusted(QUrl::RemovePassword).url()));
+    return QString::fromLatin1(md5.result().toHex()) + QStringLiteral(".png");
+}
+
+QString ThumbnailLoader::locateThumbnail(const QString &originalPath, int thumbSize)
+{
+#if defined(Q_OS_MAC) || defined(Q_OS_WIN)
+    return "";
+#endif
+    QStringList folders = {
+        QStringLiteral("xx-large/"), // max 1024px
+        QStringLiteral("x-large/"), // max 512px
+        QStringLiteral("large/"), // max 256px, doesn't look too bad when upscaled to max
+    };
+
+    if (thumbSize <= 200) {
+        folders.append(QStringLiteral("normal/")); // 128px max
+    }
+
+    const QString filename = thumbnailFileName(originalPath);
+    const QFileInfo originalInfo(originalPath);
+    ThumbnailCacheIndex *cacheIndex = ThumbnailCacheIndex::instance();
+    for (const QString &folder : folders) {
+        const QDateTime thumbnailModified = cacheIndex->lastModified(folder, filename);
+        if (!thumbnailModified.isValid()) {
+            continue;
+        }
+        if (originalInfo.metadataChangeTime() > thumbnailModified) {
+            continue;
+        }
+        if (originalInfo.lastModified() > thumbnailModified) {
+            continue;
+        }
+        return cacheIndex->filePath(folder, filename);
+    }
+    return QString();
+}
+
+bool ThumbnailLoader::scaleForCache(QImage &thumbnail, QString &folder) {
+    const QString smartCrop = thumbnail.text(SMART_CROP_TEXT_KEY);
+    const int maxSize = qMax(thumbnail.width(), thumbnail.height());
+    if (maxSize < 64) {
+        qDebug() << "Refusing to store tiny thumbnail" << thumbnail.size();
+        return false;
+    }
+    if (maxSize >= 1024) {
+        folder = QStringLiteral("xx-large/");
+        thumbnail = Resampler::scaled(thumbnail, 1024, 1024, Qt::KeepAspectRatio);
+    } else if (maxSize >= 512) {
+        folder = QStringLiteral("x-large/");
+        thumbnail = Resampler::scaled(thumbnail, 512, 512, Qt::KeepAspectRatio);
+    } else if (maxSize >= 256) {
+        folder = QStringLiteral("large/");
+        thumbnail = Resampler::scaled(thumbnail, 256, 256, Qt::KeepAspectRatio);
+    } else if (maxSize >= 128) {
+        folder = QStringLiteral("normal/");
+        thumbnail = Resampler::scaled(thumbnail, 128, 128, Qt::KeepAspectRatio);
+    } else {
+        qWarning() << "Thumbnail too small" << thumbnail.size();
+        return false;
+    }
+    if (!smartCrop.isEmpty()) {
+        thumbnail.setText(SMART_CROP_TEXT_KEY, smartCrop);
+    }
+    return true;
+}
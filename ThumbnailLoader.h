@@ -0,0 +1,109 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THUMBNAIL_LOADER_H
+#define THUMBNAIL_LOADER_H
+
+#include <QtWidgets>
+#include <atomic>
+#include <memory>
+#include "Histogram.h"
+#include "ThumbnailPack.h"
+#include "MetadataCache.h"
+#include "MappedFile.h"
+#include "PackedThumbnail.h"
+
+// Everything the workers need is copied into the request, so they never
+// touch the model or the settings
+struct ThumbnailRequest
+{
+    quint64 ticket = 0;
+    QString imageFileName;
+    int thumbSize = 0;
+    bool smartCrop = false;
+    long orientation = 0;
+    bool readOrientation = false;
+    qint64 lastModified = 0;
+    qint64 fileSize = 0;
+    bool usePack = false;
+    PackedThumbnail::Encoding packEncoding = PackedThumbnail::Png;
+    int generation = 0;
+    // Set once the system was asked to read the file ahead
+    bool isReadAhead = false;
+};
+
+// Decodes, scales, rotates and crops thumbnails on a pool of worker threads.
+// Results are delivered through queued signals, so the receiver only ever
+// sees them on its own thread.
+class ThumbnailLoader : public QObject {
+Q_OBJECT
+
+public:
+    explicit ThumbnailLoader(const std::shared_ptr<MetadataCache> &metadataCache, QObject *parent = nullptr);
+
+    ~ThumbnailLoader() override;
+
+    void enqueue(const QList<ThumbnailRequest> &requests);
+
+    // Drops requests that no worker has picked up yet and returns their tickets
+    QList<quint64> clearQueue();
+
+    // Starts a new generation; everything queued or in flight is discarded
+    void cancel();
+
+    static QString thumbnailFileName(const QString &originalPath);
+
+    static QString locateThumbnail(const QString &originalPath, int thumbSize);
+
+    static bool scaleForCache(QImage &thumbnail, QString &folder);
+
+signals:
+
+    void thumbnailLoaded(quint64 ticket, const QImage &thumb, qreal brightness, const Histogram &histogram);
+
+    void thumbnailFailed(quint64 ticket);
+
+private:
+    class Worker;
+
+    void processQueue();
+
+    void readAheadQueue();
+
+    bool loadThumbnail(const ThumbnailRequest &request, MappedFile &imageFile, QImage &thumb, qreal &brightness);
+
+    static bool loadEmbeddedPreview(const ThumbnailRequest &request, const QByteArray &fileData,
+                                    QSize &originalSize, QImage &thumb);
+
+    static bool loadPackedThumbnail(const ThumbnailRequest &request, ThumbnailPack *pack, QImage &thumb,
+                                    QString &cachedCrop);
+
+    static QRectF smartCropRect(const ThumbnailRequest &request, const QString &cachedCrop, QImage &thumb);
+
+    static void finishThumbnail(const ThumbnailRequest &request, const QRectF &crop, QImage &thumb,
+                                qreal &brightness);
+
+    std::shared_ptr<MetadataCache> metadataCache;
+    QThreadPool threadPool;
+    QMutex mutex;
+    QList<ThumbnailRequest> queue;
+    int activeWorkers = 0;
+    std::atomic<int> generation{0};
+};
+
+#endif // THUMBNAIL_LOADER_H
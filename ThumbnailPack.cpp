@@ -0,0 +1,287 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ThumbnailPack.h"
+
+#define PACK_VERSION 2
+#define PACK_HEADER_SIZE 16
+#define PACK_RECORD_MAGIC 0x52485450
+#define MAX_OPEN_PACKS 16
+#define MIN_STALE_RECORDS_TO_COMPACT 256
+#define PACK_RECORD_ALIGNMENT 8
+
+static QByteArray packHeader() {
+    QByteArray header("PHTPACK1", 8);
+    const quint32 version = PACK_VERSION;
+    const quint32 reserved = 0;
+    header.append(reinterpret_cast<const char *>(&version), sizeof(version));
+    header.append(reinterpret_cast<const char *>(&reserved), sizeof(reserved));
+    return header;
+}
+
+// Records start on an 8 byte boundary, so raw pixels can be used where they are mapped
+static qint64 alignedOffset(qint64 offset) {
+    return (offset + PACK_RECORD_ALIGNMENT - 1) & ~qint64(PACK_RECORD_ALIGNMENT - 1);
+}
+
+static QByteArray recordPadding(qint64 recordEnd) {
+    return QByteArray(int(alignedOffset(recordEnd) - recordEnd), '\0');
+}
+
+std::shared_ptr<ThumbnailPack> ThumbnailPack::forDirectory(const QString &directoryPath) {
+    static QMutex packsMutex;
+    // Every pack in use anywhere, so a file is never opened twice: opening may truncate
+    // or compact it under the feet of an instance still appending to it
+    static QHash<QString, std::weak_ptr<ThumbnailPack>> livePacks;
+    // The most recently used ones stay open when nobody holds them
+    static QList<std::shared_ptr<ThumbnailPack>> recentPacks;
+
+    QMutexLocker locker(&packsMutex);
+    std::shared_ptr<ThumbnailPack> pack = livePacks.value(directoryPath).lock();
+    if (!pack) {
+        const QString packName = QString::fromLatin1(
+                QCryptographicHash::hash(QFile::encodeName(directoryPath), QCryptographicHash::Md5).toHex())
+                                 + QStringLiteral(".pack");
+        const QString basePath = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) +
+            QLatin1String("/phototonic/packs/");
+        pack = std::make_shared<ThumbnailPack>(basePath + packName);
+        livePacks.insert(directoryPath, pack);
+    }
+
+    recentPacks.removeOne(pack);
+    recentPacks.prepend(pack);
+    if (recentPacks.size() > MAX_OPEN_PACKS) {
+        // Packs still used by a worker or the writer stay alive until they are done with them
+        recentPacks.removeLast();
+        QHash<QString, std::weak_ptr<ThumbnailPack>>::iterator it = livePacks.begin();
+        while (it != livePacks.end()) {
+            if (it->expired()) {
+                it = livePacks.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    return pack;
+}
+
+ThumbnailPack::ThumbnailPack(const QString &packPath) {
+    file.setFileName(packPath);
+    isValid = open();
+}
+
+ThumbnailPack::~ThumbnailPack() {
+    close();
+}
+
+quint64 ThumbnailPack::nameHash(const QString &fileName) {
+    // FNV-1a, stable across runs unlike qHash()
+    quint64 hash = 14695981039346656037ULL;
+    for (const QChar &c : fileName) {
+        hash ^= c.unicode();
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool ThumbnailPack::open() {
+    if (!QDir().mkpath(QFileInfo(file.fileName()).absolutePath())
+        || !file.open(QIODevice::ReadWrite)) {
+        qWarning() << "Unable to open thumbnail pack" << file.fileName() << file.errorString();
+        return false;
+    }
+
+    const QByteArray header = packHeader();
+    if (file.size() < PACK_HEADER_SIZE || file.read(PACK_HEADER_SIZE) != header) {
+        // New pack, or one written by an incompatible version
+        if (!file.resize(0) || !file.seek(0) || file.write(header) != header.size() || !file.flush()) {
+            qWarning() << "Unable to initialize thumbnail pack" << file.fileName() << file.errorString();
+            file.close();
+            return false;
+        }
+    }
+
+    const int staleRecords = scan();
+    if (staleRecords >= MIN_STALE_RECORDS_TO_COMPACT && staleRecords > index.size()) {
+        compact();
+    }
+
+    return file.isOpen();
+}
+
+void ThumbnailPack::close() {
+    for (const MappedRegion &region : regions) {
+        file.unmap(region.data);
+    }
+    regions.clear();
+    mappedEnd = 0;
+    file.close();
+}
+
+int ThumbnailPack::scan() {
+    int staleRecords = 0;
+    qint64 offset = PACK_HEADER_SIZE;
+    qint64 fileSize = file.size();
+
+    index.clear();
+    mappedEnd = fileSize;
+    if (fileSize <= offset) {
+        return 0;
+    }
+
+    uchar *data = file.map(0, fileSize);
+    if (!data) {
+        qWarning() << "Unable to map thumbnail pack" << file.fileName() << file.errorString();
+        mappedEnd = 0;
+        return 0;
+    }
+    regions.append({0, fileSize, data});
+
+    while (offset + qint64(sizeof(RecordHeader)) <= fileSize) {
+        RecordHeader header;
+        memcpy(&header, data + offset, sizeof(header));
+        const qint64 recordEnd = alignedOffset(offset + qint64(sizeof(header)) + header.length);
+
+        if (header.magic != PACK_RECORD_MAGIC || recordEnd > fileSize) {
+            // Torn write from a previous session, drop it
+            qWarning() << "Truncating damaged thumbnail pack" << file.fileName() << "at" << offset;
+            file.unmap(data);
+            regions.clear();
+            file.resize(offset);
+            data = file.map(0, offset);
+            if (data) {
+                regions.append({0, offset, data});
+            }
+            mappedEnd = data ? offset : 0;
+            break;
+        }
+
+        if (index.contains(header.nameHash)) {
+            ++staleRecords;
+        }
+        index.insert(header.nameHash, {offset + qint64(sizeof(header)), header.length, header.lastModified,
+                                       header.fileSize, QSize(int(header.width), int(header.height))});
+        offset = recordEnd;
+    }
+
+    return staleRecords;
+}
+
+bool ThumbnailPack::compact() {
+    QSaveFile compacted(file.fileName());
+    if (!compacted.open(QIODevice::WriteOnly)) {
+        qWarning() << "Unable to compact thumbnail pack" << file.fileName() << compacted.errorString();
+        return false;
+    }
+
+    compacted.write(packHeader());
+    for (QHash<quint64, Entry>::const_iterator it = index.constBegin(); it != index.constEnd(); ++it) {
+        const uchar *data = dataAt(it->offset, it->length);
+        if (!data) {
+            continue;
+        }
+        const RecordHeader header = {PACK_RECORD_MAGIC, it->length, it.key(), it->lastModified, it->fileSize,
+                                     quint32(it->originalSize.width()), quint32(it->originalSize.height())};
+        compacted.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        compacted.write(reinterpret_cast<const char *>(data), it->length);
+        compacted.write(recordPadding(qint64(sizeof(header)) + it->length));
+    }
+
+    if (!compacted.commit()) {
+        qWarning() << "Unable to compact thumbnail pack" << file.fileName() << compacted.errorString();
+        return false;
+    }
+
+    close();
+    if (!file.open(QIODevice::ReadWrite)) {
+        qWarning() << "Unable to reopen thumbnail pack" << file.fileName() << file.errorString();
+        return false;
+    }
+    scan();
+    return true;
+}
+
+const uchar *ThumbnailPack::dataAt(qint64 offset, qint64 length) {
+    if (offset + length > mappedEnd) {
+        // Records appended since the last mapping
+        const qint64 fileSize = file.size();
+        if (offset + length > fileSize) {
+            return nullptr;
+        }
+        uchar *data = file.map(mappedEnd, fileSize - mappedEnd);
+        if (!data) {
+            qWarning() << "Unable to map thumbnail pack" << file.fileName() << file.errorString();
+            return nullptr;
+        }
+        regions.append({mappedEnd, fileSize - mappedEnd, data});
+        mappedEnd = fileSize;
+    }
+
+    for (const MappedRegion &region : regions) {
+        if (offset >= region.offset && offset + length <= region.offset + region.size) {
+            return region.data + (offset - region.offset);
+        }
+    }
+    return nullptr;
+}
+
+QByteArray ThumbnailPack::find(const QString &fileName, qint64 lastModified, qint64 fileSize, QSize *originalSize) {
+    QMutexLocker locker(&mutex);
+    if (!isValid) {
+        return QByteArray();
+    }
+
+    QHash<quint64, Entry>::const_iterator it = index.constFind(nameHash(fileName));
+    if (it == index.constEnd() || it->lastModified != lastModified || it->fileSize != fileSize) {
+        return QByteArray();
+    }
+
+    const uchar *data = dataAt(it->offset, it->length);
+    if (!data) {
+        return QByteArray();
+    }
+
+    if (originalSize) {
+        *originalSize = it->originalSize;
+    }
+    return QByteArray::fromRawData(reinterpret_cast<const char *>(data), int(it->length));
+}
+
+void ThumbnailPack::insert(const QString &fileName, qint64 lastModified, qint64 fileSize,
+                           const QSize &originalSize, const QByteArray &data) {
+    QMutexLocker locker(&mutex);
+    if (!isValid || data.isEmpty()) {
+        return;
+    }
+
+    const RecordHeader header = {PACK_RECORD_MAGIC, quint32(data.size()), nameHash(fileName), lastModified, fileSize,
+                                 quint32(originalSize.width()), quint32(originalSize.height())};
+    const qint64 offset = file.size();
+    if (!file.seek(offset)
+        || file.write(reinterpret_cast<const char *>(&header), sizeof(header)) != qint64(sizeof(header))
+        || file.write(data) != data.size()
+        || file.write(recordPadding(qint64(sizeof(header)) + data.size())) < 0
+        || !file.flush()) {
+        qWarning() << "Unable to write thumbnail pack" << file.fileName() << file.errorString();
+        file.resize(offset);
+        return;
+    }
+
+    index.insert(header.nameHash, {offset + qint64(sizeof(header)), header.length, lastModified, fileSize,
+                                   originalSize});
+}
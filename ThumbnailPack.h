@@ -0,0 +1,91 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THUMBNAIL_PACK_H
+#define THUMBNAIL_PACK_H
+
+#include <QtCore>
+#include <memory>
+
+// One append-only file per source directory holding encoded thumbnails.
+// The file is a small header followed by records, each a fixed size
+// RecordHeader and the encoded image, padded to 8 bytes. All records are
+// indexed when the pack is opened and image data is read straight out of the
+// memory mapping.
+class ThumbnailPack {
+
+public:
+    // The same instance for as long as anyone holds it, only one may have the file open
+    static std::shared_ptr<ThumbnailPack> forDirectory(const QString &directoryPath);
+
+    explicit ThumbnailPack(const QString &packPath);
+
+    ~ThumbnailPack();
+
+    // Returns a view into the mapping, valid for as long as the pack is alive
+    QByteArray find(const QString &fileName, qint64 lastModified, qint64 fileSize, QSize *originalSize);
+
+    void insert(const QString &fileName, qint64 lastModified, qint64 fileSize,
+                const QSize &originalSize, const QByteArray &data);
+
+private:
+    struct RecordHeader {
+        quint32 magic;
+        quint32 length;
+        quint64 nameHash;
+        qint64 lastModified;
+        qint64 fileSize;
+        quint32 width;
+        quint32 height;
+    };
+
+    struct Entry {
+        qint64 offset;
+        quint32 length;
+        qint64 lastModified;
+        qint64 fileSize;
+        QSize originalSize;
+    };
+
+    struct MappedRegion {
+        qint64 offset;
+        qint64 size;
+        uchar *data;
+    };
+
+    static quint64 nameHash(const QString &fileName);
+
+    bool open();
+
+    void close();
+
+    int scan();
+
+    bool compact();
+
+    const uchar *dataAt(qint64 offset, qint64 length);
+
+    QMutex mutex;
+    QFile file;
+    QHash<quint64, Entry> index;
+    QVector<MappedRegion> regions;
+    qint64 mappedEnd = 0;
+    bool isValid = false;
+};
+
+#endif // THUMBNAIL_PACK_H
@@ -0,0 +1,263 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ThumbnailWriter.h"
+#include "ThumbnailLoader.h"
+#include "ThumbnailCacheIndex.h"
+#include "PerfCounters.h"
+#include "ColorTransforms.h"
+#include "Resampler.h"
+
+#define MAX_PENDING_WRITES 256
+
+class ThumbnailWriter::Worker : public QRunnable {
+public:
+    explicit Worker(ThumbnailWriter *writer) : writer(writer) {}
+
+    void run() override {
+        writer->processQueue();
+    }
+
+private:
+    ThumbnailWriter *writer;
+};
+
+ThumbnailWriter *ThumbnailWriter::instance() {
+    static ThumbnailWriter writer;
+    return &writer;
+}
+
+ThumbnailWriter::ThumbnailWriter() {
+    threadPool.setMaxThreadCount(1);
+}
+
+ThumbnailWriter::~ThumbnailWriter() {
+    shutdown();
+}
+
+void ThumbnailWriter::storeThumbnail(const QString &originalPath, const QImage &thumbnail,
+                                     const QSize &originalSize, Priority priority) {
+#if defined(Q_OS_MAC) || defined(Q_OS_WIN)
+    return;
+#endif
+    Job job;
+    job.originalPath = originalPath;
+    job.thumbnail = thumbnail;
+    job.originalSize = originalSize;
+    job.priority = priority;
+    enqueue(QStringLiteral("freedesktop:") + originalPath, job);
+}
+
+void ThumbnailWriter::storeThumbnailSizes(const QString &originalPath, const QImage &thumbnail,
+                                          const QSize &originalSize, Priority priority) {
+#if defined(Q_OS_MAC) || defined(Q_OS_WIN)
+    return;
+#endif
+    Job job;
+    job.originalPath = originalPath;
+    job.thumbnail = thumbnail;
+    job.originalSize = originalSize;
+    job.allSizes = true;
+    job.priority = priority;
+    enqueue(QStringLiteral("freedesktop-all:") + originalPath, job);
+}
+
+void ThumbnailWriter::storePackedThumbnail(const std::shared_ptr<ThumbnailPack> &pack,
+                                           const QString &originalPath, qint64 lastModified, qint64 fileSize,
+                                           const QImage &thumbnail, const QSize &originalSize,
+                                           PackedThumbnail::Encoding encoding, Priority priority) {
+    Job job;
+    job.originalPath = originalPath;
+    job.thumbnail = thumbnail;
+    job.originalSize = originalSize;
+    job.pack = pack;
+    job.lastModified = lastModified;
+    job.fileSize = fileSize;
+    job.encoding = encoding;
+    job.priority = priority;
+    enqueue(QStringLiteral("pack:") + originalPath, job);
+}
+
+void ThumbnailWriter::shutdown() {
+    {
+        QMutexLocker locker(&mutex);
+        isShutDown = true;
+        for (int i = pendingKeys.size() - 1; i >= 0; --i) {
+            if (pendingJobs.value(pendingKeys.at(i)).priority == LowPriority) {
+                pendingJobs.remove(pendingKeys.takeAt(i));
+            }
+        }
+    }
+    threadPool.waitForDone();
+}
+
+int ThumbnailWriter::pendingCount() {
+    QMutexLocker locker(&mutex);
+    return pendingKeys.size() + activeJobs;
+}
+
+void ThumbnailWriter::enqueue(const QString &key, const Job &job) {
+    QMutexLocker locker(&mutex);
+    if (isShutDown) {
+        return;
+    }
+
+    if (pendingJobs.contains(key)) {
+        Job &pendingJob = pendingJobs[key];
+        const Priority priority = qMax(pendingJob.priority, job.priority);
+        pendingJob = job;
+        pendingJob.priority = priority;
+        return;
+    }
+
+    if (pendingKeys.size() >= MAX_PENDING_WRITES) {
+        // Make room by dropping the oldest low priority store, or this one if there is none
+        int dropIndex = -1;
+        for (int i = 0; i < pendingKeys.size(); ++i) {
+            if (pendingJobs.value(pendingKeys.at(i)).priority == LowPriority) {
+                dropIndex = i;
+                break;
+            }
+        }
+        if (dropIndex < 0) {
+            if (job.priority == LowPriority) {
+                return;
+            }
+            dropIndex = 0;
+        }
+        pendingJobs.remove(pendingKeys.takeAt(dropIndex));
+    }
+
+    pendingKeys.append(key);
+    pendingJobs.insert(key, job);
+    Perf::setGauge(Perf::ThumbnailWriterQueue, pendingKeys.size());
+
+    if (!isWorkerRunning) {
+        isWorkerRunning = true;
+        threadPool.start(new Worker(this));
+    }
+}
+
+void ThumbnailWriter::processQueue() {
+    forever {
+        Job job;
+        {
+            QMutexLocker locker(&mutex);
+            activeJobs = 0;
+            if (pendingKeys.isEmpty()) {
+                isWorkerRunning = false;
+                return;
+            }
+            job = pendingJobs.take(pendingKeys.takeFirst());
+            activeJobs = 1;
+            Perf::setGauge(Perf::ThumbnailWriterQueue, pendingKeys.size());
+        }
+
+        Perf::ScopedTimer timer(Perf::ThumbnailStore);
+
+        if (job.pack) {
+            writePackedThumbnail(job);
+        } else {
+            writeThumbnail(job);
+        }
+    }
+}
+
+void ThumbnailWriter::writeThumbnail(Job &job) {
+    const QFileInfo originalInfo(job.originalPath);
+    const QString canonicalPath = originalInfo.canonicalFilePath();
+    if (canonicalPath.isEmpty()) {
+        qWarning() << "Asked to store thumbnail for non-existent path" << job.originalPath;
+        return;
+    }
+
+    if (!job.allSizes) {
+        QString folder;
+        if (ThumbnailLoader::scaleForCache(job.thumbnail, folder)) {
+            writeThumbnailFile(originalInfo, canonicalPath, job.originalSize, folder, job.thumbnail);
+        }
+        return;
+    }
+
+    // Largest first, each one is scaled from the one before
+    QImage thumbnail = job.thumbnail;
+    for (int size : {1024, 512, 256, 128}) {
+        if (qMax(thumbnail.width(), thumbnail.height()) < size) {
+            continue;
+        }
+        QString folder;
+        QImage sizedThumbnail = qMax(thumbnail.width(), thumbnail.height()) > size
+                                ? Resampler::scaled(thumbnail, size, size, Qt::KeepAspectRatio)
+                                : thumbnail;
+        if (!ThumbnailLoader::scaleForCache(sizedThumbnail, folder)) {
+            break;
+        }
+        writeThumbnailFile(originalInfo, canonicalPath, job.originalSize, folder, sizedThumbnail);
+        thumbnail = sizedThumbnail;
+    }
+}
+
+void ThumbnailWriter::writeThumbnailFile(const QFileInfo &originalInfo, const QString &canonicalPath,
+                                         const QSize &originalSize, const QString &folder, QImage &thumbnail) {
+    const QString filename = ThumbnailLoader::thumbnailFileName(originalInfo.filePath());
+    const QString basePath = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) +
+        QLatin1String("/thumbnails/");
+
+    // Only ever touched from the writer thread
+    if (!createdFolders.contains(folder)) {
+        QDir().mkpath(basePath + folder);
+        createdFolders.insert(folder);
+    }
+
+    QDateTime lastModified = originalInfo.lastModified();
+    if (originalInfo.metadataChangeTime() > lastModified) {
+        lastModified = originalInfo.metadataChangeTime();
+    }
+    thumbnail.setText(QStringLiteral("Thumb::MTime"), QString::number(lastModified.toTime_t()));
+
+    QUrl url = QUrl::fromLocalFile(canonicalPath).adjusted(QUrl::RemovePassword);
+    thumbnail.setText(QStringLiteral("Thumb::URI"), url.url());
+
+    thumbnail.setText(QStringLiteral("Thumb::Image::Width"), QString::number(originalSize.width()));
+    thumbnail.setText(QStringLiteral("Thumb::Image::Height"), QString::number(originalSize.height()));
+    thumbnail.setText("Software", "Phototonic");
+    ColorTransforms::convert(thumbnail, QColorSpace(QColorSpace::SRgb));
+
+    // Readers never see a half written thumbnail
+    QSaveFile thumbnailFile(basePath + folder + filename);
+    if (!thumbnailFile.open(QIODevice::WriteOnly) || !thumbnail.save(&thumbnailFile, "PNG")
+        || !thumbnailFile.commit()) {
+        qWarning() << "Unable to store thumbnail" << thumbnailFile.fileName() << thumbnailFile.errorString();
+        return;
+    }
+    ThumbnailCacheIndex::instance()->insert(folder, filename, QFileInfo(thumbnailFile.fileName()).lastModified());
+}
+
+void ThumbnailWriter::writePackedThumbnail(Job &job) {
+    QString folder;
+    if (!ThumbnailLoader::scaleForCache(job.thumbnail, folder)) {
+        return;
+    }
+
+    ColorTransforms::convert(job.thumbnail, QColorSpace(QColorSpace::SRgb));
+    const QByteArray data = PackedThumbnail::encode(job.thumbnail, job.encoding);
+    if (!data.isEmpty()) {
+        job.pack->insert(QFileInfo(job.originalPath).fileName(), job.lastModified, job.fileSize,
+                         job.originalSize, data);
+    }
+}
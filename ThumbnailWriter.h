@@ -0,0 +1,98 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THUMBNAIL_WRITER_H
+#define THUMBNAIL_WRITER_H
+
+#include <QtCore>
+#include <QImage>
+#include <memory>
+#include "ThumbnailPack.h"
+#include "PackedThumbnail.h"
+
+// Write-behind queue for thumbnail cache population. Scaling, color
+// conversion and encoding happen on a single background thread so decoding
+// is never held up by it. Stores for the same path are coalesced.
+class ThumbnailWriter {
+
+public:
+    enum Priority {
+        LowPriority,
+        HighPriority
+    };
+
+    static ThumbnailWriter *instance();
+
+    ~ThumbnailWriter();
+
+    void storeThumbnail(const QString &originalPath, const QImage &thumbnail, const QSize &originalSize,
+                        Priority priority);
+
+    // Stores one copy for every cache size the thumbnail is large enough for, all scaled from it
+    void storeThumbnailSizes(const QString &originalPath, const QImage &thumbnail, const QSize &originalSize,
+                             Priority priority);
+
+    void storePackedThumbnail(const std::shared_ptr<ThumbnailPack> &pack, const QString &originalPath,
+                              qint64 lastModified, qint64 fileSize, const QImage &thumbnail,
+                              const QSize &originalSize, PackedThumbnail::Encoding encoding, Priority priority);
+
+    // Drops pending low priority work and waits for the rest
+    void shutdown();
+
+    // Stores queued or in progress, for producers that should wait before adding more
+    int pendingCount();
+
+private:
+    struct Job {
+        QString originalPath;
+        QImage thumbnail;
+        QSize originalSize;
+        std::shared_ptr<ThumbnailPack> pack;
+        qint64 lastModified = 0;
+        qint64 fileSize = 0;
+        PackedThumbnail::Encoding encoding = PackedThumbnail::Png;
+        bool allSizes = false;
+        Priority priority = LowPriority;
+    };
+
+    class Worker;
+
+    ThumbnailWriter();
+
+    void enqueue(const QString &key, const Job &job);
+
+    void processQueue();
+
+    void writeThumbnail(Job &job);
+
+    void writeThumbnailFile(const QFileInfo &originalInfo, const QString &canonicalPath, const QSize &originalSize,
+                            const QString &folder, QImage &thumbnail);
+
+    void writePackedThumbnail(Job &job);
+
+    QThreadPool threadPool;
+    QMutex mutex;
+    QHash<QString, Job> pendingJobs;
+    QList<QString> pendingKeys;
+    QSet<QString> createdFolders;
+    int activeJobs = 0;
+    bool isWorkerRunning = false;
+    bool isShutDown = false;
+};
+
+#endif // THUMBNAIL_WRITER_H
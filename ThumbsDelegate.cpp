@@ -0,0 +1,132 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ThumbsDelegate.h"
+
+#define MAX_ELIDED_NAMES 4096
+#define TEXT_MARGIN 2
+
+ThumbsDelegate::ThumbsDelegate(ThumbsModel *model, QObject *parent)
+    : QStyledItemDelegate(parent), model(model), fontMetrics(cachedFont) {
+}
+
+void ThumbsDelegate::clearCache() {
+    elidedNames.clear();
+}
+
+// Names that do not fit on the last line are elided, the ones before it are broken wherever the width runs out
+const QVector<QStaticText> &ThumbsDelegate::elidedName(const QString &fileName, int width, int lineCount) const {
+    if (width != cachedWidth || lineCount != cachedLineCount || elidedNames.size() >= MAX_ELIDED_NAMES) {
+        cachedWidth = width;
+        cachedLineCount = lineCount;
+        elidedNames.clear();
+    }
+
+    QHash<QString, QVector<QStaticText>>::const_iterator it = elidedNames.constFind(fileName);
+    if (it != elidedNames.constEnd()) {
+        return *it;
+    }
+
+    QVector<QStaticText> lines;
+    QString remaining = fileName;
+    for (int line = 0; line < lineCount && !remaining.isEmpty(); ++line) {
+        QString lineText;
+        if (line == lineCount - 1 || fontMetrics.horizontalAdvance(remaining) <= width) {
+            lineText = fontMetrics.elidedText(remaining, Qt::ElideRight, width);
+            remaining.clear();
+        } else {
+            int length = 1;
+            while (length < remaining.size() && fontMetrics.horizontalAdvance(remaining.left(length + 1)) <= width) {
+                ++length;
+            }
+            lineText = remaining.left(length);
+            remaining.remove(0, length);
+        }
+
+        QStaticText staticText(lineText);
+        staticText.setTextFormat(Qt::PlainText);
+        staticText.prepare(QTransform(), cachedFont);
+        lines.append(staticText);
+    }
+    return *elidedNames.insert(fileName, lines);
+}
+
+void ThumbsDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const {
+    const QWidget *widget = option.widget;
+    QStyle *style = widget ? widget->style() : QApplication::style();
+    const bool isSelected = option.state & QStyle::State_Selected;
+    const int row = index.row();
+
+    style->drawPrimitive(QStyle::PE_PanelItemViewItem, &option, painter, widget);
+
+    // The thumbnail is centered in an icon sized box at the top, like the default delegate lays it out
+    const QRect iconRect(option.rect.left(), option.rect.top(), option.rect.width(),
+                         qMin(option.decorationSize.height(), option.rect.height()));
+    const QPixmap &thumbnail = model->shownThumbnail(row);
+    if (!thumbnail.isNull()) {
+        QSize thumbnailSize = thumbnail.size() / thumbnail.devicePixelRatio();
+        if (thumbnailSize.width() > iconRect.width() || thumbnailSize.height() > iconRect.height()) {
+            thumbnailSize.scale(iconRect.size(), Qt::KeepAspectRatio);
+        }
+        const QRect thumbnailRect = QStyle::alignedRect(option.direction, Qt::AlignCenter, thumbnailSize, iconRect);
+        painter->drawPixmap(thumbnailRect, thumbnail);
+        if (isSelected) {
+            // What QIcon::Selected would have done
+            QColor highlight = option.palette.color(QPalette::Normal, QPalette::Highlight);
+            highlight.setAlphaF(0.3);
+            painter->fillRect(thumbnailRect, highlight);
+        }
+    }
+
+    if (model->isShowingFileNames()) {
+        if (option.font != cachedFont) {
+            cachedFont = option.font;
+            fontMetrics = QFontMetrics(cachedFont);
+            elidedNames.clear();
+        }
+        const QRect textRect = option.rect.adjusted(TEXT_MARGIN, iconRect.height() + TEXT_MARGIN, -TEXT_MARGIN, 0);
+        const int lineCount = qMax(1, textRect.height() / fontMetrics.lineSpacing());
+        const QVector<QStaticText> &lines = elidedName(model->fileName(row), textRect.width(), lineCount);
+
+        painter->save();
+        painter->setFont(cachedFont);
+        painter->setPen(option.palette.color(option.state & QStyle::State_Enabled ? QPalette::Normal
+                                                                                   : QPalette::Disabled,
+                                             isSelected ? QPalette::HighlightedText : QPalette::Text));
+        int y = textRect.top();
+        for (const QStaticText &line : lines) {
+            const int x = textRect.left() + (textRect.width() - qCeil(line.size().width())) / 2;
+            painter->drawStaticText(x, y, line);
+            y += fontMetrics.lineSpacing();
+        }
+        painter->restore();
+    }
+
+    if (option.state & QStyle::State_HasFocus) {
+        QStyleOptionFocusRect focusOption;
+        focusOption.QStyleOption::operator=(option);
+        focusOption.backgroundColor = option.palette.color(isSelected ? QPalette::Highlight : QPalette::Window);
+        style->drawPrimitive(QStyle::PE_FrameFocusRect, &focusOption, painter, widget);
+    }
+}
+
+QSize ThumbsDelegate::sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const {
+    const QSize itemSize = model->itemSize();
+    return itemSize.isValid() ? itemSize : QStyledItemDelegate::sizeHint(option, index);
+}
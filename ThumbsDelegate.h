@@ -0,0 +1,54 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef THUMBS_DELEGATE_H
+#define THUMBS_DELEGATE_H
+
+#include <QtWidgets>
+#include "ThumbsModel.h"
+
+// Paints thumbnails straight from the model's pixmap cache. The default
+// delegate would wrap every pixmap in a QIcon on each paint and lay the item
+// out through the style; this one only asks the style for the panel. File
+// names are elided once per name and width and kept as QStaticText.
+class ThumbsDelegate : public QStyledItemDelegate {
+Q_OBJECT
+
+public:
+    ThumbsDelegate(ThumbsModel *model, QObject *parent = nullptr);
+
+    void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+
+    QSize sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+
+    // Drops the elided names, for when the layout changes
+    void clearCache();
+
+private:
+    const QVector<QStaticText> &elidedName(const QString &fileName, int width, int lineCount) const;
+
+    ThumbsModel *model;
+    mutable QFont cachedFont;
+    mutable QFontMetrics fontMetrics;
+    mutable int cachedWidth = 0;
+    mutable int cachedLineCount = 0;
+    mutable QHash<QString, QVector<QStaticText>> elidedNames;
+};
+
+#endif // THUMBS_DELEGATE_H
@@ -0,0 +1,573 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <numeric>
+#include "ThumbsModel.h"
+#include "DirectoryEntries.h"
+
+template <typename T>
+static void permute(T &values, const QVector<int> &order) {
+    T permuted;
+    permuted.reserve(order.size());
+    for (int row : order) {
+        permuted.push_back(values[row]);
+    }
+    values.swap(permuted);
+}
+
+template <typename T>
+static void eraseRows(T &values, int row, int count) {
+    values.erase(values.begin() + row, values.begin() + row + count);
+}
+
+// Ranges are sorted, disjoint and hold (first row, count)
+template <typename T>
+static void eraseRanges(T &values, const QVector<QPair<int, int>> &ranges) {
+    int writeRow = ranges.first().first;
+    for (int i = 0; i < ranges.size(); ++i) {
+        const int keptBegin = ranges.at(i).first + ranges.at(i).second;
+        const int keptEnd = i + 1 < ranges.size() ? ranges.at(i + 1).first : int(values.size());
+        std::move(values.begin() + keptBegin, values.begin() + keptEnd, values.begin() + writeRow);
+        writeRow += keptEnd - keptBegin;
+    }
+    values.erase(values.begin() + writeRow, values.end());
+}
+
+// Stable like QStandardItemModel, so equal keys keep their relative order
+template <typename T>
+static void sortRows(QVector<int> &rows, const T &keys, Qt::SortOrder order) {
+    if (order == Qt::AscendingOrder) {
+        std::stable_sort(rows.begin(), rows.end(), [&](int a, int b) { return keys[a] < keys[b]; });
+    } else {
+        std::stable_sort(rows.begin(), rows.end(), [&](int a, int b) { return keys[b] < keys[a]; });
+    }
+}
+
+// Everything up to and including the last separator, so that joining it back
+// with the file name gives the path exactly as it was added
+static QString directoryOf(const QString &filePath) {
+    return filePath.left(filePath.lastIndexOf(QLatin1Char('/')) + 1);
+}
+
+static QString suffixOf(const QString &fileName) {
+    const int dot = fileName.lastIndexOf(QLatin1Char('.'));
+    return dot < 0 ? QString() : fileName.mid(dot + 1);
+}
+
+ThumbsModel::ThumbsModel(QObject *parent) : QAbstractListModel(parent) {
+}
+
+int ThumbsModel::rowCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : fileNames.size();
+}
+
+QVariant ThumbsModel::data(const QModelIndex &index, int role) const {
+    if (!index.isValid() || index.row() >= fileNames.size()) {
+        return QVariant();
+    }
+
+    const int row = index.row();
+    switch (role) {
+        case Qt::DisplayRole:
+            return showFileNames ? fileNames.at(row) : QVariant();
+        case Qt::TextAlignmentRole:
+            return showFileNames ? QVariant(int(Qt::AlignTop | Qt::AlignHCenter)) : QVariant();
+        case Qt::DecorationRole: {
+            QHash<quint32, CachedThumbnail>::const_iterator it = thumbnails.constFind(thumbIds.at(row));
+            return it == thumbnails.constEnd() ? QVariant() : QVariant(shownPixmap(*it));
+        }
+        case Qt::SizeHintRole:
+            return itemSizeHint.isValid() ? QVariant(itemSizeHint) : QVariant();
+        case FileNameRole:
+            return filePath(row);
+        case SortRole:
+            return sortValues.at(row);
+        case LoadedRole:
+            return thumbnails.contains(thumbIds.at(row));
+        case BrightnessRole:
+            return std::isnan(brightnessValues.at(row)) ? QVariant() : QVariant(qreal(brightnessValues.at(row)));
+        case TypeRole:
+            return suffixOf(fileNames.at(row));
+        case SizeRole:
+            return fileSize(row);
+        case TimeRole:
+            return QDateTime::fromMSecsSinceEpoch(lastModified(row));
+        default:
+            return QVariant();
+    }
+}
+
+bool ThumbsModel::setData(const QModelIndex &index, const QVariant &value, int role) {
+    if (!index.isValid() || index.row() >= fileNames.size()) {
+        return false;
+    }
+
+    const int row = index.row();
+    switch (role) {
+        case Qt::DisplayRole:
+        case Qt::EditRole:
+            // Always derived from the file name
+            return true;
+        case Qt::DecorationRole:
+            insertThumbnail(thumbIds.at(row), value.value<QPixmap>(), thumbnailSize);
+            break;
+        case FileNameRole: {
+            const QString filePath = value.toString();
+            const QString directory = directoryOf(filePath);
+            rowDirectories[row] = internDirectory(directory);
+            fileNames[row] = filePath.mid(directory.size());
+            break;
+        }
+        case SortRole:
+            sortValues[row] = value.toInt();
+            break;
+        case LoadedRole:
+            // Rows are loaded by giving them a thumbnail
+            if (value.toBool()) {
+                return false;
+            }
+            removeThumbnail(thumbIds.at(row));
+            break;
+        case BrightnessRole:
+            brightnessValues[row] = value.isValid() ? float(value.toReal()) : NAN;
+            break;
+        case SizeRole:
+            fileSizes[row] = value.toLongLong();
+            break;
+        case TimeRole:
+            modifiedTimes[row] = value.toDateTime().toMSecsSinceEpoch();
+            break;
+        default:
+            return false;
+    }
+
+    emitRowChanged(row);
+    return true;
+}
+
+Qt::ItemFlags ThumbsModel::flags(const QModelIndex &index) const {
+    if (!index.isValid()) {
+        return Qt::NoItemFlags;
+    }
+    return Qt::ItemIsEnabled | Qt::ItemIsSelectable | Qt::ItemIsDragEnabled;
+}
+
+bool ThumbsModel::removeRows(int row, int count, const QModelIndex &parent) {
+    if (parent.isValid() || row < 0 || count <= 0 || row + count > fileNames.size()) {
+        return false;
+    }
+
+    beginRemoveRows(QModelIndex(), row, row + count - 1);
+    for (int i = row; i < row + count; ++i) {
+        removeThumbnail(thumbIds.at(i));
+    }
+    eraseRows(thumbIds, row, count);
+    eraseRows(rowDirectories, row, count);
+    eraseRows(fileNames, row, count);
+    eraseRows(fileSizes, row, count);
+    eraseRows(modifiedTimes, row, count);
+    eraseRows(sortValues, row, count);
+    eraseRows(brightnessValues, row, count);
+    endRemoveRows();
+    return true;
+}
+
+void ThumbsModel::removeRowList(const QList<int> &rows) {
+    QList<int> sortedRows = rows;
+    std::sort(sortedRows.begin(), sortedRows.end());
+    sortedRows.erase(std::unique(sortedRows.begin(), sortedRows.end()), sortedRows.end());
+    while (!sortedRows.isEmpty() && sortedRows.first() < 0) {
+        sortedRows.removeFirst();
+    }
+    while (!sortedRows.isEmpty() && sortedRows.last() >= fileNames.size()) {
+        sortedRows.removeLast();
+    }
+    if (sortedRows.isEmpty()) {
+        return;
+    }
+
+    QVector<QPair<int, int>> ranges;
+    for (int row : sortedRows) {
+        if (!ranges.isEmpty() && ranges.last().first + ranges.last().second == row) {
+            ++ranges.last().second;
+        } else {
+            ranges.append(qMakePair(row, 1));
+        }
+    }
+
+    if (ranges.size() == 1) {
+        removeRows(ranges.first().first, ranges.first().second);
+        return;
+    }
+
+    // One pass over the rows instead of one removal, and one view update, per range
+    emit layoutAboutToBeChanged();
+
+    QVector<int> newRows(fileNames.size());
+    int removedRows = 0;
+    int keptRow = 0;
+    for (const QPair<int, int> &range : ranges) {
+        for (; keptRow < range.first; ++keptRow) {
+            newRows[keptRow] = keptRow - removedRows;
+        }
+        for (int row = range.first; row < range.first + range.second; ++row) {
+            removeThumbnail(thumbIds.at(row));
+            newRows[row] = -1;
+        }
+        removedRows += range.second;
+        keptRow = range.first + range.second;
+    }
+    for (; keptRow < newRows.size(); ++keptRow) {
+        newRows[keptRow] = keptRow - removedRows;
+    }
+
+    const QModelIndexList oldIndexes = persistentIndexList();
+    QModelIndexList newIndexes;
+    newIndexes.reserve(oldIndexes.size());
+    for (const QModelIndex &oldIndex : oldIndexes) {
+        const int newRow = newRows.at(oldIndex.row());
+        newIndexes.append(newRow < 0 ? QModelIndex() : index(newRow, 0));
+    }
+
+    eraseRanges(thumbIds, ranges);
+    eraseRanges(rowDirectories, ranges);
+    eraseRanges(fileNames, ranges);
+    eraseRanges(fileSizes, ranges);
+    eraseRanges(modifiedTimes, ranges);
+    eraseRanges(sortValues, ranges);
+    eraseRanges(brightnessValues, ranges);
+
+    changePersistentIndexList(oldIndexes, newIndexes);
+    emit layoutChanged();
+}
+
+void ThumbsModel::sort(int column, Qt::SortOrder order) {
+    if (column != 0 || fileNames.size() < 2) {
+        return;
+    }
+
+    QVector<int> newOrder(fileNames.size());
+    std::iota(newOrder.begin(), newOrder.end(), 0);
+
+    switch (currentSortRole) {
+        case TimeRole:
+            readAttributes();
+            sortRows(newOrder, modifiedTimes, order);
+            break;
+        case SizeRole:
+            readAttributes();
+            sortRows(newOrder, fileSizes, order);
+            break;
+        case TypeRole: {
+            QVector<QString> suffixes;
+            suffixes.reserve(fileNames.size());
+            for (const QString &fileName : fileNames) {
+                suffixes.append(suffixOf(fileName));
+            }
+            sortRows(newOrder, suffixes, order);
+            break;
+        }
+        case Qt::DisplayRole:
+        case FileNameRole:
+            sortRows(newOrder, fileNames, order);
+            break;
+        default:
+            sortRows(newOrder, sortValues, order);
+            break;
+    }
+
+    emit layoutAboutToBeChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+
+    QVector<int> newRows(newOrder.size());
+    for (int newRow = 0; newRow < newOrder.size(); ++newRow) {
+        newRows[newOrder.at(newRow)] = newRow;
+    }
+    const QModelIndexList oldIndexes = persistentIndexList();
+    QModelIndexList newIndexes;
+    newIndexes.reserve(oldIndexes.size());
+    for (const QModelIndex &oldIndex : oldIndexes) {
+        newIndexes.append(index(newRows.at(oldIndex.row()), 0));
+    }
+
+    permute(thumbIds, newOrder);
+    permute(rowDirectories, newOrder);
+    permute(fileNames, newOrder);
+    permute(fileSizes, newOrder);
+    permute(modifiedTimes, newOrder);
+    permute(sortValues, newOrder);
+    permute(brightnessValues, newOrder);
+
+    changePersistentIndexList(oldIndexes, newIndexes);
+    emit layoutChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+}
+
+void ThumbsModel::setSortRole(int role) {
+    currentSortRole = role;
+}
+
+int ThumbsModel::sortRole() const {
+    return currentSortRole;
+}
+
+int ThumbsModel::appendThumb(const QFileInfo &fileInfo, int sortValue, bool withAttributes) {
+    const int row = fileNames.size();
+    beginInsertRows(QModelIndex(), row, row);
+    thumbIds.append(nextThumbId++);
+    const QString filePath = fileInfo.filePath();
+    const QString directory = directoryOf(filePath);
+    rowDirectories.append(internDirectory(directory));
+    fileNames.append(filePath.mid(directory.size()));
+    fileSizes.append(withAttributes ? fileInfo.size() : -1);
+    modifiedTimes.append(withAttributes ? fileInfo.lastModified().toMSecsSinceEpoch() : -1);
+    sortValues.append(sortValue);
+    brightnessValues.append(NAN);
+    endInsertRows();
+    return row;
+}
+
+void ThumbsModel::clear() {
+    beginResetModel();
+    directories.clear();
+    directoryIds.clear();
+    thumbIds.clear();
+    rowDirectories.clear();
+    fileNames.clear();
+    fileSizes.clear();
+    modifiedTimes.clear();
+    sortValues.clear();
+    brightnessValues.clear();
+    thumbnails.clear();
+    thumbnailsLru.clear();
+    visibleThumbIds.clear();
+    thumbnailMemoryUsed = 0;
+    endResetModel();
+}
+
+void ThumbsModel::setShowFileNames(bool showFileNames) {
+    this->showFileNames = showFileNames;
+}
+
+void ThumbsModel::setItemSizeHint(const QSize &sizeHint) {
+    itemSizeHint = sizeHint;
+}
+
+QString ThumbsModel::filePath(int row) const {
+    if (row < 0 || row >= fileNames.size()) {
+        return QString();
+    }
+    return directories.at(rowDirectories.at(row)) + fileNames.at(row);
+}
+
+QString ThumbsModel::fileName(int row) const {
+    return fileNames.value(row);
+}
+
+qint64 ThumbsModel::fileSize(int row) const {
+    readAttributes(row);
+    return fileSizes.value(row);
+}
+
+qint64 ThumbsModel::lastModified(int row) const {
+    readAttributes(row);
+    return modifiedTimes.value(row);
+}
+
+void ThumbsModel::readAttributes(int row) const {
+    if (row < 0 || row >= fileSizes.size() || (fileSizes.at(row) >= 0 && modifiedTimes.at(row) >= 0)) {
+        return;
+    }
+    const QFileInfo fileInfo(filePath(row));
+    fileSizes[row] = fileInfo.size();
+    modifiedTimes[row] = fileInfo.exists() ? fileInfo.lastModified().toMSecsSinceEpoch() : 0;
+}
+
+void ThumbsModel::readAttributes() {
+    QVector<int> rows;
+    QStringList filePaths;
+    for (int row = 0; row < fileSizes.size(); ++row) {
+        if (fileSizes.at(row) < 0 || modifiedTimes.at(row) < 0) {
+            rows.append(row);
+            filePaths.append(filePath(row));
+        }
+    }
+    if (rows.isEmpty()) {
+        return;
+    }
+
+    QVector<qint64> sizes;
+    QVector<qint64> times;
+    DirectoryEntries::readAttributes(filePaths, sizes, times);
+    for (int i = 0; i < rows.size(); ++i) {
+        fileSizes[rows.at(i)] = sizes.at(i);
+        modifiedTimes[rows.at(i)] = times.at(i);
+    }
+}
+
+bool ThumbsModel::isLoaded(int row) const {
+    return row >= 0 && row < fileNames.size() && thumbnails.contains(thumbIds.at(row));
+}
+
+QPixmap ThumbsModel::thumbnail(int row) const {
+    if (row < 0 || row >= fileNames.size()) {
+        return QPixmap();
+    }
+    return thumbnails.value(thumbIds.at(row)).pixmap;
+}
+
+const QPixmap &ThumbsModel::shownThumbnail(int row) const {
+    static const QPixmap noThumbnail;
+    if (row < 0 || row >= fileNames.size()) {
+        return noThumbnail;
+    }
+    QHash<quint32, CachedThumbnail>::const_iterator it = thumbnails.constFind(thumbIds.at(row));
+    return it == thumbnails.constEnd() ? noThumbnail : shownPixmap(*it);
+}
+
+bool ThumbsModel::isShowingFileNames() const {
+    return showFileNames;
+}
+
+QSize ThumbsModel::itemSize() const {
+    return itemSizeHint;
+}
+
+void ThumbsModel::setThumbnail(int row, const QPixmap &pixmap, bool isScalable) {
+    if (row < 0 || row >= fileNames.size()) {
+        return;
+    }
+    insertThumbnail(thumbIds.at(row), pixmap, isScalable ? thumbnailSize : 0);
+    emitRowChanged(row);
+}
+
+void ThumbsModel::setThumbnailSize(int size) {
+    if (size == thumbnailSize) {
+        return;
+    }
+    thumbnailSize = size;
+    for (CachedThumbnail &thumbnail : thumbnails) {
+        thumbnailMemoryUsed -= thumbnail.scaledCost;
+        thumbnail.scaledPixmap = QPixmap();
+        thumbnail.scaledCost = 0;
+    }
+    if (!fileNames.isEmpty()) {
+        emit dataChanged(index(0, 0), index(fileNames.size() - 1, 0), {Qt::DecorationRole});
+    }
+}
+
+bool ThumbsModel::needsRefinement(int row) const {
+    if (row < 0 || row >= fileNames.size()) {
+        return false;
+    }
+    QHash<quint32, CachedThumbnail>::const_iterator it = thumbnails.constFind(thumbIds.at(row));
+    return it != thumbnails.constEnd() && it->decodedSize && it->decodedSize < thumbnailSize;
+}
+
+// Only rows that are painted get scaled, their cost counts from then on
+const QPixmap &ThumbsModel::shownPixmap(const CachedThumbnail &thumbnail) const {
+    if (!thumbnail.decodedSize || thumbnail.decodedSize == thumbnailSize || thumbnail.pixmap.isNull()) {
+        return thumbnail.pixmap;
+    }
+    if (thumbnail.scaledPixmap.isNull()) {
+        const qreal factor = qreal(thumbnailSize) / thumbnail.decodedSize;
+        thumbnail.scaledPixmap = thumbnail.pixmap.scaled(qMax(1, qRound(thumbnail.pixmap.width() * factor)),
+                                                         qMax(1, qRound(thumbnail.pixmap.height() * factor)),
+                                                         Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+        thumbnail.scaledCost = qint64(thumbnail.scaledPixmap.width()) * thumbnail.scaledPixmap.height()
+                               * thumbnail.scaledPixmap.depth() / 8;
+        thumbnailMemoryUsed += thumbnail.scaledCost;
+    }
+    return thumbnail.scaledPixmap;
+}
+
+void ThumbsModel::touchThumbnails(int firstRow, int lastRow) {
+    visibleThumbIds.clear();
+    firstRow = qMax(firstRow, 0);
+    lastRow = qMin(lastRow, fileNames.size() - 1);
+    for (int row = firstRow; row <= lastRow; ++row) {
+        const quint32 thumbId = thumbIds.at(row);
+        visibleThumbIds.insert(thumbId);
+
+        QHash<quint32, CachedThumbnail>::iterator it = thumbnails.find(thumbId);
+        if (it != thumbnails.end()) {
+            thumbnailsLru.splice(thumbnailsLru.begin(), thumbnailsLru, it->lruPosition);
+        }
+    }
+}
+
+void ThumbsModel::setThumbnailMemoryLimit(qint64 bytes) {
+    thumbnailMemoryLimit = bytes;
+    evictThumbnails();
+}
+
+qint64 ThumbsModel::thumbnailMemoryUsage() const {
+    return thumbnailMemoryUsed;
+}
+
+void ThumbsModel::insertThumbnail(quint32 thumbId, const QPixmap &pixmap, int decodedSize) {
+    removeThumbnail(thumbId);
+
+    thumbnailsLru.push_front(thumbId);
+    const qint64 cost = qint64(pixmap.width()) * pixmap.height() * pixmap.depth() / 8;
+    thumbnails.insert(thumbId, {pixmap, cost, thumbnailsLru.begin(), decodedSize, QPixmap(), 0});
+    thumbnailMemoryUsed += cost;
+    evictThumbnails();
+}
+
+void ThumbsModel::removeThumbnail(quint32 thumbId) {
+    QHash<quint32, CachedThumbnail>::iterator it = thumbnails.find(thumbId);
+    if (it == thumbnails.end()) {
+        return;
+    }
+    thumbnailMemoryUsed -= it->cost + it->scaledCost;
+    thumbnailsLru.erase(it->lruPosition);
+    thumbnails.erase(it);
+}
+
+void ThumbsModel::evictThumbnails() {
+    if (thumbnailMemoryLimit <= 0) {
+        return;
+    }
+
+    // Walk from the least recently used end, rows on screen are never dropped
+    std::list<quint32>::iterator it = thumbnailsLru.end();
+    while (thumbnailMemoryUsed > thumbnailMemoryLimit && it != thumbnailsLru.begin()) {
+        --it;
+        if (visibleThumbIds.contains(*it)) {
+            continue;
+        }
+        const quint32 thumbId = *it;
+        ++it;
+        removeThumbnail(thumbId);
+    }
+}
+
+int ThumbsModel::internDirectory(const QString &directory) {
+    QHash<QString, int>::const_iterator it = directoryIds.constFind(directory);
+    if (it != directoryIds.constEnd()) {
+        return it.value();
+    }
+    directories.append(directory);
+    directoryIds.insert(directory, directories.size() - 1);
+    return directories.size() - 1;
+}
+
+void ThumbsModel::emitRowChanged(int row) {
+    const QModelIndex changedIndex = index(row, 0);
+    emit dataChanged(changedIndex, changedIndex);
+}
@@ -0,0 +1,169 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THUMBS_MODEL_H
+#define THUMBS_MODEL_H
+
+#include <QtWidgets>
+#include <list>
+
+// List model for the thumbnail view. Rows are kept as a struct of arrays
+// rather than one QStandardItem per image: directories are interned, sizes
+// and times are stored as plain integers and thumbnails live in a separate
+// cache keyed by a per-row id that survives sorting.
+//
+// The thumbnail cache is bounded by a memory budget. Least recently shown
+// thumbnails are evicted first, which turns their rows back to unloaded so
+// the view requests them again when they scroll into sight.
+class ThumbsModel : public QAbstractListModel {
+Q_OBJECT
+
+public:
+    enum Roles {
+        FileNameRole = Qt::UserRole + 1,
+        SortRole,
+        LoadedRole,
+        BrightnessRole,
+        TypeRole,
+        SizeRole,
+        TimeRole,
+        HistogramRole
+    };
+
+    explicit ThumbsModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    bool setData(const QModelIndex &index, const QVariant &value, int role = Qt::EditRole) override;
+
+    Qt::ItemFlags flags(const QModelIndex &index) const override;
+
+    bool removeRows(int row, int count, const QModelIndex &parent = QModelIndex()) override;
+
+    // Removes any number of rows, in any order, with a single layout change
+    void removeRowList(const QList<int> &rows);
+
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+
+    void setSortRole(int role);
+
+    int sortRole() const;
+
+    // Without attributes, the size and modification time are read when something first asks for them
+    int appendThumb(const QFileInfo &fileInfo, int sortValue, bool withAttributes = true);
+
+    // Reads every attribute still missing, many files at once
+    void readAttributes();
+
+    void clear();
+
+    void setShowFileNames(bool showFileNames);
+
+    void setItemSizeHint(const QSize &sizeHint);
+
+    QString filePath(int row) const;
+
+    QString fileName(int row) const;
+
+    qint64 fileSize(int row) const;
+
+    qint64 lastModified(int row) const;
+
+    bool isLoaded(int row) const;
+
+    // The largest one decoded, whatever size it is shown at
+    QPixmap thumbnail(int row) const;
+
+    // The thumbnail as it is painted, scaled to the current size. Null if the row is not loaded.
+    const QPixmap &shownThumbnail(int row) const;
+
+    bool isShowingFileNames() const;
+
+    QSize itemSize() const;
+
+    // Also marks the row as loaded. Thumbnails that are not scalable, such as error icons, keep their size.
+    void setThumbnail(int row, const QPixmap &pixmap, bool isScalable = true);
+
+    // The size thumbnails are shown at. Those decoded for a larger one are scaled down from
+    // memory, smaller ones are scaled up until a sharper one replaces them.
+    void setThumbnailSize(int size);
+
+    // Shown scaled up from a thumbnail decoded for a smaller size
+    bool needsRefinement(int row) const;
+
+    // Marks the rows as most recently used and keeps them from being evicted
+    void touchThumbnails(int firstRow, int lastRow);
+
+    void setThumbnailMemoryLimit(qint64 bytes);
+
+    qint64 thumbnailMemoryUsage() const;
+
+private:
+    struct CachedThumbnail {
+        QPixmap pixmap;
+        qint64 cost;
+        std::list<quint32>::iterator lruPosition;
+        // The thumbnail size it was decoded for, 0 if it is never scaled
+        int decodedSize;
+        // Made on first use, for when it was decoded for another size
+        mutable QPixmap scaledPixmap;
+        mutable qint64 scaledCost;
+    };
+
+    int internDirectory(const QString &directory);
+
+    void readAttributes(int row) const;
+
+    void insertThumbnail(quint32 thumbId, const QPixmap &pixmap, int decodedSize);
+
+    const QPixmap &shownPixmap(const CachedThumbnail &thumbnail) const;
+
+    void removeThumbnail(quint32 thumbId);
+
+    void evictThumbnails();
+
+    void emitRowChanged(int row);
+
+    QStringList directories;
+    QHash<QString, int> directoryIds;
+
+    QVector<quint32> thumbIds;
+    QVector<int> rowDirectories;
+    QVector<QString> fileNames;
+    // -1 until read
+    mutable QVector<qint64> fileSizes;
+    mutable QVector<qint64> modifiedTimes;
+    QVector<int> sortValues;
+    QVector<float> brightnessValues;
+
+    QHash<quint32, CachedThumbnail> thumbnails;
+    std::list<quint32> thumbnailsLru;
+    QSet<quint32> visibleThumbIds;
+    qint64 thumbnailMemoryLimit = 0;
+    mutable qint64 thumbnailMemoryUsed = 0;
+    int thumbnailSize = 0;
+    quint32 nextThumbId = 0;
+
+    int currentSortRole = SortRole;
+    bool showFileNames = true;
+    QSize itemSizeHint;
+};
+
+#endif // THUMBS_MODEL_H
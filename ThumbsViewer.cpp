@@ -23,8 +23,17 @@
 #include "ThumbsViewer.h"
 #include "Phototonic.h"
 #include "SmartCrop.h"
+#include "ThumbnailWriter.h"
+#include "VisibleRange.h"
+#include "SimilarityOrder.h"
+#include "StartupTimer.h"
+#include "PerfCounters.h"
+#include "ExifPreview.h"
+#include "DirectoryEntries.h"
+#include "MetadataDatabase.h"
 
 #define BATCH_SIZE 10
+#define IMAGE_INFO_CACHE_SIZE 64
 
 ThumbsViewer::ThumbsViewer(QWidget *parent, const std::shared_ptr<MetadataCache> &metadataCache) : QListView(parent) {
     this->metadataCache = metadataCache;
@@ -49,14 +58,18 @@ ThumbsViewer::ThumbsViewer(QWidget *parent, const std::shared_ptr<MetadataCache>
     // QAbstractItemView::ScrollPerPixel instead.
     setVerticalScrollMode(QAbstractItemView::ScrollPerItem);
 
-    thumbsViewerModel = new QStandardItemModel(this);
+    thumbsViewerModel = new ThumbsModel(this);
     thumbsViewerModel->setSortRole(SortRole);
     setModel(thumbsViewerModel);
+    thumbsDelegate = new ThumbsDelegate(thumbsViewerModel, this);
+    setItemDelegate(thumbsDelegate);
 
     m_selectionChangedTimer.setInterval(10);
     m_selectionChangedTimer.setSingleShot(true);
     connect(&m_selectionChangedTimer, &QTimer::timeout, this, &ThumbsViewer::onSelectionChanged);
-    connect(this->selectionModel(), &QItemSelectionModel::selectionChanged, this, [=]() {
+    connect(this->selectionModel(), &QItemSelectionModel::selectionChanged, this,
+            [=](const QItemSelection &selected, const QItemSelection &deselected) {
+        imageTags->updateSelectionTags(selected, deselected);
         if (!m_selectionChangedTimer.isActive()) {
             m_selectionChangedTimer.start();
         }
@@ -65,6 +78,36 @@ ThumbsViewer::ThumbsViewer(QWidget *parent, const std::shared_ptr<MetadataCache>
     m_loadThumbTimer.setInterval(10);
     m_loadThumbTimer.setSingleShot(true);
     connect(&m_loadThumbTimer, &QTimer::timeout, this, &ThumbsViewer::loadThumbsRange);
+
+    // Changes come in bursts while files are being copied in, handle them once it settles
+    directoryWatcher = new QFileSystemWatcher(this);
+    directoryChangedTimer.setInterval(500);
+    directoryChangedTimer.setSingleShot(true);
+    connect(directoryWatcher, &QFileSystemWatcher::directoryChanged, this, [this]() {
+        directoryChangedTimer.start();
+    });
+    connect(&directoryChangedTimer, &QTimer::timeout, this, &ThumbsViewer::refreshChangedDirectory);
+
+    thumbnailLoader = new ThumbnailLoader(metadataCache, this);
+    connect(thumbnailLoader, &ThumbnailLoader::thumbnailLoaded, this, &ThumbsViewer::onThumbnailLoaded);
+    connect(thumbnailLoader, &ThumbnailLoader::thumbnailFailed, this, &ThumbsViewer::onThumbnailFailed);
+
+    metadataScanner = new MetadataScanner(metadataCache, this);
+    connect(metadataScanner, &MetadataScanner::metadataScanned, this, &ThumbsViewer::onMetadataScanned);
+
+    imageInfoReader = new ImageInfoReader(metadataCache, this);
+    connect(imageInfoReader, &ImageInfoReader::infoRead, this, &ThumbsViewer::onImageInfoRead);
+    imageInfoCache.setMaxCost(IMAGE_INFO_CACHE_SIZE);
+    featureStore.setHistogramsKept(Settings::preciseSimilarity);
+    duplicateHasher = new DuplicateHasher(this);
+    connect(duplicateHasher, &DuplicateHasher::hashesComputed, this, &ThumbsViewer::onDuplicateHashesComputed);
+    identicalFileFinder = new IdenticalFileFinder(this);
+    connect(identicalFileFinder, &IdenticalFileFinder::filesGrouped, this, &ThumbsViewer::onIdenticalFilesGrouped);
+    brightnessScanner = new BrightnessScanner(this);
+    connect(brightnessScanner, &BrightnessScanner::brightnessComputed, this, &ThumbsViewer::onBrightnessComputed);
+    directoryCrawler = new DirectoryCrawler(this);
+    connect(directoryCrawler, &DirectoryCrawler::filesListed, this, &ThumbsViewer::onFilesListed);
+    connect(directoryCrawler, &DirectoryCrawler::finished, this, &ThumbsViewer::onCrawlFinished);
     connect(this, SIGNAL(doubleClicked(
                                  const QModelIndex &)), parent, SLOT(loadSelectedThumbImage(
                                                                              const QModelIndex &)));
@@ -74,7 +117,13 @@ ThumbsViewer::ThumbsViewer(QWidget *parent, const std::shared_ptr<MetadataCache>
     phototonic = (Phototonic *) parent;
     infoView = new InfoView(this);
 
-    imagePreview = new ImagePreview(this);
+    imagePreview = new ImagePreview(this, metadataCache);
+    connect(imagePreview, &ImagePreview::imageLoaded, this, [this](const QPixmap &pixmap) {
+        if (Settings::setWindowIcon && Settings::layoutMode == Phototonic::ThumbViewWidget) {
+            phototonic->setWindowIcon(pixmap.scaled(WINDOW_ICON_SIZE, WINDOW_ICON_SIZE,
+                                                    Qt::KeepAspectRatio, Qt::SmoothTransformation));
+        }
+    });
 }
 
 void ThumbsViewer::setThumbColors() {
@@ -137,8 +186,7 @@ void ThumbsViewer::selectCurrentIndex() {
 
 QString ThumbsViewer::getSingleSelectionFilename() {
     if (selectionModel()->selectedIndexes().size() == 1)
-        return thumbsViewerModel->item(selectionModel()->selectedIndexes().first().row())->data(
-                FileNameRole).toString();
+        return thumbsViewerModel->filePath(selectionModel()->selectedIndexes().first().row());
 
     return ("");
 }
@@ -164,7 +212,16 @@ int ThumbsViewer::getLastRow() {
 }
 
 int ThumbsViewer::getRandomRow() {
-    return QRandomGenerator::global()->bounded(thumbsViewerModel->rowCount());
+    const int row = peekRandomRow();
+    nextRandomRow = -1;
+    return row;
+}
+
+int ThumbsViewer::peekRandomRow() {
+    if (nextRandomRow < 0 || nextRandomRow >= thumbsViewerModel->rowCount()) {
+        nextRandomRow = QRandomGenerator::global()->bounded(qMax(1, thumbsViewerModel->rowCount()));
+    }
+    return nextRandomRow;
 }
 
 int ThumbsViewer::getCurrentRow() {
@@ -180,7 +237,7 @@ void ThumbsViewer::setCurrentRow(int row) {
 }
 
 void ThumbsViewer::setImageViewerWindowTitle() {
-    QString title = thumbsViewerModel->item(currentRow)->data(Qt::DisplayRole).toString()
+    QString title = thumbsViewerModel->fileName(currentRow)
                     + " - ["
                     + QString::number(currentRow + 1)
                     + "/"
@@ -202,7 +259,7 @@ bool ThumbsViewer::setCurrentIndexByName(QString &fileName) {
 }
 
 bool ThumbsViewer::setCurrentIndexByRow(int row) {
-    QModelIndex idx = thumbsViewerModel->indexFromItem(thumbsViewerModel->item(row));
+    QModelIndex idx = thumbsViewerModel->index(row, 0);
     if (idx.isValid()) {
         currentIndex = idx;
         setCurrentRow(idx.row());
@@ -213,105 +270,96 @@ bool ThumbsViewer::setCurrentIndexByRow(int row) {
 }
 
 void ThumbsViewer::updateImageInfoViewer(int row) {
-    QString imageFullPath = thumbsViewerModel->item(row)->data(FileNameRole).toString();
-    QImageReader imageInfoReader(imageFullPath);
+    const QString imageFullPath = thumbsViewerModel->filePath(row);
+    const ImageInfo *imageInfo = imageInfoCache.object(imageFullPath);
+    if (imageInfo && imageInfo->lastModified == thumbsViewerModel->lastModified(row)
+        && imageInfo->fileSize == thumbsViewerModel->fileSize(row)) {
+        imageInfoReader->cancel();
+        showImageInfo(row, imageInfo);
+        return;
+    }
+
+    // The rest follows once the reader is done, unless the selection moved on by then
+    showImageInfo(row, nullptr);
+    imageInfoReader->read(imageFullPath);
+}
+
+void ThumbsViewer::showImageInfo(int row, const ImageInfo *imageInfo) {
     QString key;
     QString val;
 
-    QFileInfo imageInfo = QFileInfo(imageFullPath);
+    QFileInfo imageInfoFile = QFileInfo(thumbsViewerModel->filePath(row));
     infoView->addTitleEntry(tr("Image"));
 
     key = tr("File name");
-    val = imageInfo.fileName();
+    val = imageInfoFile.fileName();
     infoView->addEntry(key, val);
 
     key = tr("Location");
-    val = imageInfo.path();
+    val = imageInfoFile.path();
     infoView->addEntry(key, val);
 
     key = tr("Size");
-    val = QString::number(imageInfo.size() / 1024.0, 'f', 2) + "K";
+    val = QString::number(thumbsViewerModel->fileSize(row) / 1024.0, 'f', 2) + "K";
     infoView->addEntry(key, val);
 
     key = tr("Modified");
-    val = imageInfo.lastModified().toString(Qt::SystemLocaleShortDate);
+    val = QDateTime::fromMSecsSinceEpoch(thumbsViewerModel->lastModified(row)).toString(Qt::SystemLocaleShortDate);
     infoView->addEntry(key, val);
 
-    if (imageInfoReader.size().isValid()) {
+    if (!imageInfo) {
+        return;
+    }
+
+    if (imageInfo->size.isValid()) {
         key = tr("Format");
-        val = imageInfoReader.format().toUpper();
+        val = imageInfo->format;
         infoView->addEntry(key, val);
 
         key = tr("Resolution");
-        val = QString::number(imageInfoReader.size().width())
+        val = QString::number(imageInfo->size.width())
               + "x"
-              + QString::number(imageInfoReader.size().height());
+              + QString::number(imageInfo->size.height());
         infoView->addEntry(key, val);
 
         key = tr("Megapixel");
-        val = QString::number((imageInfoReader.size().width() * imageInfoReader.size().height()) / 1000000.0, 'f',
-                              2);
+        val = QString::number((imageInfo->size.width() * imageInfo->size.height()) / 1000000.0, 'f', 2);
         infoView->addEntry(key, val);
 
         key = tr("Average brightness");
-        val = QString::number(thumbsViewerModel->item(row)->data(BrightnessRole).toReal(), 'f', 2);
+        val = QString::number(thumbsViewerModel->index(row, 0).data(BrightnessRole).toReal(), 'f', 2);
         infoView->addEntry(key, val);
     } else {
-        imageInfoReader.read();
         key = tr("Error");
-        val = imageInfoReader.errorString();
+        val = imageInfo->error;
         infoView->addEntry(key, val);
     }
 
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wdeprecated-declarations"
-#if EXIV2_TEST_VERSION(0,28,0)
-    Exiv2::Image::UniquePtr exifImage;
-#else
-    Exiv2::Image::AutoPtr exifImage;
-#endif
-#pragma clang diagnostic pop
-
-    try {
-        exifImage = Exiv2::ImageFactory::open(imageFullPath.toStdString());
-        exifImage->readMetadata();
-    }
-    catch (const Exiv2::Error &error) {
-        qWarning() << "EXIV2:" << error.what();
-        return;
-    }
-
-    Exiv2::ExifData &exifData = exifImage->exifData();
-    if (!exifData.empty()) {
-        Exiv2::ExifData::const_iterator end = exifData.end();
-        infoView->addTitleEntry("Exif");
-        for (Exiv2::ExifData::const_iterator md = exifData.begin(); md != end; ++md) {
-            key = QString::fromUtf8(md->tagName().c_str());
-            val = QString::fromUtf8(md->print().c_str());
+    for (const ImageInfoSection &section : imageInfo->sections) {
+        infoView->addTitleEntry(section.title);
+        for (const QPair<QString, QString> &entry : section.entries) {
+            key = entry.first;
+            val = entry.second;
             infoView->addEntry(key, val);
         }
     }
+}
 
-    Exiv2::IptcData &iptcData = exifImage->iptcData();
-    if (!iptcData.empty()) {
-        Exiv2::IptcData::iterator end = iptcData.end();
-        infoView->addTitleEntry("IPTC");
-        for (Exiv2::IptcData::iterator md = iptcData.begin(); md != end; ++md) {
-            key = QString::fromUtf8(md->tagName().c_str());
-            val = QString::fromUtf8(md->print().c_str());
-            infoView->addEntry(key, val);
-        }
+void ThumbsViewer::onImageInfoRead(int generation, const ImageInfo &imageInfo) {
+    if (generation != imageInfoReader->currentGeneration()) {
+        return;
     }
 
-    Exiv2::XmpData &xmpData = exifImage->xmpData();
-    if (!xmpData.empty()) {
-        Exiv2::XmpData::iterator end = xmpData.end();
-        infoView->addTitleEntry("XMP");
-        for (Exiv2::XmpData::iterator md = xmpData.begin(); md != end; ++md) {
-            key = QString::fromUtf8(md->tagName().c_str());
-            val = QString::fromUtf8(md->print().c_str());
-            infoView->addEntry(key, val);
-        }
+    imageInfoCache.insert(imageInfo.imageFileName, new ImageInfo(imageInfo));
+
+    QModelIndexList indexesList = selectionModel()->selectedIndexes();
+    if (indexesList.isEmpty() || !infoView->isVisible()) {
+        return;
+    }
+    const int row = indexesList.first().row();
+    if (thumbsViewerModel->filePath(row) == imageInfo.imageFileName) {
+        infoView->clear();
+        showImageInfo(row, &imageInfo);
     }
 }
 
@@ -322,21 +370,27 @@ void ThumbsViewer::onSelectionChanged() {
         phototonic->setWindowIcon(phototonic->getDefaultWindowIcon());
     }
 
-    QModelIndexList indexesList = selectionModel()->selectedIndexes();
-    int selectedThumbs = indexesList.size();
+    // Rubber band selections grow with every mouse move, the selected indexes are not listed each time
+    const QItemSelection selection = selectionModel()->selection();
+    int selectedThumbs = getSelectedThumbsCount();
     if (selectedThumbs > 0) {
-        int currentRow = indexesList.first().row();
-        QString thumbFullPath = thumbsViewerModel->item(currentRow)->data(FileNameRole).toString();
+        int currentRow = selection.first().top();
+        QString thumbFullPath = thumbsViewerModel->filePath(currentRow);
         setCurrentRow(currentRow);
 
         if (infoView->isVisible()) {
             updateImageInfoViewer(currentRow);
         }
 
-        QPixmap imagePreviewPixmap = imagePreview->loadImage(thumbFullPath);
-        if (Settings::setWindowIcon && Settings::layoutMode == Phototonic::ThumbViewWidget) {
-            phototonic->setWindowIcon(imagePreviewPixmap.scaled(WINDOW_ICON_SIZE, WINDOW_ICON_SIZE,
-                                                                Qt::KeepAspectRatio, Qt::SmoothTransformation));
+        // The loaded thumbnail stands in until the preview is decoded, cropped ones would change shape
+        QPixmap thumbnail;
+        if (thumbsViewerModel->isLoaded(currentRow)) {
+            thumbnail = thumbsViewerModel->thumbnail(currentRow);
+        }
+        imagePreview->loadImage(thumbFullPath, Settings::thumbsLayout == Classic ? thumbnail : QPixmap());
+        if (!thumbnail.isNull() && Settings::setWindowIcon && Settings::layoutMode == Phototonic::ThumbViewWidget) {
+            phototonic->setWindowIcon(thumbnail.scaled(WINDOW_ICON_SIZE, WINDOW_ICON_SIZE,
+                                                       Qt::KeepAspectRatio, Qt::SmoothTransformation));
         }
     }
 
@@ -354,12 +408,20 @@ void ThumbsViewer::onSelectionChanged() {
     }
 }
 
+int ThumbsViewer::getSelectedThumbsCount() const {
+    int count = 0;
+    for (const QItemSelectionRange &range : selectionModel()->selection()) {
+        count += range.height();
+    }
+    return count;
+}
+
 QStringList ThumbsViewer::getSelectedThumbsList() {
     QModelIndexList indexesList = selectionModel()->selectedIndexes();
     QStringList SelectedThumbsPaths;
 
     for (int tn = indexesList.size() - 1; tn >= 0; --tn) {
-        SelectedThumbsPaths << thumbsViewerModel->item(indexesList[tn].row())->data(FileNameRole).toString();
+        SelectedThumbsPaths << thumbsViewerModel->filePath(indexesList[tn].row());
     }
 
     return SelectedThumbsPaths;
@@ -376,7 +438,7 @@ void ThumbsViewer::startDrag(Qt::DropActions) {
     QList<QUrl> urls;
     for (QModelIndexList::const_iterator it = indexesList.constBegin(),
                  end = indexesList.constEnd(); it != end; ++it) {
-        urls << QUrl::fromLocalFile(thumbsViewerModel->item(it->row())->data(FileNameRole).toString());
+        urls << QUrl::fromLocalFile(thumbsViewerModel->filePath(it->row()));
     }
     mimeData->setUrls(urls);
     drag->setMimeData(mimeData);
@@ -389,7 +451,7 @@ void ThumbsViewer::startDrag(Qt::DropActions) {
         painter.setPen(QPen(Qt::white, 2));
         int x = 0, y = 0, xMax = 0, yMax = 0;
         for (int i = 0; i < qMin(5, indexesList.count()); ++i) {
-            QPixmap pix = thumbsViewerModel->item(indexesList.at(i).row())->icon().pixmap(72);
+            QPixmap pix = QIcon(thumbsViewerModel->thumbnail(indexesList.at(i).row())).pixmap(72);
             if (i == 4) {
                 x = (xMax - pix.width()) / 2;
                 y = (yMax - pix.height()) / 2;
@@ -405,7 +467,7 @@ void ThumbsViewer::startDrag(Qt::DropActions) {
         pix = pix.copy(0, 0, xMax, yMax);
         drag->setPixmap(pix);
     } else {
-        pix = thumbsViewerModel->item(indexesList.at(0).row())->icon().pixmap(128);
+        pix = QIcon(thumbsViewerModel->thumbnail(indexesList.at(0).row())).pixmap(128);
         drag->setPixmap(pix);
     }
     drag->setHotSpot(QPoint(pix.width() / 2, pix.height() / 2));
@@ -414,24 +476,24 @@ void ThumbsViewer::startDrag(Qt::DropActions) {
 
 void ThumbsViewer::abort(bool permanent) {
     isAbortThumbsLoading = true;
+    cancelThumbsLoading();
 
     if (!isClosing && permanent) {
         isClosing = true;
+        ThumbnailWriter::instance()->shutdown();
     }
 }
 
 void ThumbsViewer::loadVisibleThumbs(int scrollBarValue) {
 
     // Hack:
-    // when a paint even is requested Qt first calls updateGeometry() on
-    // everything.
-    // qscrollbar emits valueChanged() in its updateGeometry(), leading to us
-    // possibly recursing when calling processEvents.
+    // visualRect() may lay out the items, and the scrollbar emits
+    // valueChanged() from updateGeometry(), leading to us recursing.
     static bool processing = false;
     if (processing) {
         return;
     }
-    processing = true;
+    QScopedValueRollback<bool> processingGuard(processing, true);
 
     static int lastScrollBarValue = 0;
 
@@ -440,83 +502,70 @@ void ThumbsViewer::loadVisibleThumbs(int scrollBarValue) {
         lastScrollBarValue = scrollBarValue;
     } else {
         loadThumbsRange();
-        processing = false;
         return;
     }
 
-    for (;;) {
-        int firstVisible = getFirstVisibleThumb();
-        int lastVisible = getLastVisibleThumb();
-        if (isAbortThumbsLoading || firstVisible < 0 || lastVisible < 0) {
-            processing = false;
-            return;
-        }
-
-        if (scrolledForward) {
-            lastVisible += ((lastVisible - firstVisible) * (Settings::thumbsPagesReadCount + 1));
-            if (lastVisible >= thumbsViewerModel->rowCount()) {
-                lastVisible = thumbsViewerModel->rowCount() - 1;
-            }
-        } else {
-            firstVisible -= (lastVisible - firstVisible) * (Settings::thumbsPagesReadCount + 1);
-            if (firstVisible < 0) {
-                firstVisible = 0;
-            }
+    int firstVisible = getFirstVisibleThumb();
+    int lastVisible = getLastVisibleThumb();
+    if (firstVisible < 0 || lastVisible < 0) {
+        return;
+    }
 
-            lastVisible += 10;
-            if (lastVisible >= thumbsViewerModel->rowCount()) {
-                lastVisible = thumbsViewerModel->rowCount() - 1;
-            }
+    if (scrolledForward) {
+        lastVisible += ((lastVisible - firstVisible) * (Settings::thumbsPagesReadCount + 1));
+        if (lastVisible >= thumbsViewerModel->rowCount()) {
+            lastVisible = thumbsViewerModel->rowCount() - 1;
         }
-
-        if (thumbsRangeFirst == firstVisible && thumbsRangeLast == lastVisible) {
-            processing = false;
-            return;
+    } else {
+        firstVisible -= (lastVisible - firstVisible) * (Settings::thumbsPagesReadCount + 1);
+        if (firstVisible < 0) {
+            firstVisible = 0;
         }
 
-        thumbsRangeFirst = firstVisible;
-        thumbsRangeLast = lastVisible;
-
-        loadThumbsRange();
-        if (isAbortThumbsLoading) {
-            processing = false;
-            break;
+        lastVisible += 10;
+        if (lastVisible >= thumbsViewerModel->rowCount()) {
+            lastVisible = thumbsViewerModel->rowCount() - 1;
         }
     }
-    processing = false;
-}
 
-int ThumbsViewer::getFirstVisibleThumb() {
-    QModelIndex idx;
+    if (thumbsRangeFirst == firstVisible && thumbsRangeLast == lastVisible) {
+        return;
+    }
 
-    for (int currThumb = 0; currThumb < thumbsViewerModel->rowCount(); ++currThumb) {
-        idx = thumbsViewerModel->indexFromItem(thumbsViewerModel->item(currThumb));
-        if (viewport()->rect().contains(QPoint(0, visualRect(idx).y() + visualRect(idx).height() + 1))) {
-            return idx.row();
-        }
+    thumbsRangeFirst = firstVisible;
+    thumbsRangeLast = lastVisible;
+
+    // Coalesce bursts of scroll events into a single queue update
+    if (!m_loadThumbTimer.isActive()) {
+        m_loadThumbTimer.start();
     }
+}
 
-    return -1;
+void ThumbsViewer::refreshVisibleThumbs() {
+    // Rows may have been added or moved under an unchanged visible range
+    thumbsRangeFirst = -1;
+    thumbsRangeLast = -1;
+    loadVisibleThumbs();
 }
 
-int ThumbsViewer::getLastVisibleThumb() {
-    QModelIndex idx;
+int ThumbsViewer::thumbBottomEdge(int row) {
+    const QRect rect = visualRect(thumbsViewerModel->index(row, 0));
+    return rect.y() + rect.height() + 1;
+}
 
-    for (int currThumb = thumbsViewerModel->rowCount() - 1; currThumb >= 0; --currThumb) {
-        idx = thumbsViewerModel->indexFromItem(thumbsViewerModel->item(currThumb));
-        if (viewport()->rect().contains(QPoint(0, visualRect(idx).y() + visualRect(idx).height() + 1))) {
-            return idx.row();
-        }
-    }
+int ThumbsViewer::getFirstVisibleThumb() {
+    return VisibleRange::firstVisible(thumbsViewerModel->rowCount(), viewport()->height(),
+                                      [this](int row) { return thumbBottomEdge(row); });
+}
 
-    return -1;
+int ThumbsViewer::getLastVisibleThumb() {
+    return VisibleRange::lastVisible(thumbsViewerModel->rowCount(), viewport()->height(),
+                                     [this](int row) { return thumbBottomEdge(row); });
 }
 
 void ThumbsViewer::loadFileList() {
-    for (int i = 0; i < Settings::filesList.size(); i++) {
-        addThumb(Settings::filesList[i]);
-    }
-    updateThumbsCount();
+    fileListRows = 0;
+    appendNewFileListPaths();
 
     imageTags->populateTagsTree();
 
@@ -528,6 +577,35 @@ void ThumbsViewer::loadFileList() {
     isBusy = false;
 }
 
+void ThumbsViewer::appendNewFileListPaths() {
+    // The list only grows until it is loaded anew
+    const QStringList paths = Settings::filesList.mid(qMin(fileListRows, Settings::filesList.size()));
+    fileListRows = Settings::filesList.size();
+    appendFileList(paths);
+}
+
+void ThumbsViewer::appendFileList(const QStringList &paths) {
+    // Rows start out as placeholders, nothing is read from the files until they are shown or sorted
+    QStringList unscannedFiles;
+    for (const QString &path : paths) {
+        if (imageTags->dirFilteringActive) {
+            metadataCache->loadImageMetadata(path);
+            if (imageTags->isImageFilteredOut(path)) {
+                continue;
+            }
+        } else if (!metadataCache->hasImageMetadata(path)) {
+            unscannedFiles.append(path);
+        }
+        thumbsViewerModel->appendThumb(QFileInfo(path), thumbsViewerModel->rowCount(), false);
+    }
+    if (!unscannedFiles.isEmpty()) {
+        metadataScanner->scan(unscannedFiles);
+    }
+
+    updateThumbsCount();
+    refreshVisibleThumbs();
+}
+
 void ThumbsViewer::reLoad() {
     disconnect(verticalScrollBar(), &QScrollBar::valueChanged, this, &ThumbsViewer::loadVisibleThumbs);
 
@@ -535,13 +613,18 @@ void ThumbsViewer::reLoad() {
     phototonic->showBusyAnimation(true);
     loadPrepare();
 
+    // Only the first load can use the prefetched listing
+    const std::shared_ptr<PrefetchedListing> listing = std::move(prefetchedListing);
+    prefetchedListing.reset();
+
     if (Settings::isFileListLoaded) {
         loadFileList();
+        connect(verticalScrollBar(), &QScrollBar::valueChanged, this, &ThumbsViewer::loadVisibleThumbs);
         return;
     }
 
     applyFilter();
-    initThumbs();
+    initThumbs(listing.get());
     updateThumbsCount();
     loadVisibleThumbs();
 
@@ -549,6 +632,12 @@ void ThumbsViewer::reLoad() {
         loadSubDirectories();
     }
 
+    if (!isAbortThumbsLoading) {
+        watchDirectory(Settings::currentDirectory);
+    }
+    // Whatever the listing read is written out in one go
+    MetadataDatabase::instance()->flush();
+
     phototonic->showBusyAnimation(false);
     isBusy = false;
 
@@ -556,68 +645,308 @@ void ThumbsViewer::reLoad() {
 }
 
 void ThumbsViewer::loadSubDirectories() {
-    QDirIterator dirIterator(Settings::currentDirectory, QDirIterator::Subdirectories);
+    isCrawlingForDupes = false;
+    crawlSubDirectories();
+    if (isAbortThumbsLoading) {
+        return;
+    }
 
-    int processed = 0;
-    while (dirIterator.hasNext()) {
-        dirIterator.next();
-        if (dirIterator.fileInfo().isDir() && dirIterator.fileName() != "." && dirIterator.fileName() != "..") {
-            thumbsDir.setPath(dirIterator.filePath());
+    imageTags->populateTagsTree();
+    if (thumbsViewerModel->rowCount() && selectionModel()->selectedIndexes().size() == 0) {
+        selectThumbByRow(0);
+    }
+    onSelectionChanged();
+}
+
+void ThumbsViewer::crawlSubDirectories() {
+    isCrawling = true;
+    directoryCrawler->crawl(Settings::currentDirectory, thumbsDir, thumbsSortFlags);
 
-            initThumbs();
-            updateThumbsCount();
-            loadVisibleThumbs();
+    // Directories are listed in the background and stream in through onFilesListed()
+    while (isCrawling && !isAbortThumbsLoading) {
+        QApplication::processEvents(QEventLoop::WaitForMoreEvents);
+    }
+    if (isCrawling) {
+        directoryCrawler->cancel();
+        isCrawling = false;
+    }
+}
 
-            if (isAbortThumbsLoading) {
-                return;
+void ThumbsViewer::onFilesListed(int generation, const QFileInfoList &files) {
+    if (!isCrawling || generation != directoryCrawler->currentGeneration()) {
+        return;
+    }
+
+    if (isCrawlingForDupes) {
+        findDupes(files);
+    } else {
+        appendThumbs(files);
+        updateThumbsCount();
+        loadVisibleThumbs();
+    }
+}
+
+void ThumbsViewer::onCrawlFinished(int generation) {
+    if (generation == directoryCrawler->currentGeneration()) {
+        isCrawling = false;
+    }
+}
+
+void ThumbsViewer::watchDirectory(const QString &directoryPath) {
+    directoryChangedTimer.stop();
+    if (!directoryWatcher->directories().isEmpty()) {
+        directoryWatcher->removePaths(directoryWatcher->directories());
+    }
+    if (!directoryPath.isEmpty()) {
+        directoryWatcher->addPath(directoryPath);
+    }
+}
+
+void ThumbsViewer::forgetPendingThumb(const QString &filePath) {
+    QHash<quint64, PendingThumb>::iterator it = pendingThumbs.begin();
+    while (it != pendingThumbs.end()) {
+        if (it->filePath == filePath) {
+            it = pendingThumbs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    pendingThumbFiles.remove(filePath);
+}
+
+// Brings the rows of the watched directory in line with what is on disk,
+// leaving loaded thumbnails, the selection and the scroll position alone
+void ThumbsViewer::refreshChangedDirectory() {
+    if (isBusy) {
+        directoryChangedTimer.start();
+        return;
+    }
+
+    QDir directory(thumbsDir);
+    directory.setPath(Settings::currentDirectory);
+    QFileInfoList files = directory.entryInfoList();
+    if (directory.sorting() == QDir::NoSort) {
+        DirectoryCrawler::sortByName(files, thumbsSortFlags);
+    }
+
+    QHash<QString, int> listingPositions;
+    listingPositions.reserve(files.size());
+    for (int i = 0; i < files.size(); ++i) {
+        listingPositions.insert(files.at(i).filePath(), i);
+    }
+
+    bool isListingChanged = false;
+    bool isAnyFileChanged = false;
+    QSet<QString> knownFiles;
+    QList<int> removedRows;
+    for (int row = thumbsViewerModel->rowCount() - 1; row >= 0; --row) {
+        QString filePath = thumbsViewerModel->filePath(row);
+        QHash<QString, int>::const_iterator it = listingPositions.constFind(filePath);
+        if (it == listingPositions.constEnd()) {
+            // Rows listed from subdirectories are not watched
+            if (QFileInfo(filePath).path() == directory.path()) {
+                forgetPendingThumb(filePath);
+                featureStore.remove(filePath);
+                metadataCache->removeImage(filePath);
+                removedRows.append(row);
+                isListingChanged = true;
             }
+            continue;
         }
-        if (++processed > BATCH_SIZE) {
-            QApplication::processEvents();
-            processed = 0;
+
+        knownFiles.insert(filePath);
+        const QFileInfo &fileInfo = files.at(*it);
+        if (thumbsViewerModel->fileSize(row) != fileInfo.size()
+            || thumbsViewerModel->lastModified(row) != fileInfo.lastModified().toMSecsSinceEpoch()) {
+            forgetPendingThumb(filePath);
+            const QModelIndex index = thumbsViewerModel->index(row, 0);
+            thumbsViewerModel->setData(index, fileInfo.size(), SizeRole);
+            thumbsViewerModel->setData(index, fileInfo.lastModified(), TimeRole);
+            thumbsViewerModel->setData(index, QVariant(), BrightnessRole);
+            thumbsViewerModel->setData(index, false, LoadedRole);
+            metadataCache->removeImage(filePath);
+            metadataScanner->scan(QStringList(filePath));
+            isAnyFileChanged = true;
         }
     }
+    thumbsViewerModel->removeRowList(removedRows);
 
-    onSelectionChanged();
+    for (const QFileInfo &fileInfo : files) {
+        QString filePath = fileInfo.filePath();
+        if (!knownFiles.contains(filePath) && addThumb(filePath) >= 0) {
+            isListingChanged = true;
+        }
+    }
+
+    if (!isListingChanged && !isAnyFileChanged) {
+        return;
+    }
+
+    // The directory's files come first, as they did when it was loaded
+    QFileInfoList updatedListing = files;
+    for (const QFileInfo &fileInfo : listedFiles) {
+        if (fileInfo.path() != directory.path()) {
+            updatedListing.append(fileInfo);
+        }
+    }
+    listedFiles.swap(updatedListing);
+
+    if (isListingChanged) {
+        sortByListingOrder();
+    }
+
+    updateThumbsCount();
+    refreshVisibleThumbs();
+
+    // Files that are still being written keep changing, look again once they may have settled
+    directoryChangedTimer.start();
 }
 
-void ThumbsViewer::applyFilter() {
-    fileFilters.clear();
-    QString textFilter("*");
-    textFilter += filterString;
-
-    // Get all patterns supported by QImageReader
-    static QStringList imageTypeGlobs;
-    // Not threadsafe, but whatever
-    if (imageTypeGlobs.isEmpty()) {
+// The sort keeps persistent indexes, and with them the selection
+void ThumbsViewer::sortByListingOrder() {
+    if (thumbsViewerModel->sortRole() != SortRole) {
+        return;
+    }
+
+    QHash<QString, int> listingPositions;
+    listingPositions.reserve(listedFiles.size());
+    for (int i = 0; i < listedFiles.size(); ++i) {
+        listingPositions.insert(listedFiles.at(i).filePath(), i);
+    }
+    for (int row = 0; row < thumbsViewerModel->rowCount(); ++row) {
+        thumbsViewerModel->setData(thumbsViewerModel->index(row, 0),
+                                   listingPositions.value(thumbsViewerModel->filePath(row), listedFiles.size() + row),
+                                   SortRole);
+    }
+    thumbsViewerModel->sort(0);
+}
+
+bool ThumbsViewer::applyTagFilter() {
+    if (isBusy || Settings::isFileListLoaded || isShowingDuplicates) {
+        return false;
+    }
+
+    // Background scans may not have got to every file yet
+    if (imageTags->dirFilteringActive) {
+        QStringList unscannedFiles;
+        for (const QFileInfo &fileInfo : listedFiles) {
+            if (!metadataCache->hasImageMetadata(fileInfo.filePath())) {
+                unscannedFiles.append(fileInfo.filePath());
+            }
+        }
+        metadataScanner->scanBlocking(unscannedFiles);
+        metadataCache->publishNewTags();
+    }
+
+    QSet<QString> shownFiles;
+    QList<int> filteredRows;
+    for (int row = thumbsViewerModel->rowCount() - 1; row >= 0; --row) {
+        const QString filePath = thumbsViewerModel->filePath(row);
+        if (imageTags->dirFilteringActive && imageTags->isImageFilteredOut(filePath)) {
+            forgetPendingThumb(filePath);
+            filteredRows.append(row);
+        } else {
+            shownFiles.insert(filePath);
+        }
+    }
+    thumbsViewerModel->removeRowList(filteredRows);
+
+    for (const QFileInfo &fileInfo : listedFiles) {
+        const QString filePath = fileInfo.filePath();
+        if (shownFiles.contains(filePath)
+            || (imageTags->dirFilteringActive && imageTags->isImageFilteredOut(filePath))) {
+            continue;
+        }
+        thumbsViewerModel->appendThumb(fileInfo, thumbsViewerModel->rowCount());
+    }
+
+    sortByListingOrder();
+    updateThumbsCount();
+    refreshVisibleThumbs();
+    return true;
+}
+
+QStringList ThumbsViewer::imageNameFilters(const QString &filterString) {
+    // Looked up once, the prefetch worker usually gets here first
+    static const QStringList imageTypeGlobs = []() {
+        QStringList globs;
         QMimeDatabase db;
         for (const QByteArray &type : QImageReader::supportedMimeTypes()) {
-            imageTypeGlobs.append(db.mimeTypeForName(type).globPatterns());
+            globs.append(db.mimeTypeForName(type).globPatterns());
         }
-    }
+        // Shown from their embedded previews when there is no decoder
+        for (const QString &glob : ExifPreview::rawNameFilters()) {
+            if (!globs.contains(glob)) {
+                globs.append(glob);
+            }
+        }
+        return globs;
+    }();
+
+    // The globs start with '*' already, without a text filter they are taken as they are
+    const QString textFilter = filterString.isEmpty() ? QString() : QLatin1Char('*') + filterString;
+    QStringList nameFilters;
+    nameFilters.reserve(imageTypeGlobs.size());
     for (const QString &glob : imageTypeGlobs) {
-        fileFilters.append(textFilter + glob);
+        nameFilters.append(textFilter + glob);
     }
+    return nameFilters;
+}
 
-    thumbsDir.setNameFilters(fileFilters);
-    thumbsDir.setFilter(QDir::Files);
+void ThumbsViewer::applyListingFlags(QDir &directory) const {
+    directory.setFilter(QDir::Files);
     if (Settings::showHiddenFiles) {
-        thumbsDir.setFilter(thumbsDir.filter() | QDir::Hidden);
+        directory.setFilter(directory.filter() | QDir::Hidden);
     }
 
-    thumbsDir.setPath(Settings::currentDirectory);
     QDir::SortFlags tempThumbsSortFlags = thumbsSortFlags;
     if (tempThumbsSortFlags & QDir::Size || tempThumbsSortFlags & QDir::Time) {
         tempThumbsSortFlags ^= QDir::Reversed;
     }
 
     if (thumbsSortFlags & QDir::Time || thumbsSortFlags & QDir::Size || thumbsSortFlags & QDir::Type) {
-        thumbsDir.setSorting(tempThumbsSortFlags);
+        directory.setSorting(tempThumbsSortFlags);
     } else { // by name
-        thumbsDir.setSorting(QDir::NoSort);
+        directory.setSorting(QDir::NoSort);
     }
 }
 
+void ThumbsViewer::applyFilter() {
+    fileFilters = imageNameFilters(filterString);
+    thumbsDir.setNameFilters(fileFilters);
+    applyListingFlags(thumbsDir);
+    thumbsDir.setPath(Settings::currentDirectory);
+}
+
+class ThumbsViewer::PrefetchWorker : public QRunnable {
+public:
+    explicit PrefetchWorker(const std::shared_ptr<PrefetchedListing> &listing) : listing(listing) {}
+
+    void run() override {
+        // Nothing else touches the listing until it is marked listed
+        QDir directory = listing->directory;
+        directory.setNameFilters(imageNameFilters(QString()));
+        const QFileInfoList files = DirectoryEntries::files(directory);
+
+        QMutexLocker locker(&listing->mutex);
+        listing->directory = directory;
+        listing->files = files;
+        listing->isListed = true;
+        listing->listed.wakeAll();
+    }
+
+private:
+    std::shared_ptr<PrefetchedListing> listing;
+};
+
+void ThumbsViewer::prefetchDirectory(const QString &path) {
+    prefetchedListing = std::make_shared<PrefetchedListing>();
+    prefetchedListing->directory.setPath(path);
+    prefetchedListing->path = prefetchedListing->directory.path();
+    applyListingFlags(prefetchedListing->directory);
+    QThreadPool::globalInstance()->start(new PrefetchWorker(prefetchedListing));
+}
+
 QSize ThumbsViewer::itemSizeHint() const
 {
     switch(Settings::thumbsLayout) {
@@ -638,6 +967,44 @@ QSize ThumbsViewer::itemSizeHint() const
 void ThumbsViewer::loadPrepare() {
 
     thumbsViewerModel->clear();
+    thumbsViewerModel->setThumbnailMemoryLimit(qint64(Settings::thumbsMemoryLimit) * 1024 * 1024);
+    applyThumbsLayout();
+
+    if (isNeedToScroll) {
+        scrollToTop();
+    }
+
+    if (!isClosing) {
+        isAbortThumbsLoading = false;
+    }
+
+    cancelThumbsLoading();
+    thumbsRangeFirst = -1;
+    thumbsRangeLast = -1;
+
+    watchDirectory(QString());
+    listedFiles.clear();
+    isShowingDuplicates = false;
+    metadataScanner->cancel();
+    directoryCrawler->cancel();
+    isCrawling = false;
+    duplicateHasher->cancel();
+    pendingDupHashes = 0;
+    identicalFileFinder->cancel();
+    isFindingIdentical = false;
+    identicalCandidates.clear();
+    identicalCopies.clear();
+    brightnessScanner->cancel();
+    pendingBrightness = 0;
+    imageInfoReader->cancel();
+    imageTags->resetTagsState();
+}
+
+void ThumbsViewer::applyThumbsLayout() {
+    thumbsViewerModel->setShowFileNames(Settings::thumbsLayout != Squares);
+    thumbsViewerModel->setItemSizeHint(itemSizeHint());
+    thumbsViewerModel->setThumbnailSize(thumbSize);
+    thumbsDelegate->clearCache();
     setIconSize(QSize(thumbSize, thumbSize));
 
     if (Settings::thumbsLayout == Squares) {
@@ -653,128 +1020,145 @@ void ThumbsViewer::loadPrepare() {
         setUniformItemSizes(false);
         setGridSize(QSize());
     }
+}
 
-    if (isNeedToScroll) {
-        scrollToTop();
-    }
-
-    if (!isClosing) {
-        isAbortThumbsLoading = false;
-    }
-
-    thumbsRangeFirst = -1;
-    thumbsRangeLast = -1;
-
-    imageTags->resetTagsState();
+// Nothing is read again, the next visible range only asks for thumbnails too small to be sharp
+void ThumbsViewer::setThumbSize(int size) {
+    thumbSize = size;
+    cancelThumbsLoading();
+    applyThumbsLayout();
+    refreshVisibleThumbs();
 }
 
 void ThumbsViewer::loadDuplicates()
 {
+    // Hashing streams in while this waits, so the timer covers the whole search
+    Perf::ScopedTimer timer(Perf::FindDuplicates);
     isBusy = true;
     phototonic->showBusyAnimation(true);
     loadPrepare();
 
     phototonic->setStatus(tr("Searching duplicate images..."));
+    isShowingDuplicates = true;
 
     dupImageHashes.clear();
-    findDupes(true);
+    dupHashIndex.clear();
+    dupOriginalImages = dupTotalFiles = dupFoundDups = 0;
+    findDupes(DirectoryEntries::files(thumbsDir));
     thumbsViewerModel->setSortRole(SortRole);
 
     if (Settings::includeSubDirectories) {
-        int processed = 0;
-        QDirIterator iterator(Settings::currentDirectory, QDirIterator::Subdirectories);
-        while (iterator.hasNext()) {
-            iterator.next();
-            if (iterator.fileInfo().isDir() && iterator.fileName() != "." && iterator.fileName() != "..") {
-                thumbsDir.setPath(iterator.filePath());
-
-                findDupes(false);
-                if (isAbortThumbsLoading) {
-                    goto finish;
-                }
-            }
-            if (++processed > BATCH_SIZE) {
-                QApplication::processEvents();
-                processed = 0;
-            }
+        isCrawlingForDupes = true;
+        crawlSubDirectories();
+    }
+
+    // Files can only be compared once all of them are listed
+    if (Settings::dupesMode != Settings::SimilarImages && !isAbortThumbsLoading) {
+        isFindingIdentical = true;
+        identicalFileFinder->find(identicalCandidates);
+        identicalCandidates.clear();
+        while (isFindingIdentical && !isAbortThumbsLoading) {
+            QApplication::processEvents(QEventLoop::WaitForMoreEvents);
+        }
+        if (isAbortThumbsLoading) {
+            identicalFileFinder->cancel();
+            isFindingIdentical = false;
         }
     }
 
-finish:
+    // Hashes stream in while the directories are still being listed, wait for the rest
+    while (pendingDupHashes > 0 && !isAbortThumbsLoading) {
+        QApplication::processEvents(QEventLoop::WaitForMoreEvents);
+    }
+    if (isAbortThumbsLoading) {
+        duplicateHasher->cancel();
+        pendingDupHashes = 0;
+    }
+    featureStore.flush();
+    MetadataDatabase::instance()->flush();
+
     thumbsViewerModel->sort(0);
+    refreshVisibleThumbs();
     isBusy = false;
     phototonic->showBusyAnimation(false);
     return;
 }
 
-void ThumbsViewer::initThumbs() {
+void ThumbsViewer::initThumbs(PrefetchedListing *prefetched) {
     phototonic->showBusyAnimation(true);
-    thumbFileInfoList = thumbsDir.entryInfoList();
 
-    if (!(thumbsSortFlags & QDir::Time) && !(thumbsSortFlags & QDir::Size) && !(thumbsSortFlags & QDir::Type)) {
-        QCollator collator;
-        if (thumbsSortFlags & QDir::IgnoreCase) {
-            collator.setCaseSensitivity(Qt::CaseInsensitive);
+    // The prefetch is waited for rather than repeated, unless it listed something else
+    bool isPrefetched = false;
+    if (prefetched && prefetched->path == thumbsDir.path()) {
+        QMutexLocker locker(&prefetched->mutex);
+        while (!prefetched->isListed) {
+            prefetched->listed.wait(&prefetched->mutex);
         }
+        if (prefetched->directory == thumbsDir) {
+            thumbFileInfoList = prefetched->files;
+            isPrefetched = true;
+        }
+    }
+    if (!isPrefetched) {
+        thumbFileInfoList = DirectoryEntries::files(thumbsDir);
+    }
+    if (thumbFileInfoList.isEmpty()) {
+        StartupTimer::finish("directory listed");
+    } else {
+        StartupTimer::mark("directory listed");
+    }
 
-        collator.setNumericMode(true);
+    // Listings sorted by name leave the attributes until something needs them
+    const bool isSortedByName = !(thumbsSortFlags & QDir::Time) && !(thumbsSortFlags & QDir::Size)
+                                && !(thumbsSortFlags & QDir::Type);
+    if (isSortedByName) {
+        DirectoryCrawler::sortByName(thumbFileInfoList, thumbsSortFlags);
+    }
 
-        if (thumbsSortFlags & QDir::Reversed) {
-            std::sort(thumbFileInfoList.begin(), thumbFileInfoList.end(), [&](const QFileInfo &a, const QFileInfo &b) {
-                    return collator.compare(a.fileName(), b.fileName()) > 0;
-                    });
-        } else {
-            std::sort(thumbFileInfoList.begin(), thumbFileInfoList.end(), [&](const QFileInfo &a, const QFileInfo &b) {
-                    return collator.compare(a.fileName(), b.fileName()) < 0;
-                    });
-        }
+    appendThumbs(thumbFileInfoList, !isSortedByName);
+
+    imageTags->populateTagsTree();
+
+    if (thumbFileInfoList.size() && selectionModel()->selectedIndexes().size() == 0) {
+        selectThumbByRow(0);
     }
+    phototonic->showBusyAnimation(false);
+}
 
-    static QStandardItem *thumbItem;
-    static int fileIndex;
-    static QPixmap emptyPixMap;
-    static QSize hintSize;
+void ThumbsViewer::appendThumbs(const QFileInfoList &files, bool withAttributes) {
     int processed = 0;
+    listedFiles.append(files);
 
-    emptyPixMap = emptyImg.scaled(thumbSize, thumbSize);
-    hintSize = itemSizeHint();
+    QStringList imageFileNames;
+    imageFileNames.reserve(files.size());
+    for (const QFileInfo &fileInfo : files) {
+        imageFileNames.append(fileInfo.filePath());
+    }
 
-    for (fileIndex = 0; fileIndex < thumbFileInfoList.size(); ++fileIndex) {
-        thumbFileInfo = thumbFileInfoList.at(fileIndex);
+    // Metadata is kept for the whole session, unless the file changed since it was read
+    metadataCache->removeChangedImages(files);
 
-        metadataCache->loadImageMetadata(thumbFileInfo.filePath());
-        if (imageTags->dirFilteringActive && imageTags->isImageFilteredOut(thumbFileInfo.filePath())) {
-            continue;
-        }
+    // Row visibility depends on the tags when filtering, otherwise they can come in later
+    if (imageTags->dirFilteringActive) {
+        metadataScanner->scanBlocking(imageFileNames);
+        metadataCache->publishNewTags();
+    } else {
+        metadataScanner->scan(imageFileNames);
+    }
 
-        thumbItem = new QStandardItem();
-        thumbItem->setData(false, LoadedRole);
-        thumbItem->setData(fileIndex, SortRole);
-        thumbItem->setData(thumbFileInfo.size(), SizeRole);
-        thumbItem->setData(thumbFileInfo.suffix(), TypeRole);
-        thumbItem->setData(thumbFileInfo.lastModified(), TimeRole);
-        thumbItem->setData(thumbFileInfo.filePath(), FileNameRole);
-        thumbItem->setSizeHint(hintSize);
-
-        if (Settings::thumbsLayout != Squares) {
-            thumbItem->setTextAlignment(Qt::AlignTop | Qt::AlignHCenter);
-            thumbItem->setText(thumbFileInfo.fileName());
+    for (const QFileInfo &fileInfo : files) {
+        if (imageTags->dirFilteringActive && imageTags->isImageFilteredOut(fileInfo.filePath())) {
+            continue;
         }
 
-        thumbsViewerModel->appendRow(thumbItem);
+        // Listing order, also across the batches of a recursive listing
+        thumbsViewerModel->appendThumb(fileInfo, thumbsViewerModel->rowCount(), withAttributes);
 
         if (++processed > BATCH_SIZE) {
             QApplication::processEvents();
             processed = 0;
         }
     }
-
-    imageTags->populateTagsTree();
-
-    if (thumbFileInfoList.size() && selectionModel()->selectedIndexes().size() == 0) {
-        selectThumbByRow(0);
-    }
-    phototonic->showBusyAnimation(false);
 }
 
 void ThumbsViewer::updateThumbsCount() {
@@ -805,83 +1189,220 @@ void ThumbsViewer::updateFoundDupesState(int duplicates, int filesScanned, int o
     phototonic->setStatus(state);
 }
 
-void ThumbsViewer::findDupes(bool resetCounters)
+void ThumbsViewer::findDupes(const QFileInfoList &files)
 {
-    thumbFileInfoList = thumbsDir.entryInfoList();
-    static int originalImages;
-    static int foundDups;
-    static int totalFiles;
-    if (resetCounters) {
-        originalImages = totalFiles = foundDups = 0;
-    }
+    QStringList filePaths;
+    filePaths.reserve(files.size());
+    for (const QFileInfo &fileInfo : files) {
+        filePaths.append(fileInfo.filePath());
+    }
+    QVector<qint64> fileSizes;
+    QVector<qint64> lastModified;
+    DirectoryEntries::readAttributes(filePaths, fileSizes, lastModified);
+
+    QList<ImageHash> uncachedImages;
+    for (int i = 0; i < filePaths.size(); ++i) {
+        ImageHash image;
+        image.imageFileName = filePaths.at(i);
+        image.lastModified = lastModified.at(i);
+        image.fileSize = fileSizes.at(i);
+
+        // Compared byte for byte once the listing is done
+        if (Settings::dupesMode != Settings::SimilarImages) {
+            identicalCandidates.append(image);
+            continue;
+        }
 
-    int processed = 0;
-    for (int currThumb = 0; currThumb < thumbFileInfoList.size(); ++currThumb) {
-        if (++processed > BATCH_SIZE) {
-            thumbsViewerModel->sort(0);
-            QApplication::processEvents();
-            processed = 0;
+        const ImageFeatures *features = featureStore.find(image.imageFileName, image.lastModified, image.fileSize);
+        if (features && features->hasDHash) {
+            addSimilarImage(image.imageFileName, features->dHash);
+        } else {
+            uncachedImages.append(image);
         }
+    }
 
-        thumbFileInfo = thumbFileInfoList.at(currThumb);
-        QImage image = QImage(thumbFileInfo.absoluteFilePath());
-        if (image.isNull()) {
-            qWarning() << "invalid image" << thumbFileInfo.fileName();
-            continue;
+    if (!uncachedImages.isEmpty()) {
+        pendingDupHashes += uncachedImages.size();
+        duplicateHasher->hash(uncachedImages);
+    }
+    updateFoundDupesState(dupFoundDups, dupTotalFiles, dupOriginalImages);
+}
+
+void ThumbsViewer::onIdenticalFilesGrouped(int generation, const ImageHashGroups &groups) {
+    if (!isFindingIdentical || generation != identicalFileFinder->currentGeneration()) {
+        return;
+    }
+    isFindingIdentical = false;
+
+    if (Settings::dupesMode == Settings::IdenticalFiles) {
+        for (const QVector<ImageHash> &group : groups) {
+            dupTotalFiles += group.size();
+            if (group.size() > 1) {
+                for (const ImageHash &file : group) {
+                    addDuplicateCandidate(file.imageFileName, file.contentHash, false);
+                }
+            }
         }
+    } else {
+        // Only one file of each group is decoded, its copies join whatever group it ends up in
+        QList<ImageHash> uncachedImages;
+        for (const QVector<ImageHash> &group : groups) {
+            const ImageHash &image = group.first();
+            if (group.size() > 1) {
+                identicalCopies.insert(image.imageFileName, group.mid(1));
+            }
 
-        QBitArray imageHash(64);
-        image = image.convertToFormat(QImage::Format_Grayscale8).scaled(9, 9, Qt::KeepAspectRatioByExpanding);
-        for (int y=0; y<8; y++) {
-            const uchar *line = image.scanLine(y);
-            //const uchar *nextLine = image.scanLine(y+1);
-            for (int x=0; x<8; x++) {
-                imageHash.setBit(y * 8 + x, line[x] > line[x+1]);
-                //imageHash.setBit(y * 8 + x + 64, line[x] > nextLine[x]);
+            const ImageFeatures *features = featureStore.find(image.imageFileName, image.lastModified, image.fileSize);
+            if (features && features->hasDHash) {
+                addSimilarImage(image.imageFileName, features->dHash);
+            } else {
+                uncachedImages.append(image);
             }
         }
+        if (!uncachedImages.isEmpty()) {
+            pendingDupHashes += uncachedImages.size();
+            duplicateHasher->hash(uncachedImages);
+        }
+    }
+
+    thumbsViewerModel->sort(0);
+    refreshVisibleThumbs();
+    updateFoundDupesState(dupFoundDups, dupTotalFiles, dupOriginalImages);
+}
 
-        QString currentFilePath = thumbFileInfo.filePath();
+void ThumbsViewer::onDuplicateHashesComputed(int generation, const QVector<ImageHash> &results) {
+    if (generation != duplicateHasher->currentGeneration()) {
+        return;
+    }
 
-        totalFiles++;
+    pendingDupHashes -= results.size();
+    for (const ImageHash &result : results) {
+        if (!result.isValid) {
+            qWarning() << "invalid image" << result.imageFileName;
 
-        if (dupImageHashes.contains(imageHash)) {
-            QStandardItem *item = nullptr;
-            if (dupImageHashes[imageHash].duplicates < 1) {
-                item = addThumb(dupImageHashes[imageHash].filePath);
-                if (item) {
-                    item->setData(dupImageHashes[imageHash].id, SortRole);
+            // Copies are still copies when the image cannot be decoded
+            const QVector<ImageHash> copies = identicalCopies.take(result.imageFileName);
+            if (!copies.isEmpty()) {
+                dupTotalFiles += copies.size() + 1;
+                addDuplicateCandidate(result.imageFileName, result.contentHash, false);
+                for (const ImageHash &copy : copies) {
+                    addDuplicateCandidate(copy.imageFileName, copy.contentHash, false);
                 }
-                originalImages++;
             }
-
-            foundDups++;
-            dupImageHashes[imageHash].duplicates++;
-            item = addThumb(currentFilePath);
-            if (item) {
-                item->setData(dupImageHashes[imageHash].id, SortRole);
-            }
-        } else {
-            DuplicateImage dupImage;
-            dupImage.filePath = currentFilePath;
-            dupImage.duplicates = 0;
-            dupImage.id = dupImageHashes.count();
-            dupImageHashes.insert(imageHash, dupImage);
+            continue;
         }
 
+        ImageFeatures &features = featureStore.features(result.imageFileName, result.lastModified, result.fileSize);
+        features.dHash = result.dHash;
+        features.hasDHash = true;
 
-        updateFoundDupesState(foundDups, totalFiles, originalImages);
+        addSimilarImage(result.imageFileName, result.dHash);
+    }
 
-        if (isAbortThumbsLoading) {
-            break;
+    thumbsViewerModel->sort(0);
+    refreshVisibleThumbs();
+    updateFoundDupesState(dupFoundDups, dupTotalFiles, dupOriginalImages);
+}
+
+void ThumbsViewer::addSimilarImage(const QString &filePath, quint64 dHash) {
+    ++dupTotalFiles;
+    const quint64 groupHash = addDuplicateCandidate(filePath, dHash);
+
+    const QVector<ImageHash> copies = identicalCopies.take(filePath);
+    dupTotalFiles += copies.size();
+    for (const ImageHash &copy : copies) {
+        addDuplicateCandidate(copy.imageFileName, groupHash, false);
+    }
+}
+
+quint64 ThumbsViewer::addDuplicateCandidate(const QString &filePath, quint64 imageHash, bool allowNearMatches) {
+    // Near duplicates join the group of the closest hash seen so far
+    if (allowNearMatches && Settings::dupesHammingDistance > 0 && !dupImageHashes.contains(imageHash)) {
+        quint64 nearestHash;
+        if (dupHashIndex.findNearest(imageHash, int(Settings::dupesHammingDistance), nearestHash)) {
+            imageHash = nearestHash;
+        } else {
+            dupHashIndex.insert(imageHash);
         }
     }
 
-    updateFoundDupesState(foundDups, totalFiles, originalImages);
+    if (dupImageHashes.contains(imageHash)) {
+        int row;
+        if (dupImageHashes[imageHash].duplicates < 1) {
+            row = addThumb(dupImageHashes[imageHash].filePath);
+            if (row >= 0) {
+                thumbsViewerModel->setData(thumbsViewerModel->index(row, 0), dupImageHashes[imageHash].id,
+                                           SortRole);
+            }
+            dupOriginalImages++;
+        }
+
+        dupFoundDups++;
+        dupImageHashes[imageHash].duplicates++;
+        row = addThumb(filePath);
+        if (row >= 0) {
+            thumbsViewerModel->setData(thumbsViewerModel->index(row, 0), dupImageHashes[imageHash].id, SortRole);
+        }
+    } else {
+        DuplicateImage dupImage;
+        dupImage.filePath = filePath;
+        dupImage.duplicates = 0;
+        dupImage.id = dupImageHashes.count();
+        dupImageHashes.insert(imageHash, dupImage);
+    }
+    return imageHash;
 }
 
 void ThumbsViewer::selectByBrightness(qreal min, qreal max) {
-    loadAllThumbs();
+    // Only rows whose brightness was never computed are scanned
+    thumbsViewerModel->readAttributes();
+    QList<ImageBrightness> missingImages;
+    QList<int> missingRows;
+    for (int row = 0; row < thumbsViewerModel->rowCount(); ++row) {
+        const QModelIndex idx = thumbsViewerModel->index(row, 0);
+        if (thumbsViewerModel->data(idx, BrightnessRole).isValid()) {
+            continue;
+        }
+        ImageBrightness image;
+        image.imageFileName = thumbsViewerModel->filePath(row);
+        image.lastModified = thumbsViewerModel->lastModified(row);
+        image.fileSize = thumbsViewerModel->fileSize(row);
+        image.usePack = Settings::packedThumbnails;
+        const ImageFeatures *features = featureStore.find(image.imageFileName, image.lastModified, image.fileSize);
+        if (features && !std::isnan(features->brightness)) {
+            thumbsViewerModel->setData(idx, features->brightness, BrightnessRole);
+        } else {
+            missingImages.append(image);
+            missingRows.append(row);
+        }
+    }
+
+    if (!missingImages.isEmpty()) {
+        QProgressDialog progress(tr("Reading brightness..."), tr("Abort"), 0, missingImages.size(), this);
+        pendingBrightness = missingImages.size();
+        brightnessScanner->scan(missingImages);
+        while (pendingBrightness > 0) {
+            progress.setValue(missingImages.size() - pendingBrightness);
+            if (progress.wasCanceled() || isAbortThumbsLoading) {
+                brightnessScanner->cancel();
+                pendingBrightness = 0;
+                break;
+            }
+            QApplication::processEvents(QEventLoop::WaitForMoreEvents);
+        }
+
+        for (int i = 0; i < missingRows.size(); ++i) {
+            const ImageBrightness &image = missingImages.at(i);
+            const ImageFeatures *features = featureStore.find(image.imageFileName, image.lastModified,
+                                                              image.fileSize);
+            if (features && !std::isnan(features->brightness)) {
+                thumbsViewerModel->setData(thumbsViewerModel->index(missingRows.at(i), 0), features->brightness,
+                                           BrightnessRole);
+            }
+        }
+        featureStore.flush();
+    }
+
     QItemSelection sel;
     for (int row = 0; row < thumbsViewerModel->rowCount(); ++row) {
         QModelIndex idx = thumbsViewerModel->index(row, 0);
@@ -895,46 +1416,20 @@ void ThumbsViewer::selectByBrightness(qreal min, qreal max) {
     selectionModel()->select(sel, QItemSelectionModel::ClearAndSelect);
 }
 
-void ThumbsViewer::loadAllThumbs() {
-    QProgressDialog progress(tr("Loading thumbnails..."), tr("Abort"), 0, thumbFileInfoList.count(), this);
-    int processed = 0;
-    for (int i = 0; i < thumbFileInfoList.count(); ++i) {
-        progress.setValue(i);
-        if (progress.wasCanceled())
-            break;
-        if (thumbsViewerModel->item(i)->data(LoadedRole).toBool())
-            continue;
-        loadThumb(i);
-
-        if (isAbortThumbsLoading) {
-            break;
-        }
-
-        if (++processed > BATCH_SIZE) {
-            QApplication::processEvents();
-            processed = 0;
-        }
+void ThumbsViewer::onBrightnessComputed(int generation, const QVector<ImageBrightness> &results) {
+    if (generation != brightnessScanner->currentGeneration()) {
+        return;
     }
-}
 
-static Histogram calcHist(const QImage &img)
-{
-    Histogram hist;
-    if (img.isNull()) {
-        qWarning() << "Invalid file";
-        return hist;
-    }
-    const QImage image = img.scaled(256, 256).convertToFormat(QImage::Format_RGB888);
-    for (int y=0; y<image.height(); y++) {
-        const uchar *line = image.scanLine(y);
-        for (int x=0; x<image.width(); x++) {
-            const int index = x * 3;
-            hist.red[line[index + 0]] += 1.f;
-            hist.green[line[index + 1]] += 1.f;
-            hist.blue[line[index + 2]] += 1.f;
+    pendingBrightness -= results.size();
+    for (const ImageBrightness &result : results) {
+        if (!result.isValid) {
+            continue;
         }
+
+        ImageFeatures &features = featureStore.features(result.imageFileName, result.lastModified, result.fileSize);
+        features.brightness = result.brightness;
     }
-    return hist;
 }
 
 static Histogram calcHist(const QString &filePath) {
@@ -946,390 +1441,283 @@ static Histogram calcHist(const QString &filePath) {
         qWarning() << "Invalid file" << filePath << reader.errorString();
         return {};
     }
-    return calcHist(image);
+    return Histogram::fromImage(image);
 }
 
 
 void ThumbsViewer::sortBySimilarity() {
-    QProgressDialog progress(tr("Loading..."), tr("Abort"), 0, thumbFileInfoList.count(), this);
+    Perf::ScopedTimer timer(Perf::SortBySimilarity);
+    const int rowCount = thumbsViewerModel->rowCount();
+    const bool isPrecise = Settings::preciseSimilarity;
+    featureStore.setHistogramsKept(isPrecise);
+    QProgressDialog progress(tr("Loading..."), tr("Abort"), 0, rowCount, this);
     progress.show();
     QApplication::processEvents();
 
-    int processed = 0;
-    for (int i = 0; i < thumbFileInfoList.count(); ++i) {
-        QStandardItem *item = thumbsViewerModel->item(i);
+    QElapsedTimer stageTimer;
+    stageTimer.start();
+    SimilarityOrder::Stage currentStage = SimilarityOrder::ComputingHistograms;
+    const SimilarityOrder::Progress reportProgress = [&](SimilarityOrder::Stage stage, int done, int total) {
+        if (stage != currentStage) {
+            currentStage = stage;
+            stageTimer.restart();
+        }
 
-        Q_ASSERT(item);
-        if (!item) {
-            continue;
+        QString label;
+        switch (stage) {
+            case SimilarityOrder::ComputingHistograms:
+                label = tr("Loading...");
+                break;
+            case SimilarityOrder::BuildingIndex:
+            case SimilarityOrder::FindingNeighbours:
+                label = tr("Comparing...");
+                break;
+            case SimilarityOrder::Chaining:
+                label = tr("Sorting...");
+                break;
         }
-        const QString filename = item->data(FileNameRole).toString();
-        if (histFiles.contains(filename)) {
-            continue;
+        // Estimate from the rate so far, once there is enough of it to go by
+        if (done > 0 && stageTimer.elapsed() > 1000) {
+            const int secondsLeft = int(stageTimer.elapsed() * (total - done) / done / 1000);
+            label += QLatin1Char(' ') + tr("About %n second(s) left", "", secondsLeft);
         }
-        histograms.append(calcHist(filename));
-        histFiles.append(filename);
+        progress.setLabelText(label);
+        progress.setMaximum(total);
+        progress.setValue(done);
+        QApplication::processEvents();
+        return !progress.wasCanceled();
+    };
 
-        if (++processed > BATCH_SIZE) {
-            processed = 0;
-            progress.setValue(i);
-            QApplication::processEvents();
-            if (progress.wasCanceled()) {
-                return;
-            }
+    // Histograms are looked up per file identity, so reloads and repeated sorts reuse them
+    thumbsViewerModel->readAttributes();
+    QVector<int> missingRows;
+    for (int row = 0; row < rowCount; ++row) {
+        const ImageFeatures *features = featureStore.find(thumbsViewerModel->filePath(row),
+                                                          thumbsViewerModel->lastModified(row),
+                                                          thumbsViewerModel->fileSize(row));
+        if (!features || (isPrecise ? !features->histogram : !features->hasDescriptor)) {
+            missingRows.append(row);
         }
     }
 
-    progress.setLabelText(tr("Comparing..."));
-    progress.setValue(0);
-
-    for (int i=0; i<histFiles.size() - 1; i++) {
-        float minScore = std::numeric_limits<float>::max();
-        int minIndex = i+1;
-
-        for (int j=i+1; j<histFiles.size(); j++) {
-            const float score = histograms[i].compare(histograms[j]);
-            if (score > minScore) {
-                continue;
+    QStringList missingFiles;
+    for (int row : missingRows) {
+        missingFiles.append(thumbsViewerModel->filePath(row));
+    }
+    // Full histograms are only held on to in precise mode
+    QVector<Histogram> missingHistograms(isPrecise ? missingRows.size() : 0);
+    QVector<ColorDescriptor> missingDescriptors(missingRows.size());
+    Histogram *computedHistograms = missingHistograms.data();
+    ColorDescriptor *computedDescriptors = missingDescriptors.data();
+    if (!SimilarityOrder::forEachInParallel(missingRows.size(), [&](int i) {
+            const Histogram histogram = calcHist(missingFiles.at(i));
+            computedDescriptors[i] = ColorDescriptor::fromHistogram(histogram);
+            if (isPrecise) {
+                computedHistograms[i] = histogram;
             }
-            minIndex = j;
-            minScore = score;
-
-            processed++;
+        }, SimilarityOrder::ComputingHistograms, reportProgress)) {
+        return;
+    }
+    for (int i = 0; i < missingRows.size(); ++i) {
+        const int row = missingRows.at(i);
+        ImageFeatures &features = featureStore.features(missingFiles.at(i), thumbsViewerModel->lastModified(row),
+                                                        thumbsViewerModel->fileSize(row));
+        features.descriptor = missingDescriptors.at(i);
+        features.hasDescriptor = true;
+        if (isPrecise) {
+            features.histogram = std::make_shared<Histogram>(missingHistograms.at(i));
         }
-        std::swap(histFiles[i+1], histFiles[minIndex]);
-        std::swap(histograms[i+1], histograms[minIndex]);
-
-        if (processed > BATCH_SIZE * 10) {
-            processed = 0;
-            progress.show();
-            progress.setValue(i);
-            QApplication::processEvents();
-            if (progress.wasCanceled()) {
-                return;
+    }
+    missingHistograms.clear();
+    missingDescriptors.clear();
+
+    QVector<int> chain;
+    if (isPrecise) {
+        // Keeps the histograms alive while the chain is built
+        QVector<std::shared_ptr<Histogram>> rowHistograms(rowCount);
+        QVector<const Histogram *> histograms(rowCount);
+        for (int row = 0; row < rowCount; ++row) {
+            const ImageFeatures *features = featureStore.find(thumbsViewerModel->filePath(row),
+                                                              thumbsViewerModel->lastModified(row),
+                                                              thumbsViewerModel->fileSize(row));
+            rowHistograms[row] = features ? features->histogram : nullptr;
+            if (!rowHistograms.at(row)) {
+                // Failed to decode, it goes with the blank images
+                rowHistograms[row] = std::make_shared<Histogram>();
             }
+            histograms[row] = rowHistograms.at(row).get();
         }
+        featureStore.flush();
+        chain = SimilarityOrder::chain(histograms, reportProgress);
+    } else {
+        // Rows that failed to decode keep the blank descriptor
+        QVector<ColorDescriptor> descriptors(rowCount);
+        for (int row = 0; row < rowCount; ++row) {
+            const ImageFeatures *features = featureStore.find(thumbsViewerModel->filePath(row),
+                                                              thumbsViewerModel->lastModified(row),
+                                                              thumbsViewerModel->fileSize(row));
+            if (features && features->hasDescriptor) {
+                descriptors[row] = features->descriptor;
+            }
+        }
+        featureStore.flush();
+        chain = SimilarityOrder::chain(descriptors, reportProgress);
     }
-
-    progress.setLabelText(tr("Sorting..."));
-    progress.setMaximum(thumbFileInfoList.count() + 1); // + 1 for the call to sort() at the bottom
-    progress.setValue(0);
-    QHash<QString, int> indices;
-    for (int i=0; i<histFiles.size(); i++) {
-        indices[histFiles[i]] = i;
+    if (chain.size() != rowCount) {
+        return;
     }
-    for (int i = 0; i < thumbFileInfoList.count(); ++i) {
-        QStandardItem *item = thumbsViewerModel->item(i);
-        Q_ASSERT(item);
-        if (!item) {
-            qWarning() << "Invalid item" << i;
-            continue;
-        }
-        const QString filename = item->data(FileNameRole).toString();
-        if (!indices.contains(filename)) {
-            qWarning() << "Invalid file" << filename;
-            continue;
-        }
-        item->setData(indices.size() - indices[filename], SortRole);
 
-        if (++processed > BATCH_SIZE) {
-            processed = 0;
-            progress.show();
-            progress.setValue(i);
-            QApplication::processEvents();
-            if (progress.wasCanceled()) {
-                return;
-            }
-        }
+    for (int i = 0; i < chain.size(); ++i) {
+        thumbsViewerModel->setData(thumbsViewerModel->index(chain.at(i), 0), chain.size() - i, SortRole);
     }
-    QApplication::processEvents();
 
     thumbsViewerModel->setSortRole(SortRole);
     thumbsViewerModel->sort(0);
 }
 
 void ThumbsViewer::loadThumbsRange() {
-    static bool isInProgress = false;
-    static int currentRowCount;
-    int currThumb;
-
-    if (isInProgress) {
-        isAbortThumbsLoading = true;
-        QTimer::singleShot(0, this, SLOT(loadThumbsRange()));
+    if (thumbsRangeFirst < 0 || thumbsRangeLast < 0) {
         return;
     }
 
-    isInProgress = true;
-    currentRowCount = thumbsViewerModel->rowCount();
+    // Whatever has not been picked up yet belongs to a range that may no longer be visible
+    const QList<quint64> droppedTickets = thumbnailLoader->clearQueue();
+    for (quint64 ticket : droppedTickets) {
+        pendingThumbFiles.remove(pendingThumbs.take(ticket).filePath);
+    }
 
-    QElapsedTimer timer;
-    timer.start();
+    // Rows about to be shown are never evicted, evicted ones are simply requested again
+    thumbsViewerModel->touchThumbnails(thumbsRangeFirst, thumbsRangeLast);
 
+    QList<ThumbnailRequest> requests;
+    int currThumb;
     for (scrolledForward ? currThumb = thumbsRangeFirst : currThumb = thumbsRangeLast;
          (scrolledForward ? currThumb <= thumbsRangeLast : currThumb >= thumbsRangeFirst);
          scrolledForward ? ++currThumb : --currThumb) {
 
-        if (isAbortThumbsLoading || thumbsViewerModel->rowCount() != currentRowCount || currThumb < 0)
+        if (currThumb < 0 || currThumb >= thumbsViewerModel->rowCount())
             break;
 
-        if (thumbsViewerModel->item(currThumb)->data(LoadedRole).toBool())
-            continue;
-
-        loadThumb(currThumb);
-
-        if (timer.elapsed() > 10) {
-            QApplication::processEvents();
-            timer.restart();
-        }
+        requestThumb(currThumb, requests);
     }
 
-    isInProgress = false;
-
-    if (!isClosing) {
-        isAbortThumbsLoading = false;
-    }
+    thumbnailLoader->enqueue(requests);
 }
 
-QString ThumbsViewer::thumbnailFileName(const QString &originalPath) const
-{
-    QFileInfo info(originalPath);
-    QString canonicalPath = info.canonicalFilePath();
-    if (canonicalPath.isEmpty()) {
-        qWarning() << originalPath << "does not exist!";
-        canonicalPath = info.absoluteFilePath();
+bool ThumbsViewer::requestThumb(int row, QList<ThumbnailRequest> &requests) {
+    if (row < 0 || row >= thumbsViewerModel->rowCount()
+        || (thumbsViewerModel->isLoaded(row) && !thumbsViewerModel->needsRefinement(row))) {
+        return false;
     }
-    QUrl url = QUrl::fromLocalFile(canonicalPath);
-    QCryptographicHash md5(QCryptographicHash::Md5);
-    md5.addData(QFile::encodeName(url.adjusted(QUrl::RemovePassword).url()));
-    return QString::fromLatin1(md5.result().toHex()) + QStringLiteral(".png");
-}
-
-QString ThumbsViewer::locateThumbnail(const QString &originalPath) const
-{
-#if defined(Q_OS_MAC) || defined(Q_OS_WIN)
-    return "";
-#endif
-    QStringList folders = {
-        QStringLiteral("xx-large/"), // max 1024px
-        QStringLiteral("x-large/"), // max 512px
-        QStringLiteral("large/"), // max 256px, doesn't look too bad when upscaled to max
-    };
 
-    if (thumbSize <= 200) {
-        folders.append(QStringLiteral("normal/")); // 128px max
+    const QString imageFileName = thumbsViewerModel->filePath(row);
+    if (pendingThumbFiles.contains(imageFileName)) {
+        return false;
     }
 
-    const QString filename = thumbnailFileName(originalPath);
-    const QString basePath = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) +
-        QLatin1String("/thumbnails/");
-    const QFileInfo originalInfo(originalPath);
-    for (const QString &folder : folders) {
-        QFileInfo info(basePath + folder + filename);
-        if (!info.exists()) {
-            continue;
-        }
-        if (originalInfo.metadataChangeTime() > info.lastModified()) {
-            continue;
-        }
-        if (originalInfo.lastModified() > info.lastModified()) {
-            continue;
+    ThumbnailRequest request;
+    request.ticket = ++lastThumbnailTicket;
+    request.imageFileName = imageFileName;
+    request.thumbSize = thumbSize;
+    request.smartCrop = Settings::thumbsLayout != Classic;
+    if (Settings::exifThumbRotationEnabled) {
+        if (metadataCache->hasImageMetadata(imageFileName)) {
+            request.orientation = metadataCache->getCachedImageOrientation(imageFileName);
+        } else {
+            request.readOrientation = true;
         }
-        return info.absoluteFilePath();
     }
-    return QString();
+    request.lastModified = thumbsViewerModel->lastModified(row);
+    request.fileSize = thumbsViewerModel->fileSize(row);
+    request.usePack = Settings::packedThumbnails;
+    request.packEncoding = PackedThumbnail::Encoding(Settings::packedThumbnailEncoding);
+    requests.append(request);
+
+    pendingThumbs.insert(request.ticket, {QPersistentModelIndex(thumbsViewerModel->index(row, 0)), imageFileName});
+    pendingThumbFiles.insert(imageFileName);
+    return true;
 }
 
-void ThumbsViewer::storeThumbnail(const QString &originalPath, QImage thumbnail, const QSize &originalSize) const {
-#if defined(Q_OS_MAC) || defined(Q_OS_WIN)
-    return;
-#endif
-    const QString canonicalPath = QFileInfo(originalPath).canonicalFilePath();
-    if (canonicalPath.isEmpty()) {
-        qWarning() << "Asked to store thumbnail for non-existent path" << originalPath;
-        return;
-    }
+void ThumbsViewer::cancelThumbsLoading() {
+    thumbnailLoader->cancel();
+    pendingThumbs.clear();
+    pendingThumbFiles.clear();
+}
 
-    QString folder = QStringLiteral("normal/");
-    const int maxSize = qMax(thumbnail.width(), thumbnail.height());
-    if (maxSize < 64) {
-        qDebug() << "Refusing to store tiny thumbnail" << thumbnail.size();
+void ThumbsViewer::onThumbnailLoaded(quint64 ticket, const QImage &thumb, qreal brightness,
+                                     const Histogram &histogram) {
+    if (!pendingThumbs.contains(ticket)) {
         return;
     }
-    if (maxSize >= 1024) {
-        folder = QStringLiteral("xx-large/");
-        thumbnail = thumbnail.scaled(1024, 1024, Qt::KeepAspectRatio);
-    } else if (maxSize >= 512) {
-        folder = QStringLiteral("x-large/");
-        thumbnail = thumbnail.scaled(512, 512, Qt::KeepAspectRatio);
-    } else if (maxSize >= 256) {
-        folder = QStringLiteral("large/");
-        thumbnail = thumbnail.scaled(256, 256, Qt::KeepAspectRatio);
-    } else if (maxSize >= 128) {
-        folder = QStringLiteral("normal/");
-        thumbnail = thumbnail.scaled(128, 128, Qt::KeepAspectRatio);
-    } else {
-        qWarning() << "Thumbnail too small" << thumbnail.size();
+
+    const PendingThumb pendingThumb = pendingThumbs.take(ticket);
+    pendingThumbFiles.remove(pendingThumb.filePath);
+    if (!pendingThumb.index.isValid()) {
         return;
     }
 
-    const QString filename = thumbnailFileName(originalPath);
-    const QString basePath = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) +
-        QLatin1String("/thumbnails/");
+    const int row = pendingThumb.index.row();
+    thumbsViewerModel->setData(pendingThumb.index, brightness, BrightnessRole);
+    thumbsViewerModel->setThumbnail(row, QPixmap::fromImage(thumb));
+    StartupTimer::finish("first thumbnail");
 
-    if (!QFileInfo::exists(basePath + folder)) {
-        QDir().mkpath(basePath + folder);
+    ImageFeatures &features = featureStore.features(pendingThumb.filePath, thumbsViewerModel->lastModified(row),
+                                                    thumbsViewerModel->fileSize(row));
+    features.brightness = brightness;
+    if (!features.hasDescriptor) {
+        features.descriptor = ColorDescriptor::fromHistogram(histogram);
+        features.hasDescriptor = true;
     }
-
-    const QString fullPath = basePath + folder + filename;
-    QFileInfo info(fullPath);
-
-    QDateTime lastModified = info.lastModified();
-    if (info.metadataChangeTime() > info.lastModified()) {
-        lastModified = info.metadataChangeTime();
+    if (Settings::preciseSimilarity && !features.histogram) {
+        features.histogram = std::make_shared<Histogram>(histogram);
     }
-    thumbnail.setText(QStringLiteral("Thumb::MTime"), QString::number(lastModified.toTime_t()));
-
-    QUrl url = QUrl::fromLocalFile(canonicalPath).adjusted(QUrl::RemovePassword);
-    thumbnail.setText(QStringLiteral("Thumb::URI"), url.url());
-
-    thumbnail.setText(QStringLiteral("Thumb::Image::Width"), QString::number(originalSize.width()));
-    thumbnail.setText(QStringLiteral("Thumb::Image::Height"), QString::number(originalSize.height()));
-    thumbnail.setText("Software", "Phototonic");
-    thumbnail.convertToColorSpace(QColorSpace::SRgb);
-
-    thumbnail.save(fullPath);
 }
 
-bool ThumbsViewer::loadThumb(int currThumb) {
-    QImageReader thumbReader;
-    QString imageFileName = thumbsViewerModel->item(currThumb)->data(FileNameRole).toString();
-    QImage thumb;
-    bool imageReadOk = false;
-    bool shouldStoreThumbnail = false;
-
-    thumbReader.setFileName(imageFileName);
-    thumbReader.setQuality(50); // 50 is the threshold where Qt does fast decoding, but still good scaling
-    const QSize origThumbSize = thumbReader.size();
-    QSize currentThumbSize = origThumbSize;
-
-    QString thumbnailPath = locateThumbnail(imageFileName);
-    if (!thumbnailPath.isEmpty()) {
-        if (QImageReader(thumbnailPath).canRead()) {
-            thumbReader.setFileName(thumbnailPath);
-        } else {
-            qWarning() << "Invalid thumbnail" << thumbnailPath;
-            shouldStoreThumbnail = true;
-        }
-    } else {
-        shouldStoreThumbnail = true;
+void ThumbsViewer::onThumbnailFailed(quint64 ticket) {
+    if (!pendingThumbs.contains(ticket)) {
+        return;
     }
 
-    if (currentThumbSize.isValid()) {
-        if (currentThumbSize.width() != thumbSize || currentThumbSize.height() != thumbSize) {
-            currentThumbSize.scale(QSize(thumbSize, thumbSize), Settings::thumbsLayout != Classic ? Qt::KeepAspectRatioByExpanding : Qt::KeepAspectRatio);
-        }
-
-        thumbReader.setScaledSize(currentThumbSize);
-        imageReadOk = thumbReader.read(&thumb);
-
-        if (imageReadOk && !shouldStoreThumbnail) {
-            int w = thumb.text("Thumb::Image::Width").toInt();
-            int h = thumb.text("Thumb::Image::Height").toInt();
-            if (origThumbSize != QSize(w, h)) {
-                qWarning() << "Invalid size in stored thumbnail" << w << h << "vs" << origThumbSize;
-                shouldStoreThumbnail = true;
-                thumbReader.setFileName(imageFileName);
-                imageReadOk = thumbReader.read(&thumb);
-            }
-
-        }
+    const PendingThumb pendingThumb = pendingThumbs.take(ticket);
+    pendingThumbFiles.remove(pendingThumb.filePath);
+    if (!pendingThumb.index.isValid()) {
+        return;
     }
 
-    if (imageReadOk) {
-        if (shouldStoreThumbnail) {
-            storeThumbnail(imageFileName, thumb, origThumbSize);
-        }
-        if (Settings::exifThumbRotationEnabled) {
-            imageViewer->rotateByExifRotation(thumb, imageFileName);
-            currentThumbSize = thumb.size();
-            currentThumbSize.scale(QSize(thumbSize, thumbSize), Settings::thumbsLayout != Classic ? Qt::KeepAspectRatioByExpanding : Qt::KeepAspectRatio);
-        }
-
-        thumbsViewerModel->item(currThumb)->setData(qGray(thumb.scaled(1, 1).pixel(0, 0)) / 255.0, BrightnessRole);
-
-        if (Settings::thumbsLayout != Classic) {
-            thumb = SmartCrop::crop(thumb, QSize(thumbSize, thumbSize));
-        }
-
-        thumbsViewerModel->item(currThumb)->setIcon(QPixmap::fromImage(thumb));
-        thumbsViewerModel->item(currThumb)->setData(true, LoadedRole);
-        histograms.append(calcHist(thumb));
-        histFiles.append(imageFileName);
-        thumbsViewerModel->item(currThumb)->setSizeHint(itemSizeHint());
-    } else {
-        thumbsViewerModel->item(currThumb)->setIcon(QIcon::fromTheme("image-missing",
-                                                                     QIcon(":/images/error_image.png")).pixmap(
-                BAD_IMAGE_SIZE, BAD_IMAGE_SIZE));
-        currentThumbSize.setHeight(BAD_IMAGE_SIZE);
-        currentThumbSize.setWidth(BAD_IMAGE_SIZE);
-        return false;
-    }
-    return true;
+    // Marked as loaded so the broken file is not queued again on every scroll
+    thumbsViewerModel->setThumbnail(pendingThumb.index.row(),
+                                    QIcon::fromTheme("image-missing", QIcon(":/images/error_image.png")).pixmap(
+                                            BAD_IMAGE_SIZE, BAD_IMAGE_SIZE), false);
 }
 
-QStandardItem * ThumbsViewer::addThumb(QString &imageFullPath) {
-
-    metadataCache->loadImageMetadata(imageFullPath);
-    if (imageTags->dirFilteringActive && imageTags->isImageFilteredOut(imageFullPath)) {
-        return nullptr;
+void ThumbsViewer::onMetadataScanned(const QVector<ScannedMetadata> &results) {
+    // The scanner has put the results into the cache already
+    QStringList imageFileNames;
+    for (const ScannedMetadata &result : results) {
+        imageFileNames.append(result.imageFileName);
     }
-
-    QStandardItem *thumbItem = new QStandardItem();
-    QImageReader thumbReader;
-    QSize hintSize = itemSizeHint();
-    QSize currThumbSize;
-
-    thumbFileInfo = QFileInfo(imageFullPath);
-    thumbItem->setData(true, LoadedRole);
-    thumbItem->setData(0, SortRole);
-    thumbItem->setData(thumbFileInfo.size(), SizeRole);
-    thumbItem->setData(thumbFileInfo.lastModified(), TimeRole);
-    thumbItem->setData(thumbFileInfo.suffix(), TypeRole);
-    thumbItem->setData(thumbFileInfo.filePath(), FileNameRole);
-    if (Settings::thumbsLayout != Squares) {
-        thumbItem->setTextAlignment(Qt::AlignTop | Qt::AlignHCenter);
-        thumbItem->setData(thumbFileInfo.fileName(), Qt::DisplayRole);
+    imageTags->updateImagesTags(imageFileNames);
+    if (metadataCache->publishNewTags()) {
+        imageTags->populateTagsTree();
+    } else if (imageTags->isVisible() && imageTags->currentDisplayMode == SelectionTagsDisplay) {
+        imageTags->showSelectedImagesTags();
     }
-    thumbItem->setSizeHint(hintSize);
-
-    thumbReader.setFileName(imageFullPath);
-    currThumbSize = thumbReader.size();
-    if (currThumbSize.isValid()) {
-        if (currThumbSize.width() > thumbSize || currThumbSize.height() > thumbSize) {
-            currThumbSize.scale(QSize(thumbSize, thumbSize), Settings::thumbsLayout != Classic ? Qt::KeepAspectRatioByExpanding : Qt::KeepAspectRatio);
-        }
+}
 
-        thumbReader.setScaledSize(currThumbSize);
-        QImage thumb = thumbReader.read();
+int ThumbsViewer::addThumb(QString &imageFullPath) {
 
-        if (Settings::exifThumbRotationEnabled) {
-            imageViewer->rotateByExifRotation(thumb, imageFullPath);
-            currThumbSize = thumb.size();
-            currThumbSize.scale(QSize(thumbSize, thumbSize), Settings::thumbsLayout != Classic ? Qt::KeepAspectRatioByExpanding : Qt::KeepAspectRatio);
+    if (imageTags->dirFilteringActive) {
+        metadataCache->loadImageMetadata(imageFullPath);
+        if (imageTags->isImageFilteredOut(imageFullPath)) {
+            return -1;
         }
-        thumbItem->setData(qGray(thumb.scaled(1, 1).pixel(0, 0)) / 255.0, BrightnessRole);
-
-        thumbItem->setIcon(QPixmap::fromImage(thumb));
-    } else {
-        thumbItem->setIcon(
-                QIcon::fromTheme("image-missing", QIcon(":/images/error_image.png")).pixmap(BAD_IMAGE_SIZE,
-                                                                                            BAD_IMAGE_SIZE));
-        currThumbSize.setHeight(BAD_IMAGE_SIZE);
-        currThumbSize.setWidth(BAD_IMAGE_SIZE);
+    } else if (!metadataCache->hasImageMetadata(imageFullPath)) {
+        metadataScanner->scan(QStringList(imageFullPath));
     }
 
-    thumbsViewerModel->appendRow(thumbItem);
-    return thumbItem;
+    // Decoding is left to the visible range loader, like initThumbs() does
+    thumbFileInfo = QFileInfo(imageFullPath);
+    return thumbsViewerModel->appendThumb(thumbFileInfo, 0);
 }
 
 void ThumbsViewer::mousePressEvent(QMouseEvent *event) {
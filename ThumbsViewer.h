@@ -28,6 +28,18 @@
 #include "Tags.h"
 #include "MetadataCache.h"
 #include "ImagePreview.h"
+#include "Histogram.h"
+#include "ThumbnailLoader.h"
+#include "MetadataScanner.h"
+#include "ThumbsModel.h"
+#include "ThumbsDelegate.h"
+#include "FeatureStore.h"
+#include "DuplicateHasher.h"
+#include "IdenticalFileFinder.h"
+#include "BrightnessScanner.h"
+#include "HammingIndex.h"
+#include "DirectoryCrawler.h"
+#include "ImageInfoReader.h"
 
 class Phototonic;
 
@@ -45,49 +57,26 @@ struct DuplicateImage
     int id = 0;
 };
 
-struct Histogram
+
+struct PendingThumb
 {
-    float red[256]{};
-    float green[256]{};
-    float blue[256]{};
-
-    inline float compareChannel(const float hist1[256], const float hist2[256])
-    {
-        float len1 = 0.f, len2 = 0.f, corr = 0.f;
-
-        for (uint16_t i=0; i<256; i++) {
-            len1 += hist1[i];
-            len2 += hist2[i];
-            corr += std::sqrt(hist1[i] * hist2[i]);
-        }
-
-        const float part1 = 1.f / std::sqrt(len1 * len2);
-
-        return std::sqrt(1.f - part1 * corr);
-    }
-
-    inline float compare(const Histogram &other)
-    {
-        return compareChannel(red, other.red) +
-            compareChannel(green, other.green) +
-            compareChannel(blue, other.blue);
-    }
+    QPersistentModelIndex index;
+    QString filePath;
 };
-Q_DECLARE_METATYPE(Histogram);
 
 class ThumbsViewer : public QListView {
 Q_OBJECT
 
 public:
     enum UserRoles {
-        FileNameRole = Qt::UserRole + 1,
-        SortRole,
-        LoadedRole,
-        BrightnessRole,
-        TypeRole,
-        SizeRole,
-        TimeRole,
-        HistogramRole
+        FileNameRole = ThumbsModel::FileNameRole,
+        SortRole = ThumbsModel::SortRole,
+        LoadedRole = ThumbsModel::LoadedRole,
+        BrightnessRole = ThumbsModel::BrightnessRole,
+        TypeRole = ThumbsModel::TypeRole,
+        SizeRole = ThumbsModel::SizeRole,
+        TimeRole = ThumbsModel::TimeRole,
+        HistogramRole = ThumbsModel::HistogramRole
     };
     enum ThumbnailLayouts {
         Classic,
@@ -99,14 +88,25 @@ public:
 
     void loadPrepare();
 
+    void setThumbSize(int size);
+
     void applyFilter();
 
+    // Lists path on a worker thread while the window is still being built, for the first load to pick up
+    void prefetchDirectory(const QString &path);
+
+    // The image types QImageReader supports, as name filters with filterString in front
+    static QStringList imageNameFilters(const QString &filterString);
+
     void reLoad();
 
     void loadDuplicates();
 
     void loadFileList();
 
+    // Adds rows for the paths of Settings::filesList that have none yet, as they are read
+    void appendNewFileListPaths();
+
     void loadSubDirectories();
 
     void setThumbColors();
@@ -123,7 +123,13 @@ public:
 
     void selectCurrentIndex();
 
-    QStandardItem *addThumb(QString &imageFullPath);
+    int addThumb(QString &imageFullPath);
+
+    void refreshVisibleThumbs();
+
+    // Removes and adds rows for the current tag filter without listing the directory again.
+    // Returns false if the view has to be reloaded instead.
+    bool applyTagFilter();
 
     void abort(bool permanent = false);
 
@@ -139,10 +145,16 @@ public:
 
     int getRandomRow();
 
+    // The row getRandomRow() returns next, so it can be prefetched
+    int peekRandomRow();
+
     int getCurrentRow();
 
     QStringList getSelectedThumbsList();
 
+    // Without building the list of selected indexes
+    int getSelectedThumbsCount() const;
+
     QString getSingleSelectionFilename();
 
     void setImageViewer(ImageViewer *imageViewer);
@@ -154,7 +166,8 @@ public:
     ImageTags *imageTags;
     QDir thumbsDir;
     QStringList fileFilters;
-    QStandardItemModel *thumbsViewerModel;
+    ThumbsModel *thumbsViewerModel;
+    ThumbsDelegate *thumbsDelegate;
     QDir::SortFlags thumbsSortFlags;
     int thumbSize;
     QString filterString;
@@ -165,48 +178,117 @@ protected:
     void mousePressEvent(QMouseEvent *event) override;
 
 private:
-    void initThumbs();
+    struct PrefetchedListing {
+        QString path;
+        QDir directory;
+        QFileInfoList files;
+        bool isListed = false;
+        QMutex mutex;
+        QWaitCondition listed;
+    };
+
+    class PrefetchWorker;
+
+    // How many paths of Settings::filesList have rows
+    int fileListRows = 0;
+
+    // Takes the files from prefetched if it listed the same directory the same way
+    void initThumbs(PrefetchedListing *prefetched);
+
+    void applyListingFlags(QDir &directory) const;
+
+    void appendFileList(const QStringList &paths);
+
+    bool requestThumb(int row, QList<ThumbnailRequest> &requests);
+
+    void cancelThumbsLoading();
 
-    bool loadThumb(int row);
+    void appendThumbs(const QFileInfoList &files, bool withAttributes = true);
 
-    void findDupes(bool resetCounters);
+    void crawlSubDirectories();
+
+    void findDupes(const QFileInfoList &files);
+
+    void watchDirectory(const QString &directoryPath);
+
+    void forgetPendingThumb(const QString &filePath);
+
+    void sortByListingOrder();
+
+    // Returns the hash of the group the file joined
+    quint64 addDuplicateCandidate(const QString &filePath, quint64 imageHash, bool allowNearMatches = true);
+
+    // Adds the image and the byte-identical copies found for it
+    void addSimilarImage(const QString &filePath, quint64 dHash);
 
     int getFirstVisibleThumb();
 
     int getLastVisibleThumb();
 
+    int thumbBottomEdge(int row);
+
     void updateThumbsCount();
 
     void updateFoundDupesState(int duplicates, int filesScanned, int originalImages);
 
     void updateImageInfoViewer(int row);
 
+    // Without the info, only what the model knows about the file is shown
+    void showImageInfo(int row, const ImageInfo *imageInfo);
+
     QSize itemSizeHint() const;
 
-    QString thumbnailFileName(const QString &path) const;
-    QString locateThumbnail(const QString &path) const;
-    void storeThumbnail(const QString &originalPath, QImage thumbnail, const QSize &originalSize) const;
+    void applyThumbsLayout();
 
     QFileInfo thumbFileInfo;
     QFileInfoList thumbFileInfoList;
-    QList<Histogram> histograms;
-    QList<QString> histFiles;
+    std::shared_ptr<PrefetchedListing> prefetchedListing;
+    // Everything listed for the view, including files the tag filter hides
+    QFileInfoList listedFiles;
+    bool isShowingDuplicates = false;
+    FeatureStore featureStore;
     QPixmap emptyImg;
     QModelIndex currentIndex;
     Phototonic *phototonic;
     std::shared_ptr<MetadataCache> metadataCache;
     ImageViewer *imageViewer;
-    QHash<QBitArray, DuplicateImage> dupImageHashes;
+    QHash<quint64, DuplicateImage> dupImageHashes;
+    HammingIndex dupHashIndex;
+    DuplicateHasher *duplicateHasher;
+    int pendingDupHashes = 0;
+    IdenticalFileFinder *identicalFileFinder;
+    QList<ImageHash> identicalCandidates;
+    // Copies of the files that are hashed for similarity, by the file they are a copy of
+    QHash<QString, QVector<ImageHash>> identicalCopies;
+    bool isFindingIdentical = false;
+    int dupOriginalImages = 0;
+    int dupFoundDups = 0;
+    int dupTotalFiles = 0;
+    BrightnessScanner *brightnessScanner;
+    int pendingBrightness = 0;
+    ThumbnailLoader *thumbnailLoader;
+    quint64 lastThumbnailTicket = 0;
+    QHash<quint64, PendingThumb> pendingThumbs;
+    QSet<QString> pendingThumbFiles;
+    MetadataScanner *metadataScanner;
+    ImageInfoReader *imageInfoReader;
+    QCache<QString, ImageInfo> imageInfoCache;
+    DirectoryCrawler *directoryCrawler;
+    bool isCrawling = false;
+    bool isCrawlingForDupes = false;
     bool isAbortThumbsLoading = false;
     bool isClosing = false;
     bool isNeedToScroll = false;
     int currentRow = 0;
+    int nextRandomRow = -1;
     bool scrolledForward = false;
     int thumbsRangeFirst;
     int thumbsRangeLast;
 
     QTimer m_selectionChangedTimer;
     QTimer m_loadThumbTimer;
+    QFileSystemWatcher *directoryWatcher;
+    QTimer directoryChangedTimer;
 
 public slots:
 
@@ -220,7 +302,25 @@ private slots:
 
     void loadThumbsRange();
 
-    void loadAllThumbs();
+    void onThumbnailLoaded(quint64 ticket, const QImage &thumb, qreal brightness, const Histogram &histogram);
+
+    void onThumbnailFailed(quint64 ticket);
+
+    void onMetadataScanned(const QVector<ScannedMetadata> &results);
+
+    void onImageInfoRead(int generation, const ImageInfo &imageInfo);
+
+    void onDuplicateHashesComputed(int generation, const QVector<ImageHash> &results);
+
+    void onIdenticalFilesGrouped(int generation, const ImageHashGroups &groups);
+
+    void onBrightnessComputed(int generation, const QVector<ImageBrightness> &results);
+
+    void onFilesListed(int generation, const QFileInfoList &files);
+
+    void onCrawlFinished(int generation);
+
+    void refreshChangedDirectory();
 };
 
 #endif // THUMBS_VIEWER_H
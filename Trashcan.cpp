@@ -27,6 +27,7 @@
 #include <QDir>
 #include <QFileInfo>
 #include <QFile>
+#include <QHash>
 #include <QStandardPaths>
 #include <QStorageInfo>
 #include <QTextStream>
@@ -38,50 +39,103 @@
 #include <fcntl.h>
 #include <cerrno>
 
+// The info and files subdirectories are set up by findTrashDir()
 static Trash::Result moveToTrashDir(const QString& filePath, const QDir& trashDir, QString& error, const QStorageInfo& nonHomeStorage)
 {
     const QDir trashInfoDir = QDir(trashDir.filePath("info"));
     const QDir trashFilesDir = QDir(trashDir.filePath("files"));
-    if (trashInfoDir.mkpath(".") && trashFilesDir.mkpath(".")) {
-        QFileInfo fileInfo(filePath);
-        QString fileName = fileInfo.fileName();
-        QString infoFileName = fileName + ".trashinfo";
-        int fd;
-        const int flag = O_CREAT | O_WRONLY | O_EXCL;
-        const int mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
-        for (unsigned int n = 2; trashFilesDir.exists(fileName) ||
-             ((fd = open(trashInfoDir.filePath(infoFileName).toUtf8().data(), flag, mode)) == -1 && errno == EEXIST); ++n) {
-            fileName = QString("%1.%2.%3").arg(fileInfo.baseName(), QString::number(n), fileInfo.completeSuffix());
-            infoFileName = fileName + ".trashinfo";
-        }
-        if (fd == -1) {
-            error = strerror(errno);
-            return Trash::Error;
-        }
-        const QString moveHere = trashFilesDir.filePath(fileName);
-        const QString deletionDate = QDateTime::currentDateTime().toString(Qt::ISODate);
-        const QString path = nonHomeStorage.isValid() ? QDir(nonHomeStorage.rootPath()).relativeFilePath(filePath) : filePath;
-        const QString escapedPath = QString::fromUtf8(QUrl::toPercentEncoding(path, "/"));
-        QFile infoFile;
-        if (infoFile.open(fd, QIODevice::WriteOnly, QFileDevice::AutoCloseHandle)) {
-            QTextStream out(&infoFile);
-            out << "[Trash Info]\nPath=" << escapedPath << "\nDeletionDate=" << deletionDate << '\n';
-        } else {
-            error = infoFile.errorString();
-            return Trash::Error;
-        }
+    QFileInfo fileInfo(filePath);
+    QString fileName = fileInfo.fileName();
+    QString infoFileName = fileName + ".trashinfo";
+    int fd;
+    const int flag = O_CREAT | O_WRONLY | O_EXCL;
+    const int mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+    for (unsigned int n = 2; trashFilesDir.exists(fileName) ||
+         ((fd = open(trashInfoDir.filePath(infoFileName).toUtf8().data(), flag, mode)) == -1 && errno == EEXIST); ++n) {
+        fileName = QString("%1.%2.%3").arg(fileInfo.baseName(), QString::number(n), fileInfo.completeSuffix());
+        infoFileName = fileName + ".trashinfo";
+    }
+    if (fd == -1) {
+        error = strerror(errno);
+        return Trash::Error;
+    }
+    const QString moveHere = trashFilesDir.filePath(fileName);
+    const QString deletionDate = QDateTime::currentDateTime().toString(Qt::ISODate);
+    const QString path = nonHomeStorage.isValid() ? QDir(nonHomeStorage.rootPath()).relativeFilePath(filePath) : filePath;
+    const QString escapedPath = QString::fromUtf8(QUrl::toPercentEncoding(path, "/"));
+    QFile infoFile;
+    if (infoFile.open(fd, QIODevice::WriteOnly, QFileDevice::AutoCloseHandle)) {
+        QTextStream out(&infoFile);
+        out << "[Trash Info]\nPath=" << escapedPath << "\nDeletionDate=" << deletionDate << '\n';
+    } else {
+        error = infoFile.errorString();
+        return Trash::Error;
+    }
 
 
-        if (QDir().rename(filePath, moveHere)) {
-            return Trash::Success;
-        } else {
-            error = QString("Could not rename %1 to %2").arg(filePath, moveHere);
+    if (QDir().rename(filePath, moveHere)) {
+        return Trash::Success;
+    } else {
+        error = QString("Could not rename %1 to %2").arg(filePath, moveHere);
+        return Trash::Error;
+    }
+}
+
+static Trash::Result findHomeDataLocation(QString& homeDataLocation, QString& error)
+{
+    homeDataLocation = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation);
+    if (homeDataLocation.isEmpty() || !QDir(homeDataLocation).exists()) {
+        error = "Could not get home data folder";
+        return Trash::Error;
+    }
+    return Trash::Success;
+}
+
+// Finds the trash directory for files on filePathStorage, creating it if needed
+static Trash::Result findTrashDir(const QStorageInfo& filePathStorage, const QString& homeDataLocation,
+                                  const QStorageInfo& homeStorage, Trash::Options trashOptions,
+                                  QDir& trashDir, QStorageInfo& nonHomeStorage, QString& error)
+{
+    if (homeStorage == filePathStorage || trashOptions == Trash::ForceDeletionToHomeTrash) {
+        const QDir homeTrashDirectory = QDir(QDir(homeDataLocation).filePath("Trash"));
+        if (!homeTrashDirectory.mkpath(".")) {
+            error = "Could not ensure that home trash directory exists";
             return Trash::Error;
         }
+        trashDir = homeTrashDirectory;
+        nonHomeStorage = QStorageInfo();
     } else {
+        const QDir topdir = QDir(filePathStorage.rootPath());
+        const QDir topdirTrash = QDir(topdir.filePath(".Trash"));
+        bool isFound = false;
+        struct stat trashStat;
+        if (lstat(topdirTrash.path().toUtf8().data(), &trashStat) == 0) {
+            // should be a directory, not link, and have sticky bit
+            if (S_ISDIR(trashStat.st_mode) && !S_ISLNK(trashStat.st_mode) && (trashStat.st_mode & S_ISVTX)) {
+                const QString subdir = QString::number(getuid());
+                if (topdirTrash.mkpath(subdir)) {
+                    trashDir = QDir(topdirTrash.filePath(subdir));
+                    isFound = true;
+                }
+            }
+        }
+        if (!isFound) {
+            // $topdir/.Trash does not exist or failed some check
+            QDir topdirUserTrash = QDir(topdir.filePath(QString(".Trash-%1").arg(getuid())));
+            if (!topdirUserTrash.mkpath(".")) {
+                error = "Could not find trash directory for the disk where the file resides";
+                return Trash::NeedsUserInput;
+            }
+            trashDir = topdirUserTrash;
+        }
+        nonHomeStorage = filePathStorage;
+    }
+
+    if (!QDir(trashDir.filePath("info")).mkpath(".") || !QDir(trashDir.filePath("files")).mkpath(".")) {
         error = "Could not set up trash subdirectories";
         return Trash::Error;
     }
+    return Trash::Success;
 }
 
 Trash::Result Trash::moveToTrash(const QString &path, QString &error, Trash::Options trashOptions)
@@ -96,41 +150,81 @@ Trash::Result Trash::moveToTrash(const QString &path, QString &error, Trash::Opt
         error = "Could not get device of the file being trashed";
         return Trash::Error;
     }
-    const QString homeDataLocation = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation);
-    const QDir homeDataDirectory(homeDataLocation);
-    if (homeDataLocation.isEmpty() || !homeDataDirectory.exists()) {
-        error = "Could not get home data folder";
+    QString homeDataLocation;
+    if (findHomeDataLocation(homeDataLocation, error) != Trash::Success) {
         return Trash::Error;
     }
 
-    if (QStorageInfo(homeDataLocation) == filePathStorage || trashOptions == Trash::ForceDeletionToHomeTrash) {
-        const QDir homeTrashDirectory = QDir(homeDataDirectory.filePath("Trash"));
-        if (homeTrashDirectory.mkpath(".")) {
-            return moveToTrashDir(filePath, homeTrashDirectory, error, QStorageInfo());
+    QDir trashDir;
+    QStorageInfo nonHomeStorage;
+    const Trash::Result result = findTrashDir(filePathStorage, homeDataLocation, QStorageInfo(homeDataLocation),
+                                              trashOptions, trashDir, nonHomeStorage, error);
+    if (result != Trash::Success) {
+        return result;
+    }
+    return moveToTrashDir(filePath, trashDir, error, nonHomeStorage);
+}
+
+void Trash::moveToTrash(const QStringList &filePaths, const std::function<bool(const FileResult &)> &resultHandler,
+                        Trash::Options trashOptions)
+{
+    struct TrashLocation
+    {
+        Trash::Result result;
+        QString error;
+        QDir trashDir;
+        QStorageInfo nonHomeStorage;
+    };
+
+    QString homeDataLocation;
+    QString homeError;
+    const Trash::Result homeResult = findHomeDataLocation(homeDataLocation, homeError);
+    const QStorageInfo homeStorage = homeResult == Trash::Success ? QStorageInfo(homeDataLocation) : QStorageInfo();
+
+    // Files in one directory are on one disk, and each disk has one trash directory
+    QHash<QString, QStorageInfo> directoryStorages;
+    QHash<QString, TrashLocation> trashLocations;
+
+    for (const QString &path : filePaths) {
+        FileResult fileResult = {path, Trash::Error, QString()};
+        if (path.isEmpty()) {
+            fileResult.error = "Path is empty";
+        } else if (homeResult != Trash::Success) {
+            fileResult.error = homeError;
         } else {
-            error = "Could not ensure that home trash directory exists";
-            return Trash::Error;
-        }
-    } else {
-        const QDir topdir = QDir(filePathStorage.rootPath());
-        const QDir topdirTrash = QDir(topdir.filePath(".Trash"));
-        struct stat trashStat;
-        if (lstat(topdirTrash.path().toUtf8().data(), &trashStat) == 0) {
-            // should be a directory, not link, and have sticky bit
-            if (S_ISDIR(trashStat.st_mode) && !S_ISLNK(trashStat.st_mode) && (trashStat.st_mode & S_ISVTX)) {
-                const QString subdir = QString::number(getuid());
-                if (topdirTrash.mkpath(subdir)) {
-                    return moveToTrashDir(filePath, QDir(topdirTrash.filePath(subdir)), error, filePathStorage);
+            const QFileInfo fileInfo(path);
+            const QString filePath = fileInfo.absoluteFilePath();
+            const QString directory = fileInfo.absolutePath();
+            QHash<QString, QStorageInfo>::iterator storage = directoryStorages.find(directory);
+            if (storage == directoryStorages.end()) {
+                storage = directoryStorages.insert(directory, QStorageInfo(directory));
+            }
+
+            if (!storage->isValid()) {
+                fileResult.error = "Could not get device of the file being trashed";
+            } else {
+                QHash<QString, TrashLocation>::iterator location = trashLocations.find(storage->rootPath());
+                if (location == trashLocations.end()) {
+                    TrashLocation newLocation;
+                    newLocation.result = findTrashDir(*storage, homeDataLocation, homeStorage, trashOptions,
+                                                      newLocation.trashDir, newLocation.nonHomeStorage,
+                                                      newLocation.error);
+                    location = trashLocations.insert(storage->rootPath(), newLocation);
+                }
+
+                if (location->result != Trash::Success) {
+                    fileResult.result = location->result;
+                    fileResult.error = location->error;
+                } else {
+                    fileResult.result = moveToTrashDir(filePath, location->trashDir, fileResult.error,
+                                                       location->nonHomeStorage);
                 }
             }
         }
-        // if we're still here, $topdir/.Trash does not exist or failed some check
-        QDir topdirUserTrash = QDir(topdir.filePath(QString(".Trash-%1").arg(getuid())));
-        if (topdirUserTrash.mkpath(".")) {
-            return moveToTrashDir(filePath, topdirUserTrash, error, filePathStorage);
+
+        if (!resultHandler(fileResult)) {
+            return;
         }
-        error = "Could not find trash directory for the disk where the file resides";
-        return Trash::NeedsUserInput;
     }
 }
 
@@ -158,6 +252,18 @@ Trash::Result Trash::moveToTrash(const QString &path, QString &error, Trash::Opt
     }
     return Trash::Success;
 }
+
+void Trash::moveToTrash(const QStringList &filePaths, const std::function<bool(const FileResult &)> &resultHandler,
+                        Trash::Options trashOptions)
+{
+    for (const QString &path : filePaths) {
+        FileResult fileResult = {path, Trash::Error, QString()};
+        fileResult.result = moveToTrash(path, fileResult.error, trashOptions);
+        if (!resultHandler(fileResult)) {
+            return;
+        }
+    }
+}
 #else
 
 Trash::Result Trash::moveToTrash(const QString &path, QString &error, Trash::Options trashOptions)
@@ -166,4 +272,59 @@ Trash::Result Trash::moveToTrash(const QString &path, QString &error, Trash::Opt
     return Trash::Error;
 }
 
+void Trash::moveToTrash(const QStringList &filePaths, const std::function<bool(const FileResult &)> &resultHandler,
+                        Trash::Options trashOptions)
+{
+    for (const QString &path : filePaths) {
+        FileResult fileResult = {path, Trash::Error, QString()};
+        fileResult.result = moveToTrash(path, fileResult.error, trashOptions);
+        if (!resultHandler(fileResult)) {
+            return;
+        }
+    }
+}
+
 #endif
+
+class TrashMover::Worker : public QRunnable
+{
+public:
+    Worker(TrashMover *mover, const QStringList &filePaths, Trash::Options trashOptions)
+        : mover(mover), filePaths(filePaths), trashOptions(trashOptions) {}
+
+    void run() override
+    {
+        Trash::moveToTrash(filePaths, [this](const Trash::FileResult &fileResult) {
+            emit mover->fileTrashed(fileResult.filePath, fileResult.result, fileResult.error);
+            return fileResult.result == Trash::Success && !mover->cancelled;
+        }, trashOptions);
+        emit mover->finished();
+    }
+
+private:
+    TrashMover *mover;
+    QStringList filePaths;
+    Trash::Options trashOptions;
+};
+
+TrashMover::TrashMover(QObject *parent) : QObject(parent)
+{
+    threadPool.setMaxThreadCount(1);
+}
+
+TrashMover::~TrashMover()
+{
+    cancel();
+    threadPool.waitForDone();
+}
+
+void TrashMover::start(const QStringList &filePaths, Trash::Options trashOptions)
+{
+    cancelled = false;
+    threadPool.start(new Worker(this, filePaths, trashOptions));
+}
+
+void TrashMover::cancel()
+{
+    cancelled = true;
+}
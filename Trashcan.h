@@ -19,7 +19,12 @@
 #ifndef TRASHCAN_H
 #define TRASHCAN_H
 
+#include <QObject>
 #include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <atomic>
+#include <functional>
 
 namespace Trash {
     typedef enum
@@ -36,6 +41,45 @@ namespace Trash {
     } Options;
 
     Trash::Result moveToTrash(const QString &filePath, QString &error, Options trashOptions = NoOptions);
+
+    typedef struct
+    {
+        QString filePath;
+        Result result;
+        QString error;
+    } FileResult;
+
+    // Resolves the trash directory of each disk only once. Blocks, so it is meant for a worker thread.
+    // The handler sees every file as it is done and stops the rest by returning false.
+    void moveToTrash(const QStringList &filePaths, const std::function<bool(const FileResult &)> &resultHandler,
+                     Options trashOptions = NoOptions);
 }
 
+// Trashes a list of files on a worker thread, reporting every file back to the GUI thread.
+// Stops at the first file that fails.
+class TrashMover : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit TrashMover(QObject *parent = nullptr);
+
+    ~TrashMover() override;
+
+    void start(const QStringList &filePaths, Trash::Options trashOptions = Trash::NoOptions);
+
+    void cancel();
+
+signals:
+    void fileTrashed(const QString &filePath, int result, const QString &error);
+
+    void finished();
+
+private:
+    class Worker;
+
+    QThreadPool threadPool;
+    std::atomic<bool> cancelled{false};
+};
+
 #endif // TRASHCAN_H
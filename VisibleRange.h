@@ -0,0 +1,72 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VISIBLE_RANGE_H
+#define VISIBLE_RANGE_H
+
+// Binary searches for the rows whose bottom edge lies inside the viewport.
+// Items are laid out in row order, so bottom edges (in viewport coordinates)
+// never decrease as the row number grows; bottomEdge(row) is only called
+// O(log n) times.
+namespace VisibleRange {
+
+template <typename BottomEdge>
+int firstVisible(int rowCount, int viewportHeight, BottomEdge bottomEdge) {
+    int low = 0;
+    int high = rowCount - 1;
+    int first = -1;
+    while (low <= high) {
+        const int mid = low + (high - low) / 2;
+        if (bottomEdge(mid) >= 0) {
+            first = mid;
+            high = mid - 1;
+        } else {
+            low = mid + 1;
+        }
+    }
+
+    if (first < 0 || bottomEdge(first) >= viewportHeight) {
+        return -1;
+    }
+    return first;
+}
+
+template <typename BottomEdge>
+int lastVisible(int rowCount, int viewportHeight, BottomEdge bottomEdge) {
+    int low = 0;
+    int high = rowCount - 1;
+    int last = -1;
+    while (low <= high) {
+        const int mid = low + (high - low) / 2;
+        if (bottomEdge(mid) < viewportHeight) {
+            last = mid;
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    if (last < 0 || bottomEdge(last) < 0) {
+        return -1;
+    }
+    return last;
+}
+
+}
+
+#endif // VISIBLE_RANGE_H
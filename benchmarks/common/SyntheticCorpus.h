@@ -0,0 +1,161 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SYNTHETIC_CORPUS_H
+#define SYNTHETIC_CORPUS_H
+
+#include <QtCore>
+#include <QImage>
+#include <QImageWriter>
+#include <random>
+
+#define CORPUS_VERSION 1
+#define CORPUS_VARIANTS 8
+
+// Deterministic image collections for the benchmarks. Every corpus of the same
+// size holds the same names and pixels on every machine, so results can be
+// compared across runs and releases.
+namespace SyntheticCorpus {
+
+// Smooth gradients with a few soft blobs, so codecs, the crop and the hashes have something to work on
+inline QImage makeImage(const QSize &size, quint32 seed) {
+    // Only the raw engine output is the same everywhere, the standard distributions are not
+    std::mt19937 random(seed);
+    const auto channelValue = [&random]() { return int(random() % 256); };
+    const auto position = [&random]() { return qreal(random() % 10000) / 10000; };
+    const QRgb from = qRgb(channelValue(), channelValue(), channelValue());
+    const QRgb to = qRgb(channelValue(), channelValue(), channelValue());
+
+    struct Blob {
+        QPointF center;
+        qreal radius;
+        QRgb color;
+    };
+    QVector<Blob> blobs;
+    for (int i = 0; i < 5; ++i) {
+        const QPointF center(position() * size.width(), position() * size.height());
+        const qreal radius = (0.05 + position() * 0.2) * qMax(size.width(), size.height());
+        blobs.append({center, radius, qRgb(channelValue(), channelValue(), channelValue())});
+    }
+
+    QImage image(size, QImage::Format_RGB32);
+    for (int y = 0; y < image.height(); ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < image.width(); ++x) {
+            const qreal t = qreal(x + y) / (image.width() + image.height());
+            qreal red = qRed(from) + (qRed(to) - qRed(from)) * t;
+            qreal green = qGreen(from) + (qGreen(to) - qGreen(from)) * t;
+            qreal blue = qBlue(from) + (qBlue(to) - qBlue(from)) * t;
+            for (const Blob &blob : blobs) {
+                const qreal dx = x - blob.center.x(), dy = y - blob.center.y();
+                const qreal weight = qMax(0.0, 1.0 - std::sqrt(dx * dx + dy * dy) / blob.radius);
+                red += (qRed(blob.color) - red) * weight;
+                green += (qGreen(blob.color) - green) * weight;
+                blue += (qBlue(blob.color) - blue) * weight;
+            }
+            line[x] = qRgb(int(red), int(green), int(blue));
+        }
+    }
+    return image;
+}
+
+// File counts from PHOTOTONIC_BENCH_CORPUS, e.g. "1000,20000,200000"; 1000 when unset.
+// Large corpora take a while to write and a few GB of disk, but only the first time.
+inline QList<int> corpusSizes() {
+    QList<int> sizes;
+    for (const QString &size : qEnvironmentVariable("PHOTOTONIC_BENCH_CORPUS").split(',', Qt::SkipEmptyParts)) {
+        if (size.toInt() > 0) {
+            sizes.append(size.toInt());
+        }
+    }
+    if (sizes.isEmpty()) {
+        sizes.append(1000);
+    }
+    return sizes;
+}
+
+// Mixed JPEG, PNG and TIFF from thumbnail to camera-ish sizes, with a few files that are not
+// images. Written once under PHOTOTONIC_BENCH_DIR, or the temp dir, and reused after that.
+inline QString directory(int fileCount) {
+    QString root = qEnvironmentVariable("PHOTOTONIC_BENCH_DIR");
+    if (root.isEmpty()) {
+        root = QDir::tempPath() + QLatin1String("/phototonic-bench");
+    }
+    const QString path = QString("%1/v%2-%3").arg(root).arg(CORPUS_VERSION).arg(fileCount);
+    const QString markerPath = path + QLatin1String("/.complete");
+    if (QFile::exists(markerPath)) {
+        return path;
+    }
+
+    QDir(path).removeRecursively();
+    if (!QDir().mkpath(path)) {
+        qWarning() << "Unable to create corpus" << path;
+        return QString();
+    }
+
+    // A handful of encoded variants per format and size, each file is a copy of one of them
+    const QSize sizes[] = {QSize(160, 120), QSize(640, 480), QSize(1280, 960), QSize(3000, 2000)};
+    const int sizePercentiles[] = {40, 75, 95, 100};
+    const char *formats[] = {"jpg", "png", "tif"};
+    const char *prefixes[] = {"IMG_", "DSC", "holiday ", "scan-"};
+    QHash<int, QByteArray> variants;
+
+    std::mt19937 random(quint32(fileCount));
+    for (int i = 0; i < fileCount; ++i) {
+        const QString prefix = QLatin1String(prefixes[random() % 4]);
+        if (random() % 100 < 2) {
+            QFile notes(QString("%1/%2%3.txt").arg(path, prefix).arg(i));
+            if (notes.open(QIODevice::WriteOnly)) {
+                notes.write("not an image\n");
+            }
+            continue;
+        }
+
+        const int percentile = int(random() % 100);
+        int size = 0;
+        while (percentile >= sizePercentiles[size]) {
+            ++size;
+        }
+        const int format = int(random() % 3);
+        const int variant = int(random() % CORPUS_VARIANTS);
+        const int key = (size * 3 + format) * CORPUS_VARIANTS + variant;
+        if (!variants.contains(key)) {
+            QBuffer buffer;
+            buffer.open(QIODevice::WriteOnly);
+            QImageWriter writer(&buffer, formats[format]);
+            writer.setQuality(85);
+            writer.write(makeImage(sizes[size], quint32(key)));
+            variants.insert(key, buffer.data());
+        }
+
+        QFile file(QString("%1/%2%3.%4").arg(path, prefix).arg(i).arg(QLatin1String(formats[format])));
+        if (!file.open(QIODevice::WriteOnly) || file.write(variants.value(key)) != variants.value(key).size()) {
+            qWarning() << "Unable to write corpus file" << file.fileName() << file.errorString();
+            return QString();
+        }
+    }
+
+    QFile marker(markerPath);
+    marker.open(QIODevice::WriteOnly);
+    return path;
+}
+
+}
+
+#endif // SYNTHETIC_CORPUS_H
@@ -0,0 +1,32 @@
+#
+#  Copyright (C) 2013-2018 Ofer Kashayov <oferkv@live.com>
+#  This file is part of Phototonic Image Viewer.
+#
+#  Phototonic is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  Phototonic is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+# Builds everything the app is built from except main(), taken straight from
+# phototonic.pro so benchmarks always measure the code that ships.
+APP_ROOT = $$PWD/../..
+INCLUDEPATH += $$APP_ROOT $$fromfile($$APP_ROOT/phototonic.pro, INCLUDEPATH)
+LIBS += $$fromfile($$APP_ROOT/phototonic.pro, LIBS)
+QT += $$fromfile($$APP_ROOT/phototonic.pro, QT)
+
+APP_SOURCES = $$fromfile($$APP_ROOT/phototonic.pro, SOURCES)
+APP_SOURCES -= main.cpp
+for(source, APP_SOURCES): SOURCES += $$APP_ROOT/$$source
+for(header, $$list($$fromfile($$APP_ROOT/phototonic.pro, HEADERS))): HEADERS += $$APP_ROOT/$$header
+for(form, $$list($$fromfile($$APP_ROOT/phototonic.pro, FORMS))): FORMS += $$APP_ROOT/$$form
+for(resource, $$list($$fromfile($$APP_ROOT/phototonic.pro, RESOURCES))): RESOURCES += $$APP_ROOT/$$resource
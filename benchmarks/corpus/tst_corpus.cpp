@@ -0,0 +1,282 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QtTest>
+#include "ThumbsViewer.h"
+#include "ThumbnailLoader.h"
+#include "ThumbnailWriter.h"
+#include "DuplicateHasher.h"
+#include "DirectoryCrawler.h"
+#include "DirectoryEntries.h"
+#include "PerfCounters.h"
+#include "SyntheticCorpus.h"
+
+// Directory wide work on synthetic corpora, from listing a directory to having
+// a thumbnail for every image in it. The thumbnail cache lives in the QtTest
+// cache location, so the user's own cache is never touched. Set
+// PHOTOTONIC_BENCH_PERF_LOG to also get the app's own counters as JSON.
+class CorpusBenchmark : public QObject {
+Q_OBJECT
+
+private slots:
+
+    void initTestCase();
+
+    void cleanupTestCase();
+
+    void listDirectory_data();
+
+    void listDirectory();
+
+    void listDirectoryEntries_data();
+
+    void listDirectoryEntries();
+
+    void sortByName_data();
+
+    void sortByName();
+
+    void thumbnailFileName_data();
+
+    void thumbnailFileName();
+
+    void dHash_data();
+
+    void dHash();
+
+    void loadDirectory_data();
+
+    void loadDirectory();
+
+    void locateThumbnail_data();
+
+    void locateThumbnail();
+
+private:
+    static void addCorpora();
+
+    // Lists like the thumbnail view does when sorting by name
+    static QFileInfoList listImages(const QString &path);
+};
+
+void CorpusBenchmark::initTestCase() {
+    QStandardPaths::setTestModeEnabled(true);
+    QDir(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)).removeRecursively();
+}
+
+void CorpusBenchmark::cleanupTestCase() {
+    const QString perfLogPath = qEnvironmentVariable("PHOTOTONIC_BENCH_PERF_LOG");
+    if (!perfLogPath.isEmpty()) {
+        Perf::writeJson(perfLogPath);
+    }
+}
+
+void CorpusBenchmark::addCorpora() {
+    QTest::addColumn<QString>("path");
+
+    for (int fileCount : SyntheticCorpus::corpusSizes()) {
+        const QString path = SyntheticCorpus::directory(fileCount);
+        QVERIFY2(!path.isEmpty(), "Unable to write the corpus");
+        QTest::newRow(qPrintable(QString::number(fileCount))) << path;
+    }
+}
+
+QFileInfoList CorpusBenchmark::listImages(const QString &path) {
+    QDir directory(path);
+    directory.setNameFilters(ThumbsViewer::imageNameFilters(QString()));
+    directory.setFilter(QDir::Files);
+    directory.setSorting(QDir::NoSort);
+    return directory.entryInfoList();
+}
+
+void CorpusBenchmark::listDirectory_data() {
+    addCorpora();
+}
+
+void CorpusBenchmark::listDirectory() {
+    QFETCH(QString, path);
+
+    QFileInfoList files;
+    QBENCHMARK {
+        files = listImages(path);
+    }
+    QVERIFY(!files.isEmpty());
+}
+
+void CorpusBenchmark::listDirectoryEntries_data() {
+    addCorpora();
+}
+
+// The readdir() listing, with name filters that all take the suffix lookup
+void CorpusBenchmark::listDirectoryEntries() {
+    QFETCH(QString, path);
+
+    const QStringList nameFilters = ThumbsViewer::imageNameFilters(QString());
+    const DirectoryEntries::NameMatcher nameMatcher(nameFilters);
+    QVERIFY(nameMatcher.suffixes.size() > nameMatcher.patterns.size());
+    QVERIFY(nameMatcher.suffixes.contains(QStringLiteral("png")));
+    QVERIFY(nameMatcher.matches(QStringLiteral("image.PNG")));
+
+    QDir directory(path);
+    directory.setNameFilters(nameFilters);
+    directory.setFilter(QDir::Files);
+    directory.setSorting(QDir::NoSort);
+    QFileInfoList files;
+    QBENCHMARK {
+        files = DirectoryEntries::files(directory);
+    }
+    QCOMPARE(files.size(), listImages(path).size());
+}
+
+void CorpusBenchmark::sortByName_data() {
+    addCorpora();
+}
+
+void CorpusBenchmark::sortByName() {
+    QFETCH(QString, path);
+
+    const QFileInfoList listed = listImages(path);
+    QFileInfoList files;
+    QBENCHMARK {
+        files = listed;
+        DirectoryCrawler::sortByName(files, QDir::IgnoreCase);
+    }
+    QCOMPARE(files.size(), listed.size());
+}
+
+void CorpusBenchmark::thumbnailFileName_data() {
+    addCorpora();
+}
+
+void CorpusBenchmark::thumbnailFileName() {
+    QFETCH(QString, path);
+
+    const QFileInfoList files = listImages(path);
+    QString fileName;
+    QBENCHMARK {
+        for (const QFileInfo &fileInfo : files) {
+            fileName = ThumbnailLoader::thumbnailFileName(fileInfo.filePath());
+        }
+    }
+    QVERIFY(fileName.endsWith(QLatin1String(".png")));
+}
+
+void CorpusBenchmark::dHash_data() {
+    addCorpora();
+}
+
+// One pass only, there is no cache in front of it to warm up
+void CorpusBenchmark::dHash() {
+    QFETCH(QString, path);
+
+    const QFileInfoList files = listImages(path);
+    int hashedCount = 0;
+    QBENCHMARK_ONCE {
+        for (const QFileInfo &fileInfo : files) {
+            quint64 dHash;
+            if (DuplicateHasher::computeDHash(fileInfo.filePath(), dHash)) {
+                ++hashedCount;
+            }
+        }
+    }
+    QCOMPARE(hashedCount, files.size());
+}
+
+// The first pass over a corpus finds an empty thumbnail cache, the second one finds it filled
+void CorpusBenchmark::loadDirectory_data() {
+    QTest::addColumn<QString>("path");
+
+    for (int fileCount : SyntheticCorpus::corpusSizes()) {
+        const QString path = SyntheticCorpus::directory(fileCount);
+        QVERIFY2(!path.isEmpty(), "Unable to write the corpus");
+        QTest::newRow(qPrintable(QString("%1 cold").arg(fileCount))) << path;
+        QTest::newRow(qPrintable(QString("%1 warm").arg(fileCount))) << path;
+    }
+}
+
+void CorpusBenchmark::loadDirectory() {
+    QFETCH(QString, path);
+
+    ThumbnailLoader thumbnailLoader(std::make_shared<MetadataCache>());
+    int pending = 0;
+    int failedCount = 0;
+    QEventLoop eventLoop;
+    connect(&thumbnailLoader, &ThumbnailLoader::thumbnailLoaded, &eventLoop, [&]() {
+        if (--pending == 0) {
+            eventLoop.quit();
+        }
+    });
+    connect(&thumbnailLoader, &ThumbnailLoader::thumbnailFailed, &eventLoop, [&]() {
+        ++failedCount;
+        if (--pending == 0) {
+            eventLoop.quit();
+        }
+    });
+
+    QBENCHMARK_ONCE {
+        QFileInfoList files = listImages(path);
+        DirectoryCrawler::sortByName(files, QDir::IgnoreCase);
+
+        QList<ThumbnailRequest> requests;
+        for (const QFileInfo &fileInfo : files) {
+            ThumbnailRequest request;
+            request.ticket = quint64(requests.size());
+            request.imageFileName = fileInfo.filePath();
+            request.thumbSize = 200;
+            request.readOrientation = true;
+            request.lastModified = fileInfo.lastModified().toMSecsSinceEpoch();
+            request.fileSize = fileInfo.size();
+            requests.append(request);
+        }
+        pending = requests.size();
+        thumbnailLoader.enqueue(requests);
+        eventLoop.exec();
+    }
+    QCOMPARE(failedCount, 0);
+
+    // The next row should find every thumbnail of this one in the cache
+    while (ThumbnailWriter::instance()->pendingCount() > 0) {
+        QThread::msleep(10);
+    }
+}
+
+void CorpusBenchmark::locateThumbnail_data() {
+    addCorpora();
+}
+
+// Runs after loadDirectory(), so every image large enough to have its thumbnail cached is a hit
+void CorpusBenchmark::locateThumbnail() {
+    QFETCH(QString, path);
+
+    const QFileInfoList files = listImages(path);
+    int foundCount = 0;
+    QBENCHMARK {
+        foundCount = 0;
+        for (const QFileInfo &fileInfo : files) {
+            if (!ThumbnailLoader::locateThumbnail(fileInfo.filePath(), 200).isEmpty()) {
+                ++foundCount;
+            }
+        }
+    }
+    qInfo("%d of %d thumbnails found", foundCount, files.size());
+}
+
+QTEST_GUILESS_MAIN(CorpusBenchmark)
+
+#include "tst_corpus.moc"
@@ -0,0 +1,206 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QtTest>
+#include "Histogram.h"
+#include "SmartCrop.h"
+#include "ColorEngine.h"
+#include "Resampler.h"
+#include "PackedThumbnail.h"
+#include "SyntheticCorpus.h"
+
+// Per image work of the thumbnail and viewer paths, on images from the
+// synthetic corpus generator. Histogram::compare() is covered by the
+// similarity benchmark.
+class ImageOpsBenchmark : public QObject {
+Q_OBJECT
+
+private slots:
+
+    void calcHist_data();
+
+    void calcHist();
+
+    void smartCrop_data();
+
+    void smartCrop();
+
+    void colorize_data();
+
+    void colorize();
+
+    void resample_data();
+
+    void resample();
+
+    void encodePackedThumbnail_data();
+
+    void encodePackedThumbnail();
+
+    void decodePackedThumbnail_data();
+
+    void decodePackedThumbnail();
+
+private:
+    static void addImageSizes();
+
+    static void addPackedEncodings();
+};
+
+void ImageOpsBenchmark::addImageSizes() {
+    QTest::addColumn<QSize>("size");
+
+    QTest::newRow("vga") << QSize(640, 480);
+    QTest::newRow("1080p") << QSize(1920, 1080);
+    QTest::newRow("12mp") << QSize(4000, 3000);
+}
+
+void ImageOpsBenchmark::calcHist_data() {
+    addImageSizes();
+}
+
+void ImageOpsBenchmark::calcHist() {
+    QFETCH(QSize, size);
+
+    const QImage image = SyntheticCorpus::makeImage(size, 1);
+    Histogram histogram;
+    QBENCHMARK {
+        histogram = Histogram::fromImage(image);
+    }
+    QVERIFY(histogram.compare(histogram) < 0.01f);
+}
+
+// Runs on the decoded thumbnail, which is the thumbnail size across its short side
+void ImageOpsBenchmark::smartCrop_data() {
+    QTest::addColumn<int>("thumbSize");
+
+    QTest::newRow("100") << 100;
+    QTest::newRow("200") << 200;
+    QTest::newRow("400") << 400;
+}
+
+void ImageOpsBenchmark::smartCrop() {
+    QFETCH(int, thumbSize);
+
+    const QImage thumb = SyntheticCorpus::makeImage(QSize(thumbSize * 3 / 2, thumbSize), 2);
+    QRect crop;
+    QBENCHMARK {
+        crop = SmartCrop::smartCropRect(thumb, QSize(thumbSize, thumbSize));
+    }
+    QVERIFY(thumb.rect().contains(crop));
+}
+
+void ImageOpsBenchmark::colorize_data() {
+    addImageSizes();
+}
+
+// The viewer colourises a fresh copy every time, so the copy is measured along with it
+void ImageOpsBenchmark::colorize() {
+    QFETCH(QSize, size);
+
+    const QImage source = SyntheticCorpus::makeImage(size, 3);
+    ColorAdjustment adjustment;
+    adjustment.isEnabled = true;
+    adjustment.red = 10;
+    adjustment.brightness = 110;
+    adjustment.contrast = 90;
+    adjustment.colorize = true;
+    adjustment.hue = 30;
+    adjustment.saturation = 120;
+    QVERIFY(adjustment.changesColors());
+
+    QImage image;
+    QBENCHMARK {
+        image = source.copy();
+        ColorEngine::apply(image, adjustment);
+    }
+    QVERIFY(image != source);
+}
+
+// Export at a quarter of the size, against the scaler Qt uses for Qt::SmoothTransformation
+void ImageOpsBenchmark::resample_data() {
+    QTest::addColumn<QSize>("size");
+    QTest::addColumn<bool>("isQtScaler");
+
+    QTest::newRow("1080p qt") << QSize(1920, 1080) << true;
+    QTest::newRow("1080p lanczos") << QSize(1920, 1080) << false;
+    QTest::newRow("12mp qt") << QSize(4000, 3000) << true;
+    QTest::newRow("12mp lanczos") << QSize(4000, 3000) << false;
+}
+
+void ImageOpsBenchmark::resample() {
+    QFETCH(QSize, size);
+    QFETCH(bool, isQtScaler);
+
+    const QImage source = SyntheticCorpus::makeImage(size, 4);
+    const QSize targetSize = size / 4;
+    QImage image;
+    QBENCHMARK {
+        image = isQtScaler ? source.scaled(targetSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation)
+                           : Resampler::scaled(source, targetSize);
+    }
+    QCOMPARE(image.size(), targetSize);
+}
+
+// A packed store hit at the default thumbnail size, which is read from the large bucket
+void ImageOpsBenchmark::addPackedEncodings() {
+    QTest::addColumn<int>("encoding");
+
+    QTest::newRow("png") << int(PackedThumbnail::Png);
+    QTest::newRow("jpeg") << int(PackedThumbnail::Jpeg);
+    if (PackedThumbnail::isSupported(PackedThumbnail::WebP)) {
+        QTest::newRow("webp") << int(PackedThumbnail::WebP);
+    }
+    QTest::newRow("raw") << int(PackedThumbnail::Raw);
+}
+
+void ImageOpsBenchmark::encodePackedThumbnail_data() {
+    addPackedEncodings();
+}
+
+void ImageOpsBenchmark::encodePackedThumbnail() {
+    QFETCH(int, encoding);
+
+    const QImage thumbnail = SyntheticCorpus::makeImage(QSize(256, 192), 5);
+    QByteArray data;
+    QBENCHMARK {
+        data = PackedThumbnail::encode(thumbnail, PackedThumbnail::Encoding(encoding));
+    }
+    QCOMPARE(PackedThumbnail::size(data), thumbnail.size());
+}
+
+void ImageOpsBenchmark::decodePackedThumbnail_data() {
+    addPackedEncodings();
+}
+
+void ImageOpsBenchmark::decodePackedThumbnail() {
+    QFETCH(int, encoding);
+
+    const QImage thumbnail = SyntheticCorpus::makeImage(QSize(256, 192), 5);
+    const QByteArray data = PackedThumbnail::encode(thumbnail, PackedThumbnail::Encoding(encoding));
+    QImage image;
+    QBENCHMARK {
+        image = PackedThumbnail::decode(data);
+    }
+    QCOMPARE(image.size(), thumbnail.size());
+}
+
+QTEST_MAIN(ImageOpsBenchmark)
+
+#include "tst_imageops.moc"
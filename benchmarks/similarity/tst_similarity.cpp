@@ -0,0 +1,151 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QtTest>
+#include <numeric>
+#include <random>
+#include "SimilarityOrder.h"
+
+// Compares the similarity order built from compact descriptors with the one
+// from full histograms. Quality is the length of the path through the chain,
+// measured with the full histogram distance: the shorter, the better.
+class SimilarityBenchmark : public QObject {
+Q_OBJECT
+
+private slots:
+
+    void orderingQuality_data();
+
+    void orderingQuality();
+
+    void compareHistograms();
+
+    void compareDescriptors();
+
+private:
+    // Images drawn from a few palettes, each with its own noise
+    static QVector<Histogram> makeHistograms(int count, int palettes);
+
+    static double pathLength(const QVector<Histogram> &histograms, const QVector<int> &order);
+};
+
+QVector<Histogram> SimilarityBenchmark::makeHistograms(int count, int palettes) {
+    std::mt19937 random(count);
+    std::uniform_int_distribution<int> channelValue(0, 255);
+    QVector<QColor> paletteColors;
+    for (int i = 0; i < palettes; ++i) {
+        paletteColors.append(QColor(channelValue(random), channelValue(random), channelValue(random)));
+    }
+
+    QVector<Histogram> histograms;
+    histograms.reserve(count);
+    std::normal_distribution<double> noise(0.0, 24.0);
+    for (int i = 0; i < count; ++i) {
+        const QColor base = paletteColors.at(int(random() % palettes));
+        QImage image(32, 32, QImage::Format_RGB32);
+        for (int y = 0; y < image.height(); ++y) {
+            for (int x = 0; x < image.width(); ++x) {
+                image.setPixel(x, y, qRgb(qBound(0, base.red() + int(noise(random)), 255),
+                                          qBound(0, base.green() + int(noise(random)), 255),
+                                          qBound(0, base.blue() + int(noise(random)), 255)));
+            }
+        }
+        histograms.append(Histogram::fromImage(image));
+    }
+    return histograms;
+}
+
+double SimilarityBenchmark::pathLength(const QVector<Histogram> &histograms, const QVector<int> &order) {
+    double length = 0.0;
+    for (int i = 1; i < order.size(); ++i) {
+        length += histograms.at(order.at(i - 1)).compare(histograms.at(order.at(i)));
+    }
+    return length;
+}
+
+void SimilarityBenchmark::orderingQuality_data() {
+    QTest::addColumn<int>("count");
+
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("10k") << 10000;
+}
+
+void SimilarityBenchmark::orderingQuality() {
+    QFETCH(int, count);
+
+    const QVector<Histogram> histograms = makeHistograms(count, 40);
+    QVector<const Histogram *> histogramPointers;
+    QVector<ColorDescriptor> descriptors;
+    for (const Histogram &histogram : histograms) {
+        histogramPointers.append(&histogram);
+        descriptors.append(ColorDescriptor::fromHistogram(histogram));
+    }
+    const SimilarityOrder::Progress progress = [](SimilarityOrder::Stage, int, int) {
+        return true;
+    };
+
+    const QVector<int> fullOrder = SimilarityOrder::chain(histogramPointers, progress);
+    QVector<int> compactOrder;
+    QBENCHMARK_ONCE {
+        compactOrder = SimilarityOrder::chain(descriptors, progress);
+    }
+    QCOMPARE(fullOrder.size(), count);
+    QCOMPARE(compactOrder.size(), count);
+
+    QVector<int> unorderedOrder(count);
+    std::iota(unorderedOrder.begin(), unorderedOrder.end(), 0);
+
+    const double fullLength = pathLength(histograms, fullOrder);
+    const double compactLength = pathLength(histograms, compactOrder);
+    const double unorderedLength = pathLength(histograms, unorderedOrder);
+    qInfo("path length: full %.1f, compact %.1f (%.1f%%), unordered %.1f", fullLength, compactLength,
+          100.0 * compactLength / fullLength, unorderedLength);
+
+    QVERIFY(compactLength < unorderedLength / 2);
+    QVERIFY(compactLength < fullLength * 1.2);
+}
+
+void SimilarityBenchmark::compareHistograms() {
+    const QVector<Histogram> histograms = makeHistograms(1000, 40);
+    float sum = 0.f;
+    QBENCHMARK {
+        for (int i = 1; i < histograms.size(); ++i) {
+            sum += histograms.at(i - 1).compare(histograms.at(i));
+        }
+    }
+    QVERIFY(sum > 0.f);
+}
+
+void SimilarityBenchmark::compareDescriptors() {
+    QVector<ColorDescriptor> descriptors;
+    for (const Histogram &histogram : makeHistograms(1000, 40)) {
+        descriptors.append(ColorDescriptor::fromHistogram(histogram));
+    }
+    float sum = 0.f;
+    QBENCHMARK {
+        for (int i = 1; i < descriptors.size(); ++i) {
+            sum += descriptors.at(i - 1).compare(descriptors.at(i));
+        }
+    }
+    QVERIFY(sum > 0.f);
+}
+
+QTEST_MAIN(SimilarityBenchmark)
+
+#include "tst_similarity.moc"
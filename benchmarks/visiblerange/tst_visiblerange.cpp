@@ -0,0 +1,87 @@
+/*
+ *  Copyright (C) 2013-2014 Ofer Kashayov <oferkv@live.com>
+ *  This file is part of Phototonic Image Viewer.
+ *
+ *  Phototonic is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Phototonic is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Phototonic.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QtTest>
+#include <QtWidgets>
+#include "VisibleRange.h"
+
+// Measures the visible range lookup done on every scrollbar change, set up
+// the same way ThumbsViewer lays out its items. Run with -platform offscreen.
+class VisibleRangeBenchmark : public QObject {
+Q_OBJECT
+
+private slots:
+
+    void visibleRange_data();
+
+    void visibleRange();
+};
+
+void VisibleRangeBenchmark::visibleRange_data() {
+    QTest::addColumn<int>("rowCount");
+
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("10k") << 10000;
+    QTest::newRow("50k") << 50000;
+    QTest::newRow("200k") << 200000;
+}
+
+void VisibleRangeBenchmark::visibleRange() {
+    QFETCH(int, rowCount);
+
+    QListView view;
+    view.setViewMode(QListView::IconMode);
+    view.setResizeMode(QListView::Adjust);
+    view.setWrapping(true);
+    view.setUniformItemSizes(true);
+    view.setGridSize(QSize(200, 200));
+    view.resize(1280, 1024);
+
+    QStandardItemModel model;
+    for (int row = 0; row < rowCount; ++row) {
+        QStandardItem *item = new QStandardItem();
+        item->setSizeHint(QSize(200, 200));
+        model.appendRow(item);
+    }
+    view.setModel(&model);
+    view.show();
+
+    // Scroll to the middle so the search cannot get lucky at either end
+    view.scrollTo(model.index(rowCount / 2, 0));
+    QCoreApplication::processEvents();
+
+    auto bottomEdge = [&view, &model](int row) {
+        const QRect rect = view.visualRect(model.index(row, 0));
+        return rect.y() + rect.height() + 1;
+    };
+
+    int first = -1;
+    int last = -1;
+    QBENCHMARK {
+        first = VisibleRange::firstVisible(model.rowCount(), view.viewport()->height(), bottomEdge);
+        last = VisibleRange::lastVisible(model.rowCount(), view.viewport()->height(), bottomEdge);
+    }
+
+    QVERIFY(first >= 0);
+    QVERIFY(last >= first);
+    QVERIFY(first <= rowCount / 2 && rowCount / 2 <= last);
+}
+
+QTEST_MAIN(VisibleRangeBenchmark)
+
+#include "tst_visiblerange.moc"
@@ -17,11 +17,17 @@
  */
 
 #include "Phototonic.h"
+#include "HeadlessTasks.h"
+#include "PerfCounters.h"
 #include <QApplication>
 #include <QCommandLineParser>
+#include <memory>
 
 int main(int argc, char *argv[]) {
-    QApplication QApp(argc, argv);
+    // Batch and cache tasks run without a display, so they get no widgets at all
+    const bool isHeadless = HeadlessTasks::isHeadless(argc, argv);
+    std::unique_ptr<QCoreApplication> app(isHeadless ? new QCoreApplication(argc, argv)
+                                                     : new QApplication(argc, argv));
     QLocale locale = QLocale::system();
     QCoreApplication::setApplicationVersion(VERSION);
 
@@ -42,23 +48,43 @@ int main(int argc, char *argv[]) {
             QCoreApplication::translate("main", "Copy all modified images into <directory>."),
             QCoreApplication::translate("main", "directory"));
     parser.addOption(targetDirectoryOption);
+    QCommandLineOption perfLogOption("perf-log",
+            QCoreApplication::translate("main", "Write timings and cache hit rates to <file> as JSON on exit."),
+            QCoreApplication::translate("main", "file"));
+    parser.addOption(perfLogOption);
+    QCommandLineOption filesFromOption("files-from",
+            QCoreApplication::translate("main", "Show the images listed in <file>, one path per line, "
+                                                "as the list is read. Use - to read standard input."),
+            QCoreApplication::translate("main", "file"));
+    parser.addOption(filesFromOption);
+    HeadlessTasks::addOptions(parser);
 
-    parser.process(QApp);
+    parser.process(*app);
 
     if (parser.isSet(langOption))
         locale = QLocale(parser.value(langOption));
 
     QTranslator qTranslator;
     qTranslator.load(locale, "qt", "_", QLibraryInfo::location(QLibraryInfo::TranslationsPath));
-    QApp.installTranslator(&qTranslator);
+    app->installTranslator(&qTranslator);
 
     QTranslator qTranslatorPhototonic;
     qTranslatorPhototonic.load(locale, "phototonic", "_", ":/translations");
-    QApp.installTranslator(&qTranslatorPhototonic);
+    app->installTranslator(&qTranslatorPhototonic);
 
-    Phototonic phototonic(parser.positionalArguments(), 0);
-    if (parser.isSet(targetDirectoryOption))
-        phototonic.setSaveDirectory(parser.value(targetDirectoryOption));
-    phototonic.show();
-    return QApp.exec();
+    int result;
+    if (isHeadless) {
+        result = HeadlessTasks::run(parser);
+    } else {
+        Phototonic phototonic(parser.positionalArguments(), 0, parser.value(filesFromOption));
+        if (parser.isSet(targetDirectoryOption))
+            phototonic.setSaveDirectory(parser.value(targetDirectoryOption));
+        phototonic.show();
+        result = app->exec();
+    }
+
+    if (parser.isSet(perfLogOption)) {
+        Perf::writeJson(parser.value(perfLogOption));
+    }
+    return result;
 }
@@ -44,14 +44,32 @@ HEADERS += Phototonic.h ThumbsViewer.h ImageViewer.h CropRubberband.h SettingsDi
 			FileSystemTree.h Bookmarks.h DirCompleter.h Tags.h MetadataCache.h ShortcutsTable.h CopyMoveDialog.h \
 			CopyMoveToDialog.h CropDialog.h ProgressDialog.h ColorsDialog.h ResizeDialog.h ExternalAppsDialog.h \
 			ImagePreview.h ImageWidget.h FileSystemModel.h FileListWidget.h RenameDialog.h Trashcan.h MessageBox.h \
-			GuideWidget.h RangeInputDialog.h SmartCrop.h
+			GuideWidget.h RangeInputDialog.h SmartCrop.h \
+			Histogram.h ThumbnailLoader.h ThumbnailPack.h ThumbnailWriter.h ThumbnailCacheIndex.h \
+			ExifPreview.h VisibleRange.h MetadataScanner.h ThumbsModel.h FeatureStore.h SimilarityOrder.h \
+			DuplicateHasher.h HammingIndex.h FeatureDatabase.h RecordFile.h DirectoryCrawler.h \
+			MetadataDatabase.h ImageInfoReader.h ImagePrefetcher.h ImagePyramid.h ImageGLView.h ColorEngine.h \
+			LosslessTransform.h BatchTransform.h HeadlessTasks.h ImageSaver.h CopyMoveEngine.h TagWriter.h \
+			BrightnessScanner.h CacheIndexer.h ThumbsDelegate.h SubdirectoryProbe.h StartupTimer.h \
+			PerfCounters.h PerformanceView.h AnimationSource.h AnimationView.h DirectoryEntries.h \
+			FileListReader.h ColorTransforms.h MappedFile.h IdenticalFileFinder.h Resampler.h \
+			PackedThumbnail.h Exiv2Init.h
 
 SOURCES += main.cpp Phototonic.cpp ThumbsViewer.cpp ImageViewer.cpp CropRubberband.cpp SettingsDialog.cpp \
 			Settings.cpp InfoViewer.cpp FileSystemTree.cpp Bookmarks.cpp DirCompleter.cpp Tags.cpp \
 			MetadataCache.cpp ShortcutsTable.cpp CopyMoveDialog.cpp CopyMoveToDialog.cpp CropDialog.cpp \
 			ProgressDialog.cpp ExternalAppsDialog.cpp ColorsDialog.cpp ResizeDialog.cpp ImagePreview.cpp \
 			ImageWidget.cpp FileSystemModel.cpp FileListWidget.cpp RenameDialog.cpp Trashcan.cpp MessageBox.cpp \
-			GuideWidget.cpp RangeInputDialog.cpp IconProvider.cpp SmartCrop.cpp
+			GuideWidget.cpp RangeInputDialog.cpp IconProvider.cpp SmartCrop.cpp \
+			ThumbnailLoader.cpp ThumbnailPack.cpp ThumbnailWriter.cpp ThumbnailCacheIndex.cpp ExifPreview.cpp \
+			MetadataScanner.cpp ThumbsModel.cpp FeatureStore.cpp SimilarityOrder.cpp DuplicateHasher.cpp \
+			HammingIndex.cpp FeatureDatabase.cpp RecordFile.cpp DirectoryCrawler.cpp MetadataDatabase.cpp \
+			ImageInfoReader.cpp ImagePrefetcher.cpp ImagePyramid.cpp ImageGLView.cpp ColorEngine.cpp \
+			LosslessTransform.cpp BatchTransform.cpp HeadlessTasks.cpp ImageSaver.cpp CopyMoveEngine.cpp \
+			TagWriter.cpp BrightnessScanner.cpp CacheIndexer.cpp ThumbsDelegate.cpp SubdirectoryProbe.cpp \
+			StartupTimer.cpp PerfCounters.cpp PerformanceView.cpp AnimationSource.cpp AnimationView.cpp \
+			DirectoryEntries.cpp FileListReader.cpp ColorTransforms.cpp MappedFile.cpp IdenticalFileFinder.cpp \
+			Resampler.cpp PackedThumbnail.cpp Exiv2Init.cpp
 
 FORMS += RangeInputDialog.ui
 